@@ -196,7 +196,8 @@ struct agwpesocket; // forward declarator
 // One agwpecom per connection to AGWPE
 struct agwpecom {
 	int		fd;
-	struct timeval	wait_until;
+	struct aprxpollfd pollfd; // fd registered for the main loop
+	struct aprxtimer timer;	// re-connect when closed
 
 	const struct netresolver *netaddr;
 
@@ -206,12 +207,10 @@ struct agwpecom {
 	int		wrlen;
 	int		wrcursor;
 
-	int		rdneed;  // this much in rdbuf before decision
-	int		rdlen;
-	int		rdcursor;
+	struct rdbuf	rd;	// frames are parsed in place in rdstore[]
 
 	uint8_t		wrbuf[4196];
-	uint8_t		rdbuf[4196];
+	uint8_t		rdstore[4196];
 };
 
 // One agwpesocket per interface
@@ -225,8 +224,11 @@ struct agwpesocket {
 static struct agwpecom **pecom;
 static int               pecomcount;
 
+static void agwpe_timer_expired(struct aprxtimer *t, void *arg);
+static void agwpe_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg);
 
-static uint32_t get_le32(uint8_t *u) {
+
+static uint32_t get_le32(const uint8_t *u) {
 	return (u[3] << 24 |
 		u[2] << 16 |
 		u[1] <<  8 |
@@ -262,8 +264,10 @@ static struct agwpecom *agwpe_find_or_add_com(const char *hostname, const char *
 	com = calloc(1, sizeof(*com));
 	com->fd = -1;
 	com->netaddr = netresolv_add(hostname, hostport);
-	com->rdneed = sizeof(struct agwpeheader);
-	tv_timeradd_millis(&com->wait_until, &tick, 30000); // redo in 30 seconds or so
+	rdbuf_init(&com->rd, com->rdstore, sizeof(com->rdstore));
+	// No reset function, time jump makes it connect right away
+	aprxtimer_init(&com->timer, "agwpe", agwpe_timer_expired, NULL, com);
+	aprxtimer_arm_millis(&com->timer, 30000); // redo in 30 seconds or so
 
 	++pecomcount;
 	pecom = realloc(pecom, sizeof(void*)*pecomcount);
@@ -304,7 +308,7 @@ void *agwpe_addport(const char *hostname, const char *hostport, const char *agwp
 static void agwpe_reset(struct agwpecom *com, const char *why)
 {
 	com->wrlen = com->wrcursor = 0;
-	tv_timeradd_millis(&com->wait_until, &tick, 30000); // redo in 30 seconds or so
+	aprxtimer_arm_millis(&com->timer, 30000); // redo in 30 seconds or so
 
 	if (debug>1)
 	  printf("Resetting AGWPE socket; %s\n", why);
@@ -314,11 +318,23 @@ static void agwpe_reset(struct agwpecom *com, const char *why)
 	  return;
 	}
 
+	aprxpolls_remove(&com->pollfd);
 	close(com->fd);
 	com->fd = -1;
 }
 
 
+// poll for write too while there is something to write
+static void agwpe_pollout(struct agwpecom *com)
+{
+	short events = POLLIN | POLLPRI;
+
+	if (com->wrlen > com->wrcursor)
+		events |= POLLOUT;
+	aprxpolls_events(&com->pollfd, events);
+}
+
+
 /*
  *  agwpe_flush()  -- write out buffered data - at least partially
  */
@@ -330,6 +346,7 @@ static void agwpe_flush(struct agwpecom *com)
 
 	if ((com->wrlen == 0) || (com->wrlen > 0 && com->wrcursor >= com->wrlen)) {
 	  com->wrlen = com->wrcursor = 0;	/* already all written */
+	  agwpe_pollout(com);
 	  return;
 	}
 
@@ -369,6 +386,7 @@ static void agwpe_flush(struct agwpecom *com)
 			com->wrlen = len;
 		}
 	}
+	agwpe_pollout(com);
 }
 
 
@@ -412,7 +430,7 @@ void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, c
 	agwpe_flush(com); // write out buffered data
 
 	// Account transmission
-	erlang_add(agwpe->iface->callsign, ERLANG_TX, axaddrlen+axdatalen + 10, 1);  // agwpe_sendto()
+	erlang_add_handle(agwpe->iface->erlang_handle, ERLANG_TX, axaddrlen+axdatalen + 10, 1);  // agwpe_sendto()
 }
 
 
@@ -515,8 +533,8 @@ static void agwpe_parsereceived(struct agwpecom *com,
 
 static void agwpe_read(struct agwpecom *com) {
 
-	int rcvspace = sizeof(com->rdbuf) - com->rdlen;
-	int rcvlen;
+	int rcvlen, avail, need;
+	const uint8_t *p;
 	struct agwpeheader hdr;
 
 	if (com->fd < 0) {
@@ -524,56 +542,40 @@ static void agwpe_read(struct agwpecom *com) {
 	  return;
 	}
 
-	if (com->rdlen > com->rdcursor) {
-	  memcpy(com->rdbuf, com->rdbuf + com->rdcursor,
-		 com->rdlen - com->rdcursor);
-	  com->rdlen -= com->rdcursor;
-	}
-	com->rdcursor = 0;
-
-
-	rcvlen = read(com->fd, com->rdbuf + com->rdlen, rcvspace);
-	if (rcvlen > 0)
-	  com->rdlen += rcvlen;
-	if (com->rdlen < com->rdneed) {
-	  // insufficient amount received, continue with it latter
+	rcvlen = rdbuf_read(&com->rd, com->fd);
+	if (rcvlen <= 0)
 	  return;
-	}
 
-	while (com->rdlen >= com->rdneed) {
+	// Process all complete frames, where they are in the buffer
+	for (;;) {
+	  p = rdbuf_view(&com->rd, &avail);
+	  if (avail < sizeof(hdr)) {
+	    // insufficient amount received, continue with it latter
+	    break;
+	  }
 
-	  hdr.radioPort = get_le32(com->rdbuf + 0);
-	  hdr.dataKind  = get_le32(com->rdbuf + 4);
-	  memcpy(hdr.fromCall, com->rdbuf + 8, 10);
-	  memcpy(hdr.toCall,   com->rdbuf + 18, 10);
-	  hdr.dataLength = get_le32(com->rdbuf + 28);
-	  hdr.userField  = get_le32(com->rdbuf + 32);
+	  hdr.radioPort = get_le32(p + 0);
+	  hdr.dataKind  = get_le32(p + 4);
+	  memcpy(hdr.fromCall, p + 8, 10);
+	  memcpy(hdr.toCall,   p + 18, 10);
+	  hdr.dataLength = get_le32(p + 28);
+	  hdr.userField  = get_le32(p + 32);
 
-	  if (com->rdneed < (sizeof(hdr) + hdr.dataLength)) {
-	    // recalculate needed data size
-	    com->rdneed = sizeof(hdr) + hdr.dataLength;
-	  }
-	  if (com->rdneed > sizeof(com->rdbuf)) {
+	  need = sizeof(hdr) + hdr.dataLength;
+	  if (hdr.dataLength > com->rd.size || need > com->rd.size) {
 	    // line noise or something...
 	    agwpe_reset(com,"received junk data");
 	    return;
 	  }
-	  if (com->rdlen < com->rdneed) {
+	  if (avail < need) {
 	    // insufficient amount received..
 	    break;
 	  }
 	  
 	  // Process received frame
-	  agwpe_parsereceived(com, &hdr, com->rdbuf + sizeof(hdr));
+	  agwpe_parsereceived(com, &hdr, p + sizeof(hdr));
 
-	  com->rdcursor += sizeof(hdr) + hdr.dataLength;
-	  if (com->rdlen > com->rdcursor) {
-	    memcpy(com->rdbuf, com->rdbuf + com->rdcursor,
-		   com->rdlen - com->rdcursor);
-	    com->rdlen -= com->rdcursor;
-	  }
-	  com->rdcursor = 0;
-	  com->rdneed = sizeof(hdr);
+	  rdbuf_consume(&com->rd, need);
 	}
 }
 
@@ -582,8 +584,7 @@ static void agwpe_connect(struct agwpecom *com) {
 	int i;
 
 	// Initial protocol reading parameters
-	com->rdcursor = 0;
-	com->rdneed = sizeof(struct agwpeheader);
+	rdbuf_reset(&com->rd);
 
 	// Create socket
 	if (debug>1) {
@@ -612,6 +613,8 @@ static void agwpe_connect(struct agwpecom *com) {
 	  agwpe_reset(com,"connect failure");
 	  return;
 	}
+	aprxpolls_add(&com->pollfd, com->fd, POLLIN | POLLPRI,
+		      agwpe_pollevents, com);
 
 	// Aprx will snoop everything that happens on radio ports,
 	// and receive frames in raw AX.25.
@@ -644,88 +647,30 @@ void agwpe_start(void)
 
 
 /*
- *  agwpe_prepoll()  --  prepare system for next round of polling
- */
-
-int agwpe_prepoll(struct aprxpolls *app)
-{
-	int idx = 0;		/* returns number of *fds filled.. */
-	int i;
-	struct agwpecom *S;
-	struct pollfd *pfd;
-
-	for (i = 0; i < pecomcount; ++i) {
-          S = pecom[i];
-          if (S->fd < 0) {
-            /* Not an open TTY, but perhaps waiting ? */
-            if ((S->wait_until.tv_sec != 0) && tv_timercmp(&S->wait_until, &tick) > 0) {
-              if (tv_timerdelta_millis(&S->wait_until, &tick) > 60000) {
-                // Verify that wait is not too long -- system time jumped backwards?  (but not 68 years..)
-                S->wait_until = tick;
-              }
-
-              /* .. waiting for future! */
-              if (tv_timercmp(&app->next_timeout, &S->wait_until) > 0)
-                app->next_timeout = S->wait_until;
-              /* .. but only until our timeout,
-                 if it is sooner than global one. */
-              continue;	/* Waiting on this one.. */
-            }
-
-            /* Waiting or not, FD is not open, and deadline is past.
-               Lets try to open! */
-
-            agwpe_connect(S);
-
-          }
-          /* .. No open FD */
-          /* Still no open FD ? */
-          if (S->fd < 0)
-            continue;
-
-          // FD is open, lets mark it for poll read..
-          pfd = aprxpolls_new(app);
-          pfd->fd = S->fd;
-          pfd->events = POLLIN | POLLPRI;
-          pfd->revents = 0;
-          // .. and if needed, poll write.
-          if (S->wrlen > S->wrcursor)
-            pfd->events |= POLLOUT;
-
-          ++idx;
-	}
-	return idx;
-}
-
-/*
- *  agwpe_postpoll()  -- Done polling, what happened ?
+ *  agwpe_pollevents()  --  our descriptor had events
  */
 
-int agwpe_postpoll(struct aprxpolls *app)
+static void agwpe_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg)
 {
-	int idx, i;
-
-	struct agwpecom *S;
-	struct pollfd *P;
-	for (idx = 0, P = app->polls; idx < app->pollcount; ++idx, ++P) {
+	struct agwpecom *S = arg;
 
-		if (!(P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP)))
-			continue;	/* No read event we are interested in... */
+	if (S->fd != P->fd)
+		return;	/* Closed meanwhile */
 
-		for (i = 0; i < pecomcount; ++i) {
-			S = pecom[i];
-			if (S->fd != P->fd)
-				continue;	/* Not this one ? */
-			/* It is this one! */
+	if (P->revents & POLLOUT)
+		agwpe_flush(S);
 
-			if (P->revents & POLLOUT)
-				agwpe_flush(S);
+	if (P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP))
+		agwpe_read(S);
+}
 
-			agwpe_read(S);
-		}
-	}
+/* Connection wait is over, lets try to open! */
+static void agwpe_timer_expired(struct aprxtimer *t, void *arg)
+{
+	struct agwpecom *com = arg;
 
-	return 0;
+	if (com->fd < 0)
+		agwpe_connect(com);
 }
 
 #endif
@@ -10,6 +10,9 @@
 
 /* This code works only with single  aprsis-server  instance! */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* for recvmmsg() */
+#endif
 #include "aprx.h"
 
 #ifndef DISABLE_IGATE
@@ -19,6 +22,8 @@
 #include <netinet/in.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #ifdef HAVE_NETINET_SCTP_H
 #include <netinet/sctp.h>
@@ -28,6 +33,17 @@
 #include <pthread.h>
 pthread_t aprsis_thread;
 pthread_attr_t pthr_attrs;
+
+/* Threads share memory, pass the messages on rings in it */
+#ifdef __ATOMIC_SEQ_CST
+#define APRSIS_RING 1
+#endif
+#endif
+
+#ifdef APRSIS_RING
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 #endif
 
 /*
@@ -57,25 +73,44 @@ struct aprsis_host {
 	char *pass;
 	char *filterparam;
 	int heartbeat_monitor_timeout;
+	int send_queue_limit;	/* high-water mark of A->wrbuf_len */
 	enum aprsis_mode mode;
 };
 
+#define APRSIS_SENDQUEUE_INITIAL  16384	/* power of two */
+#define APRSIS_SENDQUEUE_DEFAULT  65536
+#define APRSIS_SENDQUEUE_MINIMUM   4096
+
+/*
+ * Send queue counters of the APRS-IS communicator, the drops include
+ * received lines not fitting on the ring to main program.  These live in
+ * shared memory, so that main program can account them in erlang
+ * statistics also when the communicator is a fork()ed child.
+ */
+struct aprsis_queuestats {
+	long drop_packets;
+	long drop_bytes;
+	int  depth;		/* bytes in queue now */
+};
+static struct aprsis_queuestats *aprsis_qstats;
+
 struct aprsis {
 	int server_socket;
 	struct aprsis_host *H;
 	time_t next_reconnect;
 	time_t last_read;
-	int wrbuf_len;
-	int wrbuf_cur;
-	int rdbuf_len;
-	int rdbuf_cur;
-	int rdlin_len;
-
-	char wrbuf[16000];
-	char rdbuf[3000];
-	char rdline[500];
+	int wrbuf_len;		/* bytes in send queue */
+	int wrbuf_cur;		/* send queue start in the ring */
+	int wrbuf_size;		/* ring size, power of two */
+	struct rdbuf rd;	/* lines are passed on from rdstore[] in place */
+	int rdlin_skip;		/* dropping a line longer than rdstore[] */
+
+	char *wrbuf;		/* send queue ring, grows up to limit */
+	uint8_t rdstore[3000];
 };
 
+#define APRSIS_LINE_MAX 498	/* longer lines are cut to this */
+
 char * const aprsis_loginid;
 static struct aprsis *AprsIS;
 static struct aprsis_host **AISh;
@@ -86,6 +121,166 @@ static int aprsis_up = -1;	/* up & down talking socket(pair),
 						   uses this socket. */
 static int aprsis_down = -1;	/* down talking socket(pair),
 						   The aprx main loop uses this socket */
+static struct aprxpollfd aprsis_downpoll; /* .. at the main loop */
+static void aprsis_pollevents(struct aprxpolls *app, struct pollfd *pfd, void *arg);
+
+#ifdef APRSIS_RING
+/*
+ *  Single-producer single-consumer message ring in between the main
+ *  loop and the APRS-IS thread.  One ring to each direction.
+ *
+ *  The producer owns  head, the consumer owns  tail, both run
+ *  freely and are masked by  size-1  at use.  Each message is
+ *  an  int  length followed by the data and a NUL byte, padded
+ *  to  APRSIS_RING_ALIGN.  A length of -1 tells that the message
+ *  did not fit at the end, and continues at start of the buffer.
+ *
+ *  The consumer is woken up via  eventfd  (or a pipe), but only
+ *  when the producer saw the ring empty at its append.
+ */
+#define APRSIS_RING_SIZE  65536	/* power of two */
+#define APRSIS_RING_ALIGN 8
+
+struct aprsis_ring {
+	unsigned int head;	/* producer position */
+	char pad1[60];		/* keep head and tail on separate cache lines */
+	unsigned int tail;	/* consumer position */
+	char pad2[60];
+	unsigned int skip;	/* producer: wrap-around of reserved message */
+	int  wakefd[2];		/* [0] is polled by consumer, [1] is written to */
+	unsigned int dropped;	/* producer: messages not fitting in */
+	char buf[APRSIS_RING_SIZE];
+};
+
+static struct aprsis_ring *aprsis_txring;	/* main loop -> APRS-IS */
+static struct aprsis_ring *aprsis_rxring;	/* APRS-IS -> main loop */
+
+static int aprsis_ring_msgsize(int len)
+{
+	return (sizeof(int) + len + 1 + APRSIS_RING_ALIGN - 1) & ~(APRSIS_RING_ALIGN - 1);
+}
+
+static struct aprsis_ring *aprsis_ring_new(void)
+{
+	struct aprsis_ring *R = calloc(1, sizeof(*R));
+	if (R == NULL)
+		return NULL;
+#ifdef HAVE_SYS_EVENTFD_H
+	R->wakefd[0] = eventfd(0, 0);
+	R->wakefd[1] = R->wakefd[0];
+	if (R->wakefd[0] < 0)
+#endif
+	if (pipe(R->wakefd) != 0) {
+		free(R);
+		return NULL;
+	}
+	fd_nonblockingmode(R->wakefd[0]);
+	fd_nonblockingmode(R->wakefd[1]);
+	return R;
+}
+
+static void aprsis_ring_free(struct aprsis_ring *R)
+{
+	if (R == NULL) return;
+	close(R->wakefd[0]);
+	if (R->wakefd[1] != R->wakefd[0])
+		close(R->wakefd[1]);
+	free(R);
+}
+
+/* Producer: space for  len  bytes of message, or NULL when full */
+static char *aprsis_ring_reserve(struct aprsis_ring *R, int len)
+{
+	unsigned int need = aprsis_ring_msgsize(len);
+	unsigned int head = R->head;
+	unsigned int tail = __atomic_load_n(&R->tail, __ATOMIC_SEQ_CST);
+	unsigned int pos  = head & (APRSIS_RING_SIZE-1);
+	unsigned int skip = 0;
+
+	if (APRSIS_RING_SIZE - pos < need)
+		skip = APRSIS_RING_SIZE - pos; /* to start of buffer */
+
+	if (APRSIS_RING_SIZE - (head - tail) < skip + need) {
+		++R->dropped;
+		return NULL;
+	}
+	if (skip) {
+		*(int*)(R->buf + pos) = -1;
+		pos = 0;
+	}
+	R->skip = skip;
+	*(int*)(R->buf + pos) = len;
+	R->buf[pos + sizeof(int) + len] = 0;
+	return R->buf + pos + sizeof(int);
+}
+
+/* Signal the consumer */
+static void aprsis_ring_wake(struct aprsis_ring *R)
+{
+	static const uint64_t one = 1;
+	int rc = write(R->wakefd[1], &one, sizeof(one));
+	(void)rc;
+}
+
+/* Producer: publish the message filled in at reserve */
+static void aprsis_ring_commit(struct aprsis_ring *R, int len)
+{
+	unsigned int head = R->head;
+
+	__atomic_store_n(&R->head, head + R->skip + aprsis_ring_msgsize(len),
+			 __ATOMIC_SEQ_CST);
+	// Consumer may sleep only when it has seen the ring empty
+	if (__atomic_load_n(&R->tail, __ATOMIC_SEQ_CST) == head)
+		aprsis_ring_wake(R);
+}
+
+static int aprsis_ring_put(struct aprsis_ring *R, const char *data, int len)
+{
+	char *p = aprsis_ring_reserve(R, len);
+	if (p == NULL)
+		return -1;
+	memcpy(p, data, len);
+	aprsis_ring_commit(R, len);
+	return 0;
+}
+
+/* Consumer: oldest message, or NULL when ring is empty */
+static const char *aprsis_ring_peek(struct aprsis_ring *R, int *lenp)
+{
+	unsigned int tail = R->tail;
+	unsigned int pos;
+	int len;
+
+	if (__atomic_load_n(&R->head, __ATOMIC_SEQ_CST) == tail)
+		return NULL;
+	pos = tail & (APRSIS_RING_SIZE-1);
+	len = *(int*)(R->buf + pos);
+	if (len < 0) { /* wrapped around */
+		__atomic_store_n(&R->tail, tail + APRSIS_RING_SIZE - pos,
+				 __ATOMIC_SEQ_CST);
+		pos = 0;
+		len = *(int*)(R->buf);
+	}
+	*lenp = len;
+	return R->buf + pos + sizeof(int);
+}
+
+/* Consumer: done with the message given by peek */
+static void aprsis_ring_release(struct aprsis_ring *R, int len)
+{
+	__atomic_store_n(&R->tail, R->tail + aprsis_ring_msgsize(len),
+			 __ATOMIC_SEQ_CST);
+}
+
+/* Consumer: clear the wakeup before draining the ring */
+static void aprsis_ring_wakeclear(struct aprsis_ring *R)
+{
+	char buf[64];
+	while (read(R->wakefd[0], buf, sizeof(buf)) == sizeof(buf))
+		;	/* pipe may have more, eventfd gives 8 bytes */
+}
+#endif
+
 //static dupecheck_t *aprsis_rx_dupecheck;
 
 //int  aprsis_dupecheck_storetime = 30;
@@ -125,6 +320,10 @@ static void aprsis_close(struct aprsis *A, const char *why)
 
 	A->wrbuf_len = 0;
 	A->wrbuf_cur = 0;
+	rdbuf_reset(&A->rd);
+	A->rdlin_skip = 0;
+	if (aprsis_qstats)
+		aprsis_qstats->depth = 0;
 	A->next_reconnect = tick.tv_sec + 10;
 	A->last_read = tick.tv_sec;
 
@@ -138,6 +337,99 @@ static void aprsis_close(struct aprsis *A, const char *why)
 }
 
 
+/*
+ *  Send queue ring of  A->wrbuf_size  bytes, of which  A->wrbuf_len
+ *  bytes starting at  A->wrbuf_cur  are pending.
+ */
+// APRS-IS communicator
+static int aprsis_wrbuf_grow(struct aprsis *A, int need)
+{
+	int size = A->wrbuf_size ? A->wrbuf_size : APRSIS_SENDQUEUE_INITIAL;
+	char *buf;
+	int n;
+
+	while (size < need)
+		size <<= 1;
+	buf = malloc(size);
+	if (buf == NULL)
+		return -1; // alloc error, old queue is intact
+	if (A->wrbuf_len > 0) {
+		// Lay out the queue in order to start of new ring
+		n = A->wrbuf_size - A->wrbuf_cur;
+		if (n > A->wrbuf_len)
+			n = A->wrbuf_len;
+		memcpy(buf, A->wrbuf + A->wrbuf_cur, n);
+		memcpy(buf + n, A->wrbuf, A->wrbuf_len - n);
+	}
+	free(A->wrbuf);
+	A->wrbuf      = buf;
+	A->wrbuf_size = size;
+	A->wrbuf_cur  = 0;
+	return 0;
+}
+
+// APRS-IS communicator
+static void aprsis_wrbuf_append(struct aprsis *A, const char *data, int len)
+{
+	int pos = (A->wrbuf_cur + A->wrbuf_len) & (A->wrbuf_size - 1);
+	int n = A->wrbuf_size - pos;
+
+	if (n > len)
+		n = len;
+	memcpy(A->wrbuf + pos, data, n);
+	memcpy(A->wrbuf, data + n, len - n); // wrapped around
+	A->wrbuf_len += len;
+}
+
+/*
+ *  aprsis_wrflush() - write out what is queued, with one writev()
+ */
+// APRS-IS communicator
+static void aprsis_wrflush(struct aprsis *A)
+{
+	struct iovec iov[2];
+	int i, n, iovcnt;
+
+	if (A->server_socket < 0 || A->wrbuf_len == 0)
+		return;
+
+	iov[0].iov_base = A->wrbuf + A->wrbuf_cur;
+	iov[0].iov_len  = A->wrbuf_size - A->wrbuf_cur;
+	iovcnt = 1;
+	if (iov[0].iov_len >= A->wrbuf_len) {
+		iov[0].iov_len = A->wrbuf_len;
+	} else {
+		iov[1].iov_base = A->wrbuf;
+		iov[1].iov_len  = A->wrbuf_len - iov[0].iov_len;
+		iovcnt = 2;
+	}
+
+	i = writev(A->server_socket, iov, iovcnt);
+	if (debug>2)
+		printf("%ld << %s:%s << writev() rc= %d of %d\n",
+		       tick.tv_sec, A->H->server_name, A->H->server_port,
+		       i, A->wrbuf_len);
+	if (i <= 0)
+		return;	/* Argh.. nothing */
+
+	if (log_aprsis) {
+		// Log what got written, sans the last \n
+		n = (i < iov[0].iov_len) ? i : iov[0].iov_len;
+		aprxlog(iov[0].iov_base, (n < i) ? n : n - 1,
+			"<< %s:%s << ", A->H->server_name, A->H->server_port);
+		if (n < i)
+			aprxlog(iov[1].iov_base, i - n - 1,
+				"<< %s:%s << ", A->H->server_name, A->H->server_port);
+	}
+
+	A->wrbuf_len -= i;
+	A->wrbuf_cur  = (A->wrbuf_cur + i) & (A->wrbuf_size - 1);
+	if (A->wrbuf_len == 0)
+		A->wrbuf_cur = 0;
+	if (aprsis_qstats)
+		aprsis_qstats->depth = A->wrbuf_len;
+}
+
 /*
  *  aprsis_queue_() - internal routine - queue data to specific APRS-IS instance
  */
@@ -149,7 +441,6 @@ static int aprsis_queue_(
 		const char *gwcall,
 		const char * const text,
 		int textlen) {
-	int i;
 	char addrbuf[1000];
 	int addrlen, len;
 	char * p;
@@ -162,18 +453,13 @@ static int aprsis_queue_(
 	/* Here the A->H->login is always set. */
 
 	/*
-	 * Append stuff on the writebuf, if it fits.
-	 * If it does not fit, something is broken already
-	 * and we just drop it..
-	 *
-	 * Just to make sure that the write pointer is not left
-	 * rewound when all has been done...
+	 * Append stuff on the send queue, if it fits below the
+	 * high-water mark.  If it does not fit, the uplink is stalled
+	 * and we just drop it, and account the drop.
+	 * Actual writing happens at  aprsis_wrflush()  once per
+	 * poll cycle.
 	 */
 
-	if (A->wrbuf_cur >= A->wrbuf_len && A->wrbuf_len > 0) {
-		A->wrbuf_cur = A->wrbuf_len = 0;
-	}
-
 	addrlen = 0;
 	if (addr) {
 		addrlen = sprintf(addrbuf, "%s,qA%c,%s:", addr, qtype,
@@ -181,35 +467,6 @@ static int aprsis_queue_(
 	}
 	aprsis_login = A->H->login;
 
-	len = addrlen + textlen;
-
-
-	/* Does it fit in ? */
-
-	if ((sizeof(A->wrbuf) - 10) <= (A->wrbuf_len + len)) {
-		/* The string does not fit in, perhaps it needs compacting ? */
-		if (A->wrbuf_cur > 0) { /* Compacting is possible ! */
-			memcpy(A->wrbuf, A->wrbuf + A->wrbuf_cur,
-					A->wrbuf_len - A->wrbuf_cur);
-			A->wrbuf_len -= A->wrbuf_cur;
-			A->wrbuf_cur = 0;
-		}
-
-		/* Check again if it fits in.. */
-		if ((sizeof(A->wrbuf) - 10) <= (A->wrbuf_len + len)) {
-			/* NOT!	 Too bad, drop it.. */
-			return 2;
-		}
-	}
-
-
-	/* Place it on our send buffer */
-
-	if (addrlen > 0) {
-		memcpy(A->wrbuf + A->wrbuf_len, addrbuf, addrlen);
-		A->wrbuf_len += addrlen;
-	}
-
 	/* If there is CR or LF within the packet, terminate packet at it.. */
 	p = memchr(text, '\r', textlen);
 	if (p != NULL) {
@@ -220,38 +477,43 @@ static int aprsis_queue_(
 		textlen = p - text;
 	}
 
-	/* Append CR+LF at the end of the packet */
-	p = (char*)(text + textlen);
-	*p++ = '\r';
-	*p++ = '\n';
-	textlen += 2;
+	len = addrlen + textlen + 2;
 
-	memcpy(A->wrbuf + A->wrbuf_len, text, textlen);
-	A->wrbuf_len += textlen;	/* Always supplied with tail newline.. */
-
-	/* -- debug --
-	   fwrite(A->wrbuf,A->wrbuf_len,1,stdout);
-	   return 0;
-	 */
-
-	/* Try writing it right away: */
+	/* Does it fit in ? */
 
-	i = write(A->server_socket, A->wrbuf + A->wrbuf_cur,
-			A->wrbuf_len - A->wrbuf_cur);
-	if (i > 0) {
-		// the buffer's last character is \n, don't write it
-		if (log_aprsis) {
-			aprxlog(A->wrbuf + A->wrbuf_cur, 
-					(A->wrbuf_len - A->wrbuf_cur) -1,
-					"<< %s:%s << ", A->H->server_name, A->H->server_port);
+	if (A->wrbuf_len + len > A->H->send_queue_limit) {
+		/* NOT!	 Too bad, drop it.. */
+		if (aprsis_qstats) {
+			aprsis_qstats->drop_packets += 1;
+			aprsis_qstats->drop_bytes   += len;
 		}
-
-		A->wrbuf_cur += i;
-		if (A->wrbuf_cur >= A->wrbuf_len) {	/* Wrote all ! */
-			A->wrbuf_cur = A->wrbuf_len = 0;
+		if (debug>1)
+			printf("aprsis_queue_() send queue full at %d bytes, dropped\n",
+			       A->wrbuf_len);
+		return 2;
+	}
+	if (A->wrbuf_len + len > A->wrbuf_size &&
+	    aprsis_wrbuf_grow(A, A->wrbuf_len + len) < 0) {
+		/* No memory for a bigger queue, drop it like above */
+		if (aprsis_qstats) {
+			aprsis_qstats->drop_packets += 1;
+			aprsis_qstats->drop_bytes   += len;
 		}
+		if (debug>1)
+			printf("aprsis_queue_() send queue alloc failed at %d bytes, dropped\n",
+			       A->wrbuf_len);
+		return 2;
 	}
 
+	/* Place it on our send queue, with CR+LF at the end */
+
+	aprsis_wrbuf_append(A, addrbuf, addrlen);
+	aprsis_wrbuf_append(A, text, textlen);
+	aprsis_wrbuf_append(A, "\r\n", 2);
+
+	if (aprsis_qstats)
+		aprsis_qstats->depth = A->wrbuf_len;
+
 	return 0;
 }
 
@@ -402,47 +664,75 @@ fail_out:;
 }
 
 
+// APRS-IS communicator
+static void aprsis_sockline(struct aprsis *A, const char *line, int len)
+{
+	int c;
+
+	if (len > APRSIS_LINE_MAX)
+		len = APRSIS_LINE_MAX;
+
+	A->last_read = tick.tv_sec; /* Time stamp me ! */
+
+	if (log_aprsis)
+		aprxlog(line, len, ">> %s:%s >> ", A->H->server_name, A->H->server_port);
+
+	/* Send the line content to main program */
+#ifdef APRSIS_RING
+	// Main program is far behind, drop it like the
+	// send queue does, and account the drop.
+	if (aprsis_ring_put(aprsis_rxring, line, len) < 0) {
+		if (aprsis_qstats) {
+			aprsis_qstats->drop_packets += 1;
+			aprsis_qstats->drop_bytes   += len;
+		}
+		if (debug>1)
+			printf("aprsis_sockline() ring full, dropped %u\n",
+			       aprsis_rxring->dropped);
+	}
+	c = 0;
+#else
+	c = send(aprsis_up, line, len, 0);
+#endif
+	/* This may fail with SIGPIPE.. */
+	if (c < 0 && (errno == EPIPE ||
+		      errno == ECONNRESET ||
+		      errno == ECONNREFUSED ||
+		      errno == ENOTCONN)) {
+		die_now = 1; // upstream socket send failed
+	}
+}
+
 // APRS-IS communicator
 static int aprsis_sockreadline(struct aprsis *A)
 {
-	int i, c;
+	const char *p;
+	int i, len;
 
-	/* Reads multiple lines from buffer,
+	/* Passes on all complete lines in the buffer, where they are.
 	   Last one is left into incomplete state */
 
-	for (i = A->rdbuf_cur; i < A->rdbuf_len; ++i) {
-		c = 0xFF & (A->rdbuf[i]);
-		if (c == '\r' || c == '\n') {
-			/* End of line, process.. */
-			if (A->rdlin_len > 0) {
-				A->rdline[A->rdlin_len] = 0;
-				/* */
-				A->last_read = tick.tv_sec; /* Time stamp me ! */
-
-				if (log_aprsis)
-					aprxlog(A->rdline, A->rdlin_len,
-							">> %s:%s >> ", A->H->server_name, A->H->server_port);
-
-				/* Send the A->rdline content to main program */
-				c = send(aprsis_up, A->rdline, A->rdlin_len, 0);
-				/* This may fail with SIGPIPE.. */
-				if (c < 0 && (errno == EPIPE ||
-				              errno == ECONNRESET ||
-				              errno == ECONNREFUSED ||
-				              errno == ENOTCONN)) {
-					die_now = 1; // upstream socket send failed
-				}
-			}
-			A->rdlin_len = 0;
-			continue;
+	for (;;) {
+		p = (const char *)rdbuf_view(&A->rd, &len);
+		for (i = 0; i < len; ++i) {
+			if (p[i] == '\r' || p[i] == '\n')
+				break;
 		}
-		if (A->rdlin_len < sizeof(A->rdline) - 2) {
-			A->rdline[A->rdlin_len++] = c;
+		if (i >= len) {
+			if (A->rd.cursor == 0 && A->rd.len == A->rd.size) {
+				// Longer than whole buffer, skip to its end
+				A->rdlin_skip = 1;
+				rdbuf_consume(&A->rd, len);
+			}
+			break;
 		}
+		/* End of line, process.. */
+		if (i > 0 && !A->rdlin_skip)
+			aprsis_sockline(A, p, i);
+		A->rdlin_skip = 0;
+		rdbuf_consume(&A->rd, i + 1);
 	}
-	A->rdbuf_cur = 0;
-	A->rdbuf_len = 0;	/* we ignore line reading */
-	return 0;		/* .. this is placeholder.. */
+	return 0;
 }
 
 // APRS-IS communicator
@@ -450,29 +740,10 @@ static int aprsis_sockread(struct aprsis *A)
 {
 	int i;
 
-	int rdspace = sizeof(A->rdbuf) - A->rdbuf_len;
-
-	if (A->rdbuf_cur > 0) {
-		/* Read-out cursor is not at block beginning,
-		   is there unread data too ? */
-		if (A->rdbuf_cur > A->rdbuf_len) {
-			memcpy(A->rdbuf, A->rdbuf + A->rdbuf_cur,
-					A->rdbuf_len - A->rdbuf_cur);
-			A->rdbuf_len -= A->rdbuf_cur;
-		} else
-			A->rdbuf_len = 0;	/* all processed, mark its size zero */
-		A->rdbuf_cur = 0;
-
-		/* recalculate */
-		rdspace = sizeof(A->rdbuf) - A->rdbuf_len;
-	}
-
-	i = read(A->server_socket, A->rdbuf + A->rdbuf_len, rdspace);
+	i = rdbuf_read(&A->rd, A->server_socket);
 
 	if (i > 0) {
 
-		A->rdbuf_len += i;
-
 		/* we just ignore the readback.. but do time-stamp the event */
 		A->last_read = tick.tv_sec;
 
@@ -491,31 +762,21 @@ struct aprsis_tx_msg_head {
 };
 
 /*
- * Read frame from a socket in between main-program and
- * APRS-IS interface subprogram.  (At APRS-IS side.)
- * 
+ * Queue one message from main-program to APRS-IS server.
+ * The  buf  has NUL byte at  buf[recv_len].
  */
 // APRS-IS communicator
-static void aprsis_readup(void)
+static void aprsis_readup_msg(const char *buf, int recv_len)
 {
-	int recv_len;
-	char buf[10000];
 	const char *addr;
 	const char *gwcall;
 	const char *text;
 	int textlen;
 	struct aprsis_tx_msg_head head;
 
-	recv_len = recv(aprsis_up, buf, sizeof(buf), 0);
-	if (recv_len == 0) { // EOF !
-		if (debug>1) printf("Upstream fd read resulted eof status.\n");
-		die_now = 1;
-		return;
-	}
-	if (recv_len < 0) {
-		return;		/* Whatever was the reason.. */
+	if (recv_len < sizeof(head)) {
+		return;		// BAD!
 	}
-	buf[recv_len] = 0;		/* String Termination NUL byte */
 
 	memcpy(&head, buf, sizeof(head));
 	addr = buf + sizeof(head);
@@ -547,6 +808,42 @@ static void aprsis_readup(void)
 		aprsis_queue_(AprsIS, addr, head.qtype, gwcall, text, textlen);
 }
 
+/*
+ * Read frame from a socket in between main-program and
+ * APRS-IS interface subprogram.  (At APRS-IS side.)
+ * 
+ */
+// APRS-IS communicator
+static void aprsis_readup(void)
+{
+#ifdef APRSIS_RING
+	const char *buf;
+	int len;
+
+	aprsis_ring_wakeclear(aprsis_txring);
+	while ((buf = aprsis_ring_peek(aprsis_txring, &len)) != NULL) {
+		aprsis_readup_msg(buf, len);
+		aprsis_ring_release(aprsis_txring, len);
+	}
+#else
+	int recv_len;
+	char buf[10000];
+
+	recv_len = recv(aprsis_up, buf, sizeof(buf)-1, 0);
+	if (recv_len == 0) { // EOF !
+		if (debug>1) printf("Upstream fd read resulted eof status.\n");
+		die_now = 1;
+		return;
+	}
+	if (recv_len < 0) {
+		return;		/* Whatever was the reason.. */
+	}
+	buf[recv_len] = 0;		/* String Termination NUL byte */
+
+	aprsis_readup_msg(buf, recv_len);
+#endif
+}
+
 
 // main program side
 int aprsis_queue(
@@ -556,15 +853,21 @@ int aprsis_queue(
 		const char *gwcall,
 		const char *text,
 		int textlen) {
+#ifdef APRSIS_RING
+	char *buf;		/* Space reserved on the ring */
+#else
 	static char *buf;	/* Dynamically allocated buffer... */
 	static int buflen;
+	int newlen;
+#endif
 	int i, len, gwlen = strlen(gwcall);
 	char *p;
 	struct aprsis_tx_msg_head head;
-	int newlen;
+	int64_t t0;
 	//	dupe_record_t *dp;
 
 	if (aprsis_down < 0) return -1; // No socket!
+	t0 = erlang_latency_now();
 
 	if (addrlen == 0)      /* should never be... */
 		addrlen = strlen(addr);
@@ -576,12 +879,25 @@ int aprsis_queue(
 	//	  if (dp != NULL) return 1; // Bad either as dupe, or due to alloc failure
 	//	}
 
-	newlen = sizeof(head) + addrlen + gwlen + textlen + 6;
+	// Message length, without the final 0 byte
+	len    = sizeof(head) + addrlen + 1 + gwlen + 1 + textlen;
+#ifdef APRSIS_RING
+	// Compose the message directly on the ring, the reserved
+	// length goes to the ring and must be that of the commit
+	buf = aprsis_ring_reserve(aprsis_txring, len);
+	if (buf == NULL) {
+		if (debug>1) printf("aprsis_queue() ring full, dropped %u\n",
+				    aprsis_txring->dropped);
+		return 1;
+	}
+#else
+	newlen = len + 6;
 	if (newlen > buflen) {
 		buflen = newlen;
 		buf = realloc(buf, buflen);
 		memset(buf, 0, buflen); // (re)init it to silence valgrind
 	}
+#endif
 
 	memset(&head, 0, sizeof(head));
 	head.then    = tick.tv_sec;
@@ -601,9 +917,12 @@ int aprsis_queue(
 	*p++ = 0;		/* string terminating 0 byte */
 	memcpy(p, text, textlen);
 	p += textlen;
-	len = p - buf;
 	*p++ = 0;
 
+#ifdef APRSIS_RING
+	aprsis_ring_commit(aprsis_txring, len);
+	i = len;
+#else
 #ifndef MSG_NOSIGNAL
 # define MSG_NOSIGNAL 0 /* This exists only on Linux  */
 #endif
@@ -612,6 +931,8 @@ int aprsis_queue(
 											   or pipe is full
 											   because it is doing
 											   slow reconnection. */
+#endif
+	erlang_latency_add(LATENCY_APRSISQUEUE, t0);
 
 	return (i != len);
 	/* Return 0 if ANY of the queue operations was successfull
@@ -672,13 +993,14 @@ static int aprsis_prepoll_(struct aprxpolls *app)
 // APRS-IS communicator
 static int aprsis_postpoll_(struct aprxpolls *app)
 {
-	int i;
-	struct pollfd *pfd = app->polls;
+	int i, idx;
+	struct pollfd *pfd;
 	struct aprsis *A = AprsIS;
 
 	if (debug>3) printf("aprsis_postpoll_() cnt=%d\n", app->pollcount);
 
-	for (i = 0; i < app->pollcount; ++i, ++pfd) {
+	for (idx = 0; idx < app->readycount; ++idx) {
+		pfd = &app->polls[app->ready[idx]];
 		if (pfd->fd == A->server_socket && pfd->fd >= 0) {
 			/* This is APRS-IS socket, and we may have some results.. */
 
@@ -702,39 +1024,7 @@ static int aprsis_postpoll_(struct aprxpolls *app)
 				}
 			}
 
-			if (pfd->revents & POLLOUT) {	/* Ready for writing  */
-				/* Normal queue write processing */
-
-				if (A->wrbuf_len > 0 &&
-						A->wrbuf_cur < A->wrbuf_len) {
-					i = write(A->server_socket,
-							A->wrbuf +
-							A->wrbuf_cur,
-							A->wrbuf_len -
-							A->wrbuf_cur);
-					if (debug>2)
-						printf("%ld << %s:%s << write() rc= %d\n",
-								tick.tv_sec, A->H->server_name, A->H->server_port, i);
-
-					if (i < 0)
-						continue;	/* Argh.. nothing */
-					// if (i == 0); /* What ? */
-
-					if (log_aprsis)
-						aprxlog(A->wrbuf + A->wrbuf_cur,
-								(A->wrbuf_len - A->wrbuf_cur) -1,
-								"<< %s:%s << ", A->H->server_name,
-								A->H->server_port);
-
-					A->wrbuf_cur += i;
-					if (A->wrbuf_cur >= A->wrbuf_len) {	/* Wrote all! */
-						A->wrbuf_len = A->wrbuf_cur = 0;
-					} else {
-						/* partial write .. do nothing.. */
-					}
-				}
-				/* .. normal queue */
-			}	/* .. POLLOUT */
+			/* POLLOUT is handled at aprsis_wrflush() */
 		}	/* .. if fd == server_socket */
 	}			/* .. for .. nfds .. */
 	return 1;		/* there was something we did, maybe.. */
@@ -812,7 +1102,7 @@ static void aprsis_main(void) {
 			tv_timeradd_seconds( &app.next_timeout, &tick, 1 );
 		}
 
-		poll(app.polls, app.pollcount, aprxpolls_millis(&app));
+		aprxpolls_wait(&app, aprxpolls_millis(&app));
 
 		timetick();
 
@@ -824,6 +1114,10 @@ static void aprsis_main(void) {
 			aprsis_readup();
 		}
 		aprsis_postpoll_(&app);
+
+		// Write out all that got queued during this round
+		if (AprsIS != NULL)
+			aprsis_wrflush(AprsIS);
 	}
 	aprxpolls_free(&app); // valgrind..
 	/* Got "DIE NOW" signal... */
@@ -840,6 +1134,7 @@ int aprsis_add_server(const char *server, const char *port) {
 
 	if (AprsIS == NULL) {
 		AprsIS = calloc(1,sizeof(*AprsIS));
+		rdbuf_init(&AprsIS->rd, AprsIS->rdstore, sizeof(AprsIS->rdstore));
 	}
 
 	H = calloc(1,sizeof(*H));
@@ -853,6 +1148,7 @@ int aprsis_add_server(const char *server, const char *port) {
 	H->server_name = strdup(server);
 	H->server_port = strdup(port);
 	H->heartbeat_monitor_timeout = 120; // Default timeout 120 seconds
+	H->send_queue_limit = APRSIS_SENDQUEUE_DEFAULT;
 	H->login       = strdup(aprsis_login);	// global aprsis_login
 	H->pass	     = default_passcode;
 	if (H->login == NULL) H->login = strdup(mycall);
@@ -906,6 +1202,25 @@ int aprsis_set_login(const char *login) {
 	return 0;
 }
 
+/*
+ * Send queue counters are shared with the communicator, put them on
+ * shared memory before the thread or child gets started.
+ */
+static int aprsis_erlang;	// erlang_handle("APRSIS")
+
+static void aprsis_queuestats_init(void) {
+	void *p;
+
+	if (aprsis_qstats != NULL)
+		return;
+	p = mmap(NULL, sizeof(*aprsis_qstats), PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED)
+		return;	// no statistics then..
+	aprsis_qstats = p;
+	aprsis_erlang = erlang_handle("APRSIS");
+}
+
 #if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
 static void aprsis_runthread(void) {
 	sigset_t sigs_to_block;
@@ -939,6 +1254,24 @@ void aprsis_start(void) {
 		return;
 	}
 
+	aprsis_queuestats_init();
+
+#ifdef APRSIS_RING
+	aprsis_txring = aprsis_ring_new();
+	aprsis_rxring = aprsis_ring_new();
+	if (aprsis_txring == NULL || aprsis_rxring == NULL) {
+		aprsis_ring_free(aprsis_txring);
+		aprsis_ring_free(aprsis_rxring);
+		aprsis_txring = aprsis_rxring = NULL;
+		return;		/* FAIL ! */
+	}
+	pipes[0] = aprsis_rxring->wakefd[0];
+	pipes[1] = aprsis_txring->wakefd[0];
+	aprsis_down = pipes[0];
+	aprsis_up   = pipes[1];
+
+	if (debug) printf("aprsis_start() PTHREAD  rings(up=%d,down=%d)\n", aprsis_up, aprsis_down);
+#else
 	i = socketpair(AF_UNIX, SOCK_DGRAM, PF_UNSPEC, pipes);
 	if (i != 0) {
 		return;		/* FAIL ! */
@@ -950,6 +1283,7 @@ void aprsis_start(void) {
 	aprsis_up   = pipes[1];
 
 	if (debug) printf("aprsis_start() PTHREAD  socketpair(up=%d,down=%d)\n", aprsis_up, aprsis_down);
+#endif
 
 	pthread_attr_init(&pthr_attrs);
 	/* 64 kB stack is enough for this thread (I hope!)
@@ -959,9 +1293,17 @@ void aprsis_start(void) {
 	i = pthread_create(&aprsis_thread, &pthr_attrs, (void*)aprsis_runthread, NULL);
 	if (i == 0) {
 		if (debug) printf("APRSIS pthread_create() OK!\n");
+		aprxpolls_add(&aprsis_downpoll, aprsis_down, POLLIN | POLLPRI,
+			      aprsis_pollevents, NULL);
 	} else {  // FAIL!
+#ifdef APRSIS_RING
+		aprsis_ring_free(aprsis_txring);
+		aprsis_ring_free(aprsis_rxring);
+		aprsis_txring = aprsis_rxring = NULL;
+#else
 		close(pipes[0]);
 		close(pipes[1]);
+#endif
 		aprsis_down = -1;
 		aprsis_up   = -1;
 	}
@@ -985,6 +1327,8 @@ void aprsis_start(void) {
 		return;
 	}
 
+	aprsis_queuestats_init();
+
 
 	i = socketpair(AF_UNIX, SOCK_DGRAM, PF_UNSPEC, pipes);
 	if (i != 0) {
@@ -1012,6 +1356,8 @@ void aprsis_start(void) {
 	close(pipes[1]);
 	fd_nonblockingmode(pipes[0]);
 	aprsis_down = pipes[0];
+	aprxpolls_add(&aprsis_downpoll, aprsis_down, POLLIN | POLLPRI,
+		      aprsis_pollevents, NULL);
 }
 
 
@@ -1021,85 +1367,134 @@ void aprsis_stop(void) {
 
 
 /*
- * main-program side pre-poll
+ * main-program side accounting of communicator queues
  */
-int aprsis_prepoll(struct aprxpolls *app) {
-	int idx = 0;		/* returns number of *fds filled.. */
+static void aprsis_queuestats_collect(void) {
+	static long drop_packets, drop_bytes;
+	static int depth;
+	long p, b;
 
-	struct pollfd *pfd;
+	if (aprsis_qstats == NULL)
+		return;
 
-	// if (debug>3) printf("aprsis_prepoll()\n");
+	p = aprsis_qstats->drop_packets;
+	b = aprsis_qstats->drop_bytes;
+	if (p != drop_packets) {
+		erlang_add_handle(aprsis_erlang, ERLANG_DROP, b - drop_bytes, p - drop_packets);
+		drop_packets = p;
+		drop_bytes   = b;
+	}
+	if (aprsis_qstats->depth != depth) {
+		depth = aprsis_qstats->depth;
+		erlang_queue(aprsis_erlang, depth);
+	}
+}
 
-	pfd = aprxpolls_new(app);
+/*
+ * main-program side pre-poll
+ */
+/*
+ * Up to this many APRS-IS lines are handled per main-loop round,
+ * so that a full feed does not take a whole round for every line,
+ * nor starve the radio side.
+ */
+#define APRSIS_RX_BATCH 64
 
-	pfd->fd = aprsis_down;	/* APRS-IS communicator server Sub-process */
-	pfd->events = POLLIN | POLLPRI;
-	pfd->revents = 0;
+int aprsis_prepoll(struct aprxpolls *app) {
 
-	/* We react only for reading, if write fails because the socket is
-	   jammed,  that is just too bad... */
+	aprsis_queuestats_collect();
 
-	++idx;
+	// if (debug>3) printf("aprsis_prepoll()\n");
 
-	return idx;
+	/* aprsis_down is registered at aprsis_start(), we react
+	   only for reading, if write fails because the socket is
+	   jammed,  that is just too bad... */
 
+	return 0;
 }
 
 /*
  * main-program side reading of aprsis_down
  */
 static int aprsis_comssockread(int fd) {
-	int i;
-	char buf[10000];
-
-	i = recv(fd, buf, sizeof(buf), 0);
-	if (debug>3) printf("aprsis_comsockread(fd=%d) -> i = %d\n", fd, i);
+	int i, n;
+#ifdef APRSIS_RING
+	const char *buf;
+
+	aprsis_ring_wakeclear(aprsis_rxring);
+	for (n = 0; n < APRSIS_RX_BATCH; ++n) {
+		buf = aprsis_ring_peek(aprsis_rxring, &i);
+		if (buf == NULL)
+			return 1;
+		/* Send the frame to Tx-IGate function */
+		igate_from_aprsis(buf, i);
+		aprsis_ring_release(aprsis_rxring, i);
+	}
+	// Producer signals only an empty ring, wake up next round
+	aprsis_ring_wake(aprsis_rxring);
+	return 1;
+#else
+	/* APRS-IS lines are below 512 bytes, and
+	   the socket is level triggered in poll(). */
+	static char bufs[APRSIS_RX_BATCH][2048];
+#ifdef HAVE_RECVMMSG
+	static struct mmsghdr msgs[APRSIS_RX_BATCH];
+	static struct iovec iovs[APRSIS_RX_BATCH];
+
+	for (n = 0; n < APRSIS_RX_BATCH; ++n) {
+		iovs[n].iov_base = bufs[n];
+		iovs[n].iov_len  = sizeof(bufs[n]);
+		msgs[n].msg_hdr.msg_iov    = &iovs[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+	}
+	i = recvmmsg(fd, msgs, APRSIS_RX_BATCH, MSG_DONTWAIT, NULL);
+	if (debug>3) printf("aprsis_comsockread(fd=%d) -> %d datagrams\n", fd, i);
 	if (i == 0)
 		return 0;
-
-	/* TODO: do something with the data ?
-	   A receive-only iGate does nothing, but Rx/Tx would do... */
-
-	/* Send the frame to Tx-IGate function */
-	if (i > 0)
-		igate_from_aprsis(buf, i);
-
+	if (i < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 1 : -1;
+
+	/* Send the frames to Tx-IGate function */
+	for (n = 0; n < i; ++n) {
+		if (msgs[n].msg_len == 0)
+			return 0; // EOF
+		igate_from_aprsis(bufs[n], msgs[n].msg_len);
+	}
+#else
+	for (n = 0; n < APRSIS_RX_BATCH; ++n) {
+		i = recv(fd, bufs[n], sizeof(bufs[n]), MSG_DONTWAIT);
+		if (debug>3) printf("aprsis_comsockread(fd=%d) -> i = %d\n", fd, i);
+		if (i == 0)
+			return 0;
+		if (i < 0)
+			break;
+		/* Send the frame to Tx-IGate function */
+		igate_from_aprsis(bufs[n], i);
+	}
+#endif
 	return 1;
+#endif
 }
 
 
 /*
- * main-program side post-poll
+ * main-program side events of APRS-IS communicator subprocess socket
  */
-int aprsis_postpoll(struct aprxpolls *app) {
+static void aprsis_pollevents(struct aprxpolls *app, struct pollfd *pfd, void *arg) {
 	int i;
-	struct pollfd *pfd = app->polls;
-
 
-	// if (debug>3) printf("aprsis_postpoll()\n");
-
-	for (i = 0; i < app->pollcount; ++i, ++pfd) {
-		if (pfd->fd == aprsis_down) {
-			/* This is APRS-IS communicator subprocess socket,
-			   and we may have some results.. */
+	if (pfd->fd != aprsis_down || !pfd->revents)
+		return;
 
-			if (pfd->revents) {	/* Ready for reading */
-				i = aprsis_comssockread(pfd->fd);
-				if (i == 0) {	/* EOF ! */
-					printf("APRS-IS coms subprocess socket EOF from main program side!\n");
+	/* This is APRS-IS communicator subprocess socket,
+	   and we may have some results.. */
 
-					continue;
-				}
-				if (i < 0) {
-					continue;
-				}
-			}
-		}
-	}			/* .. for .. nfds .. */
-	return 1;		/* there was something we did, maybe.. */
+	i = aprsis_comssockread(pfd->fd);
+	if (i == 0) {	/* EOF ! */
+		printf("APRS-IS coms subprocess socket EOF from main program side!\n");
+	}
 }
 
-
 // main program side
 int aprsis_config(struct configfile *cf) {
 	char *name, *param1;
@@ -1111,6 +1506,7 @@ int aprsis_config(struct configfile *cf) {
 	AIH->login		= strdup(mycall);
 	AIH->pass		= default_passcode;
 	AIH->heartbeat_monitor_timeout = 120;
+	AIH->send_queue_limit = APRSIS_SENDQUEUE_DEFAULT;
 	AIH->mode = MODE_TCP; // default mode
 
 	while (readconfigline(cf) != NULL) {
@@ -1140,6 +1536,7 @@ int aprsis_config(struct configfile *cf) {
 		// server
 		// filter
 		// heartbeat-timeout
+		// send-queue-limit
 		// mode
 
 		if (strcmp(name, "login") == 0) {
@@ -1213,6 +1610,20 @@ int aprsis_config(struct configfile *cf) {
 				printf("%s:%d: INFO: HEARTBEAT-TIMEOUT = '%d' '%s'\n",
 						cf->name, cf->linenum, i, str);
 
+		} else if (strcmp(name, "send-queue-limit") == 0) {
+			int i = atoi(param1);
+			if (i < APRSIS_SENDQUEUE_MINIMUM) {
+				printf("%s:%d: ERROR: SEND-QUEUE-LIMIT = '%s'  - bad parameter, minimum is %d bytes\n",
+						cf->name, cf->linenum, param1, APRSIS_SENDQUEUE_MINIMUM);
+				has_fault = 1;
+				i = APRSIS_SENDQUEUE_MINIMUM;
+			}
+			AIH->send_queue_limit = i;
+
+			if (debug)
+				printf("%s:%d: INFO: SEND-QUEUE-LIMIT = '%d'\n",
+						cf->name, cf->linenum, i);
+
 		} else if (strcmp(name, "filter") == 0) {
 			int l1 = (AIH->filterparam != NULL) ? strlen(AIH->filterparam) : 0;
 			int l2 = strlen(param1);
@@ -1266,6 +1677,7 @@ int aprsis_config(struct configfile *cf) {
 	} else {
 		if (AprsIS == NULL) {
 			AprsIS = calloc(1, sizeof(*AprsIS));
+			rdbuf_init(&AprsIS->rd, AprsIS->rdstore, sizeof(AprsIS->rdstore));
 			AprsIS->server_socket = -1;
 			AprsIS->next_reconnect = tick.tv_sec +10;
 		}
@@ -0,0 +1,665 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+
+/*
+ *  aprx-bench -- offline packet replay through the receive pipeline.
+ *
+ *  Reads a captured rflog (or plain TNC2 text) file, or a raw KISS
+ *  capture, and feeds every packet through the same calls that the
+ *  live receive path uses:  ax25_format_to_tnc(), igate_to_aprsis()
+ *  and interface_receive_ax25() (as its parse and receive halves)
+ *  for radio traffic, and
+ *  igate_from_aprsis() for APRSIS lines.  Timers are run after each
+ *  packet against a virtual tick clock, which advances by 1/rate
+ *  seconds per packet, so the replay runs as fast as the CPU can go
+ *  while the digipeater and dupecheck see a believable traffic rate.
+ *
+ *  The configuration is a normal aprx.conf, but it should only have
+ *  null-device interfaces, and no APRSIS connection.  For example:
+ *
+ *	mycall  N0CALL-1
+ *	<interface>
+ *	   null-device  $mycall
+ *	</interface>
+ *	<digipeater>
+ *	   transmitter  $mycall
+ *	   <source>
+ *	      source    $mycall
+ *	   </source>
+ *	   <source>
+ *	      source    APRSIS
+ *	      relay-type third-party
+ *	      filter    t/m
+ *	   </source>
+ *	</digipeater>
+ *
+ *  Radio packets go to the interface named on the rflog line,
+ *  or to the one given with -p, or to the first interface.
+ */
+
+int debug;
+int verbout;
+int erlangout;
+int die_now;
+int log_aprsis;
+int time_reset;			/* the virtual clock never jumps */
+const char *rflogfile;		/* linkage dummy */
+const char *aprxlogfile;	/* linkage dummy */
+const char *mycall;
+float myloc_lat;
+float myloc_coslat;
+float myloc_lon;
+const char *myloc_latstr;
+const char *myloc_lonstr;
+
+const char *tocall = "APRX29";
+const char *pidfile;		/* linkage dummy */
+
+const char *swname = "aprx";
+const char *swversion = APRXVERSION;
+
+
+/* Replayed packets, prepared before the clock starts */
+struct bench_frame {
+	struct aprx_interface *aif;	// NULL: an APRSIS line
+	int	len;
+	uint8_t	*data;			// AX.25 frame, or APRSIS text
+};
+
+static struct bench_frame *frames;
+static int frames_count;
+static int frames_space;
+static int frames_skipped;
+
+enum {
+	STAGE_FORMAT,
+	STAGE_RXIGATE,
+	STAGE_PARSE,
+	STAGE_DIGI,
+	STAGE_TXIGATE,
+	STAGE_TIMERS,
+	STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+	"ax25-to-tnc2", "rx-igate", "parse", "digipeater", "tx-igate", "timers"
+};
+
+static struct bench_stage {
+	long long nanos;
+	long	  count;
+} stages[STAGE_COUNT];
+
+
+static void usage(void)
+{
+	printf("aprx-bench: [-d][-v][-k][-s][-n loops][-r rate][-w workers][-p interface] -f aprx.conf capturefile\n");
+	printf("aprx-bench: -c\n");
+	printf("    version: %s\n", swversion);
+	printf("    -c:  run the self checks, and exit\n");
+	printf("    -f ...:  configuration with null-device interfaces\n");
+	printf("    -k:  capture is raw KISS, default is rflog or TNC2 text\n");
+	printf("    -n ...:  replay the capture this many times, default 1\n");
+	printf("    -r ...:  virtual packets per second, default 10\n");
+	printf("    -p ...:  interface callsign for radio packets\n");
+	printf("    -s:  all pbufs from the largest size class, for comparison\n");
+	printf("    -w ...:  parse radio packets in this many worker threads\n");
+	printf("    -d:  turn debug printout on\n");
+	printf("    -v:  verbose output of the pipeline\n");
+	exit(64);		/* EX_USAGE */
+}
+
+
+void fd_nonblockingmode(int fd)
+{
+	int __i = fcntl(fd, F_GETFL, 0);
+	if (__i >= 0) {
+		/* set up non-blocking I/O */
+		__i |= O_NONBLOCK;
+		__i = fcntl(fd, F_SETFL, __i);
+	}
+}
+
+void timetick(void)
+{
+	// Virtual clock, advanced by the replay loop only.
+}
+
+void printtime(char *buf, int buflen)
+{
+	sprintf(buf, "%ld.%06ld", (long)tick.tv_sec, (long)tick.tv_usec);
+}
+
+#ifdef HAVE_STDARG_H
+#ifdef __STDC__
+void aprxlog(const char *fmt, ...)
+#else
+void aprxlog(fmt)
+#endif
+#else
+/* VARARGS */
+void aprxlog(va_list)
+va_dcl
+#endif
+{
+	va_list ap;
+
+	if (!verbout)
+		return;
+#ifdef 	HAVE_STDARG_H
+	va_start(ap, fmt);
+#else
+	const char *fmt;
+	va_start(ap);
+	fmt    = va_arg(ap, const char *);
+#endif
+	vfprintf(stdout, fmt, ap);
+	(void)fprintf(stdout, "\n");
+#ifdef 	HAVE_STDARG_H
+	va_end(ap);
+#endif
+}
+
+void rfloghex(const char *portname, char direction, int discard, const uint8_t *buf, int buflen)
+{
+}
+
+void rflog(const char *portname, char direction, int discard, const char *tnc2buf, int tnc2len)
+{
+}
+
+
+static long long bench_nanos(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+#endif
+}
+
+static void bench_addframe(struct aprx_interface *aif, const void *data, int len)
+{
+	struct bench_frame *bf;
+
+	if (frames_count >= frames_space) {
+		frames_space = frames_space ? frames_space * 2 : 1024;
+		frames = realloc(frames, sizeof(*frames) * frames_space);
+	}
+	bf = &frames[frames_count++];
+	bf->aif  = aif;
+	bf->len  = len;
+	bf->data = malloc(len+1);
+	memcpy(bf->data, data, len);
+	bf->data[len] = 0;
+}
+
+/* Default receiver for radio packets: -p, or the first real interface */
+static struct aprx_interface *bench_defaultif(const char *portname)
+{
+	int i;
+
+	if (portname != NULL)
+		return find_interface_by_callsign(portname);
+	for (i = 0; i < all_interfaces_count; ++i) {
+		if (all_interfaces[i]->iftype != IFTYPE_APRSIS)
+			return all_interfaces[i];
+	}
+	return NULL;
+}
+
+/*
+ *  Encode TNC2 monitor format "SRC>DEST,VIA*:payload" to AX.25 UI frame.
+ *  Returns frame length, or 0 when the address is not valid AX.25.
+ */
+static int bench_tnc2_to_ax25(const char *tnc2, int tnc2len, uint8_t *ax25, int ax25size)
+{
+	const char *e = tnc2 + tnc2len;
+	const char *colon = memchr(tnc2, ':', tnc2len);
+	const char *p, *s;
+	char addrs[10][12];
+	int n = 0, i, len;
+
+	if (colon == NULL)
+		return 0;
+
+	// Split the address part to SRC, DEST, VIA..
+	for (p = tnc2; p < colon; p = s + 1) {
+		if (n >= 10)
+			return 0;	// 8 digipeaters at most
+		for (s = p; s < colon && *s != '>' && *s != ','; ++s)
+			;
+		if (s - p == 0 || s - p >= (int)sizeof(addrs[0]))
+			return 0;
+		memcpy(addrs[n], p, s - p);
+		addrs[n][s - p] = 0;
+		++n;
+	}
+	if (n < 2)
+		return 0;
+
+	len = n * 7 + 2 + (e - colon - 1);
+	if (len > ax25size)
+		return 0;
+
+	// DEST first, then SRC, then VIAs
+	if (parse_ax25addr(ax25 + 0, addrs[1], 0xe0) ||
+	    parse_ax25addr(ax25 + 7, addrs[0], 0x60))
+		return 0;
+	for (i = 2; i < n; ++i) {
+		if (parse_ax25addr(ax25 + 7 * i, addrs[i], 0x60))
+			return 0;
+	}
+	ax25[n * 7 - 1] |= 0x01;	// address end marker
+	ax25[n * 7]      = 0x03;	// UI
+	ax25[n * 7 + 1]  = 0xf0;	// PID
+	memcpy(ax25 + n * 7 + 2, colon + 1, e - colon - 1);
+	return len;
+}
+
+/*
+ *  rflog lines look like:
+ *    2014-05-01 12:34:56.789 OH2XYZ-1  R [#*]SRC>DEST,VIA:payload
+ *  anything else with '>' and ':' in it is taken as plain TNC2.
+ */
+static void bench_textline(char *line, int len, struct aprx_interface *rxif)
+{
+	char *p = line, *e = line + len;
+	char *portname = NULL;
+	uint8_t ax25[1100];
+	int axlen;
+
+	if (len > 10 && isdigit((uint8_t)line[0]) && line[4] == '-') {
+		int direction;
+
+		// Skip date and time, pick port name and direction
+		p = strchr(p, ' ');
+		if (p) p = strchr(p + 1, ' ');
+		while (p && *p == ' ') ++p;
+		if (p == NULL || *p == 0) {
+			++frames_skipped;
+			return;
+		}
+		portname = p;
+		while (*p && *p != ' ') ++p;
+		if (*p == 0) {
+			++frames_skipped;
+			return;
+		}
+		*p++ = 0;
+		while (*p == ' ') ++p;
+		direction = *p;
+		if (direction != 'R') // Only received packets are replayed
+			return;
+		++p;
+		if (*p == ' ') ++p;
+		if (*p == '*' || *p == '#') ++p; // discard marks
+	}
+
+	if (memchr(p, '>', e - p) == NULL || memchr(p, ':', e - p) == NULL) {
+		++frames_skipped;
+		return;
+	}
+
+	if (portname != NULL && strcmp(portname, "APRSIS") == 0) {
+		bench_addframe(NULL, p, e - p);
+		return;
+	}
+	if (portname != NULL && find_interface_by_callsign(portname) != NULL)
+		rxif = find_interface_by_callsign(portname);
+	if (rxif == NULL) {
+		++frames_skipped;
+		return;
+	}
+
+	axlen = bench_tnc2_to_ax25(p, e - p, ax25, sizeof(ax25));
+	if (axlen == 0) {
+		++frames_skipped;
+		return;
+	}
+	bench_addframe(rxif, ax25, axlen);
+}
+
+static void bench_readtext(FILE *fp, struct aprx_interface *rxif)
+{
+	char line[2000];
+	int len;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strlen(line);
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = 0;
+		if (len == 0)
+			continue;
+		bench_textline(line, len, rxif);
+	}
+}
+
+/* Raw KISS: FEND framed, FESC escaped, data frames only */
+static void bench_readkiss(FILE *fp, struct aprx_interface *rxif)
+{
+	uint8_t frame[2000];
+	int len = 0, esc = 0, c;
+
+	if (rxif == NULL) {
+		fprintf(stderr, "No interface to receive KISS frames on\n");
+		exit(1);
+	}
+
+	while ((c = getc(fp)) != EOF) {
+		if (c == KISS_FEND) {
+			// Command byte low nibble 0: a data frame
+			if (len > 1 && (frame[0] & 0x0F) == 0)
+				bench_addframe(rxif, frame + 1, len - 1);
+			else if (len > 0)
+				++frames_skipped;
+			len = 0;
+			esc = 0;
+			continue;
+		}
+		if (c == KISS_FESC) {
+			esc = 1;
+			continue;
+		}
+		if (esc) {
+			if (c == KISS_TFEND) c = KISS_FEND;
+			else if (c == KISS_TFESC) c = KISS_FESC;
+			esc = 0;
+		}
+		if (len < (int)sizeof(frame))
+			frame[len++] = c;
+	}
+}
+
+static void bench_stage_end(int stage, long long *t0)
+{
+	long long t1 = bench_nanos();
+	stages[stage].nanos += t1 - *t0;
+	stages[stage].count += 1;
+	*t0 = t1;
+}
+
+/* The ax25_to_tnc2() sequence, with timing between the stages */
+static void bench_rx_ax25(struct bench_frame *bf)
+{
+	char tnc2buf[2800];
+	int tnc2len, tnc2addrlen = 0, frameaddrlen = 0, is_aprs = 0, ui_pid = 0;
+	struct pbuf_t *pb;
+	long long t0 = bench_nanos();
+
+	if (parse_workers > 0) {
+		// Whole ax25_to_tnc2(), the stages run interleaved.
+		// The virtual clock runs ahead of the pending parses,
+		// so the digipeater may see a bit different timing.
+		ax25_to_tnc2(bf->aif, bf->aif->callsign, 0, 0, bf->data, bf->len);
+		bench_stage_end(STAGE_DIGI, &t0);
+		return;
+	}
+
+	tnc2len = ax25_format_to_tnc( bf->data, bf->len,
+				      tnc2buf, sizeof(tnc2buf),
+				      & frameaddrlen, &tnc2addrlen,
+				      & is_aprs, &ui_pid );
+	bench_stage_end(STAGE_FORMAT, &t0);
+	if (tnc2len == 0) return;
+
+#ifndef DISABLE_IGATE
+	if (is_aprs) {
+	  igate_to_aprsis(bf->aif->callsign, 0, tnc2buf, tnc2addrlen, tnc2len, 0, 1);
+	  bench_stage_end(STAGE_RXIGATE, &t0);
+	}
+#endif
+
+	// interface_receive_ax25() in its two halves
+	pb = interface_parse_ax25(bf->aif, is_aprs, ui_pid,
+				  bf->data, frameaddrlen, bf->len,
+				  tnc2buf, tnc2addrlen, tnc2len);
+	bench_stage_end(STAGE_PARSE, &t0);
+
+	interface_receive_pbuf(bf->aif, pb);
+	bench_stage_end(STAGE_DIGI, &t0);
+}
+
+static void bench_replay(struct aprxpolls *app, int loops, int rate)
+{
+	int i, n;
+	long long t0;
+	long step = 1000000 / rate;
+
+	for (n = 0; n < loops; ++n) {
+		for (i = 0; i < frames_count; ++i) {
+			struct bench_frame *bf = &frames[i];
+
+			tick.tv_usec += step;
+			while (tick.tv_usec >= 1000000) {
+				tick.tv_usec -= 1000000;
+				++tick.tv_sec;
+			}
+
+			if (bf->aif != NULL) {
+				bench_rx_ax25(bf);
+			} else {
+#ifndef DISABLE_IGATE
+				t0 = bench_nanos();
+				igate_from_aprsis((const char *)bf->data, bf->len);
+				bench_stage_end(STAGE_TXIGATE, &t0);
+#endif
+			}
+
+			t0 = bench_nanos();
+			aprxtimer_postpoll(app);
+			bench_stage_end(STAGE_TIMERS, &t0);
+		}
+	}
+}
+
+static void bench_report(long long nanos, long packets)
+{
+	int i;
+	double secs = nanos / 1e9;
+
+	printf("packets      %ld in %.3f s  (%d skipped at load)\n",
+	       packets, secs, frames_skipped);
+	printf("throughput   %.0f packets/s  %.0f ns/packet\n",
+	       secs > 0 ? packets / secs : 0.0,
+	       packets > 0 ? (double)nanos / packets : 0.0);
+
+	printf("\nstage          calls     ns/call   ns/packet\n");
+	for (i = 0; i < STAGE_COUNT; ++i) {
+		const struct bench_stage *s = &stages[i];
+		printf("%-12s %8ld  %10.0f  %10.0f\n", stage_names[i], s->count,
+		       s->count > 0 ? (double)s->nanos / s->count : 0.0,
+		       packets > 0 ? (double)s->nanos / packets : 0.0);
+	}
+
+#ifdef ERLANGSTORAGE
+	printf("\n");
+	erlang_latency_print(stdout);
+#endif
+
+	printf("\n");
+	pbuf_stats(stdout);
+
+	printf("\n");
+	for (i = 0; i < all_interfaces_count; ++i) {
+		const struct aprx_interface *aif = all_interfaces[i];
+		struct digipeater *digi = digipeater_find_by_iface(aif);
+		if (digi == NULL || digi->transmitter != aif)
+			continue;
+		printf("digi %-9s dupecheck: lookups %ld  inserts %ld  expired %ld  count %d\n",
+		       aif->callsign,
+		       digi->dupechecker->dupecheck_lookups,
+		       digi->dupechecker->dupecheck_inserts,
+		       digi->dupechecker->dupecheck_expired,
+		       digi->dupechecker->count);
+#ifndef DISABLE_IGATE
+		printf("digi %-9s historydb: lookups %ld  inserts %ld  cells %ld\n",
+		       aif->callsign,
+		       digi->historydb->historydb_lookups,
+		       digi->historydb->historydb_inserts,
+		       digi->historydb->historydb_cellgauge);
+#endif
+	}
+
+	printf("\nport            rx-packets  rx-drops  tx-packets\n");
+	for (i = 0; i < ErlangLinesCount; ++i) {
+		const struct erlangline *E = ErlangLines[i];
+		printf("%-14s %11ld %9ld %11ld\n", E->name,
+		       E->SNMP.packets_rx, E->SNMP.packets_rxdrop,
+		       E->SNMP.packets_tx);
+	}
+}
+
+int main(int argc, char *const argv[])
+{
+	int i;
+	const char *cfgfile = NULL;
+	const char *portname = NULL;
+	int kissmode = 0;
+	int checkmode = 0;
+	int loops = 1;
+	int rate = 10;
+	int workers = -1;
+	long long t0, t1;
+	struct aprx_interface *rxif;
+	FILE *fp;
+
+	struct aprxpolls app = APRXPOLLS_INIT;
+
+	while ((i = getopt(argc, argv, "cdf:kn:p:r:svw:?h")) != -1) {
+		switch (i) {
+		case 'c':
+			checkmode = 1;
+			break;
+		case 'd':
+			++debug;
+			break;
+		case 'v':
+			++verbout;
+			break;
+		case 'f':
+			cfgfile = optarg;
+			break;
+		case 'k':
+			kissmode = 1;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'p':
+			portname = optarg;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 's':
+			pbuf_firstclass = PBUF_CLASSES-1;
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	if (!checkmode &&
+	    (cfgfile == NULL || optind >= argc || loops < 1 || rate < 1))
+		usage();
+
+	// Virtual clock starts from the real one
+#ifdef HAVE_CLOCK_GETTIME
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		tick.tv_sec  = ts.tv_sec;
+		tick.tv_usec = ts.tv_nsec / 1000;
+	}
+#else
+	gettimeofday(&tick, NULL);
+#endif
+
+	interface_init(); // before any interface system and aprsis init !
+	erlang_init("NONE");
+	ttyreader_init();
+#ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
+	netax25_init();
+#endif
+	dupecheck_init(); // before aprsis_init() !
+#ifndef DISABLE_IGATE
+	aprsis_init();
+#endif
+	filter_init();
+	pbuf_init();
+
+	if (checkmode)
+		exit(aprx_check() ? 1 : 0);
+
+	if (readconfig(cfgfile)) {
+		fflush(stdout);
+		fprintf(stderr, "Seen configuration errors. Aborting!\n");
+		exit(1);
+	}
+
+	// A null-device is a nameless tty on the serial transmit path,
+	// turn them to plain IFTYPE_NULL so that transmits get counted.
+	for (i = 0; i < all_interfaces_count; ++i) {
+		struct aprx_interface *aif = all_interfaces[i];
+		if (aif->iftype == IFTYPE_TCPIP && aif->tty != NULL &&
+		    aif->tty->ttyname == NULL)
+			aif->iftype = IFTYPE_NULL;
+	}
+
+	erlang_backingstore = NULL; // private memory, not the daemon's file
+	erlang_start(2);
+#ifndef DISABLE_IGATE
+	historydb_init();
+#endif
+	if (workers >= 0)
+		parse_workers = workers;
+	workers_start();
+
+	rxif = bench_defaultif(portname);
+	if (portname != NULL && rxif == NULL) {
+		fprintf(stderr, "No interface with callsign '%s'\n", portname);
+		exit(1);
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Can not open '%s': %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+	if (kissmode)
+		bench_readkiss(fp, rxif);
+	else
+		bench_readtext(fp, rxif);
+	fclose(fp);
+
+	if (frames_count == 0) {
+		fprintf(stderr, "No packets to replay in '%s'\n", argv[optind]);
+		exit(1);
+	}
+
+	t0 = bench_nanos();
+	bench_replay(&app, loops, rate);
+	workers_stop();	// completes the pending ones
+	t1 = bench_nanos();
+
+	bench_report(t1 - t0, (long)frames_count * loops);
+
+	return 0;
+}
@@ -0,0 +1,894 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+#include <limits.h>
+
+/*
+ *  aprx-check -- self checks of  "aprx-bench -c"  ("make check").
+ *
+ *  The compiled and otherwise optimized code paths are run against
+ *  their plain reference versions with pseudo-random inputs, and
+ *  every disagreement is reported.  The random sequence is fixed,
+ *  so a failure can be repeated.
+ */
+
+static uint32_t check_rndstate = 2463534242U;
+
+/* xorshift32, same sequence on every run */
+static uint32_t check_rnd(void)
+{
+	uint32_t x = check_rndstate;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	check_rndstate = x;
+	return x;
+}
+
+static int check_failures;
+
+static long long check_nanos(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+#endif
+}
+
+static void check_fail(const char *what, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (++check_failures > 20)
+		return;	// enough said
+	printf("FAIL %s: ", what);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static void check_result(const char *what, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("%-10s ", what);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+
+/*
+ *  Filters: callsign set indexes and range boxes of filter_parse()
+ *  against the plain interpreter.
+ */
+
+static const char *check_callpool[] = {
+	"OH2MQK", "OH2MQK-1", "OH2MQK-11", "OH2", "OH", "N0CALL", "W1AW",
+	"K", "KK4", "OH2XYZ", "DL1ABC", "DL1", "AB", "A", "OH7RDA", "SK1",
+	"WIDE1-1", "RELAY", "TEST", "OH2RDP"
+};
+#define CHECK_CALLPOOL (sizeof(check_callpool)/sizeof(check_callpool[0]))
+
+/* Some centers for positions and range filters, so that both hit */
+static const float check_centers[][2] = {
+	{ 60.17, 24.94 }, { 89.5, 10.0 }, { -33.9, 151.2 }, { 0.0, 179.9 },
+	{ 40.7, -74.0 }, { -89.0, -120.0 }
+};
+#define CHECK_CENTERS (sizeof(check_centers)/sizeof(check_centers[0]))
+
+static void check_callsign(char *buf)
+{
+	static const char cs[] = "OHK2MQ1-0AW";
+	int i, n;
+
+	if (check_rnd() % 3 == 0) {
+		strcpy(buf, check_callpool[check_rnd() % CHECK_CALLPOOL]);
+	} else {
+		n = 1 + check_rnd() % 9;
+		for (i = 0; i < n; ++i)
+			buf[i] = cs[check_rnd() % (sizeof(cs)-1)];
+		buf[n] = 0;
+	}
+	if (check_rnd() % 4 == 0)
+		for (i = 0; buf[i]; ++i)
+			buf[i] = tolower((uint8_t)buf[i]);
+}
+
+static void check_position(float *lat, float *lon)
+{
+	const float *c = check_centers[check_rnd() % CHECK_CENTERS];
+
+	if (check_rnd() % 4 == 0) {
+		*lat = (check_rnd() % 17999) / 100.0 - 89.99;
+		*lon = (check_rnd() % 35999) / 100.0 - 179.99;
+		return;
+	}
+	// near a center, from a few meters to a few thousand kilometers
+	*lat = c[0] + ((int)(check_rnd() % 20001) - 10000) / (1000.0 * (1 + check_rnd() % 100));
+	*lon = c[1] + ((int)(check_rnd() % 20001) - 10000) / (500.0 * (1 + check_rnd() % 100));
+	if (*lat >  89.99) *lat =  89.99;
+	if (*lat < -89.99) *lat = -89.99;
+	if (*lon >  179.99) *lon -= 359.98;
+	if (*lon < -179.99) *lon += 359.98;
+}
+
+static void check_filterterm(char *buf)
+{
+	static const char settypes[] = "bdgopu";
+	char call[16];
+	float lat, lon;
+	int i, n;
+
+	switch (check_rnd() % 8) {
+	case 0:
+		check_position(&lat, &lon);
+		sprintf(buf, "r/%.2f/%.2f/%.1f", lat, lon,
+			0.1 + (check_rnd() % 300000) / 100.0);
+		break;
+	case 1:
+		check_position(&lat, &lon);
+		n = 1 + check_rnd() % 20;
+		sprintf(buf, "a/%.2f/%.2f/%.2f/%.2f",
+			lat + n > 90 ? 90 : lat + n, lon - n,
+			lat - n < -90 ? -90 : lat - n, lon + n);
+		break;
+	case 2:
+		strcpy(buf, (check_rnd() & 1) ? "t/po" : "t/m");
+		break;
+	default:
+		buf += sprintf(buf, "%s%c", (check_rnd() % 4 == 0) ? "-" : "",
+			       settypes[check_rnd() % (sizeof(settypes)-1)]);
+		n = 1 + check_rnd() % 20;
+		for (i = 0; i < n; ++i) {
+			check_callsign(call);
+			buf += sprintf(buf, "/%s%s", call,
+				       (check_rnd() & 1) ? "*" : "");
+		}
+		break;
+	}
+}
+
+static struct pbuf_t *check_packet(void)
+{
+	char src[16], obj[16], digi[16], tnc2[300], *p;
+	float lat, lon;
+	int addrlen;
+	struct pbuf_t *pb;
+
+	check_callsign(src);
+	check_callsign(digi);
+	check_callsign(obj);
+	check_position(&lat, &lon);
+
+	p = tnc2 + sprintf(tnc2, "%s>APRS,%s*,WIDE2-1", src, digi);
+	addrlen = p - tnc2;
+	switch (check_rnd() % 3) {
+	case 0:
+		p += sprintf(p, ":!%02d%05.2f%c/%03d%05.2f%c-check",
+			     (int)fabsf(lat), (fabsf(lat) - (int)fabsf(lat)) * 60.0,
+			     lat < 0 ? 'S' : 'N',
+			     (int)fabsf(lon), (fabsf(lon) - (int)fabsf(lon)) * 60.0,
+			     lon < 0 ? 'W' : 'E');
+		break;
+	case 1:
+		p += sprintf(p, ":;%-9.9s*111111z%02d%05.2f%c/%03d%05.2f%c-obj",
+			     obj,
+			     (int)fabsf(lat), (fabsf(lat) - (int)fabsf(lat)) * 60.0,
+			     lat < 0 ? 'S' : 'N',
+			     (int)fabsf(lon), (fabsf(lon) - (int)fabsf(lon)) * 60.0,
+			     lon < 0 ? 'W' : 'E');
+		break;
+	default:
+		p += sprintf(p, "::%-9.9s:check{1", obj);
+		break;
+	}
+
+	pb = pbuf_new(1, 1, addrlen, tnc2, p - tnc2, 0, tnc2, 0);
+	if (pb != NULL)
+		parse_aprs(pb, NULL);
+	return pb;
+}
+
+static void check_filters(void)
+{
+	struct filter_t *compiled, *plain;
+	struct pbuf_t *pb;
+	char spec[2000], term[400];
+	int n, i, k, terms, a, b;
+	long packets = 0, accepts = 0;
+
+	for (n = 0; n < 2000; ++n) {
+		compiled = plain = NULL;
+		terms = 1 + check_rnd() % 4;
+		spec[0] = 0;
+		for (i = 0; i < terms; ++i) {
+			check_filterterm(term);
+			strcat(spec, " ");
+			strcat(spec, term);
+			filter_compile = 1;
+			a = filter_parse(&compiled, term);
+			filter_compile = 0;
+			b = filter_parse(&plain, term);
+			if (a != b)
+				check_fail("filter", "'%s' parse %d vs %d", term, a, b);
+		}
+		for (k = 0; k < 200; ++k) {
+			pb = check_packet();
+			if (pb == NULL)
+				continue;
+			filter_compile = 1;
+			a = filter_process(pb, compiled, NULL);
+			filter_compile = 0;
+			b = filter_process(pb, plain, NULL);
+			if (a != b)
+				check_fail("filter", "'%s' on '%.*s': %d vs %d",
+					   spec+1, pb->packet_len, pb->data, a, b);
+			++packets;
+			if (a > 0)
+				++accepts;
+			pbuf_put(pb);
+		}
+		filter_free(compiled);
+		filter_free(plain);
+	}
+	filter_compile = 1;
+	check_result("filter", "%ld packets, %ld accepted, compiled vs plain filters",
+		     packets, accepts);
+}
+
+
+/*
+ *  Digipeater regex-filter: literal prefilter of digi_refilter_match()
+ *  against plain regexec() of every pattern, and their speed.
+ */
+
+static const char *check_repatterns[] = {
+	"^N0CALL", "WIDE7", "^OH2MQK-1$", "TCPIP", "RELAY", "^TEST.*X$",
+	"^(AB|CD)", "[0-9]{3}", "Q[A-Z]+Z", "^ECHO", "GATE$",
+	"^WIDE[3-7]-[0-9]$", "\\.\\*", "TRACE[3-7]", "^K[0-9]ABC",
+	"^[A-Z]+$", "X(Y)?Z", "ab*c", "TEMP\\+1", "NOGATE", "RFONLY",
+	"^DL[0-9]XX", "a{2}b", "(OH)+7", "OH?7", "M.CALL", "[[:digit:]]Z9",
+	"^OH2RDP-[1-9]"
+};
+#define CHECK_REPATTERNS (sizeof(check_repatterns)/sizeof(check_repatterns[0]))
+
+#define CHECK_REFIELDS 50000
+
+static void check_refilter(void)
+{
+	static const char chars[] = "ABCDKOHQXYZ0123456789-WIDETRACEMQKN.*+{}ab";
+	static regex_t plain[CHECK_REPATTERNS];
+	struct digi_refilter rf;
+	regex_t *rep;
+	char (*fields)[16];
+	const char *p;
+	int i, k, n, a, b, matches = 0;
+	long long t0, t_pre, t_plain;
+
+	memset(&rf, 0, sizeof(rf));
+	for (i = 0; i < CHECK_REPATTERNS; ++i) {
+		if (regcomp(&plain[i], check_repatterns[i], REG_EXTENDED | REG_NOSUB) != 0) {
+			check_fail("refilter", "regcomp('%s')", check_repatterns[i]);
+			return;
+		}
+		rep = calloc(1, sizeof(*rep));
+		regcomp(rep, check_repatterns[i], REG_EXTENDED | REG_NOSUB);
+		digi_refilter_add(&rf, rep, check_repatterns[i]);
+	}
+
+	// Random via-sized fields, some of them made of the patterns
+	fields = calloc(CHECK_REFIELDS, sizeof(*fields));
+	for (k = 0; k < CHECK_REFIELDS; ++k) {
+		n = check_rnd() % 14;
+		for (i = 0; i < n; ++i)
+			fields[k][i] = chars[check_rnd() % (sizeof(chars)-1)];
+		fields[k][n] = 0;
+		if (check_rnd() % 5 == 0) {
+			p = check_repatterns[check_rnd() % CHECK_REPATTERNS];
+			if (*p == '^') ++p;
+			snprintf(fields[k], sizeof(fields[k]), "%s", p);
+		}
+	}
+
+	for (k = 0; k < CHECK_REFIELDS; ++k) {
+		a = digi_refilter_match(&rf, fields[k]);
+		b = 0;
+		for (i = 0; i < CHECK_REPATTERNS && !b; ++i)
+			b = (regexec(&plain[i], fields[k], 0, NULL, 0) == 0);
+		if (a != b)
+			check_fail("refilter", "'%s': %d vs %d", fields[k], a, b);
+		matches += a;
+	}
+
+	t0 = check_nanos();
+	for (k = 0; k < CHECK_REFIELDS; ++k)
+		digi_refilter_match(&rf, fields[k]);
+	t_pre = check_nanos() - t0;
+
+	t0 = check_nanos();
+	for (k = 0; k < CHECK_REFIELDS; ++k)
+		for (i = 0; i < CHECK_REPATTERNS; ++i)
+			if (regexec(&plain[i], fields[k], 0, NULL, 0) == 0)
+				break;
+	t_plain = check_nanos() - t0;
+
+	check_result("refilter", "%d fields, %d matched, %d patterns", CHECK_REFIELDS,
+		     matches, (int)CHECK_REPATTERNS);
+	check_result("", "prefilter %.0f ns/field, regexec() loop %.0f ns/field",
+		     (double)t_pre / CHECK_REFIELDS, (double)t_plain / CHECK_REFIELDS);
+
+	for (i = 0; i < CHECK_REPATTERNS; ++i)
+		regfree(&plain[i]);
+	free(fields);
+}
+
+
+/*
+ *  Pbufs: size class choice and cell integrity with a window of live
+ *  pbufs in APRS-IS like sizes, and their memory and time against the
+ *  single largest class  (aprx-bench -s).
+ */
+
+#define CHECK_PBUFLIVE   300
+#define CHECK_PBUFOPS 200000
+
+struct check_pbufop {
+	int slot;
+	int tnc2len;
+	int ax25len;
+};
+
+static void check_pbufverify(struct pbuf_t *pb, const char *tnc2, int tnc2len, int ax25len)
+{
+	int i, sc = pb->sizeclass;
+	int datalen = tnc2len + ax25len + 2;
+
+	if (memcmp(pb->data, tnc2, tnc2len) != 0 || pb->data[tnc2len] != 0 ||
+	    memcmp(pb->ax25addr, tnc2, ax25len) != 0)
+		check_fail("pbuf", "%d+%d bytes in class %d overwritten",
+			   tnc2len, ax25len, sc);
+	if (sc < 0)
+		return;	// heap, all arenas full
+	for (i = pbuf_firstclass; i < sc; ++i)
+		if (datalen <= pbuf_classes[i].datasize &&
+		    pbuf_classes[i].fallbacks == 0)
+			check_fail("pbuf", "%d bytes in class %d, fits %d",
+				   datalen, sc, i);
+	if (datalen > pbuf_classes[sc].datasize)
+		check_fail("pbuf", "%d bytes in class %d of %d", datalen, sc,
+			   pbuf_classes[sc].datasize);
+}
+
+static long long check_pbufrun(const struct check_pbufop *ops, char (*fill)[2200],
+			       int firstclass, long *kbytes)
+{
+	static struct pbuf_t *live[CHECK_PBUFLIVE];
+	static int livelen[CHECK_PBUFLIVE][2];
+	struct pbuf_t *pb;
+	const struct check_pbufop *op;
+	long long t0, t = 0;
+	int i, k, cellsize;
+
+	pbuf_firstclass = firstclass;
+	for (i = 0; i < PBUF_CLASSES; ++i)
+		pbuf_classes[i].highwater = pbuf_classes[i].inuse;
+
+	for (k = 0; k < CHECK_PBUFOPS; ++k) {
+		op = &ops[k];
+		pb = live[op->slot];
+		if (pb != NULL)
+			check_pbufverify(pb, fill[op->slot], livelen[op->slot][0],
+					 livelen[op->slot][1]);
+		t0 = check_nanos();
+		if (pb != NULL)
+			pbuf_put(pb);
+		pb = pbuf_new(1, 1, 27, fill[op->slot], op->tnc2len,
+			      0, fill[op->slot], op->ax25len);
+		t += check_nanos() - t0;
+		if (pb == NULL)
+			check_fail("pbuf", "pbuf_new() of %d+%d bytes", op->tnc2len,
+				   op->ax25len);
+		live[op->slot] = pb;
+		livelen[op->slot][0] = op->tnc2len;
+		livelen[op->slot][1] = op->ax25len;
+	}
+	for (i = 0; i < CHECK_PBUFLIVE; ++i) {
+		if (live[i] == NULL)
+			continue;
+		check_pbufverify(live[i], fill[i], livelen[i][0], livelen[i][1]);
+		pbuf_put(live[i]);
+		live[i] = NULL;
+	}
+
+	*kbytes = 0;
+	for (i = 0; i < PBUF_CLASSES; ++i) {
+		const struct pbuf_class *pc = &pbuf_classes[i];
+		if (pc->inuse != 0)
+			check_fail("pbuf", "%s inuse %ld after all freed",
+				   pc->name, pc->inuse);
+		cellsize = sizeof(struct pbuf_t) + pc->datasize;
+		*kbytes += (pc->highwater * cellsize + 1023) / 1024;
+	}
+	pbuf_firstclass = 0;
+	return t;
+}
+
+static void check_pbufs(void)
+{
+	struct check_pbufop *ops;
+	char (*fill)[2200];
+	long kb_classes, kb_single;
+	long long t_classes, t_single;
+	int i, k, n;
+
+	// Each slot has its own fill, so an overlap of two cells shows
+	fill = calloc(CHECK_PBUFLIVE, sizeof(*fill));
+	for (i = 0; i < CHECK_PBUFLIVE; ++i) {
+		memset(fill[i], 'a' + i % 26, sizeof(fill[i]));
+		memcpy(fill[i], "OH2MQK-1>APRS,TCPIP*,qAC,T2:", 28);
+		fill[i][9] = 'A' + i % 26;
+	}
+
+	// Most APRS-IS packets are under 100 bytes, a few are long.
+	// A third come from radio with an AX.25 copy of about the same size.
+	ops = calloc(CHECK_PBUFOPS, sizeof(*ops));
+	for (k = 0; k < CHECK_PBUFOPS; ++k) {
+		n = check_rnd() % 100;
+		ops[k].slot = check_rnd() % CHECK_PBUFLIVE;
+		if (n < 60)
+			ops[k].tnc2len = 40 + check_rnd() % 60;
+		else if (n < 90)
+			ops[k].tnc2len = 100 + check_rnd() % 80;
+		else if (n < 99)
+			ops[k].tnc2len = 180 + check_rnd() % (PACKETLEN_MAX - 180);
+		else
+			ops[k].tnc2len = PACKETLEN_MAX + check_rnd() % (PACKETLEN_MAX_HUGE - PACKETLEN_MAX);
+		if (check_rnd() % 3 == 0)
+			ops[k].ax25len = ops[k].tnc2len - 10;
+	}
+
+	t_classes = check_pbufrun(ops, fill, 0, &kb_classes);
+	t_single  = check_pbufrun(ops, fill, PBUF_CLASSES-1, &kb_single);
+
+	check_result("pbuf", "%d live of %d pbufs: size classes %ld kB, single class %ld kB",
+		     CHECK_PBUFLIVE, CHECK_PBUFOPS, kb_classes, kb_single);
+	check_result("", "size classes %.0f ns/pbuf, single class %.0f ns/pbuf",
+		     (double)t_classes / CHECK_PBUFOPS, (double)t_single / CHECK_PBUFOPS);
+
+	free(ops);
+	free(fill);
+}
+
+
+/*
+ *  Keyhash: piecewise feeds and case folding against the one-shot
+ *  keyhash(), its distribution over callsign keys, and its speed
+ *  against the byte-wise FNV hash it replaced.
+ */
+
+#define CHECK_KEYHASHKEYS (1 << 20)
+
+/* The keyhash() and keyhashuc() before the word-at-a-time ones,
+   out of line like they were in keyhash.c */
+static uint32_t __attribute__((noinline)) check_fnvhash(const void *p, int len, uint32_t hash, int uc)
+{
+	const uint8_t *u = p;
+	int i;
+
+	if (hash == 0)
+		hash = 2166136261U;
+	for (i = 0; i < len; ++i, ++u) {
+		uint32_t c = *u;
+		hash *= 16777619U;
+		if (uc && 'a' <= c && c <= 'z')
+			c -= ('a' - 'A');
+		hash ^= c;
+	}
+	return hash;
+}
+
+static int check_keyhashcmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void check_keyhash(void)
+{
+	static const int sizes[] = { 8, 60, 120, 180 };
+	static int buckets[65536];
+	static char keys[256][200];
+	char buf[300], ub[300];
+	uint32_t a, b, *hashes;
+	keyhash_state_t st;
+	volatile uint32_t sink = 0;
+	double chi2 = 0, e, flips = 0;
+	long long t0, t1, t2, t3, t4;
+	int i, k, n, p, len, collisions = 0;
+
+	for (i = 0; i < 200000; ++i) {
+		len = check_rnd() % 200;
+		for (k = 0; k < len; ++k) {
+			buf[k] = 32 + check_rnd() % 95;
+			ub[k] = toupper((uint8_t)buf[k]);
+		}
+		a = keyhash(buf, len, i & 1 ? 0 : check_rnd());
+		b = keyhashuc(buf, len, 0);
+		if (b != keyhash(ub, len, 0))
+			check_fail("keyhash", "keyhashuc('%.*s') is not keyhash() of upper case",
+				   len, buf);
+		keyhash_begin(&st, 0);
+		for (p = 0; p < len; p += n) {
+			n = check_rnd() % (len - p + 1);
+			keyhash_update(&st, buf + p, n);
+		}
+		if (keyhash_final(&st) != keyhash(buf, len, 0))
+			check_fail("keyhash", "'%.*s' fed in pieces", len, buf);
+		keyhash_begin(&st, 0);
+		for (p = 0; p < len; p += n) {
+			n = 1 + check_rnd() % 9;
+			if (n > len - p)
+				n = len - p;
+			keyhash_updateuc(&st, buf + p, n);
+		}
+		if (keyhash_final(&st) != b)
+			check_fail("keyhash", "'%.*s' fed in pieces with upper case", len, buf);
+		sink += a;
+	}
+
+	// Callsign keys into 2^16 buckets, and full 32 bit collisions
+	hashes = malloc(CHECK_KEYHASHKEYS * sizeof(*hashes));
+	for (i = 0; i < CHECK_KEYHASHKEYS; ++i) {
+		len = sprintf(buf, "OH%d%c%c%c-%d", i % 10, 'A' + (i / 10) % 26,
+			      'A' + (i / 260) % 26, 'A' + (i / 6760) % 26, (i / 175760) % 16);
+		hashes[i] = keyhash(buf, len, 0);
+		buckets[hashes[i] & 65535] += 1;
+	}
+	e = (double)CHECK_KEYHASHKEYS / 65536;
+	for (i = 0; i < 65536; ++i)
+		chi2 += (buckets[i] - e) * (buckets[i] - e) / e;
+	chi2 /= 65535;
+	qsort(hashes, CHECK_KEYHASHKEYS, sizeof(*hashes), check_keyhashcmp);
+	for (i = 1; i < CHECK_KEYHASHKEYS; ++i)
+		if (hashes[i] == hashes[i-1])
+			++collisions;
+	free(hashes);
+	e = (double)CHECK_KEYHASHKEYS * CHECK_KEYHASHKEYS / 2 / 4294967296.0;
+	if (chi2 > 1.05 || collisions > 2 * e)
+		check_fail("keyhash", "chi2/df %.3f, %d collisions", chi2, collisions);
+
+	// Output bits flipped by each input bit of 64 byte keys
+	for (i = 0; i < 500; ++i) {
+		for (k = 0; k < 64; ++k)
+			buf[k] = check_rnd();
+		a = keyhash(buf, 64, 0);
+		for (k = 0; k < 512; ++k) {
+			buf[k/8] ^= 1 << (k%8);
+			flips += __builtin_popcount(a ^ keyhash(buf, 64, 0));
+			buf[k/8] ^= 1 << (k%8);
+		}
+	}
+	flips /= 500 * 512;
+	if (flips < 15.5 || flips > 16.5)
+		check_fail("keyhash", "avalanche %.2f of 32 bits", flips);
+
+	check_result("keyhash", "%d keys: chi2/df %.3f, %d collisions of ~%.0f, avalanche %.2f of 32 bits",
+		     CHECK_KEYHASHKEYS, chi2, collisions, e, flips);
+
+	for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+		long long d[4] = { LLONG_MAX, LLONG_MAX, LLONG_MAX, LLONG_MAX };
+		len = sizes[i];
+		// Different keys from memory.  Storing a byte on the key
+		// just before would stall the word loads of keyhash().
+		for (n = 0; n < 256; ++n)
+			for (k = 0; k < len; ++k)
+				keys[n][k] = 'a' + (n + k) % 26;
+		// Best of a few rounds, the timings are noisy
+		for (p = 0; p < 3; ++p) {
+			t0 = check_nanos();
+			for (k = 0; k < 1000000; ++k)
+				sink += check_fnvhash(keys[k & 255], len, 0, 0);
+			t1 = check_nanos();
+			for (k = 0; k < 1000000; ++k)
+				sink += keyhash(keys[k & 255], len, 0);
+			t2 = check_nanos();
+			for (k = 0; k < 1000000; ++k)
+				sink += check_fnvhash(keys[k & 255], len, 0, 1);
+			t3 = check_nanos();
+			for (k = 0; k < 1000000; ++k)
+				sink += keyhashuc(keys[k & 255], len, 0);
+			t4 = check_nanos();
+			if (t1 - t0 < d[0]) d[0] = t1 - t0;
+			if (t2 - t1 < d[1]) d[1] = t2 - t1;
+			if (t3 - t2 < d[2]) d[2] = t3 - t2;
+			if (t4 - t3 < d[3]) d[3] = t4 - t3;
+		}
+		check_result("", "%3d bytes: keyhash %.0f ns, FNV %.0f ns;  keyhashuc %.0f ns, FNV %.0f ns",
+			     len, d[1] / 1e6, d[0] / 1e6, d[3] / 1e6, d[2] / 1e6);
+	}
+}
+
+
+/*
+ *  Positions: the fixed-column decoders of parse_aprs() against the
+ *  sscanf() decoders they replaced, and the cos_lat of range filters
+ *  computed on demand.
+ */
+
+/* The range check of pbuf_fill_pos() */
+static int check_posbad(const float lat, const float lng)
+{
+	int bad = 0;
+
+	bad |= (lat < -89.9 && -0.0001 <= lng && lng <= 0.0001);
+	bad |= (lat >  89.9 && -0.0001 <= lng && lng <= 0.0001);
+	if (-0.0001 <= lat && lat <= 0.0001) {
+		bad |= ( -0.0001 <= lng && lng <= 0.0001);
+		bad |= ( -90.01  <= lng && lng <= -89.99);
+		bad |= (  89.99  <= lng && lng <=  90.01);
+	}
+	return bad || lat < -90.0 || lat > 90.0 || lng < -180.0 || lng > 180.0;
+}
+
+/* "3210.70N/13132.15E#" the old way */
+static int check_olduncompressed(const char *body, float *lat, float *lng)
+{
+	char posbuf[20];
+	unsigned int lat_deg, lat_min, lat_min_frag, lng_deg, lng_min, lng_min_frag;
+	char lat_hemi, lng_hemi, sym_table, sym_code;
+
+	memcpy(posbuf, body, 19);
+	posbuf[19] = 0;
+	if (posbuf[2] == ' ') posbuf[2] = '3';
+	if (posbuf[3] == ' ') posbuf[3] = '5';
+	if (posbuf[5] == ' ') posbuf[5] = '5';
+	if (posbuf[6] == ' ') posbuf[6] = '5';
+	if (posbuf[12] == ' ') posbuf[12] = '3';
+	if (posbuf[13] == ' ') posbuf[13] = '5';
+	if (posbuf[15] == ' ') posbuf[15] = '5';
+	if (posbuf[16] == ' ') posbuf[16] = '5';
+	if (sscanf(posbuf, "%2u%2u.%2u%c%c%3u%2u.%2u%c%c",
+		   &lat_deg, &lat_min, &lat_min_frag, &lat_hemi, &sym_table,
+		   &lng_deg, &lng_min, &lng_min_frag, &lng_hemi, &sym_code) != 10)
+		return 0;
+	if (strchr("NnSs", lat_hemi) == NULL || strchr("EeWw", lng_hemi) == NULL ||
+	    lat_hemi == 0 || lng_hemi == 0 || lat_deg > 89 || lng_deg > 179)
+		return 0;
+
+	*lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
+	*lng = (float)lng_deg + (float)lng_min / 60.0 + (float)lng_min_frag / 6000.0;
+	if (lat_hemi == 'S' || lat_hemi == 's')
+		*lat = 0.0 - *lat;
+	if (lng_hemi == 'W' || lng_hemi == 'w')
+		*lng = 0.0 - *lng;
+	return !check_posbad(*lat, *lng);
+}
+
+static int check_oldcompressed(const char *body, float *lat, float *lng)
+{
+	int i, lat1, lng1;
+
+	for (i = 1; i <= 8; i++)
+		if (body[i] < 0x21 || body[i] > 0x7b)
+			return 0;
+	lat1 = (((((body[1] - 33) * 91) + body[2] - 33) * 91) + body[3] - 33) * 91 + body[4] - 33;
+	lng1 = (((((body[5] - 33) * 91) + body[6] - 33) * 91) + body[7] - 33) * 91 + body[8] - 33;
+	*lat =   90.0F - ((float)(lat1) / 380926.0F);
+	*lng = -180.0F + ((float)(lng1) / 190463.0F);
+	return !check_posbad(*lat, *lng);
+}
+
+/* Mic-E latitude from the destination callsign, the old way */
+static int check_oldmicelat(const char *dst, float *lat)
+{
+	char dstcall[7], *p;
+	unsigned int lat_deg, lat_min, lat_min_frag;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		if (strchr(i < 3 ? "0123456789ABCDEFGHIJKLPQRSTUVWXYZ"
+				 : "0123456789LPQRSTUVWXYZ", dst[i]) == NULL)
+			return 0;
+	memcpy(dstcall, dst, 6);
+	dstcall[6] = 0;
+	for (p = dstcall; *p; p++) {
+		if (*p >= 'A' && *p <= 'J')
+			*p -= 'A' - '0';
+		else if (*p >= 'P' && *p <= 'Y')
+			*p -= 'P' - '0';
+		else if (*p == 'K' || *p == 'L' || *p == 'Z')
+			*p = '_';
+	}
+	if (dstcall[5] == '_') dstcall[5] = '5';
+	if (dstcall[4] == '_') dstcall[4] = '5';
+	if (dstcall[3] == '_') dstcall[3] = '5';
+	if (dstcall[2] == '_') dstcall[2] = '3';
+	if (dstcall[1] == '_' || dstcall[0] == '_')
+		return 0;
+	if (sscanf(dstcall, "%2u%2u%2u", &lat_deg, &lat_min, &lat_min_frag) != 3)
+		return 0;
+	*lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
+	if (dst[3] <= 0x4c)
+		*lat = 0 - *lat;
+	return *lat >= -90.0 && *lat <= 90.0;
+}
+
+static struct pbuf_t *check_posparse(const char *dst, const char *info, int infolen)
+{
+	char tnc2[100];
+	int addrlen, len;
+	struct pbuf_t *pb;
+
+	addrlen = sprintf(tnc2, "OH2MQK-1>%s,WIDE2-1", dst);
+	tnc2[addrlen] = ':';
+	memcpy(tnc2 + addrlen + 1, info, infolen);
+	len = addrlen + 1 + infolen;
+	pb = pbuf_new(1, 1, addrlen, tnc2, len, 0, tnc2, 0);
+	if (pb != NULL)
+		parse_aprs(pb, NULL);
+	return pb;
+}
+
+static void check_posequal(const char *what, struct pbuf_t *pb, const float lat, const float lng)
+{
+	if (pb->lat != filter_lat2rad(lat) || pb->lng != filter_lon2rad(lng))
+		check_fail("position", "%s '%.*s': %.7f %.7f vs %.7f %.7f", what,
+			   pb->packet_len, pb->data, pb->lat * 180.0 / M_PI,
+			   pb->lng * 180.0 / M_PI, lat, lng);
+	if (pb->cos_lat != COSLAT_UNSET)
+		check_fail("position", "%s '%.*s': cos_lat %f at the parse", what,
+			   pb->packet_len, pb->data, pb->cos_lat);
+	if (filter_coslat(&pb->cos_lat, pb->lat) != cosf(pb->lat) ||
+	    pb->cos_lat != cosf(pb->lat))
+		check_fail("position", "%s '%.*s': cos_lat %f of %f", what,
+			   pb->packet_len, pb->data, pb->cos_lat, pb->lat);
+}
+
+static void check_positions(void)
+{
+	static const char c3[] = "0123456789ABCDEFGHIJKLPQRSTUVWXYZ";
+	static const char c6[] = "0123456789LPQRSTUVWXYZ";
+	char info[40], dst[8];
+	struct pbuf_t *pb;
+	float lat, lng;
+	int i, k, n, ok, deg, min, frag;
+	long accepted[3] = { 0, 0, 0 }, damaged = 0;
+
+	// Every deg, min and frag of both, in all four quarters
+	for (i = 0; i < 180 * 100 * 100; ++i) {
+		deg  = i / 10000;
+		min  = (i / 100) % 100;
+		frag = i % 100;
+		n = sprintf(info, "!%02d%02d.%02d%c%c%03d%02d.%02d%c-",
+			    deg % 90, min, (frag * 7 + deg / 90) % 100, "NSns"[i % 4],
+			    (i & 4) ? '\\' : '/', deg, min, frag, "EWwe"[(i / 3) % 4]);
+		pb = check_posparse("APRS", info, n);
+		ok = check_olduncompressed(info + 1, &lat, &lng);
+		if (pb == NULL || ok != ((pb->flags & F_HASPOS) != 0))
+			check_fail("position", "'%s' accepted %d vs %d", info,
+				   pb ? (pb->flags & F_HASPOS) != 0 : -1, ok);
+		else if (ok)
+			check_posequal("uncompressed", pb, lat, lng);
+		accepted[0] += ok;
+		if (pb != NULL)
+			pbuf_put(pb);
+	}
+
+	// Position ambiguity and damage; the sscanf() skipped blanks and
+	// signs, so what is accepted now must only be a subset of that
+	for (k = 0; k < 300000; ++k) {
+		n = sprintf(info, "!%02d%02d.%02d%c/%03d%02d.%02d%c-",
+			    (int)(check_rnd() % 90), (int)(check_rnd() % 60), (int)(check_rnd() % 100),
+			    "NS"[check_rnd() % 2], (int)(check_rnd() % 180), (int)(check_rnd() % 60),
+			    (int)(check_rnd() % 100), "EW"[check_rnd() % 2]);
+		if (check_rnd() % 4 == 0) {
+			static const int amb[] = { 7, 6, 4, 3 };
+			for (i = check_rnd() % 5; i > 0; --i) {
+				info[amb[i-1]]      = ' ';
+				info[amb[i-1] + 10] = ' ';
+			}
+		}
+		if (check_rnd() % 3 == 0) {
+			for (i = 1 + check_rnd() % 3; i > 0; --i)
+				info[2 + check_rnd() % 18] = 32 + check_rnd() % 95;
+			++damaged;
+		}
+		pb = check_posparse("APRS", info, n);
+		if (pb == NULL)
+			continue;
+		ok = check_olduncompressed(info + 1, &lat, &lng);
+		if (pb->flags & F_HASPOS) {
+			if (!ok)
+				check_fail("position", "'%s' accepted, sscanf() did not", info);
+			else
+				check_posequal("uncompressed", pb, lat, lng);
+		}
+		pbuf_put(pb);
+	}
+
+	// Compressed, some with characters out of base-91
+	for (k = 0; k < 300000; ++k) {
+		info[0] = '!';
+		info[1] = "/\\A"[check_rnd() % 3];
+		for (i = 2; i <= 9; ++i)
+			info[i] = 0x21 + check_rnd() % 91;
+		if (check_rnd() % 5 == 0)
+			info[2 + check_rnd() % 8] = 1 + check_rnd() % 255;
+		memcpy(info + 10, ">abc", 4);
+		pb = check_posparse("APRS", info, 14);
+		if (pb == NULL)
+			continue;
+		ok = check_oldcompressed(info + 1, &lat, &lng);
+		if (ok != ((pb->flags & F_HASPOS) != 0))
+			check_fail("position", "compressed '%.14s' accepted %d vs %d", info,
+				   (pb->flags & F_HASPOS) != 0, ok);
+		else if (ok)
+			check_posequal("compressed", pb, lat, lng);
+		accepted[1] += ok;
+		pbuf_put(pb);
+	}
+
+	// Mic-E latitudes, with ambiguity and bad characters
+	for (k = 0; k < 300000; ++k) {
+		for (i = 0; i < 6; ++i)
+			dst[i] = i < 3 ? c3[check_rnd() % (sizeof(c3)-1)]
+				       : c6[check_rnd() % (sizeof(c6)-1)];
+		if (check_rnd() % 8 == 0)
+			dst[check_rnd() % 6] = "KLZMO_a"[check_rnd() % 7];
+		dst[6] = 0;
+		info[0] = '`';
+		for (i = 1; i <= 8; ++i)
+			info[i] = 0x26 + check_rnd() % 0x3b;
+		info[7] = '>';
+		info[8] = '/';
+		pb = check_posparse(dst, info, 9);
+		if (pb == NULL)
+			continue;
+		ok = check_oldmicelat(dst, &lat);
+		if ((pb->flags & F_HASPOS) && (!ok || pb->lat != filter_lat2rad(lat)))
+			check_fail("position", "Mic-E '%s': %d %.7f vs %d %.7f", dst,
+				   1, pb->lat * 180.0 / M_PI, ok, lat);
+		if (ok && !(pb->flags & F_HASPOS) &&
+		    lat > -89.9 && lat < 89.9 && (lat < -0.0001 || lat > 0.0001))
+			check_fail("position", "Mic-E '%s' rejected", dst);
+		accepted[2] += (pb->flags & F_HASPOS) != 0;
+		pbuf_put(pb);
+	}
+
+	check_result("position", "%ld uncompressed, all deg/min/frag, and 300000 with %ld damaged",
+		     accepted[0], damaged);
+	check_result("", "%ld compressed and %ld Mic-E accepted of 300000 each",
+		     accepted[1], accepted[2]);
+}
+
+
+/*
+ *  aprx_check()  -- run all checks, return the number of failures
+ */
+int aprx_check(void)
+{
+	check_filters();
+	check_refilter();
+	check_pbufs();
+	check_keyhash();
+	check_positions();
+
+	printf("%d failures\n", check_failures);
+	return check_failures;
+}
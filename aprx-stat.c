@@ -48,11 +48,12 @@ void erlang_snmp(void)
 		struct erlangline *E = ErlangLines[i];
 
 		printf("%s", E->name);
-		printf("   %ld %ld   %ld  %ld  %ld  %ld    %d\n",
+		printf("   %ld %ld   %ld  %ld  %ld  %ld    %d  %d\n",
 		       E->SNMP.bytes_rx, E->SNMP.packets_rx,
 		       E->SNMP.bytes_rxdrop, E->SNMP.packets_rxdrop,
 		       E->SNMP.bytes_tx, E->SNMP.packets_tx,
-		       (int) (now.tv_sec - E->last_update));
+		       (int) (now.tv_sec - E->last_update),
+		       E->queue_bytes);
 	}
 }
 
@@ -194,7 +195,7 @@ void erlang_xml(int topmode)
 
 void usage(void)
 {
-	printf("Usage: aprx-stat [-t] [-f arpx-erlang.dat] {-S|-x|-X}\n");
+	printf("Usage: aprx-stat [-t] [-f arpx-erlang.dat] {-S|-x|-X|-L}\n");
 	exit(64);
 }
 
@@ -203,10 +204,11 @@ int main(int argc, char **argv)
 	int opt;
 	int mode_snmp = 0;
 	int mode_xml = 0;
+	int mode_latency = 0;
 
         gettimeofday(&now, NULL);
 
-	while ((opt = getopt(argc, argv, "f:StxX?h")) != -1) {
+	while ((opt = getopt(argc, argv, "f:LStxX?h")) != -1) {
 		switch (opt) {
 		case 'f':
 			erlang_backingstore = optarg;
@@ -214,6 +216,9 @@ int main(int argc, char **argv)
 		case 'S':	/* SNMP */
 			++mode_snmp;
 			break;
+		case 'L':	/* Latency histograms */
+			mode_latency = 1;
+			break;
 		case 'X':
 			mode_xml = 1;
 			break;
@@ -236,6 +241,8 @@ int main(int argc, char **argv)
 
 	if (mode_snmp) {
 		erlang_snmp();
+	} else if (mode_latency) {
+		erlang_latency_print(stdout);
 	} else if (mode_xml == 1) {
 		erlang_xml(0);
 	} else if (mode_xml == 2) {
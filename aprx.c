@@ -62,6 +62,14 @@ static void sig_handler(int sig)
         }
 }
 
+static volatile int rflog_reopen;
+
+static void sig_hup(int sig)
+{
+	signal(sig, sig_hup);
+	rflog_reopen = 1;	// see rflog_flush()
+}
+
 static void sig_child(int sig)
 {
 	int status;
@@ -164,7 +172,6 @@ int main(int argc, char *const argv[])
 	const char *syslog_facility = "NONE";
 	int foreground = 0;
         int millis;
-        int can_clear_timereset;
 
 	/* Init the poll(2) descriptor array */
 	struct aprxpolls app = APRXPOLLS_INIT;
@@ -214,6 +221,7 @@ int main(int argc, char *const argv[])
 
 	interface_init(); // before any interface system and aprsis init !
 	erlang_init(syslog_facility);
+	rflog_init();
 	ttyreader_init();
 #ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
 	netax25_init();
@@ -354,7 +362,7 @@ int main(int argc, char *const argv[])
 
 	signal(SIGTERM, sig_handler);
 	signal(SIGINT,  sig_handler);
-	signal(SIGHUP,  sig_handler);
+	signal(SIGHUP,  sig_hup);	// reopen rflog
 	signal(SIGPIPE, SIG_IGN);
 	signal(SIGCHLD, sig_child);
 
@@ -373,60 +381,33 @@ int main(int argc, char *const argv[])
 #ifndef DISABLE_IGATE
 	igate_start();
 #endif
+	snapshot_start();
+	workers_start();
 
         aprxlog("aprx start - %s",swversion);
 
 	// The main loop
 
-        can_clear_timereset = 0;
-
 	while (!die_now) {
+		int64_t t_loop, t_poll, t_polled;
 
         	timetick(); // pre-poll
+		t_loop = erlang_latency_now();
 
 		aprxpolls_reset(&app);
                 tv_timeradd_millis( &app.next_timeout, &tick, 30000 ); // 30 seconds
 
-		i = ttyreader_prepoll(&app);
-                // if (debug>3)printf("after ttyreader prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+		// Descriptors stay registered at aprxpolls from
+		// their opening to closing, these are for the rest.
 #ifndef DISABLE_IGATE
 		i = aprsis_prepoll(&app);
                 // if (debug>3)printf("after aprsis prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#endif
-		i = beacon_prepoll(&app);
-                // if (debug>3)printf("after beacon prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
-		i = netax25_prepoll(&app);
-                // if (debug>3)printf("after netax25 prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#endif
-#ifdef ENABLE_AGWPE
-		i = agwpe_prepoll(&app);
-                // if (debug>3)printf("after agwpe prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#endif
-		i = erlang_prepoll(&app);
-                // if (debug>3)printf("after erlang prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-		i = telemetry_prepoll(&app);
-                // if (debug>3)printf("after telemetry prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-		i = dupecheck_prepoll(&app);
-                // if (debug>3)printf("after dupecheck prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-		i = digipeater_prepoll(&app);
-                // if (debug>3)printf("after digipeater prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#ifndef DISABLE_IGATE
-		i = historydb_prepoll(&app);
-                // if (debug>3)printf("after historydb prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 		i = dprsgw_prepoll(&app);
                 // if (debug>3)printf("after dprsgw prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 #endif
-
-                // All pre-polls are done
-                if (can_clear_timereset) {
-                  // if (time_reset) {
-                  //   printf("Clearing time_reset.\n");
-                  // }
-                  time_reset = 0;
-                } else {
-                  can_clear_timereset = 1;
-                }
+		// Timers last, this also clears time_reset
+		i = aprxtimer_prepoll(&app);
+                // if (debug>3)printf("after aprxtimer prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 
 		// if (app.next_timeout <= now.tv_sec)
                 // app.next_timeout = now.tv_sec + 1;	// Just to be on safe side..
@@ -435,32 +416,29 @@ int main(int argc, char *const argv[])
                 if (millis < 10)
                   millis = 10;
 
-		i = poll(app.polls, app.pollcount, millis);
+		t_poll = erlang_latency_now();
+		i = aprxpolls_waitevents(millis);
                 timetick(); // post-poll
+		t_polled = erlang_latency_now();
+		erlang_latency_record(LATENCY_POLLWAIT, t_polled - t_poll);
 
+		aprxpolls_dispatch(&app); // descriptor events to their owners
 
-		i = beacon_postpoll(&app);
-		i = ttyreader_postpoll(&app);
-#ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
-		i = netax25_postpoll(&app);
-#endif
-#ifdef ENABLE_AGWPE
-		i = agwpe_postpoll(&app);
-#endif
-#ifndef DISABLE_IGATE
-		i = aprsis_postpoll(&app);
-#endif
-		i = erlang_postpoll(&app);
-		i = telemetry_postpoll(&app);
-		i = dupecheck_postpoll(&app);
-		i = digipeater_postpoll(&app);
+		i = aprxtimer_postpoll(&app);
+		i = rflog_postpoll(&app);
 #ifndef DISABLE_IGATE
-		i = historydb_postpoll(&app);
 		i = dprsgw_postpoll(&app);
 #endif
 
+		erlang_latency_record(LATENCY_MAINLOOP, (t_poll - t_loop) +
+				      (erlang_latency_now() - t_polled));
 	}
+	workers_stop();
+	snapshot_stop();
 	aprxpolls_free(&app); // valgrind..
+	rflog_finish();
+	if (debug)
+		pbuf_stats(stdout);
 
 #ifndef DISABLE_IGATE
 	aprsis_stop();
@@ -636,53 +614,194 @@ va_dcl
 
 /* ---------------------------------------------------------- */
 
-void rfloghex(const char *portname, char direction, int discard, const uint8_t *buf, int buflen)
+/*
+ * RF log writer.
+ *
+ * The rflogfile is kept open, and log lines are collected into
+ * a buffer, which is written out from the main loop when it has
+ * grown past RFLOG_FLUSHSIZE, or RFLOG_FLUSHMILLIS after first
+ * line went in.  SIGHUP, or the file being renamed/removed under
+ * us (logrotate), causes a reopen at next flush.
+ */
+
+#define RFLOG_BUFSIZE      16384
+#define RFLOG_FLUSHSIZE     8192
+#define RFLOG_FLUSHMILLIS   1000
+#define RFLOG_STATSECONDS     10
+
+static struct rflogwriter {
+	int		fd;
+	int		buflen;
+	dev_t		st_dev;	// identity of the opened file
+	ino_t		st_ino;
+	struct aprxtimer flushtimer;	// latest flush of buffered data
+	struct timeval	stattime;	// next check for logrotate
+	char		buf[RFLOG_BUFSIZE];
+} rflogwr = { -1, 0 };
+
+static void rflog_close(void)
 {
+	if (rflogwr.fd >= 0)
+		close(rflogwr.fd);
+	rflogwr.fd = -1;
 }
 
-void rflog(const char *portname, char direction, int discard, const char *tnc2buf, int tnc2len)
+static int rflog_open(void)
 {
-	if (rflogfile) {
-#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-#endif
+	struct stat st;
 
-		FILE *fp = NULL;
-		const char *p;
-		if (strcmp("-",rflogfile)==0) {
-			if (debug < 2) return;
-			fp = stdout;
-		} else {
-			fp = fopen(rflogfile, "a");
+	rflogwr.fd = open(rflogfile, O_WRONLY|O_APPEND|O_CREAT, 0666);
+	if (rflogwr.fd < 0) {
+		if (debug)
+			printf("rflog: open of '%s' failed: %s\n", rflogfile, strerror(errno));
+		return -1;
+	}
+	fcntl(rflogwr.fd, F_SETFD, FD_CLOEXEC);
+	if (fstat(rflogwr.fd, &st) == 0) {
+		rflogwr.st_dev = st.st_dev;
+		rflogwr.st_ino = st.st_ino;
+	}
+	tv_timeradd_seconds(&rflogwr.stattime, &tick, RFLOG_STATSECONDS);
+	return 0;
+}
+
+/* Has the file been rotated away from under the open fd ? */
+static int rflog_rotated(void)
+{
+	struct stat st;
+
+	if (stat(rflogfile, &st) < 0)
+		return 1;
+	return (st.st_dev != rflogwr.st_dev || st.st_ino != rflogwr.st_ino);
+}
+
+static void rflog_flush(void)
+{
+	int i, len;
+
+	if (rflog_reopen) {
+		rflog_reopen = 0;
+		rflog_close();
+	}
+	if (rflogwr.fd >= 0 && tv_timercmp(&rflogwr.stattime, &tick) <= 0) {
+		if (rflog_rotated())
+			rflog_close();
+		else
+			tv_timeradd_seconds(&rflogwr.stattime, &tick, RFLOG_STATSECONDS);
+	}
+
+	if (rflogwr.buflen == 0)
+		return;
+
+	if (rflogwr.fd < 0 && rflog_open() < 0) {
+		rflogwr.buflen = 0; // Can not write, discard
+		return;
+	}
+
+	aprxtimer_disarm(&rflogwr.flushtimer);
+
+	for (i = 0; i < rflogwr.buflen; i += len) {
+		len = write(rflogwr.fd, rflogwr.buf + i, rflogwr.buflen - i);
+		if (len < 0 && errno == EINTR) {
+			len = 0;
+			continue;
+		}
+		if (len <= 0) {
+			if (debug)
+				printf("rflog: write to '%s' failed: %s\n", rflogfile, strerror(errno));
+			rflog_close(); // try reopening at next flush
+			break;
 		}
+	}
+	rflogwr.buflen = 0;
+}
 
-		if (fp) {
-			char timebuf[60];
-			printtime(timebuf, sizeof(timebuf));
+static void rflog_flush_expired(struct aprxtimer *t, void *arg)
+{
+	rflog_flush();
+}
 
-			(void)fprintf(fp, "%s %-9s ", timebuf, portname);
-			(void)fprintf(fp, "%c ", direction);
+void rflog_init(void)
+{
+	// No reset function, time jump flushes right away
+	aprxtimer_init(&rflogwr.flushtimer, "rflog-flush",
+		       rflog_flush_expired, NULL, NULL);
+}
 
-			if (discard < 0) {
-				fprintf(fp, "*");
-			}
-			if (discard > 0) {
-				fprintf(fp, "#");
-			}
-			//replace non printing TNC2 characters in log print
-			for(p=tnc2buf;p<tnc2buf+tnc2len;p++){
-				if(*p<0x20 || *p>0x7e)
-					fprintf(fp,"<0x%02x>",*p);
-				else
-					fputc(*p,fp);
-			}
-			fputc('\n',fp);
+int rflog_postpoll(struct aprxpolls *app)
+{
+	// The RFLOG_FLUSHMILLIS deadline is on the timer wheel
+	if (rflog_reopen ||
+	    rflogwr.buflen >= RFLOG_FLUSHSIZE)
+		rflog_flush();
+	return 0;
+}
+
+void rflog_finish(void)
+{
+	rflog_flush();
+	rflog_close();
+}
 
-			if (fp != stdout)
-				fclose(fp);
+void rfloghex(const char *portname, char direction, int discard, const uint8_t *buf, int buflen)
+{
+}
+
+void rflog(const char *portname, char direction, int discard, const char *tnc2buf, int tnc2len)
+{
+	char timebuf[60];
+	char *b;
+	int i;
+
+	if (!rflogfile)
+		return;
+
+	if (strcmp("-",rflogfile)==0) {
+		const char *p;
+
+		if (debug < 2) return;
+
+		printtime(timebuf, sizeof(timebuf));
+		printf("%s %-9s %c %s", timebuf, portname, direction,
+		       discard < 0 ? "*" : discard > 0 ? "#" : "");
+		//replace non printing TNC2 characters in log print
+		for (p = tnc2buf; p < tnc2buf+tnc2len; p++) {
+			if (*p < 0x20 || *p > 0x7e)
+				printf("<0x%02x>", (uint8_t)*p);
+			else
+				putchar(*p);
 		}
-#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-#endif
+		putchar('\n');
+		return;
 	}
+
+	// Room for the header, and then some
+	if (rflogwr.buflen > RFLOG_BUFSIZE - 128)
+		rflog_flush();
+
+	printtime(timebuf, sizeof(timebuf));
+	b = rflogwr.buf + rflogwr.buflen;
+	b += sprintf(b, "%s %-9.40s %c %s", timebuf, portname, direction,
+		     discard < 0 ? "*" : discard > 0 ? "#" : "");
+
+	//replace non printing TNC2 characters in log print
+	for (i = 0; i < tnc2len; ++i) {
+		const uint8_t c = tnc2buf[i];
+		if (b > rflogwr.buf + RFLOG_BUFSIZE - 8) {
+			// Very long line, write out what we have so far
+			rflogwr.buflen = b - rflogwr.buf;
+			rflog_flush();
+			b = rflogwr.buf;
+		}
+		if (c < 0x20 || c > 0x7e)
+			b += sprintf(b, "<0x%02x>", c);
+		else
+			*b++ = c;
+	}
+	*b++ = '\n';
+	rflogwr.buflen = b - rflogwr.buf;
+
+	// Buffer went non-empty, here or after a flush of a long line
+	if (!aprxtimer_armed(&rflogwr.flushtimer))
+		aprxtimer_arm_millis(&rflogwr.flushtimer, RFLOG_FLUSHMILLIS);
 }
@@ -137,19 +137,48 @@ struct configfile {
 };
 
 /* aprxpolls.c */
+#if defined(HAVE_SYS_EPOLL_H) && !defined(DISABLE_EPOLL)
+#define APRXPOLLS_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
 struct aprxpolls {
 	struct pollfd *polls;
 	int pollcount;
 	int pollsize;
 	struct timeval next_timeout;
+	int *ready;		// polls[] indexes with revents after wait
+	int readycount;
+};
+#define APRXPOLLS_INIT { NULL, 0, 0, {0,0}, NULL, 0 }
+
+/* Owner of a registered descriptor, called for its events at dispatch */
+typedef void (*aprxpolls_handler)(struct aprxpolls *app, struct pollfd *pfd, void *arg);
+
+/* Main loop descriptor registration, kept by its owner */
+struct aprxpollfd {
+	int	fd;
+	short	events;
+	short	revents;
+	int8_t	registered;
+	int8_t	always;		// not pollable by epoll, a regular file
+	int	idx;		// at registration table
+	aprxpolls_handler handler;
+	void	*arg;
 };
-#define APRXPOLLS_INIT { NULL, 0, 0, {0,0} }
 
 extern int  aprxpolls_millis(struct aprxpolls *app);
 extern void aprxpolls_reset(struct aprxpolls *app);
 extern struct pollfd *aprxpolls_new(struct aprxpolls *app);
+extern int  aprxpolls_wait(struct aprxpolls *app, int millis);
 extern void aprxpolls_free(struct aprxpolls *app);
 
+extern void aprxpolls_add(struct aprxpollfd *pf, int fd, short events, aprxpolls_handler handler, void *arg);
+extern void aprxpolls_events(struct aprxpollfd *pf, short events);
+extern void aprxpolls_remove(struct aprxpollfd *pf);
+extern int  aprxpolls_waitevents(int millis);
+extern void aprxpolls_dispatch(struct aprxpolls *app);
+
 /* aprx.c */
 #ifndef DISABLE_IGATE
 extern const char *aprsis_login;
@@ -193,6 +222,9 @@ extern void aprxlog(va_list);
 #endif
 extern void rflog(const char *portname, char direction, int discard, const char *tnc2buf, int tnc2len);
 extern void rfloghex(const char *portname, char direction, int discard, const uint8_t *buf, int buflen);
+extern void rflog_init(void);
+extern int  rflog_postpoll(struct aprxpolls *app);
+extern void rflog_finish(void);
 
 /* netresolver.c */
 extern void netresolv_start(void); // separate thread working on this!
@@ -208,6 +240,34 @@ struct netresolver {
 
 extern struct netresolver *netresolv_add(const char *hostname, const char *port);
 
+/* rdbuf.c */
+struct rdbuf {
+	uint8_t *data;
+	int	 size;
+	int	 cursor;	/* next byte to consume */
+	int	 len;		/* end of data read in */
+};
+
+extern void rdbuf_init(struct rdbuf *rb, uint8_t *data, const int size);
+extern void rdbuf_reset(struct rdbuf *rb);
+extern int  rdbuf_makespace(struct rdbuf *rb);
+extern int  rdbuf_read(struct rdbuf *rb, const int fd);
+extern const uint8_t *rdbuf_view(const struct rdbuf *rb, int *lenp);
+extern void rdbuf_consume(struct rdbuf *rb, const int len);
+extern int  rdbuf_getc(struct rdbuf *rb);
+
+/* timerwheel.c, the timers are embedded in the structs below */
+struct aprxtimer {
+	struct aprxtimer  *next;
+	struct aprxtimer **prevp;	// NULL when not armed
+	struct timeval	   expires;
+	const char	  *name;
+	void		 (*callback)(struct aprxtimer *, void *);
+	void		 (*resetfunc)(struct aprxtimer *, void *); // on time_reset
+	void		  *arg;
+};
+#define aprxtimer_armed(t) ((t)->prevp != NULL)
+
 /* ttyreader.c */
 typedef enum {
 	LINETYPE_KISS,		/* all KISS variants without CRC on line */
@@ -229,8 +289,10 @@ typedef enum {
 
 struct serialport {
 	int fd;			/* UNIX fd of the port                  */
+	struct aprxpollfd pollfd; /* .. registered for the main loop     */
 
-	struct timeval wait_until;
+	struct aprxtimer timer;	/* re-open when closed, read watchdog
+				   when open                            */
 	time_t last_read_something;	/* Used by serial port functionality
 					   watchdog */
 	int read_timeout;	/* seconds                              */
@@ -255,6 +317,7 @@ struct serialport {
 	const char *ttyname;	/* "/dev/ttyUSB1234-bar22-xyz7" --
 				   Linux TTY-names can be long..        */
 	const char *ttycallsign[16]; /* callsign                             */
+	int	    ttyerlang[16];   /* erlang_handle() of ttycallsign[], 0: none */
 	const void *netax25[16];
 
 	char *initstring[16];	/* optional init-string to be sent to
@@ -265,10 +328,8 @@ struct serialport {
 	struct aprx_interface	*interface[16];
 
 
-	uint8_t rdbuf[2000];	/* buffering area for raw stream read */
-	int rdlen, rdcursor;	/* rdlen = last byte in buffer,
-				   rdcursor = next to read.
-				   When rdlen == 0, buffer is empty.    */
+	struct rdbuf rd;	/* raw stream read, over rdstore[]      */
+	uint8_t rdstore[2000];
 
 	time_t  rdline_time;	/* last time something was added there  */
 	uint8_t rdline[2000];	/* processed into lines/records         */
@@ -283,8 +344,6 @@ struct serialport {
 };
 
 
-extern int  ttyreader_prepoll(struct aprxpolls *);
-extern int  ttyreader_postpoll(struct aprxpolls *);
 extern void ttyreader_init(void);
 // Old style init: ttyreader_serialcfg()
 extern const char *ttyreader_serialcfg(struct configfile *cf, char *param1, char *str);
@@ -296,6 +355,7 @@ extern int  ttyreader_getc(struct serialport *tty);
 // extern void               ttyreader_setkissparams(struct serialport *tty, const int tncid, const char *callsign, const int timeout);
 extern int  ttyreader_parse_ttyparams(struct configfile *cf, struct serialport *tty, char *str);
 extern void ttyreader_linewrite(struct serialport *S);
+extern void ttyreader_pollout(struct serialport *S);
 extern int  ttyreader_parse_nullparams(struct configfile *cf, struct serialport *tty, char *str);
 
 extern void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr);
@@ -308,6 +368,17 @@ extern int  tv_timerdelta_millis(struct timeval * const _now, struct timeval * c
 extern int  tv_timercmp(struct timeval * const a, struct timeval * const b);
 extern int  timecmp(time_t a, time_t b);
 
+/* timerwheel.c */
+extern void aprxtimer_init(struct aprxtimer *t, const char *name,
+			   void (*callback)(struct aprxtimer *, void *),
+			   void (*resetfunc)(struct aprxtimer *, void *),
+			   void *arg);
+extern void aprxtimer_arm(struct aprxtimer *t, const struct timeval *expires);
+extern void aprxtimer_arm_millis(struct aprxtimer *t, const int millis);
+extern void aprxtimer_disarm(struct aprxtimer *t);
+extern int  aprxtimer_prepoll(struct aprxpolls *app);
+extern int  aprxtimer_postpoll(struct aprxpolls *app);
+
 
 /* ax25.c */
 extern int  ax25_to_tnc2_fmtaddress(char *dest, const uint8_t *src,
@@ -322,6 +393,12 @@ extern int  ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 			       int *is_aprs, int *ui_pid);
 extern int  parse_ax25addr(uint8_t ax25[7], const char *text,
 			   int ssidflags);
+extern void ax25_decode_addr(struct ax25_addr *a, const uint8_t *ax25);
+extern int  ax25_decode_addrs(struct ax25_addr *aa, const uint8_t *ax25,
+			      const int ax25addrlen);
+extern int  ax25_addr_format(char *dest, const struct ax25_addr *a,
+			     const int markflag);
+extern int  ax25_addr_is(const struct ax25_addr *a, const char *callsign);
 
 
 #ifndef DISABLE_IGATE
@@ -336,7 +413,6 @@ extern int  aprsis_queue(const char *addr, int addrlen,
 			 const char qtype, const char *gwcall,
 			 const char *text, int textlen);
 extern int  aprsis_prepoll(struct aprxpolls *app);
-extern int  aprsis_postpoll(struct aprxpolls *app);
 extern void aprsis_init(void);
 extern void aprsis_start(void);
 extern void aprsis_stop(void);
@@ -345,8 +421,6 @@ extern char * const aprsis_loginid;
 #endif
 
 /* beacon.c */
-extern int  beacon_prepoll(struct aprxpolls *app);
-extern int  beacon_postpoll(struct aprxpolls *app);
 extern int  beacon_config(struct configfile *cf);
 extern void beacon_childexit(int pid);
 
@@ -374,8 +448,6 @@ extern int  dprsgw_postpoll(struct aprxpolls *app);
 /* erlang.c */
 extern void erlang_init(const char *syslog_facility_name);
 extern void erlang_start(int do_create);
-extern int  erlang_prepoll(struct aprxpolls *app);
-extern int  erlang_postpoll(struct aprxpolls *app);
 
 /* igate.c */
 #ifndef DISABLE_IGATE
@@ -391,11 +463,10 @@ extern const char *tnc2_verify_callsign_format(const char *t, int starok, int st
 extern void        netax25_init(void);
 extern void        netax25_start(void);
 extern const void* netax25_open(const char *ifcallsign);
-extern int         netax25_prepoll(struct aprxpolls *);
-extern int         netax25_postpoll(struct aprxpolls *);
 extern void      * netax25_addrxport(const char *callsign, const struct aprx_interface *aif);
 extern void        netax25_sendax25(const void *nax25, const void *ax25, int ax25len);
 extern void        netax25_sendto(const void *nax25, const uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+extern int         netax25_rxring_kb;
 #endif
 
 /* telemetry.c */
@@ -403,8 +474,6 @@ extern void        netax25_sendto(const void *nax25, const uint8_t *axaddr, cons
 #define USE_ONE_MINUTE_DATA 0
 
 extern void telemetry_start(void);
-extern int  telemetry_prepoll(struct aprxpolls *app);
-extern int  telemetry_postpoll(struct aprxpolls *app);
 extern int  telemetry_config(struct configfile *cf);
 
 
@@ -415,7 +484,10 @@ typedef enum {
 } ErlangMode;
 
 extern void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets);
+extern int  erlang_handle(const char *portname);
+extern void erlang_add_handle(int handle, ErlangMode erl, int bytes, int packets);
 extern void erlang_set(const char *portname, int bytes_per_minute);
+extern void erlang_queue(int handle, int bytes);
 
 extern int erlangsyslog;
 extern int erlanglog1min;
@@ -439,6 +511,7 @@ struct erlangline {
 	time_t last_update;
 
 	int erlang_capa;	/* bytes, 1 minute                      */
+	int queue_bytes;	/* send queue depth now, bytes          */
 
 	struct erlang_rxtxbytepkt SNMP;	/* SNMPish counters             */
 
@@ -487,6 +560,34 @@ struct erlangline {
 #endif
 };
 
+#ifdef ERLANGSTORAGE
+/* Latency histograms of processing stages, in nanoseconds.
+   Buckets are logarithmic with 4 steps per power of two, so a
+   reported value is within 25% of the real one, up to 68 seconds. */
+
+#define ERLANG_LATENCY_VERSION  1
+#define ERLANG_LATENCY_BUCKETS  144
+
+typedef enum {
+	LATENCY_PARSE,		/* received frame to parsed pbuf        */
+	LATENCY_FILTER,		/* filter_process()                     */
+	LATENCY_DUPECHECK,	/* dupecheck_pbuf()                     */
+	LATENCY_DIGIPEAT,	/* digipeater_receive_backend()         */
+	LATENCY_APRSISQUEUE,	/* aprsis_queue()                       */
+	LATENCY_MAINLOOP,	/* main loop work, poll excluded        */
+	LATENCY_POLLWAIT,	/* main loop sleeping in poll()         */
+	LATENCY_COUNT
+} LatencyStage;
+
+struct erlang_latency {
+	char	 name[16];
+	uint64_t count;
+	uint64_t sum;		/* nanoseconds */
+	uint64_t max;
+	uint32_t buckets[ERLANG_LATENCY_BUCKETS];
+};
+#endif
+
 struct erlanghead {
 	char title[32];
 	int version;		/* format version                       */
@@ -498,6 +599,12 @@ struct erlanghead {
 
 	char mycall[16];
 
+#ifdef ERLANGSTORAGE
+	int latency_version;	/* ERLANG_LATENCY_VERSION, or 0         */
+	int latency_count;	/* histograms in use                    */
+	struct erlang_latency latency[LATENCY_COUNT];
+#endif
+
 	double align_filler;
 };
 
@@ -507,12 +614,24 @@ extern struct erlanghead *ErlangHead;
 extern struct erlangline **ErlangLines;
 extern int ErlangLinesCount;
 
+#ifdef ERLANGSTORAGE
+extern int64_t erlang_latency_now(void);
+extern void    erlang_latency_record(LatencyStage stage, int64_t nanos);
+extern void    erlang_latency_add(LatencyStage stage, int64_t t0);
+extern void    erlang_latency_print(FILE *fp);
+#else
+#define erlang_latency_now()              0
+#define erlang_latency_record(stage, ns)  ((void)(ns))
+#define erlang_latency_add(stage, t0)     ((void)(t0))
+#endif
+
 
 /* dupecheck.c */
 
 
 typedef struct dupe_record_t {
 	struct dupe_record_t *next;
+	struct dupe_record_t *wheelnext; // Expiry wheel slot chain
 	uint32_t hash;
 	time_t	 t;	// creation time
 	time_t	 t_exp;	// expiration time
@@ -537,11 +656,25 @@ typedef struct dupe_record_t {
 	char	 packetbuf[200]; /* 99.9+ % of time this is enough.. */
 } dupe_record_t;
 
-#define DUPECHECK_DB_SIZE 16     /* Hash index table size - per dupechecker */
+#define DUPECHECK_DB_SIZE_MIN 16 /* Initial hash index table size - per dupechecker,
+				   grows in powers of two with the load */
+#define DUPECHECK_WHEEL_SIZE  64 /* Expiry time wheel slots, one second each */
 
 typedef struct dupecheck_t {
 	int	storetime;
-	struct dupe_record_t *dupecheck_db[DUPECHECK_DB_SIZE]; /* Hash index table */
+	int	hashsize;	/* Hash index table size, power of two */
+	int	count;		/* Records in hash index table */
+	struct dupe_record_t **dupecheck_db; /* Hash index table */
+	struct dupe_record_t  *wheel[DUPECHECK_WHEEL_SIZE]; /* by t_exp second */
+	time_t	wheel_time;	/* Wheel has been expired up to this second */
+
+	// monitor counters and gauges
+	long	dupecheck_lookups;
+	long	dupecheck_probes;   /* chain records visited on lookups */
+	int	dupecheck_maxprobe; /* longest chain visited on a lookup */
+	long	dupecheck_inserts;
+	long	dupecheck_expired;
+	long	dupecheck_resizes;
 } dupecheck_t;
 
 extern void           dupecheck_init(void); /* Inits the dupechecker subsystem */
@@ -550,8 +683,8 @@ extern dupe_record_t *dupecheck_get(dupe_record_t *dp); // increment refcount
 extern void           dupecheck_put(dupe_record_t *dp); // decrement refcount
 extern dupe_record_t *dupecheck_aprs(dupecheck_t *dp, const char *addr, const int alen, const char *data, const int dlen);     /* aprs checker */
 extern dupe_record_t *dupecheck_pbuf(dupecheck_t *dp, struct pbuf_t *pb, const int viscous_delay); /* pbuf checker */
-extern int            dupecheck_prepoll(struct aprxpolls *app);
-extern int            dupecheck_postpoll(struct aprxpolls *app);
+extern dupe_record_t *dupecheck_restore(dupecheck_t *dp, const char *addr, const int addrlen, const char *data, const int datalen, const time_t t); /* snapshot reload */
+extern void           dupecheck_dump_stats(const dupecheck_t *dp, FILE *fp);
 
 
 /* crc.c */
@@ -601,6 +734,25 @@ struct tracewide {
 	int   *keylens;
 };
 
+/* A regex-filter pattern, and what was learned of it at config time */
+struct digi_repattern {
+	regex_t	*re;		// NULL when the pattern is a plain literal
+	char	*literal;	// every match contains this, or NULL
+	int	 literallen;
+	int8_t	 anchor_start;	// plain literal: '^' in front of it
+	int8_t	 anchor_end;	// plain literal: '$' after it
+	int16_t	 nextpat;	// next in firstpat[] chain, index+1, 0 ends
+};
+
+/* regex-filter patterns of one field (source/destination/via/data) */
+struct digi_refilter {
+	int	count;
+	struct digi_repattern *pats;
+	int	noliteralcount;	// patterns that have no literal part
+	int16_t	*noliteral;	// .. their indexes
+	int16_t	firstpat[256];	// patterns by first literal byte, index+1
+};
+
 struct digipeater_source {
 	struct digipeater     *parent;
 	digi_relaytype	       src_relaytype;
@@ -618,6 +770,7 @@ struct digipeater_source {
 	float		       tokenbucket;
 	float		       tbf_increment;
 	float		       tbf_limit;
+	time_t		       tbf_filltime; // tokenbucket was filled last
 
 	// Viscous queue is at <source>, but used dupechecker
 	// is <digipeater> -wide, common to all sources in that
@@ -626,18 +779,12 @@ struct digipeater_source {
 	int	               viscous_queue_size;
 	int	               viscous_queue_space;
 	struct dupe_record_t **viscous_queue;
+	struct aprxtimer       viscous_timer; // head of the queue is due
 
-	int sourceregscount;
-	regex_t **sourceregs;
-
-	int destinationregscount;
-	regex_t **destinationregs;
-
-	int viaregscount;
-	regex_t **viaregs;
-
-	int dataregscount;
-	regex_t **dataregs;
+	struct digi_refilter sourceregs;
+	struct digi_refilter destinationregs;
+	struct digi_refilter viaregs;
+	struct digi_refilter dataregs;
 };
 
 struct digipeater {
@@ -645,6 +792,7 @@ struct digipeater {
 	float		       tokenbucket;  // Per transmitter TokenBucket filter
 	float		       tbf_increment;
 	float		       tbf_limit;
+	time_t		       tbf_filltime; // tokenbucket was filled last
 	float		       src_tbf_increment; // Source call specific TokenBucket rules
         float                  src_tbf_limit;
 
@@ -660,13 +808,14 @@ struct digipeater {
 	struct digipeater_source **sources;
 };
 
-extern int  digipeater_prepoll(struct aprxpolls *app);
-extern int  digipeater_postpoll(struct aprxpolls *app);
 extern int  digipeater_config(struct configfile *cf);
 extern void digipeater_receive(struct digipeater_source *src, struct pbuf_t *pb);
 extern int  digipeater_receive_filter(struct digipeater_source *src, struct pbuf_t *pb);
 extern dupecheck_t *digipeater_find_dupecheck(const struct aprx_interface *aif);
 extern struct digipeater* digipeater_find_by_iface(const struct aprx_interface *aif);
+extern struct digipeater* digipeater_get(const int index);
+extern void digi_refilter_add(struct digi_refilter *rf, regex_t *rep, const char *pattern);
+extern int  digi_refilter_match(const struct digi_refilter *rf, const char *field);
 
 /* interface.c */
 
@@ -711,6 +860,8 @@ struct aprx_interface {
 
 	int	                   digisourcecount;
 	struct digipeater_source **digisources;
+
+	int         erlang_handle; // erlang_handle() of callsign, 0: none
 };
 
 extern struct aprx_interface aprsis_interface;
@@ -727,21 +878,54 @@ extern int interface_is_beaconable( const struct aprx_interface *iface );
 extern int interface_is_telemetrable(const struct aprx_interface *iface );
 
 extern void interface_receive_ax25( const struct aprx_interface *aif, const char *ifaddress, const int is_aprs, const int ui_pid, const uint8_t *axbuf, const int axaddrlen, const int axlen, const char *tnc2buf, const int tnc2addrlen, const int tnc2len);
+extern struct pbuf_t *interface_parse_ax25(const struct aprx_interface *aif, const int is_aprs, const int ui_pid, const uint8_t *axbuf, const int axaddrlen, const int axlen, const char *tnc2buf, const int tnc2addrlen, const int tnc2len);
+extern void interface_receive_pbuf(const struct aprx_interface *aif, struct pbuf_t *pb);
 extern void interface_transmit_ax25(const struct aprx_interface *aif, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
 extern void interface_receive_3rdparty(const struct aprx_interface *aif, char **heads, const int headscount,  const char *gwtype, const char *tnc2data, const int tnc2datalen);
 extern int  interface_transmit_beacon(const struct aprx_interface *aif, const char *src, const char *dest, const char *via, const char *tncbuf, const int tnclen);
 extern int process_message_to_myself(const struct aprx_interface*const srcif, const struct pbuf_t*const pb);
 
 
+/* workers.c */
+extern int  parse_workers;
+extern int  workers_submit(const struct aprx_interface *aif, const char *portname, const int tncid, const int is_aprs, const int ui_pid, const uint8_t *frame, const int frameaddrlen, const int framelen, const char *tnc2buf, const int tnc2addrlen, const int tnc2len);
+extern void workers_flush(void);
+extern void workers_start(void);
+extern void workers_stop(void);
+
+/* snapshot.c */
+extern const char *snapshotfile;
+extern void snapshot_start(void);
+extern void snapshot_stop(void);
+
 /* pbuf.c */
+#define PBUF_CLASSES 4
+struct pbuf_class {
+	const char  *name;
+	int          datasize;	// room after struct pbuf_t
+	int          bunch;	// cells to allocate at a time
+	cellarena_t *cells;
+	long         inuse;	// occupancy now
+	long         highwater;	// max of inuse
+	long         allocs;
+	long         fallbacks;	// arena was full
+};
+extern struct pbuf_class pbuf_classes[PBUF_CLASSES];
+
+extern int            pbuf_locking;
+extern int            pbuf_firstclass;
 extern void           pbuf_init(void);
+extern void           pbuf_stats(FILE *fp);
 extern struct pbuf_t *pbuf_get(struct pbuf_t *pb);
 extern void           pbuf_put(struct pbuf_t *pb);
+extern const struct ax25_addr *pbuf_ax25addrs(struct pbuf_t *pb, int *countp);
 extern struct pbuf_t *pbuf_new(const int is_aprs, const int digi_like_aprs, const int tnc2addrlen, const char *tnc2buf, const int tnc2len, const int ax25addrlen, const void *ax25buf, const int ax25len );
 
 
 /* parse_aprs.c */
 extern int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb);
+extern void parse_aprs_recipient_position(struct pbuf_t*const pb, historydb_t*const historydb);
+extern struct pbuf_t *parse_aprs_recipient_pbuf(struct pbuf_t*const pb, historydb_t*const historydb);
 
 struct aprs_message_t {
         const char *body;          /* message body */
@@ -761,6 +945,7 @@ struct filter_t;  // Forward declarator
 struct client_t;  // Forward declarator
 struct worker_t;  // Forward declarator
 
+extern int  filter_compile;
 extern void filter_init(void);
 extern int  filter_parse(struct filter_t **ffp, const char *filt);
 extern void filter_free(struct filter_t *c);
@@ -771,14 +956,16 @@ extern void filter_postprocess_dupefilter(struct pbuf_t *pb, historydb_t *histor
 
 extern float filter_lat2rad(float lat);
 extern float filter_lon2rad(float lon);
+extern float filter_coslat(float *coslat, const float lat);
+
+/* aprx-check.c -- self checks of aprx-bench */
+extern int  aprx_check(void);
 
 #ifdef ENABLE_AGWPE
 /* agwpesocket.c */
 extern void *agwpe_addport(const char *hostname, const char *hostport, const char *agwpeport, const struct aprx_interface *interface);
 extern void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
 
-extern int  agwpe_prepoll(struct aprxpolls *);
-extern int  agwpe_postpoll(struct aprxpolls *);
 extern void agwpe_init(void);
 extern void agwpe_start(void);
 #endif
@@ -45,7 +45,265 @@ struct pollfd *aprxpolls_new(struct aprxpolls *app)
 	return p;
 }
 
+/*
+ * aprxpolls_wait()  -- poll(2) on the collected descriptors, and
+ *                      list the ones with events at  app->ready[]
+ *
+ * This is for loops that collect their few descriptors anew on
+ * every round, like the APRS-IS communicator.
+ * Return value is like that of poll(2).
+ */
+
+int aprxpolls_wait(struct aprxpolls *app, int millis)
+{
+	int i, rc;
+
+	rc = poll(app->polls, app->pollcount, millis);
+
+	if (app->pollsize > 0)
+		app->ready = realloc(app->ready, sizeof(int) * app->pollsize);
+	app->readycount = 0;
+	if (rc > 0) {
+		for (i = 0; i < app->pollcount; ++i) {
+			if (app->polls[i].revents)
+				app->ready[app->readycount++] = i;
+		}
+	}
+	return rc;
+}
+
 void aprxpolls_free(struct aprxpolls *app) {
 	free(app->polls);
 	app->polls = NULL;
+	free(app->ready);
+	app->ready = NULL;
+}
+
+
+/*
+ * Descriptors of the main loop stay registered between rounds.
+ *
+ * Their owner adds one when it has opened it, tells when it wants
+ * POLLOUT too (output is pending), and removes it before closing.
+ * With epoll(7) the kernel keeps the set, and a wakeup costs only
+ * the ready descriptors.  Without it, the set is kept as a pollfd
+ * array for poll(2), and that is rebuilt only when registrations
+ * change.
+ *
+ * All of this is for the main thread only.
+ */
+
+static struct aprxpollfd **aprxpolls_regs;	// registered, at their ->idx
+static int aprxpolls_regcount;
+static int aprxpolls_regsize;
+
+static struct aprxpollfd **aprxpolls_pending;	// ready, not yet dispatched
+static int aprxpolls_pendingcount;
+
+static struct pollfd *aprxpolls_regpolls;	// poll(2) view of the set
+static int aprxpolls_regdirty;
+
+#ifdef APRXPOLLS_EPOLL
+static int aprxpolls_epollfd = -1;	// -2: epoll not usable, poll(2) it is
+static int aprxpolls_alwayscount;	// regular files, always ready
+static struct epoll_event *aprxpolls_epollevents;
+
+static int aprxpolls_epollctl(struct aprxpollfd *pf, int op)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	// POLL* and EPOLL* bit values are same for these
+	ev.events   = (pf->events & (POLLIN | POLLPRI | POLLOUT)) | EPOLLERR;
+	ev.data.ptr = pf;
+	return epoll_ctl(aprxpolls_epollfd, op, pf->fd, &ev);
+}
+
+/* Give up on epoll(7), the whole set goes to poll(2) */
+static void aprxpolls_epolloff(const char *why)
+{
+	if (debug)
+		printf("aprxpolls: %s failed: %s, using poll()\n", why, strerror(errno));
+	if (aprxpolls_epollfd >= 0)
+		close(aprxpolls_epollfd);
+	aprxpolls_epollfd = -2;
+}
+#endif
+
+void aprxpolls_add(struct aprxpollfd *pf, int fd, short events,
+		   aprxpolls_handler handler, void *arg)
+{
+	aprxpolls_remove(pf);
+
+	if (aprxpolls_regcount >= aprxpolls_regsize) {
+		aprxpolls_regsize += 8;
+		aprxpolls_regs = realloc(aprxpolls_regs,
+					 sizeof(void*) * aprxpolls_regsize);
+		aprxpolls_pending = realloc(aprxpolls_pending,
+					    sizeof(void*) * aprxpolls_regsize);
+	}
+	pf->fd         = fd;
+	pf->events     = events;
+	pf->revents    = 0;
+	pf->handler    = handler;
+	pf->arg        = arg;
+	pf->always     = 0;
+	pf->idx        = aprxpolls_regcount;
+	pf->registered = 1;
+	aprxpolls_regs[aprxpolls_regcount++] = pf;
+	aprxpolls_regdirty = 1;
+
+#ifdef APRXPOLLS_EPOLL
+	if (aprxpolls_epollfd == -1) {
+		aprxpolls_epollfd = epoll_create1(EPOLL_CLOEXEC);
+		if (aprxpolls_epollfd < 0) {
+			aprxpolls_epolloff("epoll_create1()");
+			return;
+		}
+	}
+	if (aprxpolls_epollfd < 0)
+		return;
+	if (aprxpolls_epollctl(pf, EPOLL_CTL_ADD) < 0) {
+		if (errno == EPERM) {
+			// Regular file, always ready in poll() terms
+			pf->always = 1;
+			++aprxpolls_alwayscount;
+			return;
+		}
+		aprxpolls_epolloff("epoll_ctl(ADD)");
+	}
+#endif
+}
+
+void aprxpolls_events(struct aprxpollfd *pf, short events)
+{
+	if (!pf->registered || pf->events == events)
+		return;
+	pf->events = events;
+	if (!aprxpolls_regdirty)
+		aprxpolls_regpolls[pf->idx].events = events;
+
+#ifdef APRXPOLLS_EPOLL
+	if (aprxpolls_epollfd >= 0 && !pf->always &&
+	    aprxpolls_epollctl(pf, EPOLL_CTL_MOD) < 0)
+		aprxpolls_epolloff("epoll_ctl(MOD)");
+#endif
+}
+
+void aprxpolls_remove(struct aprxpollfd *pf)
+{
+	struct aprxpollfd *last;
+	int i;
+
+	if (!pf->registered)
+		return;
+
+#ifdef APRXPOLLS_EPOLL
+	if (pf->always)
+		--aprxpolls_alwayscount;
+	else if (aprxpolls_epollfd >= 0 &&
+		 aprxpolls_epollctl(pf, EPOLL_CTL_DEL) < 0)
+		aprxpolls_epolloff("epoll_ctl(DEL)");
+#endif
+	// Move the last one in its place
+	last = aprxpolls_regs[--aprxpolls_regcount];
+	aprxpolls_regs[pf->idx] = last;
+	last->idx = pf->idx;
+	aprxpolls_regdirty = 1;
+
+	// It may have events still waiting for the dispatch
+	for (i = 0; i < aprxpolls_pendingcount; ++i)
+		if (aprxpolls_pending[i] == pf)
+			aprxpolls_pending[i] = NULL;
+
+	pf->registered = 0;
+	pf->always     = 0;
+}
+
+/*
+ * aprxpolls_waitevents()  -- wait on the registered descriptors
+ *                            for at most  millis,  and collect the
+ *                            ready ones for aprxpolls_dispatch()
+ */
+
+int aprxpolls_waitevents(int millis)
+{
+	struct aprxpollfd *pf;
+	int i, rc;
+
+	aprxpolls_pendingcount = 0;
+
+#ifdef APRXPOLLS_EPOLL
+	if (aprxpolls_epollfd >= 0) {
+		aprxpolls_epollevents = realloc(aprxpolls_epollevents,
+						sizeof(*aprxpolls_epollevents) * (aprxpolls_regsize+1));
+		rc = epoll_wait(aprxpolls_epollfd, aprxpolls_epollevents,
+				aprxpolls_regsize+1,
+				aprxpolls_alwayscount ? 0 : millis);
+		if (rc < 0)
+			return -1;
+		for (i = 0; i < rc; ++i) {
+			pf = aprxpolls_epollevents[i].data.ptr;
+			pf->revents = aprxpolls_epollevents[i].events & (POLLIN | POLLPRI | POLLOUT | POLLERR | POLLHUP);
+			aprxpolls_pending[aprxpolls_pendingcount++] = pf;
+		}
+		if (aprxpolls_alwayscount > 0) {
+			for (i = 0; i < aprxpolls_regcount; ++i) {
+				pf = aprxpolls_regs[i];
+				if (!pf->always)
+					continue;
+				pf->revents = pf->events & (POLLIN | POLLOUT);
+				if (pf->revents)
+					aprxpolls_pending[aprxpolls_pendingcount++] = pf;
+			}
+		}
+		return aprxpolls_pendingcount;
+	}
+#endif
+
+	if (aprxpolls_regdirty) {
+		aprxpolls_regpolls = realloc(aprxpolls_regpolls,
+					     sizeof(struct pollfd) * (aprxpolls_regsize+1));
+		for (i = 0; i < aprxpolls_regcount; ++i) {
+			pf = aprxpolls_regs[i];
+			aprxpolls_regpolls[i].fd     = pf->fd;
+			aprxpolls_regpolls[i].events = pf->events;
+		}
+		aprxpolls_regdirty = 0;
+	}
+	rc = poll(aprxpolls_regpolls, aprxpolls_regcount, millis);
+	if (rc < 0)
+		return -1;
+	for (i = 0; i < aprxpolls_regcount && rc > 0; ++i) {
+		if (!aprxpolls_regpolls[i].revents)
+			continue;
+		pf = aprxpolls_regs[i];
+		pf->revents = aprxpolls_regpolls[i].revents;
+		aprxpolls_pending[aprxpolls_pendingcount++] = pf;
+		--rc;
+	}
+	return aprxpolls_pendingcount;
+}
+
+/*
+ * aprxpolls_dispatch()  -- call owners of ready descriptors,
+ *                          after aprxpolls_waitevents()
+ */
+
+void aprxpolls_dispatch(struct aprxpolls *app)
+{
+	struct aprxpollfd *pf;
+	struct pollfd pfd;
+	int i;
+
+	for (i = 0; i < aprxpolls_pendingcount; ++i) {
+		pf = aprxpolls_pending[i];
+		if (pf == NULL)
+			continue; // removed by an earlier handler
+		pfd.fd      = pf->fd;
+		pfd.events  = pf->events;
+		pfd.revents = pf->revents;
+		pf->handler(app, &pfd, pf->arg);
+	}
+	aprxpolls_pendingcount = 0;
 }
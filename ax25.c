@@ -70,6 +70,78 @@ int ax25_to_tnc2_fmtaddress(char *dest, const uint8_t *src, int markflag)
 	return c;
 }
 
+/*
+ * ax25_decode_addr() -- an AX.25 address field to binary form.
+ * The frame has been validated already, callsign bytes are taken
+ * as they are up to the first space.
+ */
+void ax25_decode_addr(struct ax25_addr *a, const uint8_t *ax25)
+{
+	int i;
+
+	for (i = 0; i < 6; ++i) {
+		int c = ax25[i] >> 1;
+		if (c == 0 || c == ' ')
+			break;
+		a->call[i] = c;
+	}
+	a->calllen = i;
+	for (; i < 7; ++i)
+		a->call[i] = 0;
+	a->ssid = (ax25[6] >> 1) & 0x0F;
+	a->hbit = (ax25[6] & 0x80) != 0;
+}
+
+/* All address fields, returns their count */
+int ax25_decode_addrs(struct ax25_addr *aa, const uint8_t *ax25,
+		      const int ax25addrlen)
+{
+	int i, n = ax25addrlen / 7;
+
+	if (n > AX25_ADDRS_MAX)
+		n = AX25_ADDRS_MAX;
+	for (i = 0; i < n; ++i)
+		ax25_decode_addr(&aa[i], ax25 + 7*i);
+	return n;
+}
+
+/* TNC2 text of a decoded field, like ax25_to_tnc2_fmtaddress() */
+int ax25_addr_format(char *dest, const struct ax25_addr *a, const int markflag)
+{
+	char *p = dest;
+
+	memcpy(p, a->call, a->calllen);
+	p += a->calllen;
+	if (a->ssid) {
+		*p++ = '-';
+		if (a->ssid >= 10) {
+			*p++ = '1';
+			*p++ = '0' + a->ssid - 10;
+		} else
+			*p++ = '0' + a->ssid;
+	}
+	if (a->hbit && markflag)
+		*p++ = '*';
+	*p = 0;
+	return p - dest;
+}
+
+/* Is the field same as the "CALL-SSID" text without formatting it ? */
+int ax25_addr_is(const struct ax25_addr *a, const char *callsign)
+{
+	const char *p = callsign + a->calllen;
+
+	if (strncmp(a->call, callsign, a->calllen) != 0)
+		return 0;
+	if (a->ssid == 0)
+		return *p == 0;
+	if (*p++ != '-')
+		return 0;
+	if (a->ssid >= 10 && *p++ != '1')
+		return 0;
+	return p[0] == '0' + a->ssid % 10 && p[1] == 0;
+}
+
 // Return 0 on OK, != 0 on errors
 int parse_ax25addr(uint8_t ax25[7], const char *text, int ssidflags)
 {
@@ -278,6 +350,12 @@ int ax25_to_tnc2(const struct aprx_interface *aif, const char *portname,
 
 	if (tnc2len == 0) return 0; // Bad parse result
 
+	// With parse workers the rest is done when the parse is done
+	if (workers_submit(aif, portname, tncid, is_aprs, ui_pid,
+			   frame, frameaddrlen, framelen,
+			   tnc2buf, tnc2addrlen, tnc2len))
+		return 1;
+
 	// APRS type packets are first rx-igated (and rflog()ed)
 #ifndef DISABLE_IGATE
 	if (is_aprs) {
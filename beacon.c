@@ -29,6 +29,7 @@ struct beaconset {
 	struct beaconmsg **beacon_msgs;
 
   	struct timeval beacon_nexttime;
+	struct aprxtimer beacon_timer;	// fires at beacon_nexttime
 	float  beacon_cycle_size;
 
 	int beacon_msgs_count;
@@ -36,6 +37,7 @@ struct beaconset {
 
 	int    exec_pid;
 	int    exec_fd;
+	struct aprxpollfd exec_pollfd;
         time_t exec_deadline; // seconds
   	char  *exec_buf;
 	int    exec_buf_length;
@@ -47,6 +49,8 @@ static struct beaconset **bsets;
 static int bsets_count;
 
 static void beacon_it(struct beaconset *bset, struct beaconmsg *bm);
+static void beacon_timer_expired(struct aprxtimer *t, void *arg);
+static void beacon_timer_reset(struct aprxtimer *t, void *arg);
 
 
 static void beacon_reset(struct beaconset *bset)
@@ -608,6 +612,8 @@ int beacon_config(struct configfile *cf)
 
         struct beaconset *bset = calloc(1, sizeof(*bset));
         bset->beacon_cycle_size = 20.0*60.0; // 20 minutes is the default
+	aprxtimer_init(&bset->beacon_timer, "beacon",
+		       beacon_timer_expired, beacon_timer_reset, bset);
 
 	while (readconfigline(cf) != NULL) {
 		if (configline_is_comment(cf))
@@ -676,6 +682,8 @@ int beacon_config(struct configfile *cf)
           ++bsets_count;
           bsets = realloc( bsets,sizeof(*bsets)*bsets_count );
           bsets[bsets_count-1] = bset;
+          if (bset->beacon_msgs != NULL)
+            aprxtimer_arm(&bset->beacon_timer, &bset->beacon_nexttime);
 
           if (debug > 0) {
             printf("<beacon> set %d defined with %d entries\n",
@@ -786,6 +794,8 @@ static void msg_exec_read(struct beaconset *bset)
                   bm->msg = NULL;
                   // restore the nexttime
                   bset->beacon_nexttime.tv_sec = bm->nexttime;
+                  aprxtimer_arm(&bset->beacon_timer, &bset->beacon_nexttime);
+                  aprxpolls_remove(&bset->exec_pollfd);
                   close(bset->exec_fd);
                   bset->exec_fd = -1;
                   //bset->exec_pid = 0; 
@@ -819,15 +829,19 @@ static void msg_exec_read(struct beaconset *bset)
                   bm->msg = NULL;
                   // restore the nexttime
                   bset->beacon_nexttime.tv_sec = bm->nexttime;
+                  aprxtimer_arm(&bset->beacon_timer, &bset->beacon_nexttime);
                 } else {
                   aprxlog("BEACON EXEC abnormal close.");
                 }
+                aprxpolls_remove(&bset->exec_pollfd);
                 close(bset->exec_fd);
                 bset->exec_fd = -1;
                 //bset->exec_pid = 0; 
         }
 }
 
+static void beacon_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg);
+
 static int msg_exec_file(const char *filename, int timeout, struct beaconset *bset)
 {
 	int p[2];
@@ -876,6 +890,8 @@ static int msg_exec_file(const char *filename, int timeout, struct beaconset *bs
         bset->exec_deadline = tick.tv_sec + timeout;
         bset->exec_pid = pid;
         bset->exec_fd  = p[0];
+        aprxpolls_add(&bset->exec_pollfd, p[0], POLLIN | POLLPRI,
+                      beacon_pollevents, bset);
         
         bset->beacon_nexttime.tv_sec = bset->exec_deadline;
         
@@ -1147,75 +1163,47 @@ static void beacon_it(struct beaconset *bset, struct beaconmsg *bm)
 	}
 }
 
-int beacon_prepoll(struct aprxpolls *app)
+/* Output of beacon exec subprogram */
+static void beacon_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg)
 {
-	int i;
-#ifndef DISABLE_IGATE
-	if (!aprsis_login)
-		return 0;	/* No mycall !  hoh... */
-#endif
-        for (i = 0; i < bsets_count; ++i) {
-        	struct beaconset *bset = bsets[i];
-                if (bset->beacon_msgs == NULL) continue; // nothing here
+	struct beaconset *bset = arg;
 
-                if (time_reset) {
-                	// master time pickup noticed time back-tracking
-                	beacon_resettimer(bset);
-                }
-
-                if (tv_timercmp(&bset->beacon_nexttime, &app->next_timeout) < 0)
-                	app->next_timeout = bset->beacon_nexttime;
-
-                if (bset->exec_pid != 0 && bset->exec_fd >= 0) {
-                	struct pollfd *pfd;
-                        // FD is open, lets mark it for poll read..
-                        pfd = aprxpolls_new(app);
-                        pfd->fd = bset->exec_fd;
-                        pfd->events = POLLIN | POLLPRI;
-                        pfd->revents = 0;
-                }
-        }
-
-	return 0;		/* No poll descriptors, only time.. */
+	if (bset->exec_fd != P->fd)
+		return;	/* Closed meanwhile */
+	if (debug>1) printf("revents of exec_fd = 0x%x\n", P->revents);
+	if (P->revents & (POLLIN | POLLPRI | POLLHUP)) {
+		msg_exec_read(bset);
+	}
 }
 
-
-int beacon_postpoll(struct aprxpolls *app)
+/* Beacon time of a set, or the deadline of its exec subprogram */
+static void beacon_timer_expired(struct aprxtimer *t, void *arg)
 {
-	int idx, i;
-	//struct serialport *S;
-	struct pollfd *P;
+	struct beaconset *bset = arg;
+
+	if (bset->exec_pid > 0 && bset->exec_deadline < tick.tv_sec) {
+		// Waited too long, discard it.
+		if (debug) printf("Killing overdue beacon exec subprogram pid %d\n", bset->exec_pid);
+		kill(bset->exec_pid, SIGKILL);
+		bset->exec_pid = - bset->exec_pid;
+	}
 #ifndef DISABLE_IGATE
 	if (!aprsis_login)
-		return 0;	/* No mycall !  hoh... */
+		return;	/* No mycall !  hoh... */
 #endif
-        for (i = 0; i < bsets_count; ++i) {
-        	struct beaconset *bset = bsets[i];
-                if (bset->exec_pid > 0 && bset->exec_deadline < tick.tv_sec) {
-			// Waited too long, discard it.
-                	//printf("killing subprogram pid=%d mypid=%d\n", bset->exec_pid, getpid());
-                        if (debug) printf("Killing overdue beacon exec subprogram pid %d\n", bset->exec_pid);
-                	kill(bset->exec_pid, SIGKILL);
-                        bset->exec_pid = - bset->exec_pid;
-                }
-                for (idx = 0, P = app->polls; idx < app->pollcount; ++idx, ++P) {
-                	if (bset->exec_fd == P->fd) {
-                          if (debug>1) printf("revents of exec_fd = 0x%x\n", P->revents);
-                          if (P->revents & (POLLIN | POLLPRI | POLLHUP)) {
-                            msg_exec_read(bset);
-                          }
-                        }
-                }
-                if (bset->beacon_msgs == NULL) continue; // nothing..
-                if (tv_timercmp(&bset->beacon_nexttime, &tick) > 0) continue; // not yet
-
-                beacon_now(bset);
-        }
+	beacon_now(bset);
 
-        if (debug>1) printf("beacon_postpoll()\n");
+	// beacon_now() did set the next time, perhaps through exec
+	aprxtimer_arm(t, &bset->beacon_nexttime);
+}
 
+/* Time did jump, start the cycle over */
+static void beacon_timer_reset(struct aprxtimer *t, void *arg)
+{
+	struct beaconset *bset = arg;
 
-	return 0;
+	beacon_reset(bset);
+	aprxtimer_arm(t, &bset->beacon_nexttime);
 }
 
 void beacon_childexit(int pid)
@@ -85,6 +85,8 @@ int new_cellblock(cellarena_t *ca)
 	int fd;
 	char name[2048];
 
+	if (ca->cellblocks_count >= CELLBLOCKS_MAX) return -1;
+
 	sprintf(name, "/tmp/.-%d-%s-%d.mmap", getpid(), ca->arenaname, ca->cellblocks_count );
 	unlink(name);
 	fd = open(name, O_RDWR|O_CREAT, 644);
@@ -117,7 +119,6 @@ int new_cellblock(cellarena_t *ca)
 	  return -1;
 
 #ifdef MEMDEBUG
-	if (ca->cellblocks_count >= CELLBLOCKS_MAX) return -1;
 	ca->cellblocks[ca->cellblocks_count++] = cb;
 #endif
 
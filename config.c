@@ -269,6 +269,13 @@ static int logging_config(struct configfile *cf)
 	
 			erlang_backingstore = strdup(param1);
 	
+		} else if (strcmp(name, "snapshotfile") == 0) {
+			if (debug)
+				printf("%s:%d: INFO: SNAPSHOTFILE = '%s' '%s'\n",
+				       cf->name, cf->linenum, param1, str);
+	
+			snapshotfile = strdup(param1);
+	
 		} else if (strcmp(name, "erlang-loglevel") == 0) {
 			if (debug)
 				printf("%s:%d: INFO: ERLANG-LOGLEVEL = '%s' '%s'\n",
@@ -448,6 +455,18 @@ static int cfgparam(struct configfile *cf)
                 myloc_lon = filter_lon2rad(myloc_lon);
                 myloc_coslat = cos(myloc_lat);
 
+	} else if (strcmp(name, "parse-workers") == 0) {
+		int n = atoi(param1);
+		if (n < 0 || n > 16) {
+			printf("%s:%d ERROR: parse-workers value '%s' is not in range 0 to 16.\n",
+			       cf->name, cf->linenum, param1);
+			return 1;
+		}
+		if (debug)
+			printf("%s:%d: PARSE-WORKERS = %d\n",
+			       cf->name, cf->linenum, n);
+		parse_workers = n;
+
 
 #ifndef DISABLE_IGATE
 	} else if (strcmp(name, "aprsis-login") == 0) {
@@ -512,6 +531,18 @@ static int cfgparam(struct configfile *cf)
 			       cf->name, cf->linenum, param1, str);
 
 		return (netax25_addrxport(param1, NULL) == NULL);
+
+	} else if (strcmp(name, "ax25-rxring") == 0) {
+		int n = atoi(param1);
+		if (n < 0 || n > 65536) {
+			printf("%s:%d ERROR: ax25-rxring value '%s' is not in range 0 to 65536 kB.\n",
+			       cf->name, cf->linenum, param1);
+			return 1;
+		}
+		if (debug)
+			printf("%s:%d: AX25-RXRING = %d kB\n",
+			       cf->name, cf->linenum, n);
+		netax25_rxring_kb = n;
 #endif
 	} else if (strcmp(name, "radio") == 0) {
 
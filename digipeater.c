@@ -17,8 +17,6 @@ static struct digipeater **digis;
                                 // 60/5 part of "ratelimit" to be max
                                 // that token bucket can be filled to.
 
-static struct timeval tokenbucket_timer;
-
 struct viastate {
 	int hopsreq;
 	int hopsdone;
@@ -29,6 +27,7 @@ struct viastate {
 
 	int fixthis;
 	int fixall;
+	int fixhbits;	// Bitmask of via indexes needing the missing H-bit
 	int probably_heard_direct;
 };
 
@@ -62,13 +61,240 @@ static const struct tracewide default_wide_param = {
 	widewordlens
 };
 
-static int  run_tokenbucket_timers(void);
+static void viscous_expired(struct aprxtimer *t, void *arg);
+
+/*
+ *  Token buckets are filled lazily.  Each bucket remembers when it was
+ *  filled last, and gets the increments of all full intervals since that
+ *  when a packet looks at it.  Nothing needs to walk over all buckets,
+ *  and per source callsign ones in the HistoryDB, on a timer.
+ */
+static void tokenbucket_fill(float *bucket, time_t *filltime,
+			     const float increment, const float limit)
+{
+	long steps = (tick.tv_sec - *filltime) / TOKENBUCKET_INTERVAL;
+
+	if (steps <= 0) {
+		if (steps < 0) // Time went backwards, start over from now
+			*filltime = tick.tv_sec;
+		return;
+	}
+	*filltime += steps * TOKENBUCKET_INTERVAL;
+
+	if (*bucket + steps * increment > limit)
+		*bucket = limit;
+	else
+		*bucket += steps * increment;
+}
 
 
 float ratelimitmax     = 9999999.9;
 float rateincrementmax = 9999999.9;
 
 
+/*
+ * regex_literal() -- finds the longest string that every match of
+ *                    a POSIX ERE pattern must contain.  When the
+ *                    whole pattern is just such a string, possibly
+ *                    with ^ and $ anchors, *plainp is set.
+ *
+ * This is conservative: anything not understood only shortens or
+ * drops the literal, which just makes the matcher run regexec().
+ */
+static int regex_literal(const char *pattern, char *lit,
+			 int *plainp, int *anchor_startp, int *anchor_endp)
+{
+	const char *p = pattern;
+	char *run = alloca(strlen(pattern)+1);
+	int runlen = 0, litlen = 0;
+	int depth = 0, plain = 1;
+
+	*plainp = *anchor_startp = *anchor_endp = 0;
+	*lit = 0;
+
+	if (strchr(pattern, '|') != NULL)
+		return 0; // Alternates, no single required literal
+
+	if (*p == '^') {
+		*anchor_startp = 1;
+		++p;
+	}
+
+#define FLUSHRUN() do { if (runlen > litlen) { memcpy(lit, run, runlen); \
+			litlen = runlen; } runlen = 0; } while (0)
+
+	while (*p) {
+		int c = *p++;
+		switch (c) {
+		case '\\':
+			if (*p && strchr(".[]()*+?{}|^$\\", *p) != NULL) {
+				c = *p++;
+				break; // escaped literal
+			}
+			// Back-references, GNU \w etc.
+			plain = 0;
+			FLUSHRUN();
+			if (*p) ++p;
+			continue;
+		case '(':
+			++depth;
+			plain = 0;
+			FLUSHRUN();
+			continue;
+		case ')':
+			if (depth > 0) --depth;
+			plain = 0;
+			FLUSHRUN();
+			continue;
+		case '[':
+			plain = 0;
+			FLUSHRUN();
+			// Skip the bracket expression
+			if (*p == '^') ++p;
+			if (*p == ']') ++p;
+			while (*p && *p != ']') {
+				if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+					const char *e = strchr(p+2, p[1]);
+					while (e && e[1] != ']')
+						e = strchr(e+1, p[1]);
+					p = e ? e+2 : p+1;
+				} else
+					++p;
+			}
+			if (*p) ++p;
+			continue;
+		case '*':
+		case '?':
+			// Previous char is optional
+			plain = 0;
+			if (runlen > 0) --runlen;
+			FLUSHRUN();
+			continue;
+		case '+':
+			plain = 0;
+			FLUSHRUN();
+			continue;
+		case '{':
+			plain = 0;
+			if ('0' <= *p && *p <= '9') {
+				if (runlen > 0) --runlen;
+				while (*p && *p != '}') ++p;
+				if (*p) ++p;
+			}
+			FLUSHRUN();
+			continue;
+		case '$':
+			if (*p == 0 && depth == 0) {
+				*anchor_endp = 1;
+				continue;
+			}
+			/* FALLTHRU */
+		case '.':
+		case '^':
+			plain = 0;
+			FLUSHRUN();
+			continue;
+		default:
+			break;
+		}
+		if (depth > 0)
+			continue; // Group contents may be optional
+		run[runlen++] = c;
+	}
+	FLUSHRUN();
+#undef FLUSHRUN
+
+	*plainp = plain;
+	lit[litlen] = 0;
+	return litlen;
+}
+
+/*
+ * digi_refilter_add() -- stores compiled pattern into field's matcher
+ */
+void digi_refilter_add(struct digi_refilter *rf, regex_t *rep, const char *pattern)
+{
+	struct digi_repattern *rp;
+	char *lit = alloca(strlen(pattern)+1);
+	int plain, anchor_start, anchor_end;
+	int litlen = regex_literal(pattern, lit, &plain, &anchor_start, &anchor_end);
+
+	rf->pats = realloc(rf->pats, (rf->count+1) * sizeof(*rf->pats));
+	rp = &rf->pats[rf->count];
+	memset(rp, 0, sizeof(*rp));
+	rp->re = rep;
+
+	if (litlen == 0) {
+		rf->noliteral = realloc(rf->noliteral,
+					(rf->noliteralcount+1) * sizeof(*rf->noliteral));
+		rf->noliteral[rf->noliteralcount++] = rf->count;
+	} else {
+		rp->literal    = strdup(lit);
+		rp->literallen = litlen;
+		if (plain) {
+			// No need for regexec() on this one
+			rp->anchor_start = anchor_start;
+			rp->anchor_end   = anchor_end;
+			regfree(rep);
+			free(rep);
+			rp->re = NULL;
+		}
+		rp->nextpat = rf->firstpat[(uint8_t)lit[0]];
+		rf->firstpat[(uint8_t)lit[0]] = rf->count + 1;
+	}
+	if (debug)
+		printf("  .. regex-filter '%s' literal '%s'%s%s%s\n", pattern, lit,
+		       rp->re ? "" : " (plain)",
+		       rp->anchor_start ? " ^" : "", rp->anchor_end ? " $" : "");
+	++rf->count;
+}
+
+/*
+ * digi_refilter_match() -- does any of field's patterns match ?
+ *
+ * One pass over the field finds all places where some pattern's
+ * literal begins; plain literal patterns are decided right there,
+ * others get regexec() only once their literal has been seen.
+ * Patterns without literal are always run with regexec().
+ */
+int digi_refilter_match(const struct digi_refilter *rf, const char *field)
+{
+	const int fieldlen = strlen(field);
+	uint8_t *tried;
+	int i, j;
+
+	if (rf->count == 0)
+		return 0;
+
+	tried = alloca(rf->count);
+	memset(tried, 0, rf->count);
+
+	for (i = 0; i < fieldlen; ++i) {
+		for (j = rf->firstpat[(uint8_t)field[i]]; j > 0; j = rf->pats[j-1].nextpat) {
+			const struct digi_repattern *rp = &rf->pats[j-1];
+			if (tried[j-1] || rp->literallen > fieldlen - i)
+				continue;
+			if (memcmp(field + i, rp->literal, rp->literallen) != 0)
+				continue;
+			if (rp->re == NULL) {
+				if (rp->anchor_start && i != 0)
+					continue;
+				if (rp->anchor_end && i + rp->literallen != fieldlen)
+					continue;
+				return 1;       /* MATCH! */
+			}
+			tried[j-1] = 1;
+			if (regexec(rp->re, field, 0, NULL, 0) == 0)
+				return 1;       /* MATCH! */
+		}
+	}
+	for (i = 0; i < rf->noliteralcount; ++i) {
+		if (regexec(rf->pats[rf->noliteral[i]].re, field, 0, NULL, 0) == 0)
+			return 1;       /* MATCH! */
+	}
+	return 0;
+}
+
 /*
  * regex_filter_add() -- adds configured regular expressions
  *                       into forbidden patterns list.
@@ -128,63 +354,62 @@ static int regex_filter_add(struct configfile *cf,
 
 	switch (groupcode) {
 		case 0:
-			src->sourceregscount += 1;
-			src->sourceregs = realloc(src->sourceregs,
-						src->sourceregscount * sizeof(void *));
-			src->sourceregs[src->sourceregscount - 1] = rep;
+			digi_refilter_add(&src->sourceregs, rep, param1);
 			break;
 		case 1:
-			src->destinationregscount += 1;
-			src->destinationregs = realloc(src->destinationregs,
-						src->destinationregscount * sizeof(void *));
-			src->destinationregs[src->destinationregscount - 1] = rep;
+			digi_refilter_add(&src->destinationregs, rep, param1);
 			break;
 		case 2:
-			src->viaregscount += 1;
-			src->viaregs = realloc(src->viaregs,
-					src->viaregscount * sizeof(void *));
-			src->viaregs[src->viaregscount - 1] = rep;
+			digi_refilter_add(&src->viaregs, rep, param1);
 			break;
 		case 3:
-			src->dataregscount += 1;
-			src->dataregs = realloc(src->dataregs,
-						src->dataregscount * sizeof(void *));
-			src->dataregs[src->dataregscount - 1] = rep;
+			digi_refilter_add(&src->dataregs, rep, param1);
 			break;
 	}
 	return 0; // OK state
 }
 
 
-static int match_tracewide(const char *via, const struct tracewide *twp)
+/*
+ * The via field matchers work on decoded AX.25 address fields.
+ * The "star" tells if the field is to be taken as digipeated, like
+ * the '*' would be on the TNC2 text of it.
+ */
+
+static int match_tracewide(const struct ax25_addr *via, const int star,
+		const struct tracewide *twp)
 {
 	int i;
 	if (twp == NULL) return 0;
 
 	for (i = 0; i < twp->nkeys; ++i) {
 		// if (debug>2) printf(" match:'%s'",twp->keys[i]);
-		if (memcmp(via, twp->keys[i], twp->keylens[i]) == 0) {
-			int keylen = twp->keylens[i];
-			if (via[keylen] == '\0') {
-				// Match bare alias
-				return keylen;
-			}
-			if (via[keylen] > '0' && via[keylen] <= '7' &&
-			    (via[keylen+1] == '-' || via[keylen+1] == '\0')) {
-				// Match n-N alias, either "WIDEn-..." or "WIDEn"
+		int keylen = twp->keylens[i];
+		if (keylen > via->calllen ||
+		    memcmp(via->call, twp->keys[i], keylen) != 0)
+			continue;
+		if (via->calllen == keylen) {
+			// Match bare alias
+			if (via->ssid == 0 && !star)
 				return keylen;
-			}
-			// False alarm; doesn't really match the whole alias
+			continue;
+		}
+		if (via->calllen == keylen+1 &&
+		    via->call[keylen] > '0' && via->call[keylen] <= '7' &&
+		    (via->ssid != 0 || !star)) {
+			// Match n-N alias, either "WIDEn-..." or "WIDEn"
+			return keylen;
 		}
+		// False alarm; doesn't really match the whole alias
 	}
 	return 0;
 }
 
-static int match_aliases(const char *via, struct aprx_interface *txif)
+static int match_aliases(const struct ax25_addr *via, struct aprx_interface *txif)
 {
 	int i;
 	for (i = 0; i < txif->aliascount; ++i) {
-		if (strcmp(via, txif->aliases[i]) == 0)
+		if (ax25_addr_is(via, txif->aliases[i]))
 			return 1;
 	}
 	return 0;
@@ -193,69 +418,62 @@ static int match_aliases(const char *via, struct aprx_interface *txif)
 // Counts the number of requested and consumed hops in an alias
 // and adds those to the viastate->{digireq,digidone,tracereq,tracedone}.
 // returns 1 on horrific failure
-static int count_single_tnc2_tracewide(struct viastate *state,
-		const char *viafield, const int istrace,
-		const int matchlen, const int viaindex)
+static int count_single_tracewide(struct viastate *state,
+		const struct ax25_addr *via, const int star,
+		const int istrace, const int matchlen, const int viaindex)
 {
-	const char *p = viafield + matchlen;
-	const char reqc = p[0];
-	const char c    = p[1];
-	const char remc = p[2];
+	const char *p = via->call + matchlen;
 	int req, done;
 
-	int hasHflag = (strchr(viafield,'*') != NULL);
-
 	// Non-matched case, may have H-bit flag
-	if (matchlen == 0) {
+	// .. or the character following matched part is not [1-7]
+	if (matchlen == 0 || !('1' <= p[0] && p[0] <= '7')) {
 		req  = 1;
-		done = hasHflag;
-		if (viaindex == 2 && !hasHflag)
+		done = star;
+		if (viaindex == 2 && !star)
 			state->probably_heard_direct = 1;
-		// if (debug>1) printf(" a[req=%d,done=%d,trace=%d]",0,0,hasHflag);
+		// if (debug>1) printf(" a[req=%d,done=%d,trace=%d]",0,0,star);
 		goto addtostate;
 	}
 
-	// Is the character following matched part not [1-7]
-	if (!('1' <= reqc && reqc <= '7')) {
-		// Not a digit, this is single matcher..
-		req = 1;
-		done = hasHflag;
-
-		if (viaindex == 2 && !hasHflag)
-			state->probably_heard_direct = 1;
-		// if (debug>1) printf(" d[req=%d,done=%d]",1,hasHflag);
+	// Not WIDE1 nor WIDE1-
+	if (p[1] != 0) {
+		req  = 1;
+		done = star;
+		// if (debug>1) printf(" f[req=%d,done=%d]",1,star);
 		goto addtostate;
 	}
 
-	req = reqc - '0';
+	req = p[0] - '0';
 
-	if (c == '*' && remc == 0) { // WIDE1*
+	if (via->ssid == 0) {
 		done = req;
+		if (!star) // Bogus WIDE1 - uidigi puts these out.
+			state->fixthis = 1;
 		// if (debug>1) printf(" e[req=%d,done=%d]",req,req);
 		goto addtostate;
 	}
-	if (c == 0) { // Bogus WIDE1 - uidigi puts these out.
-		state->fixthis = 1;
-		done = req;
-		// if (debug>1) printf(" E[req=%d,done=%d]",req,req);
-		goto addtostate;
-	}
-	// Not WIDE1-
-	if (c != '-') {
-		req = 1;
-		done = hasHflag;
-		// if (debug>1) printf(" f[req=%d,done=%d]",1,hasHflag);
-		goto addtostate;
+
+	if (star) {
+		// Yuck, "WIDEn-N*" is impossible/syntactically invalid
+		state->hopsreq  += 1;
+		state->hopsdone += 1;
+		if (istrace) {
+			state->tracereq  += 1;
+			state->tracedone += 1;
+		}
+		// if (debug>1) printf(" h[req=%d,done=%d]",1,1);
+		return 1;
 	}
 
 	// OK, it is "WIDEn-" plus "N"
-	if ('0' <= remc  && remc <= '7' && p[3] == 0) {
-		done = req - (remc - '0');
+	if (via->ssid <= 7) {
+		done = req - via->ssid;
 		if (done < 0) {
 			// Something like "WIDE3-7", which is definitely bogus!
 			done = 0;
 			state->fixall = 1;
-			if (viaindex == 2 && !hasHflag)
+			if (viaindex == 2)
 				state->probably_heard_direct = 1;
 			goto addtostate;
 		}
@@ -263,34 +481,19 @@ static int count_single_tnc2_tracewide(struct viastate *state,
 			if (istrace) // A real "TRACE" in first slot?
 				state->probably_heard_direct = 1;
 
-			else if (!hasHflag && done == 0) // WIDE1-1/2-2/3-3/etc on first slot
+			else if (done == 0) // WIDE1-1/2-2/3-3/etc on first slot
 				state->probably_heard_direct = 1;
 		}
-		// if (debug>1) printf(" g[req=%d,done=%d%s]",req,done,hasHflag ? ",Hflag!":"");
+		// if (debug>1) printf(" g[req=%d,done=%d]",req,done);
 		goto addtostate;
-
-	} else if (('8' <= remc && remc <= '9' && p[3] == 0) ||
-			(remc == '1' && '0' <= p[3] && p[3] <= '5' && p[4] == 0)) {
-		// The request has SSID value in range of 8 to 15
-		state->fixall = 1;
-		if (viaindex == 2 && !hasHflag)
-			state->probably_heard_direct = 1;
-		return 0;
-
-	} else {
-		// Yuck, impossible/syntactically invalid
-		state->hopsreq  += 1;
-		state->hopsdone += hasHflag;
-		if (istrace) {
-			state->tracereq  += 1;
-			state->tracedone += hasHflag;
-		}
-		if (viaindex == 2 && !hasHflag)
-			state->probably_heard_direct = 1;
-		// if (debug>1) printf(" h[req=%d,done=%d]",1,hasHflag);
-		return 1;
 	}
 
+	// The request has SSID value in range of 8 to 15
+	state->fixall = 1;
+	if (viaindex == 2)
+		state->probably_heard_direct = 1;
+	return 0;
+
 addtostate:;
 		 // We've successfully parsed the field. Update the viastate and return 0
 		 state->hopsreq  += req;
@@ -302,102 +505,81 @@ addtostate:;
 		 return 0;
 }
 
-static int match_transmitter(const char *viafield,
+static int match_transmitter(const struct ax25_addr *via, const int star,
 		const struct digipeater_source *src,
-		const int lastviachar)
+		const int wantstar)
 {
-	struct aprx_interface *aif = src->parent->transmitter;
-	int tlen = strlen(aif->callsign);
+	return (star == wantstar &&
+		ax25_addr_is(via, src->parent->transmitter->callsign));
+}
 
-	if (memcmp(viafield, aif->callsign, tlen) == 0) {
-		if (viafield[tlen] == lastviachar)
-			return 1;
+/* Source, destination, and via fields are never to be these */
+static int is_nocall(const char *field)
+{
+	switch (field[0]) {
+	case 'M':
+		return (memcmp("YCALL",field+1,5)==0);
+	case 'N':
+		return (memcmp("0CALL",field+1,5)==0 ||
+			memcmp("OCALL",field+1,5)==0);
+	default:
+		return 0;
 	}
-
-	return 0;
 }
 
 static int try_reject_filters(const int  fieldtype,
 		const char *field,
 		struct digipeater_source *src)
 {
-	int i;
-	int stat = 0;
 	switch (fieldtype) {
 		case 0: // Source
-			for (i = 0; i < src->sourceregscount; ++i) {
-				stat = regexec(src->sourceregs[i],
-						field, 0, NULL, 0);
-				if (stat == 0)
-					return 1;       /* MATCH! */
-			}
-			if (memcmp("MYCALL",field,6)==0) return 1;
-			if (memcmp("N0CALL",field,6)==0) return 1;
-			if (memcmp("NOCALL",field,6)==0) return 1;
-			break;
+			return digi_refilter_match(&src->sourceregs, field) || is_nocall(field);
 		case 1: // Destination
-
-			for (i = 0; i < src->destinationregscount; ++i) {
-				int stat = regexec(src->destinationregs[i],
-						field, 0, NULL, 0);
-				if (stat == 0)
-					return 1;       /* MATCH! */
-			}
-			if (memcmp("MYCALL",field,6)==0) return 1;
-			if (memcmp("N0CALL",field,6)==0) return 1;
-			if (memcmp("NOCALL",field,6)==0) return 1;
-			break;
+			return digi_refilter_match(&src->destinationregs, field) || is_nocall(field);
 		case 2: // Via
-
-			for (i = 0; i < src->viaregscount; ++i) {
-				int stat = regexec(src->viaregs[i],
-						field, 0, NULL, 0);
-				if (stat == 0)
-					return 1;       /* MATCH! */
-			}
-			if (memcmp("MYCALL",field,6)==0) return 1;
-			if (memcmp("N0CALL",field,6)==0) return 1;
-			if (memcmp("NOCALL",field,6)==0) return 1;
-			break;
+			return digi_refilter_match(&src->viaregs, field) || is_nocall(field);
 		case 3: // Data
-
-			for (i = 0; i < src->dataregscount; ++i) {
-				int stat = regexec(src->dataregs[i],
-						field, 0, NULL, 0);
-				if (stat == 0)
-					return 1;       /* MATCH! */
-			}
-			break;
+			return digi_refilter_match(&src->dataregs, field);
 		default:
 			if (debug)
 				printf("try_reject_filters(fieldtype=%d) - CODE BUG\n",
 						fieldtype);
 			return 1;
 	}
-	if (stat != 0 && stat != REG_NOMATCH) {
-		// Some odd reason for an error?
+}
 
-	}
-	return 0;
+/* Via field reject filters, the text is made only for the regexps */
+static int try_reject_via(const struct ax25_addr *via, const int star,
+		struct digipeater_source *src)
+{
+	char viafield[14];
+
+	if (src->viaregs.count == 0)
+		return is_nocall(via->call);
+
+	ax25_addr_format(viafield, via, 0);
+	if (star)
+		strcat(viafield, "*");
+	return try_reject_filters(2, viafield, src);
 }
 
 /* Parse executed and requested WIDEn-N/TRACEn-N info */
-static int parse_tnc2_hops(struct digistate *state,
+static int parse_ax25_hops(struct digistate *state,
 		struct digipeater_source *src,
 		struct pbuf_t *pb)
 {
-	const char *p = pb->dstcall_end+1;
-	const char *s;
 	const struct digipeater *digi = src->parent;
-	const char *lastviastar;
+	const struct ax25_addr *addrs;
 	char viafield[15]; // temp buffer for many uses
 	int have_fault = 0;
-	int viaindex = 1; // First via index will be 2..
+	int viaindex;      // First via index is 2
+	int lastviastar = 1;
 	int activeviacount = 0;
+	int count;
 	int len;
 	int digiok;
 
-	if (debug>1) printf(" hops count of buffer: %s\n",p);
+	if (debug>1) printf(" hops count of buffer: %s\n",pb->dstcall_end+1);
 
 	if (src->src_relaytype == DIGIRELAY_THIRDPARTY) {
 		state->v.hopsreq = 1; // Bonus for tx-igated 3rd-party frames
@@ -430,65 +612,40 @@ static int parse_tnc2_hops(struct digistate *state,
 		return 1; // Dest reject filters
 	}
 
-	// Where is the last via-field with a star on it?
-	len = pb->info_start - p; if (len < 0) len=0;
-	lastviastar = memrchr(p, len, '*');
+	addrs = pbuf_ax25addrs(pb, &count);
 
-	// Loop over VIA fields to see if we need to digipeat anything.
-	while (p < pb->info_start && !have_fault) {
-		len = 0;
+	// Where is the last via-field with H-bit on it?
+	// This digi code logic needs it at every VIA field before it.
+	for (viaindex = 2; viaindex < count; ++viaindex) {
+		if (addrs[viaindex].hbit)
+			lastviastar = viaindex;
+	}
 
-		if (*p == ':') {
-			// A round may stop at ':' found at the end of the processed field,
-			// then next round finds it at the start of the field.
-			break;
-		}
+	// Loop over VIA fields to see if we need to digipeat anything.
+	for (viaindex = 2; viaindex < count && !have_fault; ++viaindex) {
+		const struct ax25_addr *via = &addrs[viaindex];
+		const int star = (viaindex <= lastviastar);
 
-		// Scan for a VIA field ...
-		for (s = p; s < pb->info_start; ++s) {
-			if (*s == ',' || *s == ':') {
-				// ... until comma or double-colon.
-				break;
-			}
-		}
-		// [p..s) is now one VIA field.
-		if (s == p && *p != ':') {  // BAD!
+		if (via->calllen == 0 && via->ssid == 0 && !star) {  // BAD!
 			have_fault = 1;
-			if (debug>1) printf(" S==P ");
+			if (debug>1) printf(" empty via ");
 			break;
 		}
-		if (*p == 'q') break; // APRSIS q-constructs..
-		++viaindex;
-
-		// Pick-up a viafield to separate buffer for processing
-		len = s-p;
-		if (len >= sizeof(viafield)) len = sizeof(viafield)-2;
-		memcpy(viafield, p, len);
-		viafield[len] = 0;
-		if (*s == ',') ++s;
-		p = s;
-
-		// Only last via field with H-bit is indicated at TNC2 format,
-		// but this digi code logic needs it at every VIA field where
-		// it is set.  Therefore this crooked way to add it to picked
-		// up fields.
-		if (strchr(viafield,'*') == NULL) {
-			// If it exists somewhere, and we are not yet at it..
-			if (lastviastar != NULL && p < lastviastar)
-				strcat(viafield,"*"); // we do know that there is space for this.
-		}
 
-		if (debug>1) printf(" - ViaField[%d]: '%s'\n", viaindex, viafield);
+		if (debug>1) {
+			ax25_addr_format(viafield, via, 0);
+			printf(" - ViaField[%d]: '%s%s'\n", viaindex, viafield, star ? "*":"");
+		}
 
 		// VIA-field picked up, now analyze it..
 
-		if (try_reject_filters(2, viafield, src)) {
+		if (try_reject_via(via, star, src)) {
 			if (debug>1) printf(" - Via filters reject\n");
 			return 1; // via reject filters
 		}
 
 		// Transmitter callsign match with H-flag set.
-		if (match_transmitter(viafield, src, '*')) {
+		if (match_transmitter(via, star, src, 1)) {
 			if (debug>1) printf(" - Tx match reject\n");
 			// Oops, LOOP!  I have transmit this in past
 			// (according to my transmitter callsign present
@@ -496,19 +653,19 @@ static int parse_tnc2_hops(struct digistate *state,
 			return 1;
 		}
 
-		// If there is no '*' meaning this has not been
+		// If there is no H-flag meaning this has not been
 		// processed, then this is active field..
-		if (strchr(viafield, '*') == NULL)
+		if (!star)
 			++activeviacount;
 
 		digiok = 0;
 
-		// If first active field (without '*') matches
+		// If first active field (without H-flag) matches
 		// transmitter or alias, then this digi is accepted
 		// regardless if it is APRS or some other protocol.
-		if (activeviacount == 1 &&
-				(match_transmitter(viafield, src, 0) ||
-				 match_aliases(viafield, digi->transmitter))) {
+		if (activeviacount == 1 && !star &&
+				(match_transmitter(via, star, src, 0) ||
+				 match_aliases(via, digi->transmitter))) {
 			if (debug>1) printf(" - Tx match accept!\n");
 			state->v.hopsreq  += 1;
 			state->v.tracereq += 1;
@@ -518,49 +675,49 @@ static int parse_tnc2_hops(struct digistate *state,
 		// .. otherwise following rules are applied only to APRS packets.
 		if (pb->is_aprs) {
 
-			if ((len = match_tracewide(viafield, src->src_trace))) {
+			if ((len = match_tracewide(via, star, src->src_trace))) {
 				// Match source specific list of trace aliases
 				if (debug>1) printf("Trace (src specific)\n");
-				have_fault = count_single_tnc2_tracewide(&state->v, viafield, 1, len, viaindex);
+				have_fault = count_single_tracewide(&state->v, via, star, 1, len, viaindex);
 				if (!have_fault)
 					digiok = 1;
-			} else if ((len = match_tracewide(viafield, digi->trace))) {
+			} else if ((len = match_tracewide(via, star, digi->trace))) {
 				// Match digipeater-wide list of trace aliases
 				if (debug>1) printf("Trace (global)\n");
-				have_fault = count_single_tnc2_tracewide(&state->v, viafield, 1, len, viaindex);
+				have_fault = count_single_tracewide(&state->v, via, star, 1, len, viaindex);
 				if (!have_fault)
 					digiok = 1;
-			} else if ((len = match_tracewide(viafield, src->src_wide))) {
+			} else if ((len = match_tracewide(via, star, src->src_wide))) {
 				// Match source specific list of non-trace aliases
 				if (debug>1) printf("Trace (src-specific, non-trace)\n");
-				have_fault = count_single_tnc2_tracewide(&state->v, viafield, 0, len, viaindex);
+				have_fault = count_single_tracewide(&state->v, via, star, 0, len, viaindex);
 				if (!have_fault)
 					digiok = 1;
-			} else if ((len = match_tracewide(viafield, digi->wide))) {
+			} else if ((len = match_tracewide(via, star, digi->wide))) {
 				// Match digipeater-wide list of non-trace aliases
 				if (debug>1) printf("Trace (global, non-trace)\n");
-				have_fault = count_single_tnc2_tracewide(&state->v, viafield, 0, len, viaindex);
+				have_fault = count_single_tracewide(&state->v, via, star, 0, len, viaindex);
 				if (!have_fault)
 					digiok = 1;
 			} else {
 				// No match on trace or wide, but if there was earlier
 				// match on interface or alias, then it set "digiok" for us.
-				state->v.digidone += (int) (strchr(viafield,'*') != NULL);
+				state->v.digidone += star;
 				if (debug>1) printf("Trace (non-alias) digi=%d\n",state->v.digidone);
 			}
 		}
 		if (state->v.fixthis || state->v.fixall) {
 			// Argh..  bogus WIDEn seen, which is what UIDIGIs put out..
 			// Also some other broken requests are "fixed": like WIDE3-7
-			// Fixing it: We set the missing H-bit, and continue processing.
-			// (That fixing is done in incoming AX25 address field, which
-			//  we generally do not touch - with this exception.)
-			pb->ax25addr[ AX25ADDRLEN*viaindex + AX25ADDRLEN-1 ] |= AX25HBIT;
+			// Fixing it: We remember the missing H-bit, and continue processing.
+			// (The pbuf is shared by all digipeater sources, so the bit
+			//  is set on our private copy of the address field later.)
+			state->v.fixhbits |= (1 << viaindex);
 			state->v.fixthis = 0;
 		}
 
 		if (digiok) {
-			if (debug>1) printf(" via field match %s\n", viafield);
+			if (debug>1) printf(" via field match %s\n", via->call);
 			if(state->v.hopsreq>state->v.hopsdone) break;
 		}
 	}
@@ -908,6 +1065,8 @@ static struct digipeater_source *digipeater_config_source(struct configfile *cf)
 
 	if (!has_fault && (source_aif != NULL)) {
 		source = calloc(1,sizeof(*source));
+		aprxtimer_init(&source->viscous_timer, "viscous-queue",
+			       viscous_expired, NULL, source);
 
 		source->src_if        = source_aif;
 		source->src_relaytype = relaytype;
@@ -930,15 +1089,12 @@ static struct digipeater_source *digipeater_config_source(struct configfile *cf)
 		source->tbf_limit     = (ratelimit * TOKENBUCKET_INTERVAL)/60;
 		source->tbf_increment = (rateincrement * TOKENBUCKET_INTERVAL)/60;
 		source->tokenbucket   = source->tbf_limit;
+		source->tbf_filltime  = tick.tv_sec;
 
 		// RE pattern reject filters
-		source->sourceregscount      = regexsrc.sourceregscount;
 		source->sourceregs           = regexsrc.sourceregs;
-		source->destinationregscount = regexsrc.destinationregscount;
 		source->destinationregs      = regexsrc.destinationregs;
-		source->viaregscount         = regexsrc.viaregscount;
 		source->viaregs              = regexsrc.viaregs;
-		source->dataregscount        = regexsrc.dataregscount;
 		source->dataregs             = regexsrc.dataregs;
 
 	} else {
@@ -968,10 +1124,15 @@ int digipeater_config(struct configfile *cf)
 	float rateincrement = 60;
 	float srcratelimit = 60;
 	float srcrateincrement = 60;
+	int historydbsize = HISTORYDB_INITIAL_SIZE;
 	int sourcecount = 0;
 	int dupestoretime = 30; // FIXME: parametrize! 30 is minimum..
 	struct digipeater_source **sources = NULL;
 	struct digipeater *digi = NULL;
+	dupecheck_t *dupechecker = NULL;
+#ifndef DISABLE_IGATE
+	historydb_t *historydb = NULL;
+#endif
 	struct tracewide *traceparam = NULL;
 	struct tracewide *wideparam  = NULL;
 
@@ -1050,6 +1211,13 @@ int digipeater_config(struct configfile *cf)
 				printf("  .. srcratelimit %f %f\n",
 						srcrateincrement, srcratelimit);
 
+		} else if (strcmp(name, "historydb-size") == 0) {
+			historydbsize = atoi(param1);
+			if (historydbsize < HISTORYDB_INITIAL_SIZE)
+				historydbsize = HISTORYDB_INITIAL_SIZE;
+			if (debug)
+				printf("  .. historydb-size %d\n", historydbsize);
+
 		} else if (strcmp(name, "<trace>") == 0) {
 			if (traceparam == NULL) {
 				traceparam = digipeater_config_tracewide(cf, 1);
@@ -1122,6 +1290,25 @@ int digipeater_config(struct configfile *cf)
 		}
 	}
 
+	if (!has_fault) {
+		dupechecker = dupecheck_new(dupestoretime);  // Dupecheck is per transmitter
+		if (dupechecker == NULL) {
+			has_fault = 1;
+			printf("%s:%d <digipeater> dupecheck allocation failed\n",
+			       cf->name, line0);
+		}
+	}
+#ifndef DISABLE_IGATE
+	if (!has_fault) {
+		historydb = historydb_new(historydbsize);  // HistoryDB is per transmitter
+		if (historydb == NULL) {
+			has_fault = 1;
+			printf("%s:%d <digipeater> historydb allocation failed\n",
+			       cf->name, line0);
+		}
+	}
+#endif
+
 	if (has_fault) {
 		// Free allocated resources and link pointers, if any
 		for ( i = 0; i < sourcecount; ++i ) {
@@ -1162,10 +1349,11 @@ int digipeater_config(struct configfile *cf)
 		digi->src_tbf_limit = (srcratelimit * TOKENBUCKET_INTERVAL)/60;
 		digi->src_tbf_increment = (srcrateincrement * TOKENBUCKET_INTERVAL)/60;
 		digi->tokenbucket   = digi->tbf_limit;
+		digi->tbf_filltime  = tick.tv_sec;
 
-		digi->dupechecker   = dupecheck_new(dupestoretime);  // Dupecheck is per transmitter
+		digi->dupechecker   = dupechecker;
 #ifndef DISABLE_IGATE
-		digi->historydb     = historydb_new();  // HistoryDB is per transmitter
+		digi->historydb     = historydb;
 #endif
 
 		digi->trace         = (traceparam != NULL) ? traceparam : & default_trace_param;
@@ -1193,6 +1381,22 @@ static int decrement_ssid(uint8_t *ax25addr)
 }
 
 
+/* "SRC>DEST" text of the AX.25 address, the dupecheck key; 0 on bad format */
+static int digipeater_srcdest(char *buf, const uint8_t *ax25addr)
+{
+	char *t = buf;
+
+	if (ax25_to_tnc2_fmtaddress(t, ax25addr + AX25ADDRLEN, 0) < 0)
+		return 0;
+	t += strlen(t);
+	*t++ = '>';
+	if (ax25_to_tnc2_fmtaddress(t, ax25addr, 0) < 0)
+		return 0;
+	t += strlen(t);
+	return t - buf;
+}
+
+
 /* 0 == accept, otherwise reject */
 /*
    int digipeater_receive_filter(struct digipeater_source *src, struct pbuf_t *pb)
@@ -1215,13 +1419,13 @@ static int decrement_ssid(uint8_t *ax25addr)
    }
    */
 
-static void digipeater_receive_backend(struct digipeater_source *src, struct pbuf_t *pb)
+static void digipeater_receive_backend_(struct digipeater_source *src, struct pbuf_t *pb)
 {
 	int len, viaindex;
 	struct digistate state;
 	struct viastate  viastate;
 	struct digipeater *digi = src->parent;
-	char viafield[14]; // room for text format
+	struct ax25_addr via;
 	uint8_t *axaddr, *e;
 
 	memset(&state,    0, sizeof(state));
@@ -1233,10 +1437,10 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 	//     verified)
 
 	// Parse executed and requested WIDEn-N/TRACEn-N info
-	if (parse_tnc2_hops(&state, src, pb)) {
+	if (parse_ax25_hops(&state, src, pb)) {
 		// A fault was observed! -- tests include "not this transmitter"
 		if (debug>1)
-			printf("Parse_tnc2_hops rejected this.");
+			printf("Parse_ax25_hops rejected this.");
 		return;
 	}
 
@@ -1300,6 +1504,13 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 	axaddr = state.ax25addr + 2*AX25ADDRLEN;
 	e      = state.ax25addr + state.ax25addrlen;
 
+	// Set the H-bits that parse_ax25_hops() found missing
+	if (state.v.fixhbits) {
+		for (viaindex = 2; viaindex*AX25ADDRLEN < state.ax25addrlen; ++viaindex)
+			if (state.v.fixhbits & (1 << viaindex))
+				state.ax25addr[ AX25ADDRLEN*viaindex + AX25ADDRLEN-1 ] |= AX25HBIT;
+	}
+
 	if (state.v.fixall) {
 		// Okay, insert my transmitter callsign on the first
 		// VIA field, and mark the rest with H-bit
@@ -1327,11 +1538,10 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 
 	// Search for first AX.25 VIA field that does not have H-bit set:
 	viaindex = 1; // First via field is number 2
-	*viafield = 0; // clear that buffer for starters
 	for (; axaddr < e; axaddr += AX25ADDRLEN, ++viaindex) {
-		ax25_to_tnc2_fmtaddress(viafield, axaddr, 0);
+		ax25_decode_addr(&via, axaddr);
 		// if (debug>1) {
-		//   printf(" via: %s", viafield);
+		//   printf(" via: %s", via.call);
 		// }
 
 		// Initial parsing said that things are seriously wrong..
@@ -1361,9 +1571,9 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 
 		// 7) WIDEn-N treatment (as well as transmitter matching digi)
 		if (pb->digi_like_aprs) {
-			if (strcmp(viafield,digi->transmitter->callsign) == 0 ||
+			if (ax25_addr_is(&via, digi->transmitter->callsign) ||
 					// Match on the transmitter callsign without the star...
-					match_aliases(viafield, digi->transmitter)) {
+					match_aliases(&via, digi->transmitter)) {
 				// .. or match transmitter interface alias.
 
 				// Treat it as a TRACE request.
@@ -1373,19 +1583,19 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 				memcpy(axaddr, digi->transmitter->ax25call, AX25ADDRLEN);
 				axaddr[AX25ADDRLEN-1] |= (AX25HBIT | aterm); // Set H-bit
 
-			} else if ((len = match_tracewide(viafield, src->src_trace))) {
-				count_single_tnc2_tracewide(&viastate, viafield, 1, len, viaindex);
-			} else if ((len = match_tracewide(viafield, digi->trace))) {
-				count_single_tnc2_tracewide(&viastate, viafield, 1, len, viaindex);
-			} else if ((len = match_tracewide(viafield, src->src_wide))) {
-				count_single_tnc2_tracewide(&viastate, viafield, 0, len, viaindex);
-			} else if ((len = match_tracewide(viafield, digi->wide))) {
-				count_single_tnc2_tracewide(&viastate, viafield, 0, len, viaindex);
+			} else if ((len = match_tracewide(&via, 0, src->src_trace))) {
+				count_single_tracewide(&viastate, &via, 0, 1, len, viaindex);
+			} else if ((len = match_tracewide(&via, 0, digi->trace))) {
+				count_single_tracewide(&viastate, &via, 0, 1, len, viaindex);
+			} else if ((len = match_tracewide(&via, 0, src->src_wide))) {
+				count_single_tracewide(&viastate, &via, 0, 0, len, viaindex);
+			} else if ((len = match_tracewide(&via, 0, digi->wide))) {
+				count_single_tracewide(&viastate, &via, 0, 0, len, viaindex);
 			}
 
 		} else { // Not "digi_as_aprs" rules
 
-			if (strcmp(viafield,digi->transmitter->callsign) == 0) {
+			if (ax25_addr_is(&via, digi->transmitter->callsign)) {
 				// Match on the transmitter callsign without the star.
 				// Treat it as a TRACE request.
 				int aterm = axaddr[AX25ADDRLEN-1] & AX25ATERM; // save old address termination bit
@@ -1393,7 +1603,7 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 				memcpy(axaddr, digi->transmitter->ax25call, AX25ADDRLEN);
 				axaddr[AX25ADDRLEN-1] |= (AX25HBIT | aterm); // Set H-bit
 
-			} else if (match_aliases(viafield, digi->transmitter)) {
+			} else if (match_aliases(&via, digi->transmitter)) {
 				// Match on the aliases.
 				// Treat it as a TRACE request.
 				int aterm = axaddr[AX25ADDRLEN-1] & AX25ATERM; // save old address termination bit
@@ -1404,7 +1614,7 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 		}
 
 		if (viastate.tracereq > viastate.tracedone) {
-			// if (debug) printf(" TRACE on %s!\n",viafield);
+			// if (debug) printf(" TRACE on %s!\n",via.call);
 			// Must move it up in memory to be able to put
 			// transmitter callsign in
 			int taillen = e - axaddr;
@@ -1431,7 +1641,7 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 			// If configuration didn't process "WIDE" et.al. as
 			// a TRACE, then here we process them without trace..
 			int newssid;
-			if (debug) printf(" VIA on %s!\n",viafield);
+			if (debug) printf(" VIA on %s!\n",via.call);
 			newssid = decrement_ssid(axaddr);
 			if (newssid <= 0)
 				axaddr[AX25ADDRLEN-1] |= AX25HBIT; // Set H-bit
@@ -1440,17 +1650,23 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 	{
 		history_cell_t *hcell;
 		char tbuf[2800];
-		int is_ui = 0, ui_pid = -1, frameaddrlen = 0, tnc2addrlen = 0, t2l;
-		// uint8_t *u = state.ax25addr + state.ax25addrlen;
-		// *u++ = 0;
-		// *u++ = 0;
-		// *u++ = 0;
-		t2l = ax25_format_to_tnc( state.ax25addr,
-				state.ax25addrlen+AX25ADDRLEN-1,
-				tbuf, sizeof(tbuf),
-				& frameaddrlen, &tnc2addrlen,
-				& is_ui, &ui_pid );
-		tbuf[t2l] = 0;
+		char srcdest[24];
+		int t2l = 0, sdlen;
+
+		// The TNC2 text of the new header is needed only for logging
+		if (debug || (pb->is_aprs && rflogfile)) {
+			int is_ui = 0, ui_pid = -1, frameaddrlen = 0, tnc2addrlen = 0;
+			// uint8_t *u = state.ax25addr + state.ax25addrlen;
+			// *u++ = 0;
+			// *u++ = 0;
+			// *u++ = 0;
+			t2l = ax25_format_to_tnc( state.ax25addr,
+					state.ax25addrlen+AX25ADDRLEN-1,
+					tbuf, sizeof(tbuf),
+					& frameaddrlen, &tnc2addrlen,
+					& is_ui, &ui_pid );
+			tbuf[t2l] = 0;
+		}
 		if (debug) {
 			printf(" out-hdr: '%s' data='",tbuf);
 			(void)fwrite(pb->ax25data+2, pb->ax25datalen-2,  // without Control+PID
@@ -1463,6 +1679,8 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 		hcell = historydb_insert_( digi->historydb, pb, 1 );
 
 		if (hcell != NULL) {
+			tokenbucket_fill(&hcell->tokenbucket, &hcell->tbf_filltime,
+					 digi->src_tbf_increment, digi->src_tbf_limit);
 			if (hcell->tokenbucket < 1.0) {
 				if (debug) printf("TRANSMITTER SOURCE CALLSIGN RATELIMIT DISCARD.\n");
 				return;
@@ -1472,6 +1690,8 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 #endif
 
 		// Now we do token bucket filtering -- rate limiting
+		tokenbucket_fill(&digi->tokenbucket, &digi->tbf_filltime,
+				 digi->tbf_increment, digi->tbf_limit);
 		if (digi->tokenbucket < 1.0) {
 			if (debug) printf("TRANSMITTER RATELIMIT DISCARD.\n");
 			return;
@@ -1500,10 +1720,11 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 		// This recording is needed at output side of digipeater
 		// for APRSIS and DPRS transmit gates.
 
-		if (t2l>0) {
+		sdlen = digipeater_srcdest(srcdest, state.ax25addr);
+		if (sdlen>0) {
 			dupecheck_aprs( digi->dupechecker,
-					(const char *)tbuf,
-					t2l,
+					(const char *)srcdest,
+					sdlen,
 					(const char *)pb->ax25data+2,
 					pb->ax25datalen-2 );  // ignore Ctrl+PID
 		} else {
@@ -1522,6 +1743,13 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 	if (debug>1) printf("Done.\n");
 }
 
+static void digipeater_receive_backend(struct digipeater_source *src, struct pbuf_t *pb)
+{
+	int64_t t0 = erlang_latency_now();
+	digipeater_receive_backend_(src, pb);
+	erlang_latency_add(LATENCY_DIGIPEAT, t0);
+}
+
 
 void digipeater_receive( struct digipeater_source *src,
 		struct pbuf_t *pb )
@@ -1536,6 +1764,8 @@ void digipeater_receive( struct digipeater_source *src,
 		printf("digipeater_receive() from %s, is_aprs=%d viscous_delay=%d\n",
 				src->src_if->callsign, pb->is_aprs, src->viscous_delay);
 
+	tokenbucket_fill(&src->tokenbucket, &src->tbf_filltime,
+			 src->tbf_increment, src->tbf_limit);
 	if (src->tokenbucket < 1.0) {
 		if (debug) printf("SOURCE RATELIMIT DISCARD\n");
 		return;
@@ -1553,8 +1783,10 @@ void digipeater_receive( struct digipeater_source *src,
 		//    count > 1, drop it.
 
 		int jittery = src->viscous_delay > 0 ? random() % 3 + src->viscous_delay : 0;
+		int64_t t0 = erlang_latency_now();
 		dupe_record_t *dupe = dupecheck_pbuf( src->parent->dupechecker,
 				pb, jittery);
+		erlang_latency_add(LATENCY_DUPECHECK, t0);
 		if (dupe == NULL) {  // Oops.. allocation error!
 			if (debug)
 				printf("digipeater_receive() - dupecheck_pbuf() allocation error, packet discarded\n");
@@ -1664,6 +1896,12 @@ void digipeater_receive( struct digipeater_source *src,
 			}
 			src->viscous_queue[ src->viscous_queue_size -1 ]
 				= dupecheck_get(dupe);
+			if (src->viscous_queue_size == 1) {
+				struct timeval tv;
+				tv.tv_sec  = dupe->t + src->viscous_delay;
+				tv.tv_usec = 0;
+				aprxtimer_arm(&src->viscous_timer, &tv);
+			}
 
 			if (debug) printf("%ld ENTER VISCOUS QUEUE: len=%d pbuf=%p\n",
 					tick.tv_sec, src->viscous_queue_size, pb);
@@ -1697,184 +1935,65 @@ struct digipeater* digipeater_find_by_iface(const struct aprx_interface *aif) {
 	return NULL;
 }
 
-
-static void digipeater_resettime(void *arg)
-{
-	struct timeval *tv = (struct timeval *)arg;
-	*tv = tick;
-}
-
-
-// Viscous queue processing needs poll digis <source>s for delayed actions
-int  digipeater_prepoll(struct aprxpolls *app)
-{
-	int d, s;
-
-	if (tokenbucket_timer.tv_sec == 0) {
-		tokenbucket_timer = tick; // init this..
-	}
-
-	// If the time(2) has jumped around a lot,
-	// and we didn't get around to do our work, reset the timer.
-
-	if (time_reset) {
-		digipeater_resettime(&tokenbucket_timer);
-	}
-
-	if (tv_timercmp( &tokenbucket_timer, &tick ) <= 0) {
-		// Run the digipeater timer handling now
-		// Will also advance the timer!
-		if (debug>2) printf("digipeater_prepoll() run tokenbucket_timers\n");
-		tv_timeradd_seconds( &tokenbucket_timer, &tokenbucket_timer, TOKENBUCKET_INTERVAL);
-		run_tokenbucket_timers();
-	}
-
-	if (tv_timercmp( &tokenbucket_timer, &app->next_timeout ) <= 0) {
-		app->next_timeout = tokenbucket_timer;
-	}
-
-	// if (debug>2) printf("digipeater_prepoll - 1 - timeout millis=%d\n",aprxpolls_millis(app));
-
-	// Over all digipeaters..
-	for (d = 0; d < digi_count; ++d) {
-		struct digipeater *digi = digis[d];
-		// Over all sources in those digipeaters
-		for (s = 0; s < digi->sourcecount; ++s) {
-			struct timeval tv;
-			struct digipeater_source * src = digi->sources[s];
-			// If viscous delay is zero, there is no work...
-			// if (src->viscous_delay == 0)
-			//   continue;
-			// Delay is non-zero, perhaps there is work?
-			if (src->viscous_queue_size == 0) // Empty queue
-				continue;
-			// First entry expires first
-			tv.tv_sec = src->viscous_queue[0]->t + src->viscous_delay;
-			tv.tv_usec = 0;
-			if (tv_timercmp(&app->next_timeout, &tv) > 0) {
-				app->next_timeout = tv;
-				// if (debug>2) printf("digipeater_prepoll - 2 - timeout millis=%d\n",aprxpolls_millis(app));
-			}
-		}
-	}
-
-	return 0;
+// Digipeaters in configuration order, NULL past the last one
+struct digipeater* digipeater_get(const int index) {
+	if (index < 0 || index >= digi_count)
+		return NULL;
+	return digis[index];
 }
 
-static void sourcecalltick(struct digipeater *digi);
 
-int  digipeater_postpoll(struct aprxpolls *app)
+// Viscous queue of a <source> has entries due
+static void viscous_expired(struct aprxtimer *t, void *arg)
 {
-	int d, s, i, donecount;
-
-	if (tv_timercmp(&tokenbucket_timer, &tick) < 0) {
-		tv_timeradd_seconds( &tokenbucket_timer, &tokenbucket_timer, TOKENBUCKET_INTERVAL);
-		run_tokenbucket_timers();
-	}
-
-	// Over all digipeaters..
-	for (d = 0; d < digi_count; ++d) {
-		struct digipeater *digi = digis[d];
-
-		// Over all sources in those digipeaters
-		for (s = 0; s < digi->sourcecount; ++s) {
-			struct digipeater_source * src = digi->sources[s];
-
-			// If viscous delay is zero, there is no work...
-			// if (src->viscous_delay == 0)
-			//   continue;
-			// Delay is non-zero, perhaps there is work?
-			if (src->viscous_queue_size == 0) // Empty queue
-				continue;
-			// Feed backend from viscous queue
-			donecount = 0;
-			for (i = 0; i < src->viscous_queue_size; ++i) {
-				struct dupe_record_t *dupe = src->viscous_queue[i];
-				time_t t = dupe->t + src->viscous_delay;
-				if ((t - tick.tv_sec) <= 0) {
-					if (debug)printf("%ld LEAVE VISCOUS QUEUE: dupe=%p pbuf=%p\n",
-							tick.tv_sec, dupe, dupe->pbuf);
-					if (dupe->pbuf != NULL) {
-						// We send the pbuf from viscous queue, if it still is
-						// present in the dupe record.  (For example direct sourced
-						// packets remove a packet from queued dupe record.)
-						digipeater_receive_backend(src, dupe->pbuf);
-
-						// Remove the delayed pbuf from this dupe record.
-						pbuf_put(dupe->pbuf);
-						dupe->pbuf = NULL;
-					}
-					dupecheck_put(dupe);
-					++donecount;
-				} else {
-					break; // found a case we are not yet interested in.
-				}
-			}
-			if (donecount > 0) {
-				if (donecount >= src->viscous_queue_size) {
-					// All cleared
-					src->viscous_queue_size = 0;
-				} else {
-					// Compact the queue left after this processing round
-					i = src->viscous_queue_size - donecount;
-					memcpy(&src->viscous_queue[0],
-							&src->viscous_queue[donecount],
-							sizeof(void*) * i);
-					src->viscous_queue_size = i;
-				}
+	struct digipeater_source *src = arg;
+	struct timeval tv;
+	int i, donecount;
+
+	// Feed backend from viscous queue
+	donecount = 0;
+	for (i = 0; i < src->viscous_queue_size; ++i) {
+		struct dupe_record_t *dupe = src->viscous_queue[i];
+		time_t due = dupe->t + src->viscous_delay;
+		if ((due - tick.tv_sec) <= 0) {
+			if (debug)printf("%ld LEAVE VISCOUS QUEUE: dupe=%p pbuf=%p\n",
+					tick.tv_sec, dupe, dupe->pbuf);
+			if (dupe->pbuf != NULL) {
+				// We send the pbuf from viscous queue, if it still is
+				// present in the dupe record.  (For example direct sourced
+				// packets remove a packet from queued dupe record.)
+				digipeater_receive_backend(src, dupe->pbuf);
+
+				// Remove the delayed pbuf from this dupe record.
+				pbuf_put(dupe->pbuf);
+				dupe->pbuf = NULL;
 			}
+			dupecheck_put(dupe);
+			++donecount;
+		} else {
+			break; // found a case we are not yet interested in.
 		}
 	}
-
-	return 0;
-}
-
-static int  run_tokenbucket_timers()
-{
-	int d, s;
-	// Over all digipeaters..
-	for (d = 0; d < digi_count; ++d) {
-		struct digipeater *digi = digis[d];
-
-		digi->tokenbucket += digi->tbf_increment;
-		if (digi->tokenbucket > digi->tbf_limit)
-			digi->tokenbucket = digi->tbf_limit;
-
-#ifndef DISABLE_IGATE
-		sourcecalltick(digi);
-#endif
-
-		// Over all sources in those digipeaters
-		for (s = 0; s < digi->sourcecount; ++s) {
-			struct digipeater_source * src = digi->sources[s];
-
-			src->tokenbucket += src->tbf_increment;
-			if (src->tokenbucket > src->tbf_limit)
-				src->tokenbucket = src->tbf_limit;
-
+	if (donecount > 0) {
+		if (donecount >= src->viscous_queue_size) {
+			// All cleared
+			src->viscous_queue_size = 0;
+		} else {
+			// Compact the queue left after this processing round
+			i = src->viscous_queue_size - donecount;
+			memmove(&src->viscous_queue[0],
+					&src->viscous_queue[donecount],
+					sizeof(void*) * i);
+			src->viscous_queue_size = i;
 		}
 	}
-
-	return 0;
-}
-
-#ifndef DISABLE_IGATE
-static void sourcecalltick(struct digipeater *digi)
-{
-	int i;
-	historydb_t *db = digi->historydb;
-	if (db == NULL) return; // Should never happen..
-
-	for (i = 0; i < HISTORYDB_HASH_MODULO; ++i) {
-		history_cell_t *c = db->hash[i];
-		for ( ; c != NULL; c = c->next ) {
-			c->tokenbucket += digi->src_tbf_increment;
-			if (c->tokenbucket > digi->src_tbf_limit)
-				c->tokenbucket = digi->src_tbf_limit;
-		}
+	if (src->viscous_queue_size > 0) {
+		// First entry expires first
+		tv.tv_sec  = src->viscous_queue[0]->t + src->viscous_delay;
+		tv.tv_usec = 0;
+		aprxtimer_arm(t, &tv);
 	}
 }
-#endif
 
 // An utility function that exists at GNU Libc..
 
@@ -685,7 +685,7 @@ static void dprsgw_nmea_igate( const struct aprx_interface *aif,
           if (aif != NULL) {
             igate_to_aprsis( aif->callsign, 0, (const char *)tnc2buf, tnc2addrlen, tnc2buflen, 0, 0);
           // Bytes have been counted previously, now count meaningful packet
-            erlang_add(aif->callsign, ERLANG_RX, 0, 1);
+            erlang_add_handle(aif->erlang_handle, ERLANG_RX, 0, 1);
           }
 
           char *heads[2];
@@ -745,7 +745,7 @@ static void dprsgw_rxigate( struct serialport *S )
 	    // Acceptable packet, Rx-iGate it!
 	    igate_to_aprsis( aif->callsign, 0, (const char *)tnc2addr, tnc2addrlen, tnc2bodylen, 0, 0);
           // Bytes have been counted previously, now count meaningful packet
-            erlang_add( aif->callsign, ERLANG_RX, 0, 1 );
+            erlang_add_handle( aif->erlang_handle, ERLANG_RX, 0, 1 );
 
 	    heads[0] = (char*)tnc2addr;
 	    s = heads[0];
@@ -860,7 +860,7 @@ int dprsgw_pulldprs( struct serialport *S )
 	int i;
 
         // Account all received bytes, this may or may not be a packet
-        erlang_add(aif->callsign, ERLANG_RX, S->rdlinelen, 0);
+        erlang_add_handle(aif->erlang_handle, ERLANG_RX, S->rdlinelen, 0);
 
 
 	if (S->dprsgw == NULL)
@@ -1005,16 +1005,7 @@ int freadln(FILE *fp, char *p, int buflen) // DPRSGW_DEBUG_MAIN
 
 int ttyreader_getc(struct serialport *S)  // DPRSGW_DEBUG_MAIN
 {
-	if (S->rdcursor >= S->rdlen) {	/* Out of data ? */
-		if (S->rdcursor)
-			S->rdcursor = S->rdlen = 0;
-		/* printf("-\n"); */
-		return -1;
-	}
-
-	/* printf(" %02X", 0xFF & S->rdbuf[S->rdcursor++]); */
-
-	return (0xFF & S->rdbuf[S->rdcursor++]);
+	return rdbuf_getc(&S->rd);
 }
 void igate_to_aprsis(const char *portname, const int tncid, const char *tnc2buf, int tnc2addrlen, int tnc2len, const int discard, const int strictax25_) // DPRSGW_DEBUG_MAIN
 {
@@ -1032,6 +1023,7 @@ struct timeval tick;
 int main(int argc, char *argv[]) {
   struct serialport S;
   memset(&S, 0, sizeof(S));
+  rdbuf_init(&S.rd, S.rdstore, sizeof(S.rdstore));
 
 #if 0
   // A test where string has initially some incomplete data, then finally a real data
@@ -1078,11 +1070,11 @@ int main(int argc, char *argv[]) {
     tick.tv_sec = strtol(buf1, &ep, 10); // test code time init
     if (*ep == '\t') ++ep;
     int len = n - (ep - buf1);
-    if (len > 0) {
-      memcpy(S.rdbuf+S.rdlen, ep, len);
-      S.rdlen += len;
+    if (len > 0 && rdbuf_makespace(&S.rd) >= len) {
+      memcpy(S.rd.data + S.rd.len, ep, len);
+      S.rd.len += len;
     }
-    if (S.rdlen > 0)
+    if (S.rd.len > 0)
       dprsgw_pulldprs(&S);
 
   }
@@ -38,6 +38,9 @@ cellarena_t *dupecheck_cells;
 const int duperecord_size  = sizeof(struct dupe_record_t);
 const int duperecord_align = __alignof__(struct dupe_record_t);
 
+static struct aprxtimer dupecheck_cleanup_timer;
+static void dupecheck_cleanup_expired(struct aprxtimer *t, void *arg);
+
 /*
  *	The cellmalloc does not need internal MUTEX, it is being used in single thread..
  */
@@ -49,9 +52,13 @@ void dupecheck_init(void)
 				    duperecord_size,
 				    duperecord_align,
 				    CELLMALLOC_POLICY_LIFO | CELLMALLOC_POLICY_NOMUTEX,
-				    4 /* 4 kB at the time */,
+				    32 /* 32 kB at the time, arena has
+					  at most 40 blocks */,
 				    0 /* minfree */);
 #endif
+	aprxtimer_init(&dupecheck_cleanup_timer, "dupecheck-cleanup",
+		       dupecheck_cleanup_expired, NULL, NULL);
+	aprxtimer_arm(&dupecheck_cleanup_timer, &tick);
 }
 
 /*
@@ -61,6 +68,15 @@ void dupecheck_init(void)
 dupecheck_t *dupecheck_new(const int storetime) {
 	dupecheck_t *dp = calloc(1, sizeof(dupecheck_t));
 
+	if (dp == NULL)
+		return NULL; // alloc error!
+	dp->hashsize  = DUPECHECK_DB_SIZE_MIN;
+	dp->dupecheck_db = calloc(dp->hashsize, sizeof(dupe_record_t *));
+	if (dp->dupecheck_db == NULL) {
+		free(dp);
+		return NULL; // alloc error!
+	}
+
 	++dupecheckers_count;
 	dupecheckers = realloc(dupecheckers,
 			       sizeof(dupecheck_t *) * dupecheckers_count);
@@ -136,42 +152,210 @@ void dupecheck_put(dupe_record_t *dp)
 	}
 }
 
+static int dupecheck_foldhash(const dupecheck_t *dpc, const uint32_t hash)
+{
+	uint32_t idx = hash;
+	idx ^= (idx >> 16); /* fold the hash bits.. */
+	idx ^= (idx >>  8); /* fold the hash bits.. */
+	return idx & (dpc->hashsize - 1);
+}
+
+/*
+ *	Rebuild the hash index table with a new size.
+ *	The records keep their expiry wheel positions.
+ */
+static void dupecheck_resize(dupecheck_t *dpc, const int newsize)
+{
+	dupe_record_t **olddb = dpc->dupecheck_db;
+	int oldsize = dpc->hashsize;
+	dupe_record_t *dp;
+	int i;
+
+	dpc->dupecheck_db = calloc(newsize, sizeof(dupe_record_t *));
+	if (dpc->dupecheck_db == NULL) {
+		dpc->dupecheck_db = olddb; // Keep on going with the old one
+		return;
+	}
+	dpc->hashsize = newsize;
+	++dpc->dupecheck_resizes;
+
+	for (i = 0; i < oldsize; ++i) {
+		while (( dp = olddb[i] )) {
+			int idx = dupecheck_foldhash(dpc, dp->hash);
+			olddb[i] = dp->next;
+			dp->next = dpc->dupecheck_db[idx];
+			dpc->dupecheck_db[idx] = dp;
+		}
+	}
+	free(olddb);
+
+	if (debug > 1)
+		printf("dupecheck_resize() %d -> %d buckets, %d records\n",
+		       oldsize, newsize, dpc->count);
+}
+
+/*
+ *	Expire records of one dupechecker thru the time wheel.
+ *	Records are hanging on wheel slots by their expiry second,
+ *	only those slots that have passed since previous call are
+ *	looked at.  Slots may have records of later wheel rounds too,
+ *	those are left in place.
+ */
+static int dupecheck_expire(dupecheck_t *dpc)
+{
+	dupe_record_t *dp, **dpp, **wpp;
+	time_t t, last = tick.tv_sec - 1; // Expire all with  t_exp < now
+	int cleancount = 0;
+
+	if (dpc->wheel_time == 0 || (last - dpc->wheel_time) < 0) {
+		// Fresh start, or the time has jumped backwards
+		dpc->wheel_time = last;
+		return 0;
+	}
+	t = dpc->wheel_time;
+	if ((last - t) > DUPECHECK_WHEEL_SIZE) // Full round covers all slots
+		t = last - DUPECHECK_WHEEL_SIZE;
+
+	while ((t - last) < 0) {
+		++t;
+		wpp = & dpc->wheel[t & (DUPECHECK_WHEEL_SIZE-1)];
+		while (( dp = *wpp )) {
+			if ((dp->t_exp - tick.tv_sec) >= 0) {
+				// On some later round of the wheel
+				wpp = &dp->wheelnext;
+				continue;
+			}
+			*wpp = dp->wheelnext;
+			dp->wheelnext = NULL;
+
+			// Unlink from the hash chain
+			dpp = & dpc->dupecheck_db[dupecheck_foldhash(dpc, dp->hash)];
+			while (*dpp != dp)
+				dpp = &(*dpp)->next;
+			*dpp = dp->next;
+			dp->next = NULL;
+
+			--dpc->count;
+			dupecheck_put(dp);
+			++cleancount;
+		}
+	}
+	dpc->wheel_time = last;
+	dpc->dupecheck_expired += cleancount;
+
+	// Shrink back when the load has gone away
+	if (dpc->hashsize > DUPECHECK_DB_SIZE_MIN &&
+	    dpc->count < dpc->hashsize / 8)
+		dupecheck_resize(dpc, dpc->hashsize / 2);
+
+	return cleancount;
+}
+
 /*	The  dupecheck_cleanup() is for regular database cleanups,
- *	Call this about once a minute.
+ *	Call this every few seconds.
  *
  *	Note: entry validity is possibly shorter time than the cleanup
- *	invocation interval!
+ *	invocation interval!  Lookups ignore expired records.
  */
 static void dupecheck_cleanup(void)
 {
-	dupe_record_t *dp, **dpp;
-	int cleancount = 0, i, d;
+	int cleancount = 0, d;
 
 	// All dupecheckers..
 	for (d = 0; d < dupecheckers_count; ++d) {
-
-	  // Within this dupechecker...
-	  struct dupecheck_t *dpc = dupecheckers[d];
-	  for (i = 0; i < DUPECHECK_DB_SIZE; ++i) {
-	    dpp = & (dpc->dupecheck_db[i]);
-	    while (( dp = *dpp )) {
-	      if ((dp->t_exp - tick.tv_sec) < 0) {
-		/* Old..  discard. */
-		*dpp = dp->next;
-		dp->next = NULL;
-		dupecheck_put(dp);
-		++cleancount;
-		continue;
-	      }
-	      /* No expiry, just advance the pointer */
-	      dpp = &dp->next;
-	    }
-	  }
+		cleancount += dupecheck_expire(dupecheckers[d]);
+		if (debug > 1)
+			dupecheck_dump_stats(dupecheckers[d], stdout);
 	}
 	// hlog( LOG_DEBUG, "dupecheck_cleanup() removed %d entries, count now %ld",
 	//       cleancount, dupecheck_cellgauge );
 }
 
+void dupecheck_dump_stats(const dupecheck_t *dpc, FILE *fp)
+{
+	fprintf(fp, "dupecheck: storetime=%d records=%d buckets=%d lookups=%ld probes=%ld maxprobe=%d inserts=%ld expired=%ld resizes=%ld\n",
+		dpc->storetime, dpc->count, dpc->hashsize,
+		dpc->dupecheck_lookups, dpc->dupecheck_probes,
+		dpc->dupecheck_maxprobe, dpc->dupecheck_inserts,
+		dpc->dupecheck_expired, dpc->dupecheck_resizes);
+}
+
+/*
+ *	Find a live record matching the canonic address and data.
+ */
+static dupe_record_t *dupecheck_find(dupecheck_t *dpc, const uint32_t hash,
+				     const char *addr, const int addrlen,
+				     const char *data, const int datalen)
+{
+	dupe_record_t *dp;
+	int probes = 0;
+
+	++dpc->dupecheck_lookups;
+	dp = dpc->dupecheck_db[dupecheck_foldhash(dpc, hash)];
+	for ( ; dp != NULL; dp = dp->next) {
+		++probes;
+		if ((dp->t_exp - tick.tv_sec) < 0) {
+			// Old ones are left for the expiry wheel
+			continue;
+		}
+		if (dp->hash == hash) {
+			// HASH match!  And not too old!
+			if (dp->alen == addrlen &&
+			    dp->plen == datalen &&
+			    memcmp(addr, dp->addresses, addrlen) == 0 &&
+			    memcmp(data, dp->packet,    datalen) == 0) {
+				// PACKET MATCH!
+				break;
+			}
+			// no packet match.. check next
+		}
+	}
+	dpc->dupecheck_probes += probes;
+	if (probes > dpc->dupecheck_maxprobe)
+		dpc->dupecheck_maxprobe = probes;
+
+	return dp;
+}
+
+/*
+ *	Add comparison copy of non-dupe into dupe-db,
+ *	both on hash chain and on expiry wheel.
+ */
+static dupe_record_t *dupecheck_add(dupecheck_t *dpc, const uint32_t hash,
+				    const char *addr, const int addrlen,
+				    const char *data, const int datalen,
+				    const time_t t)
+{
+	dupe_record_t *dp;
+	int idx;
+
+	dp = dupecheck_db_alloc(addrlen, datalen);
+	if (dp == NULL) return NULL; // alloc error!
+
+	memcpy(dp->addresses, addr, addrlen);
+	memcpy(dp->packet,    data, datalen);
+
+	dp->hash  = hash;
+	dp->t     = t;
+	dp->t_exp = t + dpc->storetime;
+
+	if (dpc->count >= 2 * dpc->hashsize) // Keep chains short
+		dupecheck_resize(dpc, dpc->hashsize * 2);
+
+	idx = dupecheck_foldhash(dpc, hash);
+	dp->next = dpc->dupecheck_db[idx];
+	dpc->dupecheck_db[idx] = dp;
+
+	idx = dp->t_exp & (DUPECHECK_WHEEL_SIZE-1);
+	dp->wheelnext = dpc->wheel[idx];
+	dpc->wheel[idx] = dp;
+
+	++dpc->count;
+	++dpc->dupecheck_inserts;
+
+	return dp;
+}
+
 /*
  *	Check a single packet for duplicates in APRS sense
  *	The addr/alen must be in TNC2 monitor format, data/dlen
@@ -188,8 +372,9 @@ dupe_record_t *dupecheck_aprs(dupecheck_t *dpc,
 	int i;
 	int addrlen;  // length of the address part
 	int datalen;  // length of the payload
-	uint32_t hash, idx;
-	dupe_record_t **dpp, *dp;
+	uint32_t hash;
+	keyhash_state_t hs;
+	dupe_record_t *dp;
 
 	// 1) collect canonic rep of the address (SRC,DEST, no VIAs)
 	i = 1;
@@ -219,58 +404,26 @@ dupe_record_t *dupecheck_aprs(dupecheck_t *dpc,
 
 	// 2) calculate checksum (from disjoint memory areas)
 
-	hash = keyhash(addr, addrlen, 0);
-	hash = keyhash(data, datalen, hash);
-	idx  = hash;
+	keyhash_begin(&hs, 0);
+	keyhash_update(&hs, addr, addrlen);
+	keyhash_update(&hs, data, datalen);
+	hash = keyhash_final(&hs);
 
 	// 3) lookup if same checksum is in some hash bucket chain
 	//  3b) compare packet...
 	//    3b1) flag as F_DUPE if so
-	// DUPECHECK_DB_SIZE == 16 -> 4 bits index
-	idx ^= (idx >> 16); /* fold the hash bits.. */
-	idx ^= (idx >>  8); /* fold the hash bits.. */
-	idx ^= (idx >>  4); /* fold the hash bits.. */
-	i = idx % DUPECHECK_DB_SIZE;
-	dpp = &(dpc->dupecheck_db[i]);
-	while (*dpp) {
-		dp = *dpp;
-		if ((dp->t_exp - tick.tv_sec) < 0) {
-			// Old ones are discarded when seen
-			*dpp = dp->next;
-			dp->next = NULL;
-			dupecheck_put(dp);
-			continue;
-		}
-		if (dp->hash == hash) {
-			// HASH match!  And not too old!
-			if (dp->alen == addrlen &&
-			    dp->plen == datalen &&
-			    memcmp(addr, dp->addresses, addrlen) == 0 &&
-			    memcmp(data, dp->packet,    datalen) == 0) {
-				// PACKET MATCH!
-				dp->seen += 1;
-				return dp;
-			}
-			// no packet match.. check next
-		}
-		dpp = &dp->next;
+	dp = dupecheck_find(dpc, hash, addr, addrlen, data, datalen);
+	if (dp != NULL) {
+		dp->seen += 1;
+		return dp;
 	}
-	// dpp points to pointer at the tail of the chain
 
 	// 4) Add comparison copy of non-dupe into dupe-db
 
-	dp = dupecheck_db_alloc(addrlen, datalen);
+	dp = dupecheck_add(dpc, hash, addr, addrlen, data, datalen, tick.tv_sec);
 	if (dp == NULL) return NULL; // alloc error!
-	*dpp = dp; // Put it on tail of existing chain
-
-
-	memcpy(dp->addresses, addr, addrlen);
-	memcpy(dp->packet,    data, datalen);
 
 	dp->seen  = 1;  // First observation gets number 1
-	dp->hash  = hash;
-	dp->t     = tick.tv_sec;
-	dp->t_exp = tick.tv_sec + dpc->storetime;
 	return NULL;
 }
 
@@ -282,8 +435,9 @@ dupe_record_t *dupecheck_aprs(dupecheck_t *dpc,
 dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int viscous_delay)
 {
 	int i;
-	uint32_t hash, idx;
-	dupe_record_t **dpp, *dp;
+	uint32_t hash;
+	keyhash_state_t hs;
+	dupe_record_t *dp;
 	const char *addr = pb->data;
 	int   alen = pb->dstcall_end - addr;
 
@@ -363,9 +517,10 @@ dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int vis
 	  printf("'\n");
 	} */
 
-	hash = keyhash(addr, addrlen, 0);
-	hash = keyhash(data, datalen, hash);
-	idx  = hash;
+	keyhash_begin(&hs, 0);
+	keyhash_update(&hs, addr, addrlen);
+	keyhash_update(&hs, data, datalen);
+	hash = keyhash_final(&hs);
 
 	/* if (debug>1) {
 	     printf("DUPECHECK: Addr='");
@@ -379,51 +534,22 @@ dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int vis
 	// 3) lookup if same checksum is in some hash bucket chain
 	//  3b) compare packet...
 	//    3b1) flag as F_DUPE if so
-	// DUPECHECK_DB_SIZE == 16 -> 4 bits index
-	idx ^= (idx >> 16); /* fold the hash bits.. */
-	idx ^= (idx >>  8); /* fold the hash bits.. */
-	idx ^= (idx >>  4); /* fold the hash bits.. */
-	i = idx % DUPECHECK_DB_SIZE;
-	dpp = &(dpc->dupecheck_db[i]);
-	while (*dpp) {
-		dp = *dpp;
-		if ((dp->t_exp - tick.tv_sec) < 0) {
-			// Old ones are discarded when seen
-			*dpp = dp->next;
-			dp->next = NULL;
-			dupecheck_put(dp);
-			continue;
-		}
-		if (dp->hash == hash) {
-			// HASH match!  And not too old!
-			if (dp->alen == addrlen &&
-			    dp->plen == datalen &&
-			    memcmp(addr, dp->addresses, addrlen) == 0 &&
-			    memcmp(data, dp->packet,    datalen) == 0) {
-				// PACKET MATCH!
-				if (viscous_delay > 0)
-				  dp->delayed_seen += 1;
-				else
-				  dp->seen += 1;
-				return dp;
-			}
-			// no packet match.. check next
-		}
-		dpp = &dp->next;
+	dp = dupecheck_find(dpc, hash, addr, addrlen, data, datalen);
+	if (dp != NULL) {
+		if (viscous_delay > 0)
+		  dp->delayed_seen += 1;
+		else
+		  dp->seen += 1;
+		return dp;
 	}
-	// dpp points to pointer at the tail of the chain
 
 	// 4) Add comparison copy of non-dupe into dupe-db
 
-	dp = dupecheck_db_alloc(addrlen, datalen);
+	dp = dupecheck_add(dpc, hash, addr, addrlen, data, datalen, tick.tv_sec);
 	if (dp == NULL) {
 	  if (debug) printf("DUPECHECK ALLOC ERROR!\n");
 	  return NULL; // alloc error!
 	}
-	*dpp = dp; // Put it on tail of existing chain
-
-	memcpy(dp->addresses, addr, addrlen);
-	memcpy(dp->packet,    data, datalen);
 
 	dp->pbuf  = pbuf_get(pb); // increments refcount
 	if (viscous_delay > 0) {  // First observation gets number 1
@@ -435,49 +561,46 @@ dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int vis
 	  dp->delayed_seen = 0;
 	}
 
-	dp->hash  = hash;
-	dp->t     = tick.tv_sec;
-	dp->t_exp = tick.tv_sec + dpc->storetime;
-
 	return dp;
 }
 
 /*
- * dupechecker aprx poll integration, timed tasks control
- *
+ *  dupecheck_restore() puts back a record from a warm-restart snapshot,
+ *  canonic address and data as they were in the saved record.  Returns
+ *  NULL when it has expired, or is there already.  No pbuf is attached.
  */
-
-static struct timeval dupecheck_cleanup_nexttime;
-
-static void dupecheck_resettime(void *arg)
+dupe_record_t *dupecheck_restore(dupecheck_t *dpc,
+				 const char *addr, const int addrlen,
+				 const char *data, const int datalen,
+				 const time_t t)
 {
-	struct timeval *tv = (struct timeval *)arg;
-        *tv = tick;
-}
+	keyhash_state_t hs;
+	uint32_t hash;
 
-int dupecheck_prepoll(struct aprxpolls *app)
-{
-	if (time_reset) {
-        	dupecheck_resettime(&dupecheck_cleanup_nexttime);
-        }
+	if (addrlen > sizeof(((dupe_record_t*)0)->addresses))
+		return NULL;
+	if ((t + dpc->storetime - tick.tv_sec) < 0)
+		return NULL; // Expired while we were away
 
-	if (dupecheck_cleanup_nexttime.tv_sec == 0) dupecheck_cleanup_nexttime = tick;
+	keyhash_begin(&hs, 0);
+	keyhash_update(&hs, addr, addrlen);
+	keyhash_update(&hs, data, datalen);
+	hash = keyhash_final(&hs);
 
-	if (tv_timercmp(&dupecheck_cleanup_nexttime, &app->next_timeout) > 0)
-		app->next_timeout = dupecheck_cleanup_nexttime;
+	if (dupecheck_find(dpc, hash, addr, addrlen, data, datalen) != NULL)
+		return NULL;
 
-	return 0;		/* No poll descriptors, only time.. */
+	return dupecheck_add(dpc, hash, addr, addrlen, data, datalen, t);
 }
 
+/*
+ * dupechecker timed tasks control
+ *
+ */
 
-int dupecheck_postpoll(struct aprxpolls *app)
+static void dupecheck_cleanup_expired(struct aprxtimer *t, void *arg)
 {
-        if (tv_timercmp(&dupecheck_cleanup_nexttime, &tick) > 0)
-		return 0;	/* Too early.. */
-
-        tv_timeradd_seconds( &dupecheck_cleanup_nexttime, &tick, 30 ); // tick every 30 second or so
+        aprxtimer_arm_millis(t, 5000); // tick every 5 seconds, the wheel keeps it cheap
 
 	dupecheck_cleanup();
-
-	return 0;
 }
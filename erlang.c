@@ -61,6 +61,141 @@ struct erlang_file {
 	struct erlangline lines[1];
 };
 
+#ifdef ERLANGSTORAGE
+/*
+ *  Latency histograms live in the head block of the backing store,
+ *  and they describe only the running server process.
+ */
+
+static const char *erlang_latency_names[LATENCY_COUNT] = {
+	"parse", "filter", "dupecheck", "digipeat",
+	"aprsis-queue", "mainloop", "pollwait"
+};
+
+static void erlang_latency_startops(void)
+{
+	int i;
+
+	memset(ErlangHead->latency, 0, sizeof(ErlangHead->latency));
+	for (i = 0; i < LATENCY_COUNT; ++i)
+		strncpy(ErlangHead->latency[i].name, erlang_latency_names[i],
+			sizeof(ErlangHead->latency[i].name) - 1);
+	ErlangHead->latency_count   = LATENCY_COUNT;
+	ErlangHead->latency_version = ERLANG_LATENCY_VERSION;
+}
+
+int64_t erlang_latency_now(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+/* Bucket of a value: exact below 4, then 4 buckets per power of two */
+static int erlang_latency_bucket(uint64_t v)
+{
+	int msb = 0, i;
+
+	if (v < 4)
+		return v;
+#ifdef __GNUC__
+	msb = 63 - __builtin_clzll(v);
+#else
+	while ((v >> msb) > 1)
+		++msb;
+#endif
+	i = 4 * (msb - 1) + ((v >> (msb - 2)) & 3);
+	if (i >= ERLANG_LATENCY_BUCKETS)
+		i = ERLANG_LATENCY_BUCKETS - 1;
+	return i;
+}
+
+/* Highest value that lands on bucket i */
+static uint64_t erlang_latency_bucketvalue(int i)
+{
+	if (i < 4)
+		return i;
+	return ((uint64_t)(4 + i % 4 + 1) << (i / 4 - 1)) - 1;
+}
+
+void erlang_latency_record(LatencyStage stage, int64_t nanos)
+{
+	struct erlang_latency *L;
+
+	if (ErlangHead == NULL || ErlangHead->latency_version == 0)
+		return;	// Not started
+	if (nanos < 0)
+		nanos = 0;
+	L = &ErlangHead->latency[stage];
+	L->count += 1;
+	L->sum   += nanos;
+	if ((uint64_t)nanos > L->max)
+		L->max = nanos;
+	L->buckets[erlang_latency_bucket(nanos)] += 1;
+}
+
+void erlang_latency_add(LatencyStage stage, int64_t t0)
+{
+	erlang_latency_record(stage, erlang_latency_now() - t0);
+}
+
+static double erlang_latency_percentile(const struct erlang_latency *L, double q)
+{
+	uint64_t target = (uint64_t)(L->count * q + 0.999999);
+	uint64_t seen = 0, v;
+	int i;
+
+	for (i = 0; i < ERLANG_LATENCY_BUCKETS; ++i) {
+		seen += L->buckets[i];
+		if (seen >= target && seen > 0)
+			break;
+	}
+	v = erlang_latency_bucketvalue(i);
+	if (v > L->max)
+		v = L->max;
+	return v / 1000.0;
+}
+
+/*
+ *  erlang_latency_print()  -- percentiles in microseconds
+ */
+void erlang_latency_print(FILE *fp)
+{
+	int i;
+
+	if (ErlangHead == NULL ||
+	    ErlangHead->latency_version != ERLANG_LATENCY_VERSION) {
+		fprintf(fp, "No latency data\n");
+		return;
+	}
+
+	fprintf(fp, "%-14s %10s %12s %12s %12s %12s %12s %12s\n",
+		"LATENCY", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < ErlangHead->latency_count && i < LATENCY_COUNT; ++i) {
+		const struct erlang_latency *L = &ErlangHead->latency[i];
+
+		fprintf(fp, "%-14.15s %10llu", L->name, (unsigned long long)L->count);
+		if (L->count == 0) {
+			fprintf(fp, "\n");
+			continue;
+		}
+		fprintf(fp, " %12.3f %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+			(double)L->sum / L->count / 1000.0,
+			erlang_latency_percentile(L, 0.50),
+			erlang_latency_percentile(L, 0.90),
+			erlang_latency_percentile(L, 0.99),
+			erlang_latency_percentile(L, 0.999),
+			L->max / 1000.0);
+	}
+}
+#endif
+
 static void erlang_backingstore_startops(void)
 {
 	ErlangHead->server_pid = getpid();
@@ -73,6 +208,10 @@ static void erlang_backingstore_startops(void)
 		strncpy(ErlangHead->mycall, mycall,
 			sizeof(ErlangHead->mycall));
 	ErlangHead->mycall[sizeof(ErlangHead->mycall) - 1] = 0;	/* NUL terminate */
+
+#ifdef ERLANGSTORAGE
+	erlang_latency_startops();
+#endif
 }
 
 static int erlang_backingstore_grow(int do_create, int add_count)
@@ -103,7 +242,8 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 		new_size *= pagesize;
 	}
 	if (new_size == 0) {
-		new_size = pagesize;
+		// Room at least for the head block
+		new_size = (sizeof(struct erlang_file) + pagesize - 1) / pagesize * pagesize;
 		doing_init = 1;
 	}
 	/* new_size expanded to be exact page size multiple.  */
@@ -398,115 +538,157 @@ void erlang_set(const char *portname, int bytes_per_minute)
 }
 
 /*
- *  erlang_add()
+ *  Interned port names.  A handle is resolved once at configuration
+ *  time, and it stays valid even when the backing store is remapped
+ *  at erlang_start(), as the handle is then resolved again.
+ *  Handles count from 1, zero (as in calloc()ed memory) is none.
  */
-void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets)
-{
-	struct erlangline *E;
-	if (!portname) return;
-
-	E = erlang_findline(portname, (int) ((1200.0 * 60) / 8.2));
 
-	if (debug > 1)
-	  printf("erlang_add(%s, %s, %d, %d)\n", portname,
-		 (erl == ERLANG_RX ? "RX":(erl == ERLANG_TX ? "TX": "DROP")),
-		 bytes, packets);
+struct erlang_handle {
+	char *name;
+	int   line;	/* ErlangLines[] index, or -1 */
+};
+static struct erlang_handle *erlang_handles;
+static int erlang_handlecount;
 
-	if (!E)
-		return;
+static void erlang_handle_resolve(struct erlang_handle *H)
+{
+	struct erlangline *E = erlang_findline(H->name, (int) ((1200.0 * 60) / 8.2));
+	H->line = (E != NULL) ? E->index : -1;
+}
 
-	if (erl == ERLANG_RX) {
-		E->SNMP.bytes_rx += bytes;
-		E->SNMP.packets_rx += packets;
-		E->SNMP.update = tick.tv_sec;
-		E->last_update = tick.tv_sec;
+/*
+ *  erlang_handle()  -- handle of a port, or 0
+ */
+int erlang_handle(const char *portname)
+{
+	int i;
+	if (!portname) return 0;
 
-#ifdef ERLANGSTORAGE
-		E->erl1m.bytes_rx += bytes;
-		E->erl1m.packets_rx += packets;
-		E->erl1m.update = tick.tv_sec;
+	for (i = 0; i < erlang_handlecount; ++i) {
+		if (strcmp(portname, erlang_handles[i].name) == 0)
+			return i+1;
+	}
+	erlang_handles = realloc(erlang_handles,
+				 sizeof(*erlang_handles) * (erlang_handlecount + 1));
+	erlang_handles[erlang_handlecount].name = strdup(portname);
+	erlang_handle_resolve(&erlang_handles[erlang_handlecount]);
+	return ++erlang_handlecount;
+}
 
-		E->erl10m.bytes_rx += bytes;
-		E->erl10m.packets_rx += packets;
-		E->erl10m.update = tick.tv_sec;
+static void erlang_handles_resolve(void)
+{
+	int i;
+	for (i = 0; i < erlang_handlecount; ++i)
+		erlang_handle_resolve(&erlang_handles[i]);
+}
 
-		E->erl60m.bytes_rx += bytes;
-		E->erl60m.packets_rx += packets;
-		E->erl60m.update = tick.tv_sec;
-#else
-#if (USE_ONE_MINUTE_STORAGE == 1)
-		E->erl1m.bytes_rx += bytes;
-		E->erl1m.packets_rx += packets;
-		E->erl1m.update = tick.tv_sec;
+/*
+ *  Counts go to the shortest interval block only, and are folded
+ *  into the longer ones at erlang_time_end()
+ */
+#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_STORAGE == 1))
+#define ERLANG_ACCUMULATOR(E) (&(E)->erl1m)
 #else
-		E->erl10m.bytes_rx += bytes;
-		E->erl10m.packets_rx += packets;
-		E->erl10m.update = tick.tv_sec;
-#endif
+#define ERLANG_ACCUMULATOR(E) (&(E)->erl10m)
 #endif
+
+static void erlang_add_line(struct erlangline *E, ErlangMode erl, int bytes, int packets)
+{
+	struct erlang_rxtxbytepkt *acc = ERLANG_ACCUMULATOR(E);
+
+	E->SNMP.update = tick.tv_sec;
+	E->last_update = tick.tv_sec;
+	acc->update    = tick.tv_sec;
+
+	if (erl == ERLANG_RX) {
+		E->SNMP.bytes_rx += bytes;
+		E->SNMP.packets_rx += packets;
+		acc->bytes_rx += bytes;
+		acc->packets_rx += packets;
 	}
 	if (erl == ERLANG_TX) {
 		E->SNMP.bytes_tx += bytes;
 		E->SNMP.packets_tx += packets;
-		E->SNMP.update = tick.tv_sec;
-		E->last_update = tick.tv_sec;
-
-#ifdef ERLANGSTORAGE
-		E->erl1m.bytes_tx += bytes;
-		E->erl1m.packets_tx += packets;
-		E->erl1m.update = tick.tv_sec;
-
-		E->erl10m.bytes_tx += bytes;
-		E->erl10m.packets_tx += packets;
-		E->erl10m.update = tick.tv_sec;
-
-		E->erl60m.bytes_tx += bytes;
-		E->erl60m.packets_tx += packets;
-		E->erl60m.update = tick.tv_sec;
-#else
-#if (USE_ONE_MINUTE_STORAGE == 1)
-		E->erl1m.bytes_tx += bytes;
-		E->erl1m.packets_tx += packets;
-		E->erl1m.update = tick.tv_sec;
-#else
-		E->erl10m.bytes_tx += bytes;
-		E->erl10m.packets_tx += packets;
-		E->erl10m.update = tick.tv_sec;
-#endif
-#endif
+		acc->bytes_tx += bytes;
+		acc->packets_tx += packets;
 	}
 	if (erl == ERLANG_DROP) {
 		E->SNMP.bytes_rxdrop += bytes;
 		E->SNMP.packets_rxdrop += packets;
-		E->SNMP.update = tick.tv_sec;
-		E->last_update = tick.tv_sec;
+		acc->bytes_rxdrop += bytes;
+		acc->packets_rxdrop += packets;
+	}
+}
 
-#ifdef ERLANGSTORAGE
-		E->erl1m.bytes_rxdrop += bytes;
-		E->erl1m.packets_rxdrop += packets;
-		E->erl1m.update = tick.tv_sec;
+/*
+ *  erlang_add_handle()
+ */
+void erlang_add_handle(int handle, ErlangMode erl, int bytes, int packets)
+{
+	int line;
 
-		E->erl10m.bytes_rxdrop += bytes;
-		E->erl10m.packets_rxdrop += packets;
-		E->erl10m.update = tick.tv_sec;
+	if (handle <= 0 || handle > erlang_handlecount) return;
+	line = erlang_handles[handle-1].line;
 
-		E->erl60m.bytes_rxdrop += bytes;
-		E->erl60m.packets_rxdrop += packets;
-		E->erl60m.update = tick.tv_sec;
-#else
-#if (USE_ONE_MINUTE_STORAGE == 1)
-		E->erl1m.bytes_rxdrop += bytes;
-		E->erl1m.packets_rxdrop += packets;
-		E->erl1m.update = tick.tv_sec;
-#else
-		E->erl10m.bytes_rxdrop += bytes;
-		E->erl10m.packets_rxdrop += packets;
-		E->erl10m.update = tick.tv_sec;
-#endif
-#endif
-	}
+	if (debug > 1)
+	  printf("erlang_add(%s, %s, %d, %d)\n", erlang_handles[handle-1].name,
+		 (erl == ERLANG_RX ? "RX":(erl == ERLANG_TX ? "TX": "DROP")),
+		 bytes, packets);
+
+	if (line < 0 || line >= ErlangLinesCount)
+		return;
+	erlang_add_line(ErlangLines[line], erl, bytes, packets);
 }
 
+/*
+ *  erlang_queue()  -- record current send queue depth of a port
+ */
+void erlang_queue(int handle, int bytes)
+{
+	int line;
+
+	if (handle <= 0 || handle > erlang_handlecount) return;
+	line = erlang_handles[handle-1].line;
+	if (line < 0 || line >= ErlangLinesCount)
+		return;
+	ErlangLines[line]->queue_bytes = bytes;
+}
+
+/*
+ *  erlang_add()  -- by port name, for the occasional caller
+ */
+void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets)
+{
+	struct erlangline *E;
+	if (!portname) return;
+
+	E = erlang_findline(portname, (int) ((1200.0 * 60) / 8.2));
+
+	if (debug > 1)
+	  printf("erlang_add(%s, %s, %d, %d)\n", portname,
+		 (erl == ERLANG_RX ? "RX":(erl == ERLANG_TX ? "TX": "DROP")),
+		 bytes, packets);
+
+	if (!E)
+		return;
+	erlang_add_line(E, erl, bytes, packets);
+}
+
+#ifdef ERLANGSTORAGE
+static void erlang_fold(struct erlang_rxtxbytepkt *dst, const struct erlang_rxtxbytepkt *src)
+{
+	dst->packets_rx     += src->packets_rx;
+	dst->packets_rxdrop += src->packets_rxdrop;
+	dst->packets_tx     += src->packets_tx;
+	dst->bytes_rx       += src->bytes_rx;
+	dst->bytes_rxdrop   += src->bytes_rxdrop;
+	dst->bytes_tx       += src->bytes_tx;
+	if (src->update > dst->update)
+		dst->update = src->update;
+}
+#endif
+
 
 /*
  *  erlang_time_end() - process erlang measurement interval time end event
@@ -561,6 +743,11 @@ static void erlang_time_end(void)
 					       msgbuf);
 			}
 
+#ifdef ERLANGSTORAGE
+			// Longer intervals get this minute's counts now
+			erlang_fold(&E->erl10m, &E->erl1m);
+			erlang_fold(&E->erl60m, &E->erl1m);
+#endif
 			E->erl1m.update = tick.tv_sec;
 			E->e1[E->e1_cursor] = E->erl1m;
 			++E->e1_cursor;
@@ -660,46 +847,47 @@ static void erlang_time_end(void)
 		fclose(fp);
 }
 
-int erlang_prepoll(struct aprxpolls *app)
+static struct aprxtimer erlang_timer;
+
+static void erlang_timer_arm(void)
 {
-        if (time_reset) {
-        	if (debug) printf("erlang_timer_init() to be called\n");
-        	erlang_timer_init(NULL);
-        }
-
-	if (tv_timercmp(&app->next_timeout, &erlang_time_end_1min) > 0)
-		app->next_timeout = erlang_time_end_1min;
-	if (tv_timercmp(&app->next_timeout, &erlang_time_end_10min) > 0)
-		app->next_timeout = erlang_time_end_10min;
+	struct timeval *tv = &erlang_time_end_1min;
+
+	if (tv_timercmp(&erlang_time_end_10min, tv) < 0)
+		tv = &erlang_time_end_10min;
 #ifdef ERLANGSTORAGE
-	if (tv_timercmp(&app->next_timeout, &erlang_time_end_60min) > 0)
-		app->next_timeout = erlang_time_end_60min;
+	if (tv_timercmp(&erlang_time_end_60min, tv) < 0)
+		tv = &erlang_time_end_60min;
 #endif
-	return 0;
+	aprxtimer_arm(&erlang_timer, tv);
 }
 
-int erlang_postpoll(struct aprxpolls *app)
+static void erlang_timer_expired(struct aprxtimer *t, void *arg)
 {
-	if (tv_timercmp(&tick, &erlang_time_end_1min) >= 0 ||
-	    tv_timercmp(&tick, &erlang_time_end_10min) >= 0
-#ifdef ERLANGSTORAGE
-	    || tv_timercmp(&tick, &erlang_time_end_60min) >= 0
-#endif
-	    )
-		erlang_time_end();
+	erlang_time_end();
+	erlang_timer_arm();
+}
 
-	return 0;
+static void erlang_timer_reset(struct aprxtimer *t, void *arg)
+{
+	if (debug) printf("erlang_timer_init() to be called\n");
+	erlang_timer_init(NULL);
+	erlang_timer_arm();
 }
 
 
 void erlang_init(const char *syslog_facility_name)
 {
         erlang_timer_init(NULL);
+	aprxtimer_init(&erlang_timer, "erlang",
+		       erlang_timer_expired, erlang_timer_reset, NULL);
+	erlang_timer_arm();
 }
 
 void erlang_start(int do_create)
 {
 	erlang_backingstore_open(do_create);
+	erlang_handles_resolve();
 	if (do_create > 1)
 		erlang_backingstore_startops();
 }
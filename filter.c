@@ -114,10 +114,47 @@ struct filter_refcallsign_t {
 	char	callsign[CALLSIGNLEN_MAX+1]; /* size: 10.. */
 	int8_t	reflen; /* length and flags */
 };
+
+/* Hash index over a callsign set, compiled at filter parse time
+ * for sets with FILTER_INDEX_MINNAMES or more names.
+ * Keys are stored in upper case, each key tells the first position
+ * in the refcallsigns[] array where it appears as plain name, and
+ * as wild-carded name.  Lookups probe the key and its prefixes,
+ * and pick the lowest position, which keeps the "first match in
+ * entry order" semantics of the linear scan.
+ */
+#define FILTER_INDEX_MINNAMES 8
+
+/* Zero makes filter_parse() skip the callsign set indexes and the
+ * range boxes, for  "aprx-bench -c"  to compare the two against the
+ * plain interpreter.
+ */
+int filter_compile = 1;
+
+struct filter_refindex_entry_t {
+	uint32_t hash;
+	int16_t	 exactidx;	/* first non-wildcard ref, -1 if none	*/
+	int16_t	 wildidx;	/* first wildcard ref, -1 if none	*/
+	int8_t	 len;		/* 0 for an unused slot			*/
+	char	 callsign[CALLSIGNLEN_MAX+1];
+};
+
+struct filter_refindex_t {
+	int	mask;		/* slot count - 1, power of two */
+	struct filter_refindex_entry_t entries[1];
+};
+
+typedef int (*filter_process_fn_t)(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb);
+
 struct filter_head_t {
 	struct filter_t *next;
 	const char *text; /* filter text as is		*/
+	/* per type evaluator, picked at parse time	*/
+	filter_process_fn_t process;
+	struct filter_refindex_t *refindex; /* b, d, g, o, p, u sets */
 	float   f_latN, f_lonE;
+	float	f_boxdlat, f_boxdlon; /* R/F/T range bounding box half-sizes,
+					 negative when not bounded */
 	union {
 	  float   f_latS;   /* for A filter */
 	  float   f_coslat; /* for R filter */
@@ -224,6 +261,8 @@ int hist_lookup_interval = 20; /* FIXME: Configurable: Cache historydb
 				  each filter entry referring to some
 				  fixed callsign (f,m,t) */
 
+static filter_process_fn_t filter_process_fn(const char type);
+
 float filter_lat2rad(float lat)
 {
 	return (lat * (M_PI / 180.0));
@@ -234,6 +273,18 @@ float filter_lon2rad(float lon)
 	return (lon * (M_PI / 180.0));
 }
 
+/*
+ *  COS of latitude, for the range filters.  It is not calculated
+ *  at the parse, but when some filter needs it for the first time,
+ *  and then kept in the pbuf or the historydb cell.
+ */
+float filter_coslat(float *coslat, const float lat)
+{
+	if (*coslat < 0.0F)
+		*coslat = cosf(lat);
+	return *coslat;
+}
+
 
 const int filter_cellsize  = sizeof(struct filter_t);
 const int filter_cellalign = __alignof__(struct filter_t);
@@ -723,6 +774,145 @@ void filter_postprocess_dupefilter(struct pbuf_t *pbuf, historydb_t *historydb)
  *
  */
 
+#define FILTER_REFHASH_INIT 2166136261U
+
+static inline uint32_t filter_refindex_hashstep(uint32_t hash, const char c)
+{
+	// Prefixes are hashed one character at the time, the same
+	// way on index build, and on lookup.  A rolling FNV-1a step
+	// has the hash of every prefix for one multiplication.
+	uint32_t u = c & 0xFF;
+	if ('a' <= u && u <= 'z')
+		u -= ('a' - 'A');
+	return (hash ^ u) * 16777619U;
+}
+
+static inline uint32_t filter_refindex_hashkey(uint32_t hash)
+{
+	// Only at the probed lengths: fold the high bits down to
+	// those picking the slot.
+	return hash ^ (hash >> 15);
+}
+
+static int filter_refindex_cmp(const struct filter_refindex_entry_t *e, const uint32_t hash, const char *key, const int len)
+{
+	return (e->hash == hash && e->len == len &&
+		strncasecmp(e->callsign, key, len) == 0);
+}
+
+/*
+ *	filter_refindex_build()  compiles the callsign set of filter
+ *	into a hash index.  Sets extended by following filter entries
+ *	of same type get their index rebuilt.
+ */
+
+static void filter_refindex_build(struct filter_t *f)
+{
+	struct filter_refcallsign_t *r = f->h.u5.refcallsigns;
+	struct filter_refindex_t *ri;
+	int i, j, k, size;
+
+	if (f->h.refindex != NULL) {
+		free(f->h.refindex);
+		f->h.refindex = NULL;
+	}
+	if (f->h.u3.numnames < FILTER_INDEX_MINNAMES || !filter_compile)
+		return; // linear scan is fine with this few
+
+	for (size = 16; size < 2 * f->h.u3.numnames; size <<= 1)
+		;
+	ri = calloc(1, sizeof(*ri) + sizeof(ri->entries[0]) * (size-1));
+	if (ri == NULL)
+		return; // Use the linear scan then
+	ri->mask = size - 1;
+
+	for (i = 0; i < f->h.u3.numnames; ++i) {
+		const int len = r[i].reflen & LengthMask;
+		uint32_t hash = FILTER_REFHASH_INIT;
+		struct filter_refindex_entry_t *e;
+
+		if (len == 0)
+			continue; // never matches anything
+		for (j = 0; j < len; ++j)
+			hash = filter_refindex_hashstep(hash, r[i].callsign[j]);
+		hash = filter_refindex_hashkey(hash);
+
+		for (j = hash & ri->mask; ; j = (j+1) & ri->mask) {
+			e = &ri->entries[j];
+			if (e->len == 0) {
+				e->hash     = hash;
+				e->len      = len;
+				e->exactidx = -1;
+				e->wildidx  = -1;
+				for (k = 0; k < len; ++k)
+					e->callsign[k] = toupper(r[i].callsign[k] & 0xFF);
+				break;
+			}
+			if (filter_refindex_cmp(e, hash, r[i].callsign, len))
+				break;
+		}
+		// Keep the first one in entry order
+		if (r[i].reflen & WildCard) {
+			if (e->wildidx < 0)  e->wildidx = i;
+		} else {
+			if (e->exactidx < 0) e->exactidx = i;
+		}
+	}
+	f->h.refindex = ri;
+}
+
+static const struct filter_refindex_entry_t *filter_refindex_find(const struct filter_refindex_t *ri, const uint32_t hash, const char *key, const int len)
+{
+	int j;
+	for (j = hash & ri->mask; ; j = (j+1) & ri->mask) {
+		const struct filter_refindex_entry_t *e = &ri->entries[j];
+		if (e->len == 0)
+			return NULL;
+		if (filter_refindex_cmp(e, hash, key, len))
+			return e;
+	}
+}
+
+/*
+ *	filter_match_on_refindex()  does the same as the linear scan
+ *	below, but looks up every prefix of the key from the index.
+ */
+
+static int filter_match_on_refindex(struct filter_refcallsign_t *ref, int keylen, struct filter_t *f, const MatchEnum wildok)
+{
+	const struct filter_refindex_t *ri = f->h.refindex;
+	const char *key = ref->callsign;
+	uint32_t hash = FILTER_REFHASH_INIT;
+	int len, best = f->h.u3.numnames;
+
+	for (len = 1; len <= keylen && len <= CALLSIGNLEN_MAX; ++len) {
+		const struct filter_refindex_entry_t *e;
+		int idx = -1;
+
+		hash = filter_refindex_hashstep(hash, key[len-1]);
+		if (wildok == MatchExact && len < keylen)
+			continue;
+		e = filter_refindex_find(ri, filter_refindex_hashkey(hash), key, len);
+		if (e == NULL)
+			continue;
+
+		if (wildok == MatchWild && len < keylen) {
+			// Only wild-carded ones match on a shorter prefix
+			idx = e->wildidx;
+		} else {
+			idx = e->exactidx;
+			if (idx < 0 || (e->wildidx >= 0 && e->wildidx < idx))
+				idx = e->wildidx;
+		}
+		if (idx >= 0 && idx < best)
+			best = idx;
+	}
+	if (best >= f->h.u3.numnames)
+		return 0; /* no match */
+
+	return ( f->h.u5.refcallsigns[best].reflen & NegationFlag ? 2 : 1 );
+}
+
 static int filter_match_on_callsignset(struct filter_refcallsign_t *ref, int keylen, struct filter_t *f, const MatchEnum wildok)
 {
 	int i;
@@ -731,6 +921,9 @@ static int filter_match_on_callsignset(struct filter_refcallsign_t *ref, int key
 
 	if (debug) printf(" filter_match_on_callsignset(ref='%s', keylen=%d, filter='%s')\n", ref->callsign, keylen, f->h.text);
 
+	if (f->h.refindex != NULL)
+		return filter_match_on_refindex(ref, keylen, f, wildok);
+
 	for (i = 0; i < f->h.u3.numnames; ++i) {
 		const int reflen = r[i].reflen;
 		const int len    = reflen & LengthMask;
@@ -898,6 +1091,8 @@ static int filter_parse_one_callsignset(struct filter_t **ffp, struct filter_t *
 		}
 	}
 	/* If not extending existing filter item, let main parser do the finalizations */
+	if (extend)
+		filter_refindex_build(ff);
 
 	return extend;
 }
@@ -981,6 +1176,52 @@ int filter_parse_one_s(struct filter_t *f0, struct filter_t **ffp, const char *f
 }
 
 
+/*
+ *	filter_range_box()  computes range filter bounding box half-sizes
+ *	in radians around the center point.  The box is made a bit
+ *	larger than the range, so that float rounding can not make
+ *	the pre-test disagree with the full distance calculation.
+ *	Longitude is left unbounded when the range reaches a pole.
+ *	The R (and M) filters have a fixed center, and get the box at
+ *	parse time, the F and T filters when their center is looked up.
+ */
+static void filter_range_box(struct filter_t *f, const float range)
+{
+	float d = fabsf(range) / (111.2 * 180.0 / M_PI); /* radians */
+	float s;
+
+	d = d * 1.01 + 0.0001;
+	if (!filter_compile)
+		d = 2.0 * M_PI; /* no latitude is outside of this */
+
+	f->h.f_boxdlat = d;
+	f->h.f_boxdlon = -1.0;
+	if (d < M_PI * 0.5 && f->h.u1.f_coslat > 0.0) {
+		s = sinf(d) / f->h.u1.f_coslat;
+		if (s < 1.0)
+			f->h.f_boxdlon = asinf(s);
+	}
+}
+
+/*
+ *	Bounding box pre-test of the range filters: a point outside of
+ *	the box is certainly farther than the range, and needs no
+ *	trigonometry.
+ */
+static int filter_range_outside_box(const struct filter_t *f, const float lat2, const float lon2)
+{
+	float dlon;
+
+	if (fabsf(lat2 - f->h.f_latN) > f->h.f_boxdlat)
+		return 1;
+	if (f->h.f_boxdlon < 0.0)
+		return 0; /* longitude is not bounded */
+	dlon = fabsf(lon2 - f->h.f_lonE);
+	if (dlon > M_PI)
+		dlon = 2.0 * M_PI - dlon;
+	return (dlon > f->h.f_boxdlon);
+}
+
 int filter_parse(struct filter_t **ffp, const char *filt)
 {
 	struct filter_t f0;
@@ -1456,6 +1697,12 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 	strcpy(f->textbuf, filt); /* and copy of filter text */
 #endif
 
+	f->h.process = filter_process_fn(f->h.type);
+	if (f->h.type == 'r')
+		filter_range_box(f, f->h.u2.f_dist);
+	else if (strchr("bdgopuBDGOPU", f->h.type))
+		filter_refindex_build(f);
+
 	/* hlog(LOG_DEBUG, "parsed filter: t=%c n=%d '%s'", f->h.type, f->h.negation, f->h.text); */
 
 	/* link to the tail.. */
@@ -1478,8 +1725,12 @@ void filter_free(struct filter_t *f)
 #ifndef _FOR_VALGRIND_
 		if (f->h.text != f->textbuf)
 			free((void*)(f->h.text));
+		if (f->h.refindex)
+			free(f->h.refindex);
 		cellfree(filter_cells, f);
 #else
+		if (f->h.refindex)
+			free(f->h.refindex);
 		free(f);
 #endif
 	}
@@ -1545,7 +1796,7 @@ static float maidenhead_km_distance(float lat1, float coslat1, float lon1, float
  *
  */
 
-static int filter_process_one_a(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_a(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* a/latN/lonW/latS/lonE  	Area filter
 
@@ -1580,7 +1831,7 @@ static int filter_process_one_a(struct pbuf_t *pb, struct filter_t *f)
 	return 0;
 }
 
-static int filter_process_one_b(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_b(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* b/call1/call2...  	Budlist filter
 
@@ -1603,7 +1854,7 @@ static int filter_process_one_b(struct pbuf_t *pb, struct filter_t *f)
 	return filter_match_on_callsignset(&ref, i, f, MatchWild);
 }
 
-static int filter_process_one_d(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_d(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* d/digi1/digi2...  	Digipeater filter
 
@@ -1729,7 +1980,8 @@ static int filter_process_one_f(struct pbuf_t *pb, struct filter_t *f, historydb
 		f->h.u3.numnames = 1;
 		f->h.f_latN   = history->lat;
 		f->h.f_lonE   = history->lon;
-		f->h.u1.f_coslat = history->coslat;
+		f->h.u1.f_coslat = filter_coslat(&history->coslat, history->lat);
+		filter_range_box(f, f->h.u2.f_dist);
 	}
 	if (!f->h.u3.numnames) {
 	  if (debug) printf("f-filter: no history lookup result (numnames == 0) -> return 0\n");
@@ -1742,8 +1994,15 @@ static int filter_process_one_f(struct pbuf_t *pb, struct filter_t *f, historydb
 
 	lat2    = pb->lat;
 	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
 
+	if (filter_range_outside_box(f, lat2, lon2)) {
+		if (debug) printf("f-filter: outside of range box\n");
+		if (f->h.u2.f_dist < 0.0)
+			return (f->h.negation) ? 2 : 1;
+		return 0;
+	}
+
+	coslat2 = filter_coslat(&pb->cos_lat, pb->lat);
 	r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
 	if (debug) printf("f-filter: r=%.1f km\n", r);
 
@@ -1761,7 +2020,7 @@ static int filter_process_one_f(struct pbuf_t *pb, struct filter_t *f, historydb
 }
 #endif
 
-static int filter_process_one_g(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_g(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* g/call1/call2...  	Group Messaging filter
 
@@ -1815,7 +2074,7 @@ static int filter_process_one_m(struct pbuf_t *pb, struct filter_t *f)
 
 	lat2    = pb->lat;
 	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
+	coslat2 = filter_coslat(&pb->cos_lat, pb->lat);
 
 	r = maidenhead_km_distance(myloc_lat, myloc_coslat, myloc_lon, lat2, coslat2, lon2);
 	if (f->h.u2.f_dist < 0.0) {
@@ -1832,7 +2091,7 @@ static int filter_process_one_m(struct pbuf_t *pb, struct filter_t *f)
 }
 #endif
 
-static int filter_process_one_o(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_o(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* o/obj1/obj2...  	Object filter
 	   Pass all objects with the exact name of obj1, obj2, ...
@@ -1868,7 +2127,7 @@ static int filter_process_one_o(struct pbuf_t *pb, struct filter_t *f)
 	return filter_match_on_callsignset(&ref, i, f, MatchWild);
 }
 
-static int filter_process_one_p(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_p(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 
 	/* p/aa/bb/cc...  	Prefix filter
@@ -1969,7 +2228,7 @@ static int filter_process_one_q(struct pbuf_t *pb, struct filter_t *f)
 }
 #endif
 
-static int filter_process_one_r(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_r(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* r/lat/lon/dist  	Range filter
 
@@ -2001,8 +2260,14 @@ static int filter_process_one_r(struct pbuf_t *pb, struct filter_t *f)
 
 	lat2    = pb->lat;
 	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
 
+	if (filter_range_outside_box(f, lat2, lon2)) {
+		if (f->h.u2.f_dist < 0.0)
+			return (f->h.negation) ? 2 : 1;
+		return 0;
+	}
+
+	coslat2 = filter_coslat(&pb->cos_lat, pb->lat);
 	r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
 
 	if (f->h.u2.f_dist < 0.0) {
@@ -2018,7 +2283,7 @@ static int filter_process_one_r(struct pbuf_t *pb, struct filter_t *f)
 	return 0;
 }
 
-static int filter_process_one_s(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_s(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* s/pri/alt/over  	Symbol filter
 
@@ -2166,7 +2431,8 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 			f->h.hist_age = tick.tv_sec + hist_lookup_interval;
 			f->h.f_latN   = history->lat;
 			f->h.f_lonE   = history->lon;
-			f->h.u1.f_coslat = history->coslat;
+			f->h.u1.f_coslat = filter_coslat(&history->coslat, history->lat);
+			filter_range_box(f, range);
 		}
 #endif
 		if (!f->h.u3.numnames) return 0; /* No valid data at range center position cache */
@@ -2177,8 +2443,14 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 
 		lat2    = pb->lat;
 		lon2    = pb->lng;
-		coslat2 = pb->cos_lat;
 
+		if (filter_range_outside_box(f, lat2, lon2)) {
+			if (range < 0.0)
+				return (f->h.negation) ? 2 : 1;
+			return 0;
+		}
+
+		coslat2 = filter_coslat(&pb->cos_lat, pb->lat);
 		r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
 
 		if (range < 0.0) {
@@ -2197,7 +2469,7 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 	return (f->h.negation ? (rc+rc) : rc);
 }
 
-static int filter_process_one_u(struct pbuf_t *pb, struct filter_t *f)
+static int filter_process_one_u(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	/* u/unproto1/unproto2/...  	Unproto filter
 
@@ -2227,108 +2499,106 @@ static int filter_process_one_u(struct pbuf_t *pb, struct filter_t *f)
 	return filter_match_on_callsignset(&ref, i, f, MatchWild);
 }
 
-static int filter_process_one(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
+static int filter_process_bad(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
-	int rc = 0;
+	return -1;
+}
 
-	if (debug>1) printf("filter_process_one() type=%c  '%s'\n",f->h.type, f->h.text);
+/*
+ *	filter_process_fn()  picks the evaluator for filter type at parse
+ *	time, so that filter_process() does not need to switch on it for
+ *	every packet.
+ */
 
-	switch (f->h.type) {
+static filter_process_fn_t filter_process_fn(const char type)
+{
+	switch (type) {
 
 	case 'a':
 	case 'A':
-		rc = filter_process_one_a(pb, f);
-		break;
+		return filter_process_one_a;
 
 	case 'b':
 	case 'B':
-		rc = filter_process_one_b(pb, f);
-		break;
+		return filter_process_one_b;
 	case 'd':
 	case 'D':
-		rc = filter_process_one_d(pb, f);
-		break;
+		return filter_process_one_d;
 
 #if 0
 	case 'e':
 	case 'E':
-		rc = filter_process_one_e(pb, f);
-		break;
+		return filter_process_one_e;
 #endif
 
 #ifndef DISABLE_IGATE
 	case 'f':
 	case 'F':
-		rc = filter_process_one_f(pb, f, historydb);
-		break;
+		return filter_process_one_f;
 #endif
         case 'g':
         case 'G':
-		rc = filter_process_one_g(pb, f);
-		break;
+		return filter_process_one_g;
 
 #if 0 // these are compiled as R filters, no M filters exist internally
 	case 'm':
 	case 'M':
-		rc = filter_process_one_m(pb, f);
-		break;
+		return filter_process_one_m;
 #endif
 	case 'o':
 	case 'O':
-		rc = filter_process_one_o(pb, f);
-		break;
+		return filter_process_one_o;
 
 	case 'p':
 	case 'P':
-		rc = filter_process_one_p(pb, f);
-		break;
+		return filter_process_one_p;
 #if 0
 	case 'q':
 	case 'Q':
-		rc = filter_process_one_q(pb, f);
-		break;
+		return filter_process_one_q;
 #endif
 	case 'r':
 	case 'R':
-		rc = filter_process_one_r(pb, f);
-		break;
+		return filter_process_one_r;
 
 	case 's':
 	case 'S':
-		rc = filter_process_one_s(pb, f);
-		break;
+		return filter_process_one_s;
 
 	case 't':
 	case 'T':
-		rc = filter_process_one_t(pb, f, historydb);
-		break;
+		return filter_process_one_t;
 
 	case 'u':
 	case 'U':
-		rc = filter_process_one_u(pb, f);
-		break;
+		return filter_process_one_u;
 
 	default:
-		rc = -1;
 		break;
 	}
-	// hlog(LOG_DEBUG, "filter '%s'  rc=%d", f->h.text, rc);
-
-	return rc;
+	return filter_process_bad;
 }
 
 int filter_process(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb)
 {
 	int seen_accept = 0;
+	int64_t t0 = erlang_latency_now();
 
 	for ( ; f; f = f->h.next ) {
-		int rc = filter_process_one(pb, f, historydb);
+		int rc;
+
+		if (debug>1) printf("filter_process_one() type=%c  '%s'\n",f->h.type, f->h.text);
+
+		rc = f->h.process(pb, f, historydb);
 		/* no reports to user about bad filters.. */
 		if (rc == 1)
 			seen_accept = 1;
-		else if (rc == 2)
-			return -1;
+		else if (rc == 2) {
+			seen_accept = -1;
+			break;
 			/* "2" reply means: "match, but don't pass.." */
+		}
 	}
+	erlang_latency_add(LATENCY_FILTER, t0);
 	return seen_accept;
 }
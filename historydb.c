@@ -27,33 +27,60 @@ void historydb_hashmatch(void) {}
 void historydb_keymatch(void) {}
 void historydb_dataupdate(void) {}
 
-// Single aprx wide alloc system
-static cellarena_t   *historydb_cells;
+// Single aprx wide alloc system for packet texts
+static cellarena_t   *historydb_packets;
 
-const int historydb_cellsize  = sizeof(struct history_cell_t);
-const int historydb_cellalign = __alignof__(struct history_cell_t);
+static struct aprxtimer historydb_cleanup_timer;
+static void historydb_cleanup_expired(struct aprxtimer *t, void *arg);
+
+#define HISTORYDB_CLEANUP_MILLIS  1000	// a slice every second..
+#define HISTORYDB_CLEANUP_ROUND     60	// .. whole table in a minute
 
 void historydb_init(void)
 {
-	// printf("historydb_init() sizeof(mutex)=%d sizeof(rwlock)=%d\n",
-	//       sizeof(pthread_mutex_t), sizeof(rwlock_t));
-
-	// _dbs = malloc(sizeof(void*));
-	// _dbs_count = 0;
-
-	historydb_cells = cellinit( "historydb",
-				    historydb_cellsize,
-				    historydb_cellalign, 
-				    CELLMALLOC_POLICY_FIFO,
-				    32 /* 32 kB */,
-				    0 /* minfree */ );
+	historydb_packets = cellinit( "historydb",
+				      HISTORYDB_PACKETCELL,
+				      __alignof__(char*),
+				      CELLMALLOC_POLICY_FIFO,
+				      128 /* 128 kB */,
+				      0 /* minfree */ );
+
+	aprxtimer_init(&historydb_cleanup_timer, "historydb-cleanup",
+		       historydb_cleanup_expired, NULL, NULL);
+	aprxtimer_arm(&historydb_cleanup_timer, &tick);
+}
+
+static int historydb_table_alloc(historydb_t *db, int size)
+{
+	history_cell_t *cells;
+	int tsize = HISTORYDB_INITIAL_SIZE;
+	int bits  = 8;
+
+	while (tsize < size) {
+		tsize <<= 1;
+		bits  += 1;
+	}
+	cells = calloc(tsize, sizeof(cells[0]));
+	if (cells == NULL)
+		return -1; // alloc error, db is untouched
+	db->cells = cells;
+	db->size  = tsize;
+	db->bits  = bits;
+	return 0;
 }
 
 /* new instance - for new digipeater tx */
-historydb_t *historydb_new(void)
+historydb_t *historydb_new(int size)
 {
 	historydb_t *db = calloc(1, sizeof(*db));
 
+	if (db == NULL)
+		return NULL; // alloc error!
+	if (historydb_table_alloc(db, size) < 0) {
+		free(db);
+		return NULL;
+	}
+
 	++_dbs_count;
 	_dbs = realloc(_dbs, sizeof(void*)*_dbs_count);
 	_dbs[_dbs_count-1] = db;
@@ -62,31 +89,183 @@ historydb_t *historydb_new(void)
 }
 
 
+/* Home slot of hash value */
+static inline int historydb_slot(const historydb_t *db, const uint32_t h1)
+{
+	return (h1 * 2654435761U) >> (32 - db->bits);
+}
+
+/* Release packet text storage of the cell */
+static void historydb_freepacket(history_cell_t *cp)
+{
+	if (cp->packet == NULL)
+		return;
+	if (cp->packetcell)
+		cellfree( historydb_packets, cp->packet );
+	else
+		free( cp->packet );
+	cp->packet = NULL;
+}
+
+/* Place packet text on the cell, small ones on the slab */
+static void historydb_setpacket(history_cell_t *cp, const char *packet, const int packetlen)
+{
+	int issmall = (packetlen <= HISTORYDB_PACKETCELL);
+
+	if (cp->packet != NULL && cp->packetcell != issmall)
+		historydb_freepacket(cp);
+	if (cp->packet == NULL) {
+		cp->packetcell = 0;
+		if (issmall) {
+			cp->packet = cellmalloc( historydb_packets );
+			cp->packetcell = (cp->packet != NULL);
+		}
+		if (cp->packet == NULL)
+			// Needs bigger buffer than slab cell, or
+			// slab is full, thus it retrieves that from heap.
+			cp->packet = malloc( issmall ? HISTORYDB_PACKETCELL : packetlen );
+	} else if (!issmall && cp->packetlen < packetlen) {
+		char *p = realloc( cp->packet, packetlen );
+		if (p == NULL) {
+			// Keep the old buffer, but without text in it
+			cp->packetlen = 0;
+			return;
+		}
+		cp->packet = p;
+	}
+	if (cp->packet == NULL) {
+		// Out of memory, the cell stays without packet text
+		cp->packetlen = 0;
+		return;
+	}
+	cp->packetlen = packetlen;
+	memcpy( cp->packet, packet, cp->packetlen );
+}
 
-/* Called only under WR-LOCK */
-void historydb_free(struct history_cell_t *p)
+static void historydb_free(history_cell_t *p)
 {
-	if (p->packet != p->packetbuf)
-		free(p->packet);
+	historydb_freepacket(p);
 	if (p->last_heard != p->last_heard_buf)
 		free(p->last_heard);
+}
 
-	--p->db->historydb_cellgauge;
+/* Move cell content to another slot */
+static void historydb_move(history_cell_t *dst, history_cell_t *src)
+{
+	*dst = *src;
+	if (src->last_heard == src->last_heard_buf)
+		dst->last_heard = dst->last_heard_buf;
+}
 
-	cellfree( historydb_cells, p );
+static void historydb_grow(historydb_t *db)
+{
+	history_cell_t *old = db->cells;
+	int i, oldsize = db->size;
+
+	if (historydb_table_alloc(db, oldsize * 2) < 0) {
+		// Keep on using the old table, it still has free slots
+		if (debug) printf("historydb grow to %d slots failed\n", oldsize * 2);
+		return;
+	}
+	for (i = 0; i < oldsize; ++i) {
+		history_cell_t *cp = &old[i];
+		int j;
+		if (cp->keylen == 0) continue;
+		j = historydb_slot(db, cp->hash1);
+		while (db->cells[j].keylen != 0)
+			j = (j + 1) & (db->size - 1);
+		historydb_move(&db->cells[j], cp);
+	}
+	free(old);
+	db->cleanupcursor = 0;
+	if (debug > 1) printf("historydb grown to %d slots\n", db->size);
+}
+
+/* Find a cell by key, or NULL */
+static history_cell_t *historydb_find(historydb_t *db, const uint32_t h1, const char *keybuf, const int keylen)
+{
+	int i = historydb_slot(db, h1);
+	history_cell_t *cp;
+
+	for (;; i = (i + 1) & (db->size - 1)) {
+		cp = &db->cells[i];
+		if (cp->keylen == 0)
+			return NULL; // end of probe sequence
+		if (cp->hash1 == h1) {
+			// Hash match, compare the key
+			historydb_hashmatch(); // debug thing -- a profiling counter
+			++db->historydb_hashmatches;
+			if (cp->keylen == keylen &&
+			    memcmp(cp->key, keybuf, keylen) == 0) {
+				// Key match!
+				historydb_keymatch(); // debug thing -- a profiling counter
+				++db->historydb_keymatches;
+				return cp;
+			}
+		}
+	}
 }
 
-/* Called only under WR-LOCK */
-struct history_cell_t *historydb_alloc(historydb_t *db, int packet_len)
+/* Empty cell for a key that is known not to be in the table */
+static history_cell_t *historydb_newcell(historydb_t *db, const uint32_t h1, const char *keybuf, const int keylen)
 {
-	struct history_cell_t *ret = cellmalloc( historydb_cells );
-	if (!ret) return NULL;
+	history_cell_t *cp;
+	int i;
+
+	// Keep load factor below 3/4
+	if ((db->historydb_cellgauge + 1) * 4 > db->size * 3)
+		historydb_grow(db);
+
+	i = historydb_slot(db, h1);
+	while (db->cells[i].keylen != 0)
+		i = (i + 1) & (db->size - 1);
+
+	cp = &db->cells[i];
+	cp->last_heard = ((top_interfaces_group <= MAX_IF_GROUP) ?
+			  cp->last_heard_buf :
+			  calloc(top_interfaces_group, sizeof(time_t)));
+	memcpy(cp->key, keybuf, keylen);
+	cp->key[keylen] = 0; /* zero terminate */
+	cp->keylen = keylen;
+	cp->hash1  = h1;
+
+	// Initial value is 32.0 tokens to permit
+	// digipeat a packet source at the first
+	// time it has been heard -- including to
+	// possible multiple transmitters. Within
+	// about 5 seconds this will be dropped
+	// down to max burst rate of the srcratefilter
+	// parameter. This code does not know how
+	// many interfaces there are...
+	cp->tokenbucket  = 32.0;
+	cp->tbf_filltime = tick.tv_sec;
 	++db->historydb_cellgauge;
-	ret->db = db;
-	ret->last_heard = ((top_interfaces_group <= MAX_IF_GROUP) ?
-			   ret->last_heard_buf :
-			   malloc(sizeof(time_t)*top_interfaces_group));
-	return ret;
+	return cp;
+}
+
+/* Remove a cell, close the gap by moving the probe sequence back */
+static void historydb_delete(historydb_t *db, history_cell_t *cp)
+{
+	const int mask = db->size - 1;
+	int i = cp - db->cells;
+	int j = i, k;
+
+	historydb_free(cp);
+	--db->historydb_cellgauge;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		if (db->cells[j].keylen == 0)
+			break;
+		k = historydb_slot(db, db->cells[j].hash1);
+		// Can the entry at j move back to i ?
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			historydb_move(&db->cells[i], &db->cells[j]);
+			i = j;
+		}
+	}
+	memset(&db->cells[i], 0, sizeof(db->cells[i]));
 }
 
 /*
@@ -98,15 +277,11 @@ void historydb_atend(void)
 	int j, i;
 	for (j = 0; j < _dbs_count; ++j) {
 	  historydb_t *db = _dbs[j];
-	  struct history_cell_t *hp, *hp2;
-	  for (i = 0; i < HISTORYDB_HASH_MODULO; ++i) {
-	    hp = db->hash[i];
-	    while (hp) {
-	      hp2 = hp->next;
-	      historydb_free(hp);
-	      hp = hp2;
-	    }
+	  for (i = 0; i < db->size; ++i) {
+	    if (db->cells[i].keylen != 0)
+	      historydb_free(&db->cells[i]);
 	  }
+	  free(db->cells);
 	}
 }
 
@@ -126,25 +301,18 @@ void historydb_dump(const historydb_t *db, FILE *fp)
 {
 	/* Dump the historydb out on text format */
 	int i;
-	struct history_cell_t *hp;
+	const struct history_cell_t *hp;
 	time_t expirytime   = tick.tv_sec - lastposition_storetime;
 
-	for ( i = 0; i < HISTORYDB_HASH_MODULO; ++i ) {
-		hp = db->hash[i];
-		for ( ; hp ; hp = hp->next )
-                	if (timecmp(hp->arrivaltime, expirytime) > 0)
-				historydb_dump_entry(fp, hp);
+	for ( i = 0; i < db->size; ++i ) {
+		hp = &db->cells[i];
+		if (hp->keylen != 0 &&
+		    timecmp(hp->arrivaltime, expirytime) > 0)
+			historydb_dump_entry(fp, hp);
 	}
 }
 
 
-static int foldhash( const unsigned int h1 )
-{
-	unsigned int h2 = h1 ^ (h1 >> 7) ^ (h1 >> 14); /* fold hash bits.. */
-	return (h2 % HISTORYDB_HASH_MODULO);
-}
-
-
 /* insert... */
 
 history_cell_t *historydb_insert(historydb_t *db, const struct pbuf_t *pb)
@@ -154,10 +322,9 @@ history_cell_t *historydb_insert(historydb_t *db, const struct pbuf_t *pb)
 
 history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, const int insertall)
 {
-	int i;
 	unsigned int h1;
 	int isdead = 0, keylen;
-	struct history_cell_t **hp, *cp, *cp1;
+	struct history_cell_t *cp;
 
 	time_t expirytime   = tick.tv_sec - lastposition_storetime;
 
@@ -250,78 +417,37 @@ history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, cons
 	++db->historydb_inserts;
 
 	h1 = keyhash(keybuf, keylen, 0);
-	i  = foldhash(h1);
-	if (debug > 1) printf(" key='%s' hash=%d", keybuf, i);
+	if (debug > 1) printf(" key='%s' hash=%08x", keybuf, h1);
 
-	cp = cp1 = NULL;
-	hp = &db->hash[i];
+	cp = historydb_find(db, h1, keybuf, keylen);
 
-	// scan the hash-bucket chain, and do incidential obsolete data discard
-	while (( cp = *hp )) {
-		if (timecmp(cp->arrivaltime, expirytime) < 0) {
-			// OLD...
-			*hp = cp->next;
-			cp->next = NULL;
-			historydb_free(cp);
-			continue;
-		}
-		if ( (cp->hash1 == h1)) {
-		       // Hash match, compare the key
-		    historydb_hashmatch(); // debug thing -- a profiling counter
-		    ++db->historydb_hashmatches;
-		    if ( cp->keylen == keylen &&
-			 (memcmp(cp->key, keybuf, keylen) == 0) ) {
-		  	// Key match!
-		    	historydb_keymatch(); // debug thing -- a profiling counter
-			++db->historydb_keymatches;
-			if (isdead) {
-				// Remove this key..
-				*hp = cp->next;
-				cp->next = NULL;
-				historydb_free(cp);
-				continue;
-			} else {
-				historydb_dataupdate(); // debug thing -- a profiling counter
-				// Update the data content
-				cp1 = cp;
-				if (pb->flags & F_HASPOS) {
-				  // Update coordinate, if available
-				  cp->lat         = pb->lat;
-				  cp->coslat      = pb->cos_lat;
-				  cp->lon         = pb->lng;
-				  cp->positiontime = pb->t;
-				}
-				cp->packettype  = pb->packettype;
-				cp->flags      |= pb->flags;
-
-				cp->arrivaltime = pb->t;
-				cp->flags       = pb->flags;
-				cp->packetlen   = pb->packet_len;
-				cp->last_heard[pb->source_if_group] = pb->t;
-				if ( cp->packet != cp->packetbuf )
-					free( cp->packet );
-
-				cp->packet = cp->packetbuf; // default case
-				if ( cp->packetlen > sizeof(cp->packetbuf) ) {
-				  // Needs bigger buffer than pre-allocated one,
-				  // thus it retrieves that one from heap.
-				  cp->packet = malloc( cp->packetlen );
-				}
-				memcpy( cp->packet, pb->data, cp->packetlen );
-			}
-		    }
-		} // .. else no match, advance hp..
-		hp = &(cp -> next);
+	if (cp != NULL && (isdead || timecmp(cp->arrivaltime, expirytime) < 0)) {
+		// Remove this key, it is killed or OLD...
+		historydb_delete(db, cp);
+		cp = NULL;
 	}
+	if (isdead)
+		return NULL;
+
+	if (cp != NULL) {
+		historydb_dataupdate(); // debug thing -- a profiling counter
+		// Update the data content
+		if (pb->flags & F_HASPOS) {
+		  // Update coordinate, if available
+		  cp->lat         = pb->lat;
+		  cp->coslat      = pb->cos_lat;
+		  cp->lon         = pb->lng;
+		  cp->positiontime = pb->t;
+		}
+		cp->packettype  = pb->packettype;
+		cp->arrivaltime = pb->t;
+		cp->flags       = pb->flags;
+		cp->last_heard[pb->source_if_group] = pb->t;
+		historydb_setpacket(cp, pb->data, pb->packet_len);
 
-	if (!cp1 && !isdead) {
-		// Not found on this chain, append it!
-		cp = historydb_alloc(db, pb->packet_len);
-		cp->next = NULL;
-		memcpy(cp->key, keybuf, keylen);
-		cp->key[keylen] = 0; /* zero terminate */
-		cp->keylen = keylen;
-		cp->hash1 = h1;
+	} else {
+		// Not found, insert it!
+		cp = historydb_newcell(db, h1, keybuf, keylen);
 
 		cp->lat         = pb->lat;
 		cp->coslat      = pb->cos_lat;
@@ -333,36 +459,17 @@ history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, cons
 		if (pb->flags & F_HASPOS)
 		  cp->positiontime = pb->t;
 
-		cp->packetlen   = pb->packet_len;
-		cp->packet      = cp->packetbuf; // default case
-		if (cp->packetlen > sizeof(cp->packetbuf)) {
-		  // Needs bigger buffer than pre-allocated one,
-		  // thus it retrieves that one from heap.
-		  cp->packet = malloc( cp->packetlen );
-		}
-
-                // Initial value is 32.0 tokens to permit
-                // digipeat a packet source at the first
-                // time it has been heard -- including to
-                // possible multiple transmitters. Within
-                // about 5 seconds this will be dropped
-                // down to max burst rate of the srcratefilter
-                // parameter. This code does not know how
-                // many interfaces there are...
-                cp->tokenbucket = 32.0;
-
-		*hp = cp; 
+		historydb_setpacket(cp, pb->data, pb->packet_len);
 	}
 
-	return *hp;
+	return cp;
 }
 
 history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
 {
-	int i;
 	unsigned int h1;
 	int keylen;
-	struct history_cell_t **hp, *cp, *cp1;
+	struct history_cell_t *cp;
 
 	time_t expirytime   = tick.tv_sec - lastposition_storetime;
 
@@ -418,108 +525,85 @@ history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
 	++db->historydb_inserts;
 
 	h1 = keyhash(keybuf, keylen, 0);
-	i  = foldhash(h1);
-	if (debug > 1) printf(" key='%s' hash=%d", keybuf, i);
+	if (debug > 1) printf(" key='%s' hash=%08x", keybuf, h1);
 
-	cp1 = NULL;
-	hp = &db->hash[i];
+	cp = historydb_find(db, h1, keybuf, keylen);
 
-	// scan the hash-bucket chain, and do incidential obsolete data discard
-	while (( cp = *hp ) != NULL) {
-        	if (timecmp(cp->arrivaltime, expirytime) < 0) {
-			// OLD...
-			if (debug > 1) printf(" .. dropping old record\n");
-			*hp = cp->next;
-			cp->next = NULL;
-			historydb_free(cp);
-			continue;
-		}
-		if ( (cp->hash1 == h1)) {
-		       // Hash match, compare the key
-		    historydb_hashmatch(); // debug thing -- a profiling counter
-		    ++db->historydb_hashmatches;
-		    if (debug > 1) printf(" .. found matching hash");
-		    if ( cp->keylen == keylen &&
-			 (memcmp(cp->key, keybuf, keylen) == 0) ) {
-		  	// Key match!
-		        if (debug > 1) printf(" .. found matching key!\n");
-
-		    	historydb_keymatch(); // debug thing -- a profiling counter
-			++db->historydb_keymatches;
-
-			historydb_dataupdate(); // debug thing -- a profiling counter
-			// Update the data content
-			cp1 = cp;
-			if (pb->flags & F_HASPOS) {
-			  // Update coordinate, if available
-			  cp->lat         = pb->lat;
-			  cp->coslat      = pb->cos_lat;
-			  cp->lon         = pb->lng;
-			  cp->positiontime = pb->t;
-			  cp->arrivaltime  = pb->t;
-			}
-			cp->flags      |= pb->flags;
-
-			// Track packet source timestamps
-			cp->last_heard[pb->source_if_group] = pb->t;
-
-			// Don't save a message on top of positional packet
-			if (!(pb->packettype & T_MESSAGE)) {
-			  cp->packettype  = pb->packettype;
-			  cp->arrivaltime = pb->t;
-			  cp->flags       = pb->flags;
-			  cp->packetlen   = pb->packet_len;
-			  if ( cp->packet != cp->packetbuf )
-			    free( cp->packet );
-				  
-			  cp->packet = cp->packetbuf; // default case
-			  if ( cp->packetlen > sizeof(cp->packetbuf) ) {
-			    // Needs bigger buffer than pre-allocated one,
-			    // thus it retrieves that one from heap.
-			    cp->packet = malloc( cp->packetlen );
-			  }
-			  memcpy( cp->packet, pb->data, cp->packetlen );
-			}
-		    }
-		} // .. else no match, advance hp..
-		hp = &(cp -> next);
+	if (cp != NULL && timecmp(cp->arrivaltime, expirytime) < 0) {
+		// OLD...
+		if (debug > 1) printf(" .. dropping old record\n");
+		historydb_delete(db, cp);
+		cp = NULL;
 	}
 
-	if (!cp1) {
-		if (debug > 1) printf(" .. inserting new history entry.\n");
+	if (cp != NULL) {
+		if (debug > 1) printf(" .. found matching key!\n");
 
-		// Not found on this chain, append it!
-		cp = historydb_alloc(db, pb->packet_len);
-		cp->next = NULL;
-		memcpy(cp->key, keybuf, keylen);
-		cp->key[keylen] = 0; /* zero terminate */
-		cp->keylen = keylen;
-		cp->hash1 = h1;
+		historydb_dataupdate(); // debug thing -- a profiling counter
+		// Update the data content
+		if (pb->flags & F_HASPOS) {
+		  // Update coordinate, if available
+		  cp->lat         = pb->lat;
+		  cp->coslat      = pb->cos_lat;
+		  cp->lon         = pb->lng;
+		  cp->positiontime = pb->t;
+		  cp->arrivaltime  = pb->t;
+		}
+		cp->flags      |= pb->flags;
 
-		cp->lat         = pb->lat;
-		cp->coslat      = pb->cos_lat;
-		cp->lon         = pb->lng;
-		cp->arrivaltime = pb->t;
-		cp->packettype  = pb->packettype;
-		cp->flags       = pb->flags;
+		// Track packet source timestamps
 		cp->last_heard[pb->source_if_group] = pb->t;
-		if (pb->flags & F_HASPOS)
-		  cp->positiontime = pb->t;
 
-		cp->packetlen   = pb->packet_len;
-		cp->packet      = cp->packetbuf; // default case
-		if (cp->packetlen > sizeof(cp->packetbuf)) {
-		  // Needs bigger buffer than pre-allocated one,
-		  // thus it retrieves that one from heap.
-		  cp->packet = malloc( cp->packetlen );
+		// Don't save a message on top of positional packet
+		if (!(pb->packettype & T_MESSAGE)) {
+		  cp->packettype  = pb->packettype;
+		  cp->arrivaltime = pb->t;
+		  cp->flags       = pb->flags;
+		  historydb_setpacket(cp, pb->data, pb->packet_len);
 		}
-
-		*hp = cp; 
+		return cp;
 	}
-	else
-	  return cp1; // != NULL
 
-	return *hp;
+	if (debug > 1) printf(" .. inserting new history entry.\n");
+
+	// Not found, insert it!
+	cp = historydb_newcell(db, h1, keybuf, keylen);
+
+	cp->lat         = pb->lat;
+	cp->coslat      = pb->cos_lat;
+	cp->lon         = pb->lng;
+	cp->arrivaltime = pb->t;
+	cp->packettype  = pb->packettype;
+	cp->flags       = pb->flags;
+	cp->last_heard[pb->source_if_group] = pb->t;
+	if (pb->flags & F_HASPOS)
+	  cp->positiontime = pb->t;
+
+	historydb_setpacket(cp, pb->data, pb->packet_len);
+
+	return cp;
+}
+
+
+/*
+ *	Put back a cell from a warm-restart snapshot.  Caller fills in
+ *	the rest of it.  NULL when the key is there already.
+ */
+history_cell_t *historydb_restore(historydb_t *db, const char *keybuf, const int keylen, const char *packet, const int packetlen)
+{
+	uint32_t h1;
+	history_cell_t *cp;
+
+	if (keylen <= 0 || keylen > CALLSIGNLEN_MAX+1)
+		return NULL;
+
+	h1 = keyhash(keybuf, keylen, 0);
+	if (historydb_find(db, h1, keybuf, keylen) != NULL)
+		return NULL;
+
+	cp = historydb_newcell(db, h1, keybuf, keylen);
+	historydb_setpacket(cp, packet, packetlen);
+	return cp;
 }
 
 
@@ -527,35 +611,30 @@ history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
 
 history_cell_t *historydb_lookup(historydb_t *db, const char *keybuf, const int keylen)
 {
-	int i;
 	unsigned int h1;
 	struct history_cell_t *cp;
 
 	// validity is 5 minutes shorter than expiration time..
 	time_t validitytime   = tick.tv_sec - lastposition_storetime + 5*60;
+	time_t expirytime     = tick.tv_sec - lastposition_storetime;
 
 	++db->historydb_lookups;
 
 	h1 = keyhash(keybuf, keylen, 0);
-	i  = foldhash(h1);
-
-	cp = db->hash[i];
-
-	if (debug > 1) printf("historydb_lookup('%.*s') -> i=%d", keylen, keybuf, i);
-
-	for ( ; cp != NULL ; cp = cp->next ) {
-	  if ( (cp->hash1 == h1) &&
-	       // Hash match, compare the key
-	       (cp->keylen == keylen) ) {
-	    if (debug > 1) printf(" .. hash match");
-	    if (memcmp(cp->key, keybuf, keylen) == 0) {
-	      if (debug > 1) printf(" .. key match");
-	      // Key match!
-	      if (timecmp(cp->arrivaltime, validitytime) > 0) {
-		if (debug > 1) printf(" .. and not too old\n");
-		return cp;
-	      }
-	    }
+
+	if (debug > 1) printf("historydb_lookup('%.*s') -> h=%08x", keylen, keybuf, h1);
+
+	cp = historydb_find(db, h1, keybuf, keylen);
+	if (cp != NULL) {
+	  if (debug > 1) printf(" .. key match");
+	  if (timecmp(cp->arrivaltime, validitytime) > 0) {
+	    if (debug > 1) printf(" .. and not too old\n");
+	    return cp;
+	  }
+	  if (timecmp(cp->arrivaltime, expirytime) < 0) {
+	    // Expired, drop it now instead of waiting for the cleanup
+	    if (debug > 1) printf(" .. expired, dropped");
+	    historydb_delete(db, cp);
 	  }
 	}
 	if (debug > 1) printf(" .. no match\n");
@@ -566,65 +645,49 @@ history_cell_t *historydb_lookup(historydb_t *db, const char *keybuf, const int
 
 /*
  *	The  historydb_cleanup()  exists to purge too old data out of
- *	the database at regular intervals.  Call this about once a minute.
+ *	the database.  Each call looks at next slice of the table.
  */
 
 static void historydb_cleanup(historydb_t *db)
 {
-	struct history_cell_t **hp, *cp;
-	int i, cleancount = 0;
-
-	if (debug > 1) printf("historydb_cleanup() ");
+	history_cell_t *cp;
+	int i, n, cleancount = 0;
 
 	time_t expirytime   = tick.tv_sec - lastposition_storetime;
 
-	for (i = 0; i < HISTORYDB_HASH_MODULO; ++i) {
-		hp = &db->hash[i];
+	n = db->size / HISTORYDB_CLEANUP_ROUND + 1;
+	i = db->cleanupcursor;
+	if (i >= db->size)
+		i = 0;
 
-		// multiple locks ? one for each bucket, or for a subset of buckets ?
+	if (debug > 1) printf("historydb_cleanup() %d..%d", i, i+n-1);
 
-		while (( cp = *hp )) {
-                	if (timecmp(cp->arrivaltime, expirytime) < 0) {
-				// OLD...
-				*hp = cp->next;
-				cp->next = NULL;
-				historydb_free(cp);
-				++cleancount;
-				if (debug > 1) printf(" drop(%p) i=%d", cp, i);
-
-			} else {
-				/* No expiry, just advance the pointer */
-				hp = &(cp -> next);
-			}
+	while (n-- > 0 && i < db->size) {
+		cp = &db->cells[i];
+		if (cp->keylen != 0 &&
+		    timecmp(cp->arrivaltime, expirytime) < 0) {
+			// OLD...
+			if (debug > 1) printf(" drop(%.*s) i=%d", cp->keylen, cp->key, i);
+			historydb_delete(db, cp);
+			++cleancount;
+			continue; // Something else may have moved in here
 		}
+		++i;
 	}
-	if (debug > 1) printf(" .. done.\n");
+	db->cleanupcursor = i;
+	if (debug > 1) printf(" .. done, %d dropped.\n", cleancount);
 }
 
 
-static time_t next_cleanup_time;
-
-int  historydb_prepoll(struct aprxpolls *app)
-{
-	return 0;
-}
-
-int  historydb_postpoll(struct aprxpolls *app)
+static void historydb_cleanup_expired(struct aprxtimer *t, void *arg)
 {
 	int i;
-        // Limit next cleanup to be at most 60 second in future
-        // (just in case the system time jumped back)
-        if (next_cleanup_time >= tick.tv_sec+61) {
-          next_cleanup_time = tick.tv_sec + 60;
-        }
-	if (next_cleanup_time >= tick.tv_sec) return 0;
-	next_cleanup_time = tick.tv_sec + 60; // A minute from now..
+
+	aprxtimer_arm_millis(t, HISTORYDB_CLEANUP_MILLIS);
 
 	for (i = 0; i < _dbs_count; ++i) {
 	  historydb_cleanup(_dbs[i]);
 	}
-
-	return 0;
 }
 
 #endif
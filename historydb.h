@@ -16,8 +16,9 @@
  *	Keying varies, origination callsign of positions, name
  *	for object/item.
  *
- *	Inserting does incidential cleanup scanning while traversing
- *	hash chains.
+ *	Expired entries are swept out incrementally, a slice of the
+ *	table at the time, so that whole table gets visited about
+ *	once a minute.
  *
  *	In APRS-IS there are about 25 000 distinct callsigns or
  *	item or object names with position information PER WEEK.
@@ -37,15 +38,22 @@
 #ifdef HAVE_STDINT_H
 # include <stdint.h>
 #endif
-#define HISTORYDB_HASH_MODULO 128 /* fold bits: 7 & 14 */
+#define HISTORYDB_INITIAL_SIZE 256 /* slots, power of two */
+#define HISTORYDB_PACKETCELL   170 /* Maybe a dozen packets are bigger than
+				      170 bytes long out of some 17 000 .. */
 
 struct pbuf_t;      // forward declarator
 struct historydb_t; // forward..
 
+/*
+ *  The cells live directly in an open-addressing table, and move
+ *  around when it grows or entries get deleted.  Do not keep the
+ *  pointers to them over calls to  historydb_insert*().
+ *
+ *  The cell carries what lookups and filters look at, the packet
+ *  text lives in a separate slab behind  packet  pointer.
+ */
 typedef struct history_cell_t {
-	struct history_cell_t *next;
-	struct historydb_t    *db;
-
 	time_t       arrivaltime;
 	time_t       positiontime; // When last position was received
 	time_t       *last_heard;  // Usually points to last_heard_buf[]
@@ -53,23 +61,27 @@ typedef struct history_cell_t {
 
 	float	     tokenbucket; // Source callsign specific TokenBucket filter
                                   // Digi allocates HistoryDb per transmitter.
+	time_t       tbf_filltime; // tokenbucket was filled last, the digi
+                                  // fills it when a packet looks at it
 
 	uint16_t     packettype;
 	uint16_t     flags;
 	uint16_t     packetlen;
-	uint8_t	     keylen;
+	uint8_t	     keylen;       // 0 on an empty slot
+	uint8_t	     packetcell;   // packet is on the slab, not from malloc
 	char         key[CALLSIGNLEN_MAX+2];
 
 	float	lat, coslat, lon;
 	uint32_t hash1;
 
 	char *packet;
-	char packetbuf[170]; /* Maybe a dozen packets are bigger than
-				170 bytes long out of some 17 000 .. */
 } history_cell_t;
 
 typedef struct historydb_t {
-	struct history_cell_t *hash[HISTORYDB_HASH_MODULO];
+	struct history_cell_t *cells;
+	int size;         // power of two
+	int bits;         // log2(size)
+	int cleanupcursor; // incremental expiry position
 
 	// monitor counters and gauges
 	long historydb_inserts;
@@ -81,21 +93,22 @@ typedef struct historydb_t {
 } historydb_t;
 
 
+extern int lastposition_storetime;
+
 extern void historydb_init(void);
 
-extern historydb_t *historydb_new(void);
+extern historydb_t *historydb_new(int size);
 
 extern void historydb_dump(const historydb_t *, FILE *fp);
 
 extern void historydb_atend(void);
 
-extern int  historydb_prepoll(struct aprxpolls *app);
-extern int  historydb_postpoll(struct aprxpolls *app);
 
 /* insert and lookup... */
 extern history_cell_t *historydb_insert(historydb_t *db, const struct pbuf_t*);
 extern history_cell_t *historydb_insert_(historydb_t *, const struct pbuf_t *, const int);
 extern history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t*);
 extern history_cell_t *historydb_lookup(historydb_t *db, const char *keybuf, const int keylen);
+extern history_cell_t *historydb_restore(historydb_t *db, const char *keybuf, const int keylen, const char *packet, const int packetlen);
 
 #endif
@@ -165,7 +165,7 @@ static void interface_store(struct aprx_interface *aif)
 	  printf("interface_store() aif->callsign = '%s'\n", aif->callsign);
 
 	// Init the interface specific Erlang accounting
-	erlang_add(aif->callsign, ERLANG_RX, 0, 0);
+	aif->erlang_handle = erlang_handle(aif->callsign);
 
 	all_interfaces_count += 1;
 	all_interfaces = realloc(all_interfaces,
@@ -1001,86 +1001,139 @@ void interface_receive_ax25(const struct aprx_interface *aif,
 		const uint8_t *axbuf, const int axaddrlen, const int axlen,
 		const char    *tnc2buf, const int tnc2addrlen, const int tnc2len)
 {
-	int i;
-	int digi_like_aprs = is_aprs;
+	struct pbuf_t *pb;
+	int64_t t0;
 
 	if (aif == NULL) return;         // Not a real interface for digi use
+
+	if (debug) printf("interface_receive_ax25() from %s axlen=%d tnc2len=%d\n",aif->callsign,axlen,tnc2len);
+
+	t0 = erlang_latency_now();
+	pb = interface_parse_ax25(aif, is_aprs, ui_pid,
+				  axbuf, axaddrlen, axlen,
+				  tnc2buf, tnc2addrlen, tnc2len);
+	erlang_latency_add(LATENCY_PARSE, t0);
+
+	interface_receive_pbuf(aif, pb);
+}
+
+/*
+ * interface_parse_ax25() -- the first half of interface_receive_ax25(),
+ * allocate and parse the pbuf.  Returns NULL when nobody wants it.
+ *
+ * This does not touch any of the HistoryDBs, message recipient
+ * positions are looked up at interface_receive_pbuf(), and is
+ * thus safe to call from the parse workers.
+ */
+
+struct pbuf_t *interface_parse_ax25(const struct aprx_interface *aif,
+		const int is_aprs, const int ui_pid,
+		const uint8_t *axbuf, const int axaddrlen, const int axlen,
+		const char    *tnc2buf, const int tnc2addrlen, const int tnc2len)
+{
+	int digi_like_aprs = is_aprs;
+	struct pbuf_t *pb;
+
+	if (aif == NULL) return NULL;    // Not a real interface for digi use
 	if (aif->digisourcecount == 0) {
-		if (debug>1) printf("interface_receive_ax25() no receivers for source %s\n",aif->callsign);
+		// No receivers, but APRS is added to HistoryDB anyways,
+		// if this interface is some digipeater's transmitter.
+		// Check that before allocating and parsing anything.
+		if (!is_aprs) return NULL;
+		if (digipeater_find_by_iface(aif) == NULL) return NULL;
 
-		if (!is_aprs) return;
-		if (debug > 1) printf("  Adding to histroydb anyways...");
-		struct digipeater *digi = digipeater_find_by_iface(aif);
-		if (digi == NULL) return;
-		historydb_t *historydb = digi->historydb;
-		struct pbuf_t *pb = pbuf_new(is_aprs, digi_like_aprs,
-				tnc2addrlen, tnc2buf, tnc2len,
-				axaddrlen, axbuf, axlen);
-		if (pb == NULL) return;
-		pb->source_if_group = aif->ifgroup;
-		parse_aprs(pb, historydb);
-		historydb_insert_heard(historydb, pb);
-		pbuf_put(pb);
-		return; // No receivers for this source
+	} else {
+		// AX.25 address length is missing at least a SRCADDR>DESTADDR
+		if (axaddrlen < 14) return NULL;
+
+		// FIXME: match ui_pid to list of UI PIDs that are treated with similar
+		//        digipeat rules as is APRS New-N.
+
+		// ui_pid < 0 means that this frame is not an UI frame at all.
+		if (ui_pid >= 0)  digi_like_aprs = 1; // FIXME: more precise matching?
 	}
 
-	if (debug) printf("interface_receive_ax25() from %s axlen=%d tnc2len=%d\n",aif->callsign,axlen,tnc2len);
+	// Allocate pbuf, it is born "gotten" (refcount == 1).
+	// The frame is parsed only once, and the same pbuf is then
+	// shared by all digipeater sources.  Digipeater does its
+	// address rewriting on a copy of its own.
+	pb = pbuf_new(is_aprs, digi_like_aprs,
+		      tnc2addrlen, tnc2buf, tnc2len,
+		      axaddrlen, axbuf, axlen);
+	if (pb == NULL) {
+		// Urgh!  Can't do a thing to this!
+		// Likely reason: axlen+tnc2len  > 2100 bytes!
+		return NULL;
+	}
+
+	pb->source_if_group = aif->ifgroup;
 
+	// If APRS packet, then parse for APRS meaning ...
+	if (is_aprs) {
+		int rc = parse_aprs(pb, NULL); // don't look inside 3rd party
+		if (debug)
+			printf(".. parse_aprs() rc=%s  type=0x%02x  srcif=%s  tnc2addr='%s'  info_start='%s'\n",
+			       rc ? "OK":"FAIL", pb->packettype, aif->callsign, pb->data, pb->info_start);
+	}
+	return pb;
+}
 
-	// AX.25 address length is missing at least a SRCADDR>DESTADDR
-	if (axaddrlen < 14) return;     
+/*
+ * interface_receive_pbuf() -- the second half of interface_receive_ax25(),
+ * feed the parsed pbuf to each digipeater source.  Consumes the pbuf.
+ */
+
+void interface_receive_pbuf(const struct aprx_interface *aif, struct pbuf_t *pb)
+{
+	int i;
+	struct pbuf_t *msgpb = NULL;	// pb, or its copy with recipient position
+	historydb_t *msgpb_historydb = NULL;
 
-	// FIXME: match ui_pid to list of UI PIDs that are treated with similar
-	//        digipeat rules as is APRS New-N.
+	if (pb == NULL) return;
 
-	// ui_pid < 0 means that this frame is not an UI frame at all.
-	if (ui_pid >= 0)  digi_like_aprs = 1; // FIXME: more precise matching?
+	if (aif->digisourcecount == 0) {
+		if (debug>1) printf("interface_receive_ax25() no receivers for source %s\n",aif->callsign);
 
+		if (debug > 1) printf("  Adding to histroydb anyways...");
+		// interface_parse_ax25() returned a pbuf only if this finds one
+		struct digipeater *digi = digipeater_find_by_iface(aif);
+		if (digi != NULL) {
+			historydb_t *historydb = digi->historydb;
+			parse_aprs_recipient_position(pb, historydb);
+			historydb_insert_heard(historydb, pb);
+		}
+		pbuf_put(pb);
+		return; // No receivers for this source
+	}
 
 	for (i = 0; i < aif->digisourcecount; ++i) {
 		struct digipeater_source *digisource = aif->digisources[i];
 #ifndef DISABLE_IGATE
 		// Transmitter's HistoryDB
 		historydb_t *historydb = digisource->parent->historydb;
-#endif
-
-		// Allocate pbuf, it is born "gotten" (refcount == 1)
-		struct pbuf_t *pb = pbuf_new(is_aprs, digi_like_aprs,
-				tnc2addrlen, tnc2buf, tnc2len,
-				axaddrlen, axbuf, axlen);
-		if (pb == NULL) {
-			// Urgh!  Can't do a thing to this!
-			// Likely reason: axlen+tnc2len  > 2100 bytes!
-			continue;
-		}
-
-		pb->source_if_group = aif->ifgroup;
-
-		// If APRS packet, then parse for APRS meaning ...
-		if (is_aprs) {
-			int rc = parse_aprs(pb,
-#ifndef DISABLE_IGATE
-					historydb
 #else
-					NULL
+		historydb_t *historydb = NULL;
 #endif
-					); // don't look inside 3rd party
-			char *srcif = aif->callsign;
-			if (debug)
-				printf(".. parse_aprs() rc=%s  type=0x%02x  srcif=%s  tnc2addr='%s'  info_start='%s'\n",
-						rc ? "OK":"FAIL", pb->packettype, srcif, pb->data, pb->info_start);
+		struct pbuf_t *srcpb = pb;
+
+		if (pb->is_aprs) {
+			// The shared pbuf is not touched, message recipient
+			// positions are per transmitter HistoryDB.
+			if (msgpb == NULL || historydb != msgpb_historydb) {
+				if (msgpb != NULL)
+					pbuf_put(msgpb);
+				msgpb = parse_aprs_recipient_pbuf(pb, historydb);
+				msgpb_historydb = historydb;
+			}
+			srcpb = msgpb;
 
 			// If there are no filters, permit all packets
 			if (digisource->src_filters != NULL) {
+				// Filter result is specific to this source
 				int filter_discard =
-					filter_process(pb,
-							digisource->src_filters,
-#ifndef DISABLE_IGATE
-							historydb // Transmitter HistoryDB
-#else
-							NULL
-#endif
-							);
+					filter_process(srcpb,
+						       digisource->src_filters,
+						       historydb); // Transmitter HistoryDB
 				// filter_discard > 0: accept
 				// filter_discard = 0: indifferent (not reject, not accept), tx-igate rules as is.
 				// filter_discard < 0: reject
@@ -1090,28 +1143,30 @@ void interface_receive_ax25(const struct aprx_interface *aif,
 							 (filter_discard > 0 ? "ACCEPT" : "no-match")));
 
 				if (filter_discard <= 0) {
-					pbuf_put(pb);
 					continue; // allow only explicitly accepted
 				}
 			}
 
 #ifndef DISABLE_IGATE
 			// Find out IGATE callsign (if any), and record it on transmitter's historydb.
-			if (pb->packettype & T_THIRDPARTY) {
-				rx_analyze_3rdparty( historydb, pb );
+			if (srcpb->packettype & T_THIRDPARTY) {
+				rx_analyze_3rdparty( historydb, srcpb );
 			} else {
 				// Everything else, feed to history-db
-				historydb_insert_heard( historydb, pb );
+				historydb_insert_heard( historydb, srcpb );
 			}
 #endif
 		}
 
-		// Feed it to digipeater ...
-		digipeater_receive( digisource, pb);
-
-		// .. and finally free up the pbuf (if refcount goes to zero)
-		pbuf_put(pb);
+		// Feed it to digipeater, it takes references of its own
+		// when it needs to keep the pbuf around.
+		digipeater_receive( digisource, srcpb);
 	}
+
+	// .. and finally free up the pbufs (if refcount goes to zero)
+	if (msgpb != NULL)
+		pbuf_put(msgpb);
+	pbuf_put(pb);
 }
 
 
@@ -1185,7 +1240,7 @@ void interface_transmit_ax25(const struct aprx_interface *aif, uint8_t *axaddr,
                 }
 
 		// Account the transmission anyway ;-)
-		erlang_add(aif->callsign, ERLANG_TX, axaddrlen+axdatalen + 10, 1);
+		erlang_add_handle(aif->erlang_handle, ERLANG_TX, axaddrlen+axdatalen + 10, 1);
 		break;
 	default:
 		break;
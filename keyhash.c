@@ -20,72 +20,213 @@
  *   http://www.concentric.net/~Ttwang/tech/inthash.htm
  *   http://isthe.com/chongo/tech/comp/fnv/
  *
- * Currently using FNV-1a
+ * Was FNV-1a, which goes one byte at the time.  Now the data is taken
+ * 8 bytes at the time as a little-endian 64 bit word, and each word
+ * is mixed in with one multiplication.  A final mix with the total
+ * length spreads the bits over the 32 bit result.  Keys shorter than
+ * KEYHASH_SHORT bytes, like callsigns, are hashed in one go from at
+ * most two words, and get a cheaper final mix of one multiplication.
  *
+ * Hashing happens in pieces:  keyhash_begin(), then any number of
+ * keyhash_update() calls, and keyhash_final().  Incomplete words are
+ * kept in the state, so that pieces give the same result as the same
+ * data in one go.  keyhash_updateuc() folds lower case ASCII letters
+ * to upper case, eight of them at the time.
  */
 
-/*
-//  FNV-1a  hash from   http://isthe.com/chongo/tech/comp/fnv/
-//
-//  It is algorithmic hash without memory lookups.
-//  Compiler seems to prefer actual multiplication over a bunch of
-//  fixed shifts and additions.
-*/
-
-#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "keyhash.h"
 
+#define KEYHASH_MUL   0x9E3779B97F4A7C15ULL
+#define KEYHASH_SEED  0x811C9DC5CBF29CE4ULL
+#define KEYHASH_SHORT 16
+
 void keyhash_init(void) { }
 
-uint32_t __attribute__((pure)) keyhash(const void const *p, int len, uint32_t hash)
+static inline uint64_t keyhash_load(const uint8_t *u)
+{
+	uint64_t w;
+	memcpy(&w, u, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+/* The last  len  bytes (0 to 7) as a word, without reading beyond them */
+static inline uint64_t keyhash_loadtail(const uint8_t *u, int len)
 {
-	const uint8_t *u = p;
-	int i;
-#define FNV_32_PRIME     16777619U
-#define FNV_32_OFFSET  2166136261U
-
-	if (hash == 0)
-        	hash = (uint32_t)FNV_32_OFFSET;
-
-	for (i = 0; i < len; ++i, ++u) {
-#if defined(NO_FNV_GCC_OPTIMIZATION)
-		hash *= FNV_32_PRIME;
-#else
-		hash += (hash<<1) + (hash<<4) + (hash<<7) +
-		        (hash<<8) + (hash<<24);
+	uint32_t a, b;
+
+	if (len < 4) {
+		if (len == 0)
+			return 0;
+		return ((uint64_t)u[0] | ((uint64_t)u[len/2] << (8 * (len/2))) |
+			((uint64_t)u[len-1] << (8 * (len-1))));
+	}
+	// Two overlapping loads, the common bytes are the same
+	memcpy(&a, u, 4);
+	memcpy(&b, u + len - 4, 4);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	a = __builtin_bswap32(a);
+	b = __builtin_bswap32(b);
 #endif
-		hash ^= (uint32_t) *u;
+	return a | ((uint64_t)b << (8 * (len - 4)));
+}
+
+static inline uint64_t keyhash_mix(uint64_t hash, uint64_t w)
+{
+	hash ^= w;
+	hash *= KEYHASH_MUL;
+	return hash ^ (hash >> 29);
+}
+
+/* Lower case ASCII letters of all 8 bytes to upper case */
+static inline uint64_t keyhash_ucword(uint64_t w)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t high = 0x8080808080808080ULL;
+	uint64_t low7  = w & ~high;
+	uint64_t ge_a  = low7 + (0x80 - 'a') * ones;     // high bit: >= 'a'
+	uint64_t gt_z  = low7 + (0x80 - 'z' - 1) * ones; // high bit: > 'z'
+	uint64_t lower = ge_a & ~gt_z & ~w & high;
+	return w ^ (lower >> 2);	// clear 0x20 bit of those
+}
+
+static inline uint64_t keyhash_seed(uint32_t seed)
+{
+	if (seed == 0)	// the usual case, spare a multiplication
+		return KEYHASH_SEED;
+	return KEYHASH_SEED ^ ((uint64_t)seed * KEYHASH_MUL);
+}
+
+static inline uint32_t keyhash_finish(uint64_t hash, uint32_t len)
+{
+	hash ^= len;
+
+	if (len < KEYHASH_SHORT) {
+		// At most two words went in, one multiplication
+		// spreads them well enough over the high half.
+		hash *= 0xFF51AFD7ED558CCDULL;
+		return (uint32_t)(hash >> 32);
 	}
-	return hash;
+
+	// Final avalanche, from MurmurHash3 fmix64
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return (uint32_t)hash;
+}
+
+void keyhash_begin(keyhash_state_t *st, uint32_t seed)
+{
+	st->hash = keyhash_seed(seed);
+	st->tail = 0;
+	st->len  = 0;
+}
+
+static inline void keyhash_update_(keyhash_state_t *st, const uint8_t *u, int len, const int uc)
+{
+	int have = st->len & 7;
+
+	st->len += len;
+
+	// Fill up an incomplete word first
+	if (have) {
+		while (have < 8 && len > 0) {
+			uint64_t c = *u++;
+			if (uc && 'a' <= c && c <= 'z')
+				c -= ('a' - 'A');
+			st->tail |= c << (8 * have);
+			++have;
+			--len;
+		}
+		if (have < 8)
+			return;
+		st->hash = keyhash_mix(st->hash, st->tail);
+		st->tail = 0;
+	}
+
+	for ( ; len >= 8; len -= 8, u += 8) {
+		uint64_t w = keyhash_load(u);
+		if (uc)
+			w = keyhash_ucword(w);
+		st->hash = keyhash_mix(st->hash, w);
+	}
+
+	for (have = 0; have < len; ++have) {
+		uint64_t c = u[have];
+		if (uc && 'a' <= c && c <= 'z')
+			c -= ('a' - 'A');
+		st->tail |= c << (8 * have);
+	}
+}
+
+void keyhash_update(keyhash_state_t *st, const void *p, int len)
+{
+	keyhash_update_(st, p, len, 0);
 }
 
 /* The data material is known to contain ASCII, and if any value in there
  * is a lower case letter, it is first converted to upper case one.
-*/
-uint32_t __attribute__((pure)) keyhashuc(const void const *p, int len, uint32_t hash)
+ */
+void keyhash_updateuc(keyhash_state_t *st, const void *p, int len)
 {
-	const uint8_t *u = p;
-	int i;
-
-	if (hash == 0)
-        	hash = (uint32_t)FNV_32_OFFSET;
-
-	for (i = 0; i < len; ++i, ++u) {
-#if defined(NO_FNV_GCC_OPTIMIZATION)
-		hash *= FNV_32_PRIME;
-#else
-		hash += (hash<<1) + (hash<<4) + (hash<<7) +
-		        (hash<<8) + (hash<<24);
-#endif
-		uint32_t c = *u;
-		// Is it lower case ASCII letter ?
-		if ('a' <= c && c <= 'z') {
-			// convert to upper case.
-			c -= ('a' - 'A');
-		}
-		hash ^= c;
+	keyhash_update_(st, p, len, 1);
+}
+
+uint32_t keyhash_final(const keyhash_state_t *st)
+{
+	uint64_t hash = st->hash;
+
+	if (st->len & 7)
+		hash = keyhash_mix(hash, st->tail);
+	return keyhash_finish(hash, st->len);
+}
+
+/* Keys below KEYHASH_SHORT bytes, the same hash as in pieces above */
+static inline uint32_t keyhash_short(const uint8_t *u, int len, uint32_t hash0, const int uc)
+{
+	uint64_t hash = keyhash_seed(hash0);
+	uint64_t w;
+
+	if (len >= 8) {
+		w = keyhash_load(u);
+		if (uc)
+			w = keyhash_ucword(w);
+		hash = keyhash_mix(hash, w);
+		u += 8;
 	}
-	return hash;
+	if (len & 7) {
+		w = keyhash_loadtail(u, len & 7);
+		if (uc)
+			w = keyhash_ucword(w);
+		hash = keyhash_mix(hash, w);
+	}
+	return keyhash_finish(hash, len);
+}
+
+/* One-shot hashing.  A non-zero hash0 chains from a previous result. */
+uint32_t __attribute__((pure)) keyhash(const void *p, int len, uint32_t hash0)
+{
+	keyhash_state_t st;
+	if (len < KEYHASH_SHORT)
+		return keyhash_short(p, len, hash0, 0);
+	keyhash_begin(&st, hash0);
+	keyhash_update_(&st, p, len, 0);
+	return keyhash_final(&st);
+}
+
+uint32_t __attribute__((pure)) keyhashuc(const void *p, int len, uint32_t hash0)
+{
+	keyhash_state_t st;
+	if (len < KEYHASH_SHORT)
+		return keyhash_short(p, len, hash0, 1);
+	keyhash_begin(&st, hash0);
+	keyhash_update_(&st, p, len, 1);
+	return keyhash_final(&st);
 }
@@ -10,8 +10,23 @@
 #ifndef KEYHASH_H
 #define KEYHASH_H
 
-extern void         keyhash_init(void);
-extern unsigned int keyhash(const void *s, int slen, unsigned int hash0);
-extern unsigned int keyhashuc(const void *s, int slen, unsigned int hash0);
+#include <stdint.h>
+
+/* Incremental hashing state.  Feeding data in pieces gives the same
+   hash as feeding it all at once. */
+typedef struct keyhash_state {
+	uint64_t hash;
+	uint64_t tail;		/* bytes of an incomplete word */
+	uint32_t len;		/* total length fed in */
+} keyhash_state_t;
+
+extern void     keyhash_init(void);
+extern void     keyhash_begin(keyhash_state_t *st, uint32_t seed);
+extern void     keyhash_update(keyhash_state_t *st, const void *s, int slen);
+extern void     keyhash_updateuc(keyhash_state_t *st, const void *s, int slen);
+extern uint32_t keyhash_final(const keyhash_state_t *st);
+
+extern uint32_t keyhash(const void *s, int slen, uint32_t hash0);
+extern uint32_t keyhashuc(const void *s, int slen, uint32_t hash0);
 
 #endif
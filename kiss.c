@@ -201,7 +201,7 @@ static int kissprocess(struct serialport *S)
 			printf("\n");
 		}
 		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 		return -1;
 	}
 
@@ -236,7 +236,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 		crc = calc_crc_flex(S->rdline, S->rdlinelen);
@@ -249,7 +249,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
 			return -1;	// The CRC was invalid..
 		}
 		S->rdlinelen -= 2; // remove 2 bytes!
@@ -269,7 +269,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 
@@ -283,7 +283,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 		S->rdlinelen -= 1;	/* remove the sum-byte from tail */
@@ -304,7 +304,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 
@@ -335,7 +335,7 @@ static int kissprocess(struct serialport *S)
 					printf("\n");
 				}
 				rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-				erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
+				erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
 				return -1;	/* The CRC was invalid.. */
 			}
 
@@ -394,7 +394,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 	}
@@ -410,7 +410,7 @@ static int kissprocess(struct serialport *S)
 				printf("\n");
 			}
 			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 			return -1;
 		}
 	}
@@ -422,7 +422,7 @@ static int kissprocess(struct serialport *S)
 		/* Too short frame.. */
 		/* printf(" ..too short a frame for anything\n");  */
 		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 		return -1;
 	}
 
@@ -438,7 +438,7 @@ static int kissprocess(struct serialport *S)
 	// Rx-IGate functionality.  Returns non-zero only when
 	// AX.25 header is OK, and packet is sane.
 
-	erlang_add(S->ttycallsign[tncid], ERLANG_RX, S->rdlinelen, 1);	/* Account one packet */
+	erlang_add_handle(S->ttyerlang[tncid], ERLANG_RX, S->rdlinelen, 1);	/* Account one packet */
 
 	if (ax25_to_tnc2(S->interface[tncid], S->ttycallsign[tncid], tncid,
 				cmdbyte, S->rdline + 1, S->rdlinelen - 1)) {
@@ -453,7 +453,7 @@ static int kissprocess(struct serialport *S)
 	} else {
 		// The packet is not valid per AX.25 header bit rules
 		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		erlang_add_handle(S->ttyerlang[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
 
 		if (aprxlogfile) {
 			// NOT replaced with aprxlog() -- because this is a bit more complicated..
@@ -481,11 +481,11 @@ static int kissprocess(struct serialport *S)
 
 int kiss_pullkiss(struct serialport *S)
 {
-	/* printf("ttyreader_pullkiss()  rdlen=%d rdcursor=%d, state=%d\n",
-	   S->rdlen, S->rdcursor, S->kissstate); fflush(stdout); */
+	/* printf("ttyreader_pullkiss()  rd.len=%d rd.cursor=%d, state=%d\n",
+	   S->rd.len, S->rd.cursor, S->kissstate); fflush(stdout); */
 
 	/* At incoming call there is at least one byte in between
-	   S->rdcursor and S->rdlen  */
+	   S->rd.cursor and S->rd.len  */
 
 	/* Phases:
 	   kissstate == 0: hunt for KISS_FEND, discard everything before it.
@@ -668,7 +668,7 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 	if ((S->wrlen + len) < sizeof(S->wrbuf)) {
 		memcpy(S->wrbuf + S->wrlen, kissbuf, len);
 		S->wrlen += len;
-		erlang_add(S->ttycallsign[tncid], ERLANG_TX, ax25rawlen, 1);
+		erlang_add_handle(S->ttyerlang[tncid], ERLANG_TX, ax25rawlen, 1);
 
 		if (debug)
 		  printf(" .. put %d bytes of KISS frame on IO buffer\n",len);
@@ -676,6 +676,7 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 		// No fit!
 		if (debug)
 		  printf(" .. %d bytes of KISS frame did not fit on IO buffer\n",len);
+		ttyreader_pollout(S);
 		return;
 	}
 
@@ -697,6 +698,7 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 			S->wrlen = len;
 		}
 	}
+	ttyreader_pollout(S);
 }
 
 
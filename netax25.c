@@ -19,7 +19,13 @@
 
 #include <sys/ioctl.h>
 #include <net/if.h>
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(HAVE_LINUX_FILTER_H)
+#include <linux/if_packet.h>	/* netpacket/packet.h without TPACKET_V3 */
+#include <linux/filter.h>
+#include <sys/mman.h>
+#else
 #include <netpacket/packet.h>
+#endif
 #include <netinet/if_ether.h>
 
 #include <netinet/in.h>
@@ -59,6 +65,7 @@ struct netax25_dev {
 	uint8_t         scan;
 	char		devname[IFNAMSIZ];
 	char		callsign[10];
+	int		erlanghandle;	// 0 until first used
 	const struct aprx_interface *interface;
 };
 
@@ -83,6 +90,7 @@ struct netax25_pty {
 	int                          fd;
 	int			     ifindex;
 	const char                  *callsign;
+	int                          erlanghandle;
 	const struct aprx_interface *interface;
 	struct sockaddr_ax25         ax25addr;
 };
@@ -90,6 +98,7 @@ struct netax25_pty {
 
 static int rx_socket = -1;
 static int tx_socket = -1;
+static struct aprxpollfd rx_pollfd;
 
 static struct netax25_pty **ax25rxports;
 static int                  ax25rxportscount;
@@ -97,6 +106,41 @@ static int                  ax25rxportscount;
 static char **ax25ttyports;
 static int   *ax25ttyfds;
 static int    ax25ttyportscount;
+static struct aprxpollfd *ax25ttypolls;	// registered at netax25_start()
+
+
+/*
+ *  With  "ax25-rxring N"  in the configuration, the rx_socket is read
+ *  thru a TPACKET_V3 memory mapped ring of N kB, instead of recvfrom().
+ *  The kernel fills frames into blocks of the ring, and hands a block
+ *  over when it is full, or has waited RXRING_BLOCKTMO milliseconds.
+ *  The frames of a block are processed right on the ring, and then the
+ *  block is given back, so a burst costs one wakeup and no copies.
+ *
+ *  A classic BPF program on the socket drops in the kernel what the
+ *  receiver would drop anyway: frames not from a receiving AX.25
+ *  device, and on devices without digipeater sources, also frames
+ *  that are not UI frames.  Those are then not counted in the device
+ *  Erlang statistics either.  The program is rebuilt when the device
+ *  scan finds the set of devices changed.
+ */
+
+int netax25_rxring_kb;		/* ax25-rxring, 0 = use recvfrom() */
+
+#ifdef TP_STATUS_BLK_TMO	/* TPACKET_V3 is available */
+#define NETAX25_RXRING 1
+
+#define RXRING_BLOCKSIZE (64*1024)
+#define RXRING_BLOCKTMO  10	/* ms */
+#define RXFILTER_MAXDEVS 200	/* jump offsets are 8 bits */
+
+static uint8_t *rxring;		/* the mmap()ed ring, or NULL */
+static int      rxring_blocks;
+static int      rxring_cursor;	/* next block to look at */
+
+static struct sock_filter *rxfilter;
+static int                 rxfilter_len;
+#endif
 
 
 
@@ -163,6 +207,7 @@ static const void* netax25_openpty(const char *mycall)
 	nax25->fd       = pty_master;
 	nax25->ifindex  = -1;
 	nax25->callsign = mycall;
+	nax25->erlanghandle = erlang_handle(mycall);
 
 	nax25->ax25addr.sax25_family = PF_AX25;
 	nax25->ax25addr.sax25_ndigis = 0;
@@ -297,6 +342,147 @@ static int is_ax25ttyport(const char *callsign)
 }
 
 
+#ifdef NETAX25_RXRING
+/*
+ *  The socket filter.  Jump offsets are relative to the next
+ *  instruction, and the layout is fixed:
+ *
+ *	PACKET_HOST and leading KISS byte 0, or DROP
+ *	ifindex of a device taking all frames -> ACCEPT
+ *	ifindex of a device taking UI frames  -> UI
+ *	DROP
+ *   UI:
+ *	address end bit at byte 7*k, k = 2..10 -> CTL k
+ *	ACCEPT (too many addresses, let ax25_to_tnc2() reject it)
+ *   CTL:
+ *	control byte 7*k+1 is 0x03 -> ACCEPT, or DROP
+ *	ACCEPT
+ *	DROP
+ *
+ *  The frame starts with the KISS command byte, then the addresses.
+ *  A load past the frame end drops it.
+ */
+static int rxfilter_build(struct sock_filter *prog)
+{
+	int i, k, n = 0, all = 0, ui = 0, uistart, ctl, accept, drop;
+
+	for (i = 0; i < netax25_devcount; ++i) {
+	  const struct netax25_dev *d = netax25_devs[i];
+	  if (d->interface == NULL || !d->rxok) continue;
+	  if (d->interface->digisourcecount > 0) ++all;
+	  else ++ui;
+	}
+	uistart = 5 + all + ui + 1;
+	ctl     = uistart + 2*9 + 1;
+	accept  = ctl + 2*9;
+	drop    = accept + 1;
+
+#define RXF_STMT(c,v)        (prog[n].code = (c), prog[n].jt = 0, prog[n].jf = 0, prog[n].k = (v), ++n)
+#define RXF_JUMP(c,v,tt,ft)  (prog[n].code = (c), prog[n].jt = (tt) ? (tt) - n - 1 : 0, prog[n].jf = (ft) ? (ft) - n - 1 : 0, prog[n].k = (v), ++n)
+
+	RXF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	RXF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 0, drop);
+	RXF_STMT(BPF_LD  | BPF_B | BPF_ABS, 0);
+	RXF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, drop);
+	RXF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+	for (k = 0; k < 2; ++k) {
+	  for (i = 0; i < netax25_devcount; ++i) {
+	    const struct netax25_dev *d = netax25_devs[i];
+	    if (d->interface == NULL || !d->rxok) continue;
+	    if ((d->interface->digisourcecount > 0) != (k == 0)) continue;
+	    RXF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, d->ifindex,
+		     (k == 0) ? accept : uistart, 0);
+	  }
+	}
+	RXF_STMT(BPF_RET | BPF_K, 0);
+	// UI:
+	for (k = 2; k <= 10; ++k) {
+	  RXF_STMT(BPF_LD  | BPF_B | BPF_ABS, 7*k);
+	  RXF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x01, ctl + 2*(k-2), 0);
+	}
+	RXF_STMT(BPF_RET | BPF_K, 0x40000);
+	// CTL:
+	for (k = 2; k <= 10; ++k) {
+	  RXF_STMT(BPF_LD  | BPF_B | BPF_ABS, 7*k + 1);
+	  RXF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x03, accept, drop);
+	}
+	RXF_STMT(BPF_RET | BPF_K, 0x40000); // ACCEPT
+	RXF_STMT(BPF_RET | BPF_K, 0);       // DROP
+
+#undef RXF_STMT
+#undef RXF_JUMP
+	return n;
+}
+
+/* Attach the socket filter, if the devices have changed */
+static void rxfilter_attach(void)
+{
+	struct sock_filter *prog;
+	struct sock_fprog fprog;
+	int len;
+
+	if (netax25_devcount > RXFILTER_MAXDEVS) return;
+
+	prog = calloc(netax25_devcount + 48, sizeof(*prog));
+	if (prog == NULL) return;
+	len = rxfilter_build(prog);
+
+	if (len == rxfilter_len &&
+	    memcmp(prog, rxfilter, len * sizeof(*prog)) == 0) {
+	  free(prog); // No change
+	  return;
+	}
+
+	fprog.len    = len;
+	fprog.filter = prog;
+	if (setsockopt(rx_socket, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+	  aprxlog("ax25-rxring: can not attach socket filter: %s", strerror(errno));
+	  free(prog);
+	  return;
+	}
+	if (debug) printf("ax25-rxring: socket filter of %d instructions attached\n", len);
+	free(rxfilter);
+	rxfilter     = prog;
+	rxfilter_len = len;
+}
+
+/* Set up the TPACKET_V3 ring on the rx_socket, or leave it at recvfrom() */
+static void rxring_setup(const int fd)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	void *ring;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size     = RXRING_BLOCKSIZE;
+	req.tp_block_nr       = netax25_rxring_kb * 1024 / RXRING_BLOCKSIZE;
+	if (req.tp_block_nr < 2)
+	  req.tp_block_nr = 2;
+	req.tp_frame_size     = 2048;
+	req.tp_frame_nr       = req.tp_block_size / req.tp_frame_size * req.tp_block_nr;
+	req.tp_retire_blk_tov = RXRING_BLOCKTMO;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+	    setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+	  aprxlog("ax25-rxring: can not set up the ring: %s, using recvfrom()", strerror(errno));
+	  return;
+	}
+	ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+	  aprxlog("ax25-rxring: can not map the ring: %s, using recvfrom()", strerror(errno));
+	  // Frames go to the ring now, take it down
+	  memset(&req, 0, sizeof(req));
+	  (void)setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+	  return;
+	}
+	rxring        = ring;
+	rxring_blocks = req.tp_block_nr;
+	rxring_cursor = 0;
+	if (debug) printf("ax25-rxring: %d blocks of %d bytes\n", rxring_blocks, RXRING_BLOCKSIZE);
+}
+#endif
+
 static int scan_linux_devices(void) {
 	FILE *fp;
 	struct ifreq ifr;
@@ -416,6 +602,11 @@ static int scan_linux_devices(void) {
 	  }
 	}
 
+#ifdef NETAX25_RXRING
+	if (rxring != NULL)
+	  rxfilter_attach();
+#endif
+
 	return 0;
 }
 
@@ -444,6 +635,8 @@ void *netax25_addrxport(const char *callsign, const struct aprx_interface *inter
 	  nax25p->callsign  = interface->callsign;
 	}
 
+	nax25p->erlanghandle = erlang_handle(nax25p->callsign);
+
 	ax25rxports = realloc(ax25rxports,
 			      sizeof(struct netax25_pty*) * (ax25rxportscount + 1));
 	ax25rxports[ax25rxportscount++] = nax25p;
@@ -464,17 +657,36 @@ static void netax25_addttyport(const char *callsign,
 }
 
 
+static struct aprxtimer netax25_scan_timer;
+static void netax25_scan_expired(struct aprxtimer *t, void *arg);
+static void netax25_scan_reset(struct aprxtimer *t, void *arg);
+
 /* Nothing much in early init */
 void netax25_init(void)
 {
+	// Device scan at the first round, and then every 60 seconds
+	aprxtimer_init(&netax25_scan_timer, "netax25-scan",
+		       netax25_scan_expired, netax25_scan_reset, NULL);
+	aprxtimer_arm_millis(&netax25_scan_timer, 0);
 }
 
+static void netax25_pollevents(struct aprxpolls *app, struct pollfd *pfd, void *arg);
+
 /* .. but all things in late start.. */
 void netax25_start(void)
 {
 	int i;
 	int rx_protocol;
 
+	/* read from PTY masters */
+	if (ax25ttyportscount > 0)
+		ax25ttypolls = calloc(ax25ttyportscount, sizeof(*ax25ttypolls));
+	for (i = 0; i < ax25ttyportscount; ++i) {
+		if (ax25ttyfds[i] >= 0)
+			aprxpolls_add(&ax25ttypolls[i], ax25ttyfds[i],
+				      POLLIN | POLLPRI, netax25_pollevents, NULL);
+	}
+
 	rx_socket = -1;			/* Initialize for early bail-out  */
 	tx_socket = -1;
 
@@ -512,6 +724,17 @@ void netax25_start(void)
 
 	if (rx_socket >= 0)
 		fd_nonblockingmode(rx_socket);
+
+	if (netax25_rxring_kb > 0) {
+#ifdef NETAX25_RXRING
+		rxring_setup(rx_socket);
+#else
+		aprxlog("ax25-rxring: not available in this build, using recvfrom()");
+#endif
+	}
+
+	aprxpolls_add(&rx_pollfd, rx_socket, POLLIN | POLLPRI,
+		      netax25_pollevents, NULL);
 }
 
 
@@ -521,61 +744,27 @@ const void* netax25_open(const char *ifcallsign)
 	return netax25_openpty(ifcallsign);
 }
 
-static struct timeval next_scantime;
-
-static void netax25_resettimer(void*arg)
+static void netax25_scan_expired(struct aprxtimer *t, void *arg)
 {
-	struct timeval *tv = (struct timeval *)arg;
-	tv_timeradd_seconds(tv, &tick, 60);
-        scan_linux_devices();
+	struct timeval tv;
+
+	scan_linux_devices();
+	// Rescan every 60 seconds, on the dot.
+	tv_timeradd_seconds(&tv, &t->expires, 60);
+	aprxtimer_arm(t, &tv);
 }
 
-int netax25_prepoll(struct aprxpolls *app)
+static void netax25_scan_reset(struct aprxtimer *t, void *arg)
 {
-	struct pollfd *pfd;
-	int i;
-
-        if (next_scantime.tv_sec == 0) next_scantime = tick;
-
-        if (time_reset) {
-        	netax25_resettimer(&next_scantime);
-        }
-
-	if (rx_socket >= 0) {
-		/* FD is open, lets mark it for poll read.. */
-		pfd = aprxpolls_new(app);
-		pfd->fd = rx_socket;
-		pfd->events = POLLIN | POLLPRI;
-		pfd->revents = 0;
-	}
-
-	/* read from PTY masters */
-	for (i = 0; i < ax25ttyportscount; ++i) {
-		if (ax25ttyfds[i] >= 0) {
-		  pfd = aprxpolls_new(app);
-		  pfd->fd = ax25ttyfds[i];
-		  pfd->events = POLLIN | POLLPRI;
-		  pfd->revents = 0;
-		}
-	}
-
-	return 1;
+        scan_linux_devices();
+	aprxtimer_arm_millis(t, 60000);
 }
 
-static int rxsock_read( const int fd )
+/* One frame from the rx_socket, from recvfrom() or from the ring */
+static void rxsock_frame( const struct sockaddr_ll *sll, const uint8_t *rxbuf, const int rcvlen )
 {
-	struct sockaddr_ll sll;
-	socklen_t sllsize;
-	int rcvlen, ifindex, i;
+	int ifindex, i;
 	struct netax25_dev *netdev;
-	uint8_t rxbuf[3000];
-
-	sllsize = sizeof(sll);
-	rcvlen = recvfrom(fd, rxbuf, sizeof(rxbuf), 0, (struct sockaddr*)&sll, &sllsize);
-
-	if (rcvlen < 0) {
-		return 0;	/* No more at this time.. */
-	}
 
 /*
 struct sockaddr_ll
@@ -600,23 +789,24 @@ Leads with 00 byte, then AX.25 address..
 
 */
 
-	if (sll.sll_family   != PF_PACKET         ||
-	    sll.sll_protocol != htons(ETH_P_AX25) ||
-	    sll.sll_hatype   != SOCK_RAW          ||
-	    sll.sll_pkttype  != 0                 ||
-	    sll.sll_halen    != 0                 ||
-	    rxbuf[0]         != 0 ) {
-	  return 1; // Not of our interest
+	if (sll->sll_family   != PF_PACKET         ||
+	    sll->sll_protocol != htons(ETH_P_AX25) ||
+	    sll->sll_hatype   != SOCK_RAW          ||
+	    sll->sll_pkttype  != 0                 ||
+	    sll->sll_halen    != 0                 ||
+	    rcvlen            <  1                 ||
+	    rxbuf[0]          != 0 ) {
+	  return; // Not of our interest
 	}
-	ifindex = sll.sll_ifindex;
+	ifindex = sll->sll_ifindex;
 
 	if (debug>1) {
 	  printf("netax25rx packet len=%d from rx_socket;  family=%d protocol=%x ifindex=%d hatype=%d pkttype=%d halen=%d\n",
-		 rcvlen, sll.sll_family, sll.sll_protocol, sll.sll_ifindex, sll.sll_hatype, sll.sll_pkttype, sll.sll_halen);
+		 rcvlen, sll->sll_family, sll->sll_protocol, sll->sll_ifindex, sll->sll_hatype, sll->sll_pkttype, sll->sll_halen);
 /*
 	  printf(" addr=%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n",
-		 sll.sll_addr[0],sll.sll_addr[1],sll.sll_addr[2],sll.sll_addr[3],
-		 sll.sll_addr[4],sll.sll_addr[5],sll.sll_addr[6],sll.sll_addr[7]);
+		 sll->sll_addr[0],sll->sll_addr[1],sll->sll_addr[2],sll->sll_addr[3],
+		 sll->sll_addr[4],sll->sll_addr[5],sll->sll_addr[6],sll->sll_addr[7]);
 
 		  int i;
 		  printf("Data: ");
@@ -654,11 +844,11 @@ Leads with 00 byte, then AX.25 address..
 	if (netdev == NULL) {
 	  // Not found from Ax.25 devices
 	  if (debug>1) printf(".. not from known AX.25 device\n");
-	  return 1;
+	  return;
 	}
         if (netdev->interface == NULL) {
 	  if (debug>1) printf(".. not from AX.25 device configured for receiving.\n");
-          return 1;
+          return;
         }
 
 	if (debug) printf("Received frame of %d bytes from %s: %s\n",
@@ -669,7 +859,7 @@ Leads with 00 byte, then AX.25 address..
 		if (debug > 1) {
 		  printf("%s is ttyport which we serve.\n",netdev->callsign);
 		}
-		return 1; // We drop our own packets, if we ever see them
+		return; // We drop our own packets, if we ever see them
 	}
 
 	/// Now: actual AX.25 frame reception,
@@ -679,7 +869,9 @@ Leads with 00 byte, then AX.25 address..
 	 * "+10" is a magic constant for trying
 	 * to estimate channel occupation overhead
 	 */
-	erlang_add(netdev->callsign, ERLANG_RX, rcvlen + 10, 1); // rxsock_read()
+	if (netdev->erlanghandle == 0)
+		netdev->erlanghandle = erlang_handle(netdev->callsign);
+	erlang_add_handle(netdev->erlanghandle, ERLANG_RX, rcvlen + 10, 1); // rxsock_read()
 
 	// Send it to Rx-IGate, validates also AX.25 header bits,
 	// and returns non-zero only when things are OK for processing.
@@ -691,7 +883,7 @@ Leads with 00 byte, then AX.25 address..
 	} else {
 	  // The packet is not valid per AX.25 header bit rules
           rfloghex(netdev->callsign, 'D', 1, rxbuf, rcvlen);
-	  erlang_add(netdev->callsign, ERLANG_DROP, rcvlen+10, 1);	/* Account one packet */
+	  erlang_add_handle(netdev->erlanghandle, ERLANG_DROP, rcvlen+10, 1);	/* Account one packet */
 
 	  if (aprxlogfile) {
 	    FILE *fp = fopen(aprxlogfile, "a");
@@ -706,10 +898,58 @@ Leads with 00 byte, then AX.25 address..
 	    }
 	  }
 	}
+}
 
+static int rxsock_read( const int fd )
+{
+	struct sockaddr_ll sll;
+	socklen_t sllsize;
+	int rcvlen;
+	uint8_t rxbuf[3000];
+
+	sllsize = sizeof(sll);
+	rcvlen = recvfrom(fd, rxbuf, sizeof(rxbuf), 0, (struct sockaddr*)&sll, &sllsize);
+
+	if (rcvlen < 0) {
+		return 0;	/* No more at this time.. */
+	}
+	rxsock_frame(&sll, rxbuf, rcvlen);
 	return 1;
 }
 
+#ifdef NETAX25_RXRING
+/* Process the blocks that the kernel has handed over, and give them back */
+static void rxring_read(void)
+{
+	int n;
+
+	for (n = 0; n < rxring_blocks; ++n) {
+		struct tpacket_block_desc *bd = (struct tpacket_block_desc *)
+			(rxring + (size_t)rxring_cursor * RXRING_BLOCKSIZE);
+		const struct tpacket3_hdr *th;
+		int i;
+
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;	// Kernel still fills it
+		__sync_synchronize();
+
+		th = (const struct tpacket3_hdr *)
+			((const uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts; ++i) {
+			const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+				((const uint8_t *)th + TPACKET_ALIGN(sizeof(*th)));
+			rxsock_frame(sll, (const uint8_t *)th + th->tp_mac, th->tp_snaplen);
+			th = (const struct tpacket3_hdr *)
+				((const uint8_t *)th + th->tp_next_offset);
+		}
+
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		rxring_cursor = (rxring_cursor + 1) % rxring_blocks;
+	}
+}
+#endif
+
 static void discard_read_fd( const int fd )
 {
 	char buf[2000];
@@ -717,44 +957,24 @@ static void discard_read_fd( const int fd )
 }
 
 
-int netax25_postpoll(struct aprxpolls *app)
+static void netax25_pollevents(struct aprxpolls *app, struct pollfd *pfd, void *arg)
 {
-	int i, j;
-	struct pollfd *pfd;
-	// char ifaddress[10];
-
-        assert(app->polls != NULL);
-
-        if (tv_timercmp(&tick, &next_scantime) > 0) {
-        	scan_linux_devices();
-                // Rescan every 60 seconds, on the dot.
-                tv_timeradd_seconds(&next_scantime, &next_scantime, 60);
-        }
-
-	pfd = app->polls;
-
-	if (rx_socket < 0)
-		return 0;
-
-	for (i = 0; i < app->pollcount; ++i, ++pfd) {
-	  if ((pfd->fd == rx_socket) &&
-	      (pfd->revents & (POLLIN | POLLPRI))) {
-	    /* something coming in.. */
-	    rxsock_read( rx_socket );
-	  }
-	  for (j = 0; j < ax25ttyportscount; ++j) {
-	    if ((pfd->revents & (POLLIN | POLLPRI)) &&
-		(ax25ttyfds[j] == pfd->fd)) {
-	      discard_read_fd(ax25ttyfds[j]);
-	    }
-	  }
+	if (!(pfd->revents & (POLLIN | POLLPRI)))
+		return;
+	if (pfd->fd == rx_socket) {
+	  /* something coming in.. */
+#ifdef NETAX25_RXRING
+	  if (rxring != NULL)
+	    rxring_read();
+	  else
+#endif
+	  rxsock_read( rx_socket );
+	} else {
+	  /* one of our PTY masters */
+	  discard_read_fd(pfd->fd);
 	}
-	
-	return 0;
 }
 
-
-
 void netax25_sendto(const void *nax25p, const uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
 {
 	const struct netax25_pty *nax25 = nax25p;
@@ -806,6 +1026,6 @@ void netax25_sendto(const void *nax25p, const uint8_t *axaddr, const int axaddrl
 	i = sendmsg(tx_socket, &mh, 0);
 	if (debug>1)printf("netax25_sendto() the sendmsg len=%d rc=%d errno=%d\n", len, i, errno);
 
-	erlang_add(nax25->callsign, ERLANG_TX, axaddrlen+axdatalen + 10, 1);  // netax25_sendto()
+	erlang_add_handle(nax25->erlanghandle, ERLANG_TX, axaddrlen+axdatalen + 10, 1);  // netax25_sendto()
 }
 #endif
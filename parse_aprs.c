@@ -53,10 +53,57 @@ static int valid_sym_table_uncompressed(char c)
 		    || (c >= 0x30 && c <= 0x39)); /* [\/\\A-Z0-9] */
 }
 
+/*
+ *	Decimal digits at fixed columns, as a number.
+ *	Any non-digit among them makes the result negative.
+ */
+
+static int aprs_digits(const char *s, int n)
+{
+	int v = 0, bad = 0;
+	for ( ; n > 0; --n, ++s) {
+		unsigned int d = (uint8_t)*s - '0';
+		bad |= (d > 9);
+		v    = v * 10 + d;
+	}
+	return bad ? -1 : v;
+}
+
+/*
+ *	Degrees, minutes and hundredths of minute into degrees.
+ *	Counted in hundredths of minute, there is only one rounding,
+ *	and the result is the same float as that of the old
+ *	  deg + min / 60.0 + frag / 6000.0
+ *	for every deg 0..179, min 0..99 and frag 0..99.
+ */
+
+static float aprs_fixedpos_degrees(const int deg, const int min, const int frag)
+{
+	return (double)(deg * 6000 + min * 100 + frag) / 6000.0;
+}
+
+/*
+ *	Mic-E destination callsign character as a latitude digit,
+ *	-1 for a position ambiguity (K, L, Z).  The characters have
+ *	been validated before this.
+ */
+
+static int mice_lat_digit(const char c)
+{
+	if (c <= '9')
+		return c - '0';
+	if (c <= 'J')
+		return c - 'A';
+	if (c >= 'P' && c <= 'Y')
+		return c - 'P';
+	return -1;
+}
+
 /*
  *	Fill the pbuf_t structure with a parsed position and
- *	symbol table & code. Also does range checking for lat/lng
- *	and pre-calculates cosf(lat) for range filters.
+ *	symbol table & code. Also does range checking for lat/lng.
+ *	The cosf(lat) for range filters is calculated later on,
+ *	only if some range filter needs it:  filter_coslat()
  */
 
 static int pbuf_fill_pos(struct pbuf_t *pb, const float lat, const float lng, const char sym_table, const char sym_code)
@@ -95,7 +142,7 @@ static int pbuf_fill_pos(struct pbuf_t *pb, const float lat, const float lng, co
 
 	/* Pre-calculations for A/R/F/M-filter tests */
 	pb->lat     = filter_lat2rad(lat);  /* deg-to-radians */
-	pb->cos_lat = cosf(pb->lat);        /* used in range filters */
+	pb->cos_lat = COSLAT_UNSET;         /* used in range filters */
 	pb->lng     = filter_lon2rad(lng);  /* deg-to-radians */
 	
 	pb->flags |= F_HASPOS;	/* the packet has positional data */
@@ -578,10 +625,9 @@ static int parse_aprs_telem(struct pbuf_t *pb, const char *body, const char *bod
 static int parse_aprs_mice(struct pbuf_t *pb, const unsigned char *body, const unsigned char *body_end)
 {
 	float lat = 0.0, lng = 0.0;
-	unsigned int lat_deg = 0, lat_min = 0, lat_min_frag = 0, lng_deg = 0, lng_min = 0, lng_min_frag = 0;
+	unsigned int lng_deg = 0, lng_min = 0, lng_min_frag = 0;
 	const char *d_start;
-	char dstcall[7];
-	char *p;
+	int latdigit[6];
 	char sym_table, sym_code;
 	int posambiguity = 0;
 	int i;
@@ -664,48 +710,32 @@ static int parse_aprs_mice(struct pbuf_t *pb, const unsigned char *body, const u
 	
 	DEBUG_LOG("\tpassed info format check");
 	
-	/* make a local copy, we're going to modify it */
-	strncpy(dstcall, d_start, 6);
-	dstcall[6] = 0;
-	
 	/* First do the destination callsign
 	 * (latitude, message bits, N/S and W/E indicators and long. offset)
 	 *
-	 * Translate the characters to get the latitude
+	 * Translate the characters to get the latitude digits
 	 */
-	 
-	//fprintf(stderr, "\tuntranslated dstcall: %s\n", dstcall);
-	for (p = dstcall; *p; p++) {
-		if (*p >= 'A' && *p <= 'J')
-			*p -= 'A' - '0';
-		else if (*p >= 'P' && *p <= 'Y')
-			*p -= 'P' - '0';
-		else if (*p == 'K' || *p == 'L' || *p == 'Z')
-			*p = '_';
-	}
-	//fprintf(stderr, "\ttranslated dstcall: %s\n", dstcall);
+	for (i = 0; i < 6; i++)
+		latdigit[i] = mice_lat_digit(d_start[i]);
 	
 	// position ambiquity is going to get ignored now,
 	// it's not needed in this application.
 
-	if (dstcall[5] == '_') { dstcall[5] = '5'; posambiguity = 1; }
-	if (dstcall[4] == '_') { dstcall[4] = '5'; posambiguity = 2; }
-	if (dstcall[3] == '_') { dstcall[3] = '5'; posambiguity = 3; }
-	if (dstcall[2] == '_') { dstcall[2] = '3'; posambiguity = 4; }
-	if (dstcall[1] == '_' || dstcall[0] == '_') {
+	if (latdigit[5] < 0) { latdigit[5] = 5; posambiguity = 1; }
+	if (latdigit[4] < 0) { latdigit[4] = 5; posambiguity = 2; }
+	if (latdigit[3] < 0) { latdigit[3] = 5; posambiguity = 3; }
+	if (latdigit[2] < 0) { latdigit[2] = 3; posambiguity = 4; }
+	if (latdigit[1] < 0 || latdigit[0] < 0) {
 		DEBUG_LOG("..bad pos-ambiguity on destcall");
 		return 0;
 	} // cannot use posamb here
 	
-	// convert to degrees, minutes and decimal degrees,
-	//  and then to a float lat
+	// degrees, minutes and hundredths of minute
+	//  to a float lat
 
-	if (sscanf(dstcall, "%2u%2u%2u",
-	    &lat_deg, &lat_min, &lat_min_frag) != 3) {
-		DEBUG_LOG("\tsscanf failed");
-		return 0;
-	}
-	lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
+	lat = aprs_fixedpos_degrees(latdigit[0] * 10 + latdigit[1],
+				    latdigit[2] * 10 + latdigit[3],
+				    latdigit[4] * 10 + latdigit[5]);
 	
 	// check the north/south direction and correct the latitude if necessary
 	if (d_start[3] <= 0x4c)
@@ -790,9 +820,7 @@ static int parse_aprs_compressed(struct pbuf_t *pb, const char *body, const char
 {
 	char sym_table, sym_code;
 	int i;
-	int lat1, lat2, lat3, lat4;
-	int lng1, lng2, lng3, lng4;
-	float lat, lng;
+	unsigned int lat = 0, lng = 0, bad = 0;
 	
 	DEBUG_LOG("parse_aprs_compressed");
 	
@@ -809,34 +837,31 @@ static int parse_aprs_compressed(struct pbuf_t *pb, const char *body, const char
 	sym_table = body[0]; /* has been validated before entering this function */
 	sym_code = body[9];
 	
-	/* base-91 check */
-	for (i = 1; i <= 8; i++)
-		if (body[i] < 0x21 || body[i] > 0x7b)
-			return 0;
+	/* decode, and do the base-91 check at the same time:
+	 * a character out of 0x21..0x7b is out of 0..90 after
+	 * the subtraction (as unsigned), and marks it bad.
+	 */
+	for (i = 1; i <= 4; i++) {
+		unsigned int c = (uint8_t)body[i] - 33;
+		bad |= (c > 90);
+		lat  = lat * 91 + c;
+	}
+	for (i = 5; i <= 8; i++) {
+		unsigned int c = (uint8_t)body[i] - 33;
+		bad |= (c > 90);
+		lng  = lng * 91 + c;
+	}
+	if (bad)
+		return 0;
 	
 	// fprintf(stderr, "\tpassed length and format checks, sym %c%c\n", sym_table, sym_code);
 	
-	/* decode */
-	lat1 = (body[1] - 33);
-	lat2 = (body[2] - 33);
-	lat3 = (body[3] - 33);
-	lat4 = (body[4] - 33);
-
-	lat1 = ((((lat1 * 91) + lat2) * 91) + lat3) * 91 + lat4;
-
-	lng1 = (body[5] - 33);
-	lng2 = (body[6] - 33);
-	lng3 = (body[7] - 33);
-	lng4 = (body[8] - 33);
-
-	lng1 = ((((lng1 * 91) + lng2) * 91) + lng3) * 91 + lng4;
-	
 	/* calculate latitude and longitude */
 	
-	lat =   90.0F - ((float)(lat1) / 380926.0F);
-	lng = -180.0F + ((float)(lng1) / 190463.0F);
-	
-	return pbuf_fill_pos(pb, lat, lng, sym_table, sym_code);
+	return pbuf_fill_pos(pb,
+			     90.0F - ((float)(int)lat / 380926.0F),
+			   -180.0F + ((float)(int)lng / 190463.0F),
+			     sym_table, sym_code);
 }
 
 /*
@@ -849,7 +874,7 @@ static int parse_aprs_compressed(struct pbuf_t *pb, const char *body, const char
 static int parse_aprs_uncompressed(struct pbuf_t *pb, const char *body, const char *body_end)
 {
 	char posbuf[20];
-	unsigned int lat_deg = 0, lat_min = 0, lat_min_frag = 0, lng_deg = 0, lng_min = 0, lng_min_frag = 0;
+	int lat_deg, lat_min, lat_min_frag, lng_deg, lng_min, lng_min_frag;
 	float lat, lng;
 	char lat_hemi, lng_hemi;
 	char sym_table, sym_code;
@@ -883,11 +908,21 @@ static int parse_aprs_uncompressed(struct pbuf_t *pb, const char *body, const ch
 	if (posbuf[16] == ' ') posbuf[16] = '5';
 	
 	// fprintf(stderr, "\tafter filling amb: %s\n", posbuf);
-	/* 3210.70N/13132.15E# */
-	if (sscanf(posbuf, "%2u%2u.%2u%c%c%3u%2u.%2u%c%c",
-	    &lat_deg, &lat_min, &lat_min_frag, &lat_hemi, &sym_table,
-	    &lng_deg, &lng_min, &lng_min_frag, &lng_hemi, &sym_code) != 10) {
-		DEBUG_LOG("\tsscanf failed");
+	/* 3210.70N/13132.15E#   -- every field is at a fixed column */
+	lat_deg      = aprs_digits(posbuf +  0, 2);
+	lat_min      = aprs_digits(posbuf +  2, 2);
+	lat_min_frag = aprs_digits(posbuf +  5, 2);
+	lat_hemi     = posbuf[7];
+	sym_table    = posbuf[8];
+	lng_deg      = aprs_digits(posbuf +  9, 3);
+	lng_min      = aprs_digits(posbuf + 12, 2);
+	lng_min_frag = aprs_digits(posbuf + 15, 2);
+	lng_hemi     = posbuf[17];
+	sym_code     = posbuf[18];
+
+	if ((lat_deg | lat_min | lat_min_frag | lng_deg | lng_min | lng_min_frag) < 0 ||
+	    posbuf[4] != '.' || posbuf[14] != '.') {
+		DEBUG_LOG("\tbad position format");
 		return 0;
 	}
 	
@@ -907,8 +942,8 @@ static int parse_aprs_uncompressed(struct pbuf_t *pb, const char *body, const ch
 	if (lat_deg > 89 || lng_deg > 179)
 		return 0; /* too large values for lat/lng degrees */
 	
-	lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
-	lng = (float)lng_deg + (float)lng_min / 60.0 + (float)lng_min_frag / 6000.0;
+	lat = aprs_fixedpos_degrees(lat_deg, lat_min, lat_min_frag);
+	lng = aprs_fixedpos_degrees(lng_deg, lng_min, lng_min_frag);
 	
 	/* Finally apply south/west indicators */
 	if (issouth)
@@ -1062,6 +1097,94 @@ int parse_aprs_txgate(struct pbuf_t *pb, int look_inside_3rd_party, historydb_t
 }
 #endif
 
+/*
+ *	Look up message recipient's position from given historydb.
+ */
+
+#ifndef DISABLE_IGATE
+static history_cell_t *parse_aprs_recipient_lookup(const struct pbuf_t*const pb, historydb_t*const historydb)
+{
+	const char *p = pb->dstname;
+	int i;
+
+	if (p == NULL || historydb == NULL)
+		return NULL; // Not a message
+
+	for (i = 0; i < CALLSIGNLEN_MAX; ++i, ++p) {
+		// the recipient address is space padded
+		// to 9 chars, while our historydb is not.
+		if (*p == 0 || *p == ' ' || *p == ':')
+			break;
+	}
+	return historydb_lookup( historydb, pb->dstname, i );
+}
+#endif
+
+/*
+ *	Supplement the message recipient's position to the message packet.
+ */
+
+void parse_aprs_recipient_position(struct pbuf_t*const pb, historydb_t*const historydb)
+{
+#ifndef DISABLE_IGATE
+	history_cell_t *history;
+#endif
+
+	if (pb->dstname == NULL)
+		return; // Not a message
+
+	// The recipient position is the only position a message has
+	pb->flags &= ~F_HASPOS;
+
+#ifndef DISABLE_IGATE
+	history = parse_aprs_recipient_lookup(pb, historydb);
+	if (history != NULL) {
+		pb->lat     = history->lat;
+		pb->lng     = history->lon;
+		pb->cos_lat = history->coslat;
+
+		pb->flags  |= F_HASPOS;
+	}
+#endif
+}
+
+/*
+ *	A received frame is parsed only once, and then shared in between
+ *	all digipeater sources using it.  Those may have different
+ *	transmitter historydbs, and keep the pbuf in their queues, thus
+ *	a message with a known recipient gets a copy of its own with
+ *	the position of that historydb.  Everything else gets the
+ *	shared pbuf.  Either way the caller holds a reference.
+ */
+
+struct pbuf_t *parse_aprs_recipient_pbuf(struct pbuf_t*const pb, historydb_t*const historydb)
+{
+#ifndef DISABLE_IGATE
+	struct pbuf_t *cp;
+	history_cell_t *history = parse_aprs_recipient_lookup(pb, historydb);
+
+	if (history == NULL)
+		return pbuf_get(pb);
+
+	cp = pbuf_new(pb->is_aprs, pb->digi_like_aprs,
+		      pb->info_start - pb->data - 1, pb->data, pb->packet_len,
+		      pb->ax25addrlen, pb->ax25addr, pb->ax25addrlen + pb->ax25datalen);
+	if (cp == NULL)
+		return pbuf_get(pb); // without the position then
+	cp->source_if_group = pb->source_if_group;
+	cp->t               = pb->t;
+	parse_aprs(cp, NULL);
+
+	cp->lat     = history->lat;
+	cp->lng     = history->lon;
+	cp->cos_lat = history->coslat;
+	cp->flags  |= F_HASPOS;
+	return cp;
+#else
+	return pbuf_get(pb);
+#endif
+}
+
 /*
  *	Try to parse an APRS packet.
  *	Returns 1 if position was parsed successfully,
@@ -1254,34 +1377,9 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 		// to have some location data ?  Because then we can treat
 		// them the same way in filters as we do those with real
 		// positions..
-		{
-			const char *p;
-			int i;
-#ifndef DISABLE_IGATE
-			history_cell_t *history;
-#endif
-			pb->dstname = body;
-			p = body;
-			for (i = 0; i < CALLSIGNLEN_MAX; ++i) {
-				// the recipient address is space padded
-				// to 9 chars, while our historydb is not.
-				if (*p == 0 || *p == ' ' || *p == ':')
-					break;
-			}
-			pb->dstname_len = p - body;
-#ifndef DISABLE_IGATE
-                        if (historydb != NULL) {
-                        	history = historydb_lookup( historydb, pb->dstname, i );
-                                if (history != NULL) {
-					pb->lat     = history->lat;
-                                        pb->lng     = history->lon;
-                                        pb->cos_lat = history->coslat;
-			    
-                                        pb->flags  |= F_HASPOS;
-                                }
-                        }
-#endif
-		}
+		pb->dstname = body;
+		pb->dstname_len = 0;
+		parse_aprs_recipient_position(pb, historydb);
 		return 1;
 
 	case ';':
@@ -18,42 +18,69 @@
  * - Handle refcount  (get/put)
  */
 
-#ifndef _FOR_VALGRIND_
-static cellarena_t *pbuf_cells;
-#endif
-
-// int pbuf_size = sizeof(struct pbuf_t); // 152 bytes on i386
-// int pbuf_alignment = __alignof__(struct pbuf_t); // 8 on i386
+/*
+ * Size classes by the data area after  struct pbuf_t,  which holds
+ * both TNC2 text, and AX.25 frame of about same length.
+ * The biggest one takes in an AX.25 packet of about 1kB in size,
+ * and in APRS use there never should be larger than about 512 bytes.
+ */
 
-// 2150 byte pbuf takes in an AX.25 packet of about 1kB in size,
-// and in APRS use there never should be larger than about 512 bytes.
-// A 16 kB arena fits in 7 of these humongous pbufs.
+struct pbuf_class pbuf_classes[PBUF_CLASSES] = {
+	{ "pbuf-small",  2*PACKETLEN_MAX_SMALL+2,  PBUF_ALLOCATE_BUNCH_SMALL  },
+	{ "pbuf-medium", 2*PACKETLEN_MAX_MEDIUM+2, PBUF_ALLOCATE_BUNCH_MEDIUM },
+	{ "pbuf-large",  2*PACKETLEN_MAX_LARGE+2,  PBUF_ALLOCATE_BUNCH_LARGE  },
+	{ "pbuf-huge",   2*PACKETLEN_MAX_HUGE+10,  PBUF_ALLOCATE_BUNCH_HUGE   },
+};
 
-const int pbufcell_size  = sizeof(struct pbuf_t) + 2150;
 const int pbufcell_align = __alignof__(struct pbuf_t);
 
+/* Smallest class to allocate from.  aprx-bench -s sets the largest
+   one, which is about what the single arena before size classes was. */
+int pbuf_firstclass;
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+/* The parse workers allocate pbufs too.  While they run, the cell
+   arenas and their counters are used under this lock. */
+int pbuf_locking;
+static pthread_mutex_t pbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define PBUF_LOCK()   if (pbuf_locking) pthread_mutex_lock(&pbuf_mutex)
+#define PBUF_UNLOCK() if (pbuf_locking) pthread_mutex_unlock(&pbuf_mutex)
+#else
+#define PBUF_LOCK()
+#define PBUF_UNLOCK()
+#endif
+
 void pbuf_init(void)
 {
 #ifndef _FOR_VALGRIND_
-	/* A _few_... */
-
-	pbuf_cells = cellinit( "filter",
-			       pbufcell_size,
-			       pbufcell_align,
-			       CELLMALLOC_POLICY_LIFO,
-			       16, // 16 kB at the time
-			       0   // minfree
-			       );
+	int i;
+	for (i = 0; i < PBUF_CLASSES; ++i) {
+		struct pbuf_class *pc = &pbuf_classes[i];
+		int cellsize = sizeof(struct pbuf_t) + pc->datasize;
+
+		pc->cells = cellinit( pc->name,
+				      cellsize,
+				      pbufcell_align,
+				      CELLMALLOC_POLICY_LIFO,
+				      (cellsize * pc->bunch + 1023) / 1024,
+				      0   // minfree
+				      );
+	}
 #endif
 }
 
 static void pbuf_free(struct pbuf_t *pb)
 {
 #ifndef _FOR_VALGRIND_
-	cellfree(pbuf_cells, pb);
-#else
-	free(pb);
+	if (pb->sizeclass >= 0) {
+		struct pbuf_class *pc = &pbuf_classes[pb->sizeclass];
+		PBUF_LOCK();
+		pc->inuse -= 1;
+		cellfree(pc->cells, pb);
+		PBUF_UNLOCK();
+	} else
 #endif
+		free(pb);
 	if (debug > 1) printf("pbuf_free(%p)\n",pb);
 }
 
@@ -61,24 +88,48 @@ static struct pbuf_t *pbuf_alloc( const int axlen,
                                   const int tnc2len )
 {
 	int pblen = sizeof(struct pbuf_t) + axlen + tnc2len + 2;
+	int datalen = axlen + tnc2len + 2;
+	struct pbuf_t *pb = NULL;
+	int i = -1;
 
 #ifndef _FOR_VALGRIND_
 	// Picks suitably sized pbuf, and pre-cleans it
 	// before passing to user
 
-	struct pbuf_t *pb;
-	if (pblen > 2150) {
+	if (datalen > pbuf_classes[PBUF_CLASSES-1].datasize) {
 	  // Outch!
 	  return NULL;
 	}
-	pb = cellmalloc(pbuf_cells);
-	memset(pb, 0, pblen );
-#else
-	// No size limits with valgrind..
-	struct pbuf_t *pb = calloc( 1, pblen );
+	PBUF_LOCK();
+	for (i = pbuf_firstclass; i < PBUF_CLASSES; ++i) {
+		struct pbuf_class *pc = &pbuf_classes[i];
+		if (datalen > pc->datasize)
+			continue;
+		pb = cellmalloc(pc->cells);
+		if (pb == NULL) {
+			// Arena is full, try next bigger one
+			pc->fallbacks += 1;
+			continue;
+		}
+		pc->allocs += 1;
+		pc->inuse  += 1;
+		if (pc->inuse > pc->highwater)
+			pc->highwater = pc->inuse;
+		break;
+	}
+	PBUF_UNLOCK();
+	if (pb == NULL)
+		i = -1;	// from heap
 #endif
+	if (pb == NULL) {
+		// No size limits with valgrind..
+		pb = malloc( pblen );
+		if (pb == NULL) return NULL;
+	}
+	memset(pb, 0, pblen );
+	pb->sizeclass = i;
 
-	if (debug > 1) printf("pbuf_alloc(%d,%d) -> %p\n",axlen,tnc2len,pb);
+	if (debug > 1) printf("pbuf_alloc(%d,%d) -> %p class %d\n",axlen,tnc2len,pb,i);
 
 	pb->packet_len = tnc2len;
 	pb->buf_len    = tnc2len;
@@ -89,6 +140,25 @@ static struct pbuf_t *pbuf_alloc( const int axlen,
 	return pb;
 }
 
+/*
+ * pbuf_stats() -- print allocator size class counters
+ */
+void pbuf_stats(FILE *fp)
+{
+	int i, cellsize;
+	long kbytes = 0;
+	for (i = 0; i < PBUF_CLASSES; ++i) {
+		const struct pbuf_class *pc = &pbuf_classes[i];
+		cellsize = sizeof(struct pbuf_t) + pc->datasize;
+		fprintf(fp, "%-12s %5d bytes  inuse %ld  highwater %ld (%ld kB)  allocs %ld  fallbacks %ld\n",
+			pc->name, cellsize, pc->inuse, pc->highwater,
+			(pc->highwater * cellsize + 1023) / 1024,
+			pc->allocs, pc->fallbacks);
+		kbytes += (pc->highwater * cellsize + 1023) / 1024;
+	}
+	fprintf(fp, "pbuf memory  %ld kB at the highwater marks\n", kbytes);
+}
+
 struct pbuf_t *pbuf_get( struct pbuf_t *pb )
 {
 	// Increments refcount
@@ -105,6 +175,20 @@ void pbuf_put( struct pbuf_t *pb )
 }
 
 
+/*
+ * pbuf_ax25addrs() -- AX.25 address fields of the pbuf in decoded form.
+ * They are decoded at first use, and describe the frame as received.
+ */
+const struct ax25_addr *pbuf_ax25addrs(struct pbuf_t *pb, int *countp)
+{
+	if (pb->ax25addrcount == 0)
+		pb->ax25addrcount = ax25_decode_addrs(pb->ax25addrs, pb->ax25addr,
+						      pb->ax25addrlen);
+	*countp = pb->ax25addrcount;
+	return pb->ax25addrs;
+}
+
+
 static struct pbuf_t *_pbuf_new(const int is_aprs, const int digi_like_aprs, const int axlen, const int tnc2len);
 static struct pbuf_t *_pbuf_new(const int is_aprs, const int digi_like_aprs, const int axlen, const int tnc2len)
 {
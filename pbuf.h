@@ -50,11 +50,13 @@
 #define PACKETLEN_MAX_SMALL  100 
 #define PACKETLEN_MAX_MEDIUM 180 /* about 99.5% are smaller than this */
 #define PACKETLEN_MAX_LARGE  PACKETLEN_MAX
+#define PACKETLEN_MAX_HUGE  1070 /* AX.25 frame of about 1 kB */
 
 /* number of pbuf_t structures to allocate at a time */
-#define PBUF_ALLOCATE_BUNCH_SMALL  2000 /* grow to 2000 in production use */
-#define PBUF_ALLOCATE_BUNCH_MEDIUM 2000 /* grow to 2000 in production use */
-#define PBUF_ALLOCATE_BUNCH_LARGE    50 /* grow to 50 in production use */
+#define PBUF_ALLOCATE_BUNCH_SMALL    64
+#define PBUF_ALLOCATE_BUNCH_MEDIUM   64
+#define PBUF_ALLOCATE_BUNCH_LARGE    16
+#define PBUF_ALLOCATE_BUNCH_HUGE      8
 
 /* a packet buffer */
 /* Type flags -- some can happen in combinations: T_CWOP + T_WX / T_CWOP + T_POSITION ... */
@@ -73,10 +75,22 @@
 #define T_THIRDPARTY (1 << 12)
 #define T_ALL	     (1 << 15) // set on _all_ packets
 
+/* An AX.25 address field in decoded form */
+struct ax25_addr {
+	char	call[7];	/* callsign without SSID, NUL terminated */
+	uint8_t	calllen;
+	uint8_t	ssid;		/* 0 .. 15 */
+	uint8_t	hbit;		/* H-bit, "has been digipeated" at VIA fields */
+};
+
+#define AX25_ADDRS_MAX 10	/* DEST, SRC, and up to 8 VIAs */
+
 #define F_DUPE    	(1 << 0) // Duplicate of a previously seen packet
 #define F_HASPOS  	(1 << 1) // This packet has valid parsed position
 #define F_HAS_TCPIP	(1 << 2) // There is a TCPIP* in the path
 
+#define COSLAT_UNSET	(-1.0F)	 // cos_lat not calculated yet, real ones are >= 0
+
 struct pbuf_t {
 	struct pbuf_t *next;
 
@@ -111,7 +125,8 @@ struct pbuf_t {
 	
 	float lat;	/* if the packet is PT_POSITION, latitude and longitude go here */
 	float lng;	/* .. in RADIAN */
-	float cos_lat;	/* cache of COS of LATitude for radial distance filter    */
+	float cos_lat;	/* cache of COS of LATitude for radial distance filter,
+			   COSLAT_UNSET until a filter needs it: filter_coslat() */
 
 	char symbol[3]; /* 2(+1) chars of symbol, if any, NUL for not found */
 
@@ -121,6 +136,11 @@ struct pbuf_t {
 	uint8_t *ax25data;	// Start of AX.25 data after addresses
 	int      ax25datalen;	// length of that data
 
+	int      ax25addrcount;	// decoded fields in ax25addrs[], 0 = not yet
+	struct ax25_addr ax25addrs[AX25_ADDRS_MAX]; // as received, see pbuf_ax25addrs()
+
+	int      sizeclass;	// pbuf.c allocator size class, -1: heap
+
 	char data[1];
 };
 
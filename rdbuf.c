@@ -0,0 +1,94 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+
+/*
+ *  Read buffering of the stream readers: serial ports, AGWPE and
+ *  APRS-IS connections.
+ *
+ *  Data is read in at  len,  and the parser takes frames and lines
+ *  out at  cursor,  looking at them in place thru  rdbuf_view().
+ *  Consumed data is not moved away after each frame.  When the buffer
+ *  empties, both go back to zero for free, and an incomplete frame
+ *  left at the tail is moved down at most once per read(), and only
+ *  when the room behind it has become short.  So a burst of frames in
+ *  one read() costs a single pass over it, and a frame being parsed
+ *  is always contiguous in the buffer.
+ */
+
+void rdbuf_init(struct rdbuf *rb, uint8_t *data, const int size)
+{
+	rb->data   = data;
+	rb->size   = size;
+	rb->cursor = 0;
+	rb->len    = 0;
+}
+
+void rdbuf_reset(struct rdbuf *rb)
+{
+	rb->cursor = 0;
+	rb->len    = 0;
+}
+
+/* Make room at the end, return how much there is */
+int rdbuf_makespace(struct rdbuf *rb)
+{
+	if (rb->cursor > 0 && (rb->size - rb->len) < rb->size / 2) {
+		// Move the unconsumed tail down to the buffer start
+		memmove(rb->data, rb->data + rb->cursor, rb->len - rb->cursor);
+		rb->len   -= rb->cursor;
+		rb->cursor = 0;
+	}
+	return rb->size - rb->len;
+}
+
+/*
+ * Read what there is into the buffer, return value as of read(2).
+ * With a full buffer, -1 and errno ENOBUFS.
+ */
+int rdbuf_read(struct rdbuf *rb, const int fd)
+{
+	int space = rdbuf_makespace(rb);
+	int i;
+
+	if (space <= 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	i = read(fd, rb->data + rb->len, space);
+	if (i > 0)
+		rb->len += i;
+	return i;
+}
+
+/* Unconsumed data, and its length */
+const uint8_t *rdbuf_view(const struct rdbuf *rb, int *lenp)
+{
+	*lenp = rb->len - rb->cursor;
+	return rb->data + rb->cursor;
+}
+
+void rdbuf_consume(struct rdbuf *rb, const int len)
+{
+	rb->cursor += len;
+	if (rb->cursor >= rb->len)
+		rb->cursor = rb->len = 0; // Empty, start over from the beginning
+}
+
+/* One byte ( >= 0 ) out of the buffer, or -1 if it is empty */
+int rdbuf_getc(struct rdbuf *rb)
+{
+	if (rb->cursor >= rb->len) {
+		rb->cursor = rb->len = 0;
+		return -1;
+	}
+	return rb->data[rb->cursor++];
+}
@@ -0,0 +1,508 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+#include <sys/mman.h>
+#include <limits.h>
+
+/*
+ *  Warm-restart snapshot.
+ *
+ *  With  "snapshotfile PATH"  in the <logging> section, the state that
+ *  takes long to learn again -- HistoryDB cells, live dupe records, and
+ *  the token buckets of digipeaters, their sources and source callsigns
+ *  -- is written in a file at shutdown and every few minutes.  Startup
+ *  mmap()s the file and puts the entries back, expired ones are left out.
+ *
+ *  The file is a header, and then records of a type and a length.  The
+ *  records of a digipeater follow its SNAP_DIGI record, which names the
+ *  transmitter, so a changed configuration picks up what still matches.
+ *  Times are kept as seconds before the save, since the tick clock starts
+ *  over on a reboot, and the wall clock of the save tells how long aprx
+ *  was away.  Hashes are not saved, the tables compute them anew.
+ *  Numbers are in host byte order, the byte order word in the header
+ *  keeps a file of another kind of host from being read in.
+ */
+
+const char *snapshotfile;
+
+#define SNAPSHOT_MAGIC      "APRXSNAP"
+#define SNAPSHOT_VERSION    2
+#define SNAPSHOT_BYTEORDER  0x01020304
+#define SNAPSHOT_INTERVAL   300		// seconds between periodic saves
+#define SNAP_NEVER          INT32_MIN	// time_t value 0, "not yet"
+
+enum {
+	SNAP_END,
+	SNAP_DIGI,
+	SNAP_HCELL,
+	SNAP_DUPE
+};
+
+struct snap_head {
+	char     magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	int64_t  walltime;	// time(NULL) at the save
+};
+
+struct snap_rec {
+	uint16_t type;
+	uint16_t len;		// of the payload after this
+};
+
+struct snap_bucket {
+	float    tokens;
+	int32_t  filltime;	// seconds before the save
+};
+
+struct snap_digi {
+	struct snap_bucket bucket;
+	uint16_t sourcecount;	// buckets of the sources follow,
+	uint16_t calllen;	// .. and then transmitter callsign
+};
+
+struct snap_hcell {
+	int32_t  arrivaltime;	// seconds before the save
+	int32_t  positiontime;
+	struct snap_bucket bucket;
+	float    lat, coslat, lon;
+	uint16_t packettype;
+	uint16_t flags;
+	uint16_t packetlen;
+	uint8_t  keylen;
+	uint8_t  heardcount;	// key, int32 last_heard[], packet follow
+};
+
+struct snap_dupe {
+	int32_t  t;		// seconds before the save
+	int16_t  seen;
+	int16_t  delayed_seen;
+	int16_t  seen_on_transmitter;
+	uint16_t alen;
+	uint16_t plen;		// addresses, packet follow
+};
+
+static struct aprxtimer snapshot_timer;
+
+static char snapbuf[65535];	// payload of record being written
+static int  snaplen;
+static int  snapoverflow;
+
+static void snap_put(const void *p, const int len)
+{
+	if (snaplen + len > sizeof(snapbuf)) {
+		snapoverflow = 1;
+		return;
+	}
+	memcpy(snapbuf + snaplen, p, len);
+	snaplen += len;
+}
+
+static void snap_flush(FILE *fp, const int type)
+{
+	struct snap_rec rec;
+
+	if (!snapoverflow) {
+		rec.type = type;
+		rec.len  = snaplen;
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(snapbuf, snaplen, 1, fp);
+	}
+	snaplen      = 0;
+	snapoverflow = 0;
+}
+
+static int32_t snap_reltime(const time_t t)
+{
+	long d;
+	if (t == 0)
+		return SNAP_NEVER;
+	d = t - tick.tv_sec;
+	if (d <= SNAP_NEVER) d = SNAP_NEVER + 1;
+	if (d > INT32_MAX)   d = INT32_MAX;
+	return d;
+}
+
+static time_t snap_abstime(const int32_t rel, const long away)
+{
+	if (rel == SNAP_NEVER)
+		return 0;
+	return tick.tv_sec - away + rel;
+}
+
+
+static void snap_put_bucket(const float tokens, const time_t filltime)
+{
+	struct snap_bucket sb;
+	sb.tokens   = tokens;
+	sb.filltime = snap_reltime(filltime);
+	snap_put(&sb, sizeof(sb));
+}
+
+// Bucket back as it was, but not over the limit of today
+static void snap_get_bucket(const struct snap_bucket *sb, const long away, const float limit,
+			    float *tokens, time_t *filltime)
+{
+	*tokens   = (sb->tokens > limit) ? limit : sb->tokens;
+	*filltime = snap_abstime(sb->filltime, away);
+}
+
+
+static void snapshot_write_digi(FILE *fp, struct digipeater *digi)
+{
+	struct snap_digi sd;
+	const char *call = digi->transmitter->callsign;
+	int i;
+
+	if (call == NULL) call = "";
+
+	sd.bucket.tokens   = digi->tokenbucket;
+	sd.bucket.filltime = snap_reltime(digi->tbf_filltime);
+	sd.sourcecount     = digi->sourcecount;
+	sd.calllen         = strlen(call);
+	snap_put(&sd, sizeof(sd));
+	for (i = 0; i < digi->sourcecount; ++i)
+		snap_put_bucket(digi->sources[i]->tokenbucket,
+				digi->sources[i]->tbf_filltime);
+	snap_put(call, sd.calllen);
+	snap_flush(fp, SNAP_DIGI);
+}
+
+#ifndef DISABLE_IGATE
+static int snapshot_write_historydb(FILE *fp, const historydb_t *db)
+{
+	time_t expirytime = tick.tv_sec - lastposition_storetime;
+	int i, j, count = 0;
+
+	for (i = 0; i < db->size; ++i) {
+		const history_cell_t *cp = &db->cells[i];
+		struct snap_hcell sh;
+
+		if (cp->keylen == 0 ||
+		    timecmp(cp->arrivaltime, expirytime) < 0)
+			continue;
+
+		sh.arrivaltime  = snap_reltime(cp->arrivaltime);
+		sh.positiontime = snap_reltime(cp->positiontime);
+		sh.bucket.tokens   = cp->tokenbucket;
+		sh.bucket.filltime = snap_reltime(cp->tbf_filltime);
+		sh.lat          = cp->lat;
+		sh.coslat       = cp->coslat;
+		sh.lon          = cp->lon;
+		sh.packettype   = cp->packettype;
+		sh.flags        = cp->flags;
+		sh.packetlen    = cp->packetlen;
+		sh.keylen       = cp->keylen;
+		sh.heardcount   = top_interfaces_group < 255 ? top_interfaces_group : 255;
+		snap_put(&sh, sizeof(sh));
+		snap_put(cp->key, cp->keylen);
+		for (j = 0; j < sh.heardcount; ++j) {
+			int32_t t = snap_reltime(cp->last_heard[j]);
+			snap_put(&t, sizeof(t));
+		}
+		snap_put(cp->packet, cp->packetlen);
+		snap_flush(fp, SNAP_HCELL);
+		++count;
+	}
+	return count;
+}
+#endif
+
+static int snapshot_write_dupecheck(FILE *fp, const dupecheck_t *dpc)
+{
+	int i, count = 0;
+
+	for (i = 0; i < dpc->hashsize; ++i) {
+		const dupe_record_t *dp;
+		for (dp = dpc->dupecheck_db[i]; dp != NULL; dp = dp->next) {
+			struct snap_dupe sd;
+
+			if ((dp->t_exp - tick.tv_sec) < 0)
+				continue; // Left for the expiry wheel
+			if (dp->pbuf != NULL && dp->seen == 0)
+				continue; // On viscous queue, not sent yet
+
+			sd.t                   = snap_reltime(dp->t);
+			sd.seen                = dp->seen;
+			sd.delayed_seen        = dp->delayed_seen;
+			sd.seen_on_transmitter = dp->seen_on_transmitter;
+			sd.alen                = dp->alen;
+			sd.plen                = dp->plen;
+			snap_put(&sd, sizeof(sd));
+			snap_put(dp->addresses, dp->alen);
+			snap_put(dp->packet, dp->plen);
+			snap_flush(fp, SNAP_DUPE);
+			++count;
+		}
+	}
+	return count;
+}
+
+static void snapshot_save(void)
+{
+	char tmpname[PATH_MAX];
+	struct snap_head head;
+	struct digipeater *digi;
+	FILE *fp;
+	int d, cells = 0, dupes = 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", snapshotfile);
+	fp = fopen(tmpname, "w");
+	if (fp == NULL) {
+		aprxlog("snapshot: can not write %s: %s", tmpname, strerror(errno));
+		return;
+	}
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, SNAPSHOT_MAGIC, sizeof(head.magic));
+	head.version   = SNAPSHOT_VERSION;
+	head.byteorder = SNAPSHOT_BYTEORDER;
+	head.walltime  = time(NULL);
+	fwrite(&head, sizeof(head), 1, fp);
+
+	for (d = 0; (digi = digipeater_get(d)) != NULL; ++d) {
+		snapshot_write_digi(fp, digi);
+#ifndef DISABLE_IGATE
+		if (digi->historydb != NULL)
+			cells += snapshot_write_historydb(fp, digi->historydb);
+#endif
+		if (digi->dupechecker != NULL)
+			dupes += snapshot_write_dupecheck(fp, digi->dupechecker);
+	}
+	snap_flush(fp, SNAP_END);
+
+	if (ferror(fp) | (fclose(fp) != 0)) {
+		aprxlog("snapshot: write of %s failed", tmpname);
+		unlink(tmpname);
+		return;
+	}
+	if (rename(tmpname, snapshotfile) != 0) {
+		aprxlog("snapshot: rename to %s failed: %s", snapshotfile, strerror(errno));
+		unlink(tmpname);
+		return;
+	}
+	if (debug)
+		printf("snapshot: saved %d history cells, %d dupe records\n",
+		       cells, dupes);
+}
+
+
+static struct digipeater *snapshot_find_digi(const char *call, const int calllen)
+{
+	struct digipeater *digi;
+	int d;
+
+	for (d = 0; (digi = digipeater_get(d)) != NULL; ++d) {
+		const char *c = digi->transmitter->callsign;
+		if (c == NULL) c = "";
+		if (strlen(c) == calllen && memcmp(c, call, calllen) == 0)
+			return digi;
+	}
+	return NULL;
+}
+
+static struct digipeater *snapshot_read_digi(const uint8_t *p, const int len, const long away)
+{
+	struct snap_digi sd;
+	struct digipeater *digi;
+	int i;
+
+	if (len < sizeof(sd)) return NULL;
+	memcpy(&sd, p, sizeof(sd));
+	if (len != sizeof(sd) + sd.sourcecount * sizeof(struct snap_bucket) + sd.calllen)
+		return NULL;
+
+	digi = snapshot_find_digi((const char *)p + len - sd.calllen, sd.calllen);
+	if (digi == NULL)
+		return NULL; // Not in the configuration anymore
+
+	snap_get_bucket(&sd.bucket, away, digi->tbf_limit,
+			&digi->tokenbucket, &digi->tbf_filltime);
+	// Sources are matched by their order, when it is the same count
+	if (sd.sourcecount == digi->sourcecount) {
+		for (i = 0; i < sd.sourcecount; ++i) {
+			struct digipeater_source *src = digi->sources[i];
+			struct snap_bucket sb;
+			memcpy(&sb, p + sizeof(sd) + i * sizeof(sb), sizeof(sb));
+			snap_get_bucket(&sb, away, src->tbf_limit,
+					&src->tokenbucket, &src->tbf_filltime);
+		}
+	}
+	return digi;
+}
+
+#ifndef DISABLE_IGATE
+static int snapshot_read_hcell(struct digipeater *digi, const uint8_t *p, const int len, const long away)
+{
+	struct snap_hcell sh;
+	history_cell_t *cp;
+	time_t expirytime = tick.tv_sec - lastposition_storetime;
+	const char *key;
+	int i;
+
+	if (len < sizeof(sh)) return 0;
+	memcpy(&sh, p, sizeof(sh));
+	if (len != sizeof(sh) + sh.keylen + sh.heardcount * sizeof(int32_t) + sh.packetlen)
+		return 0;
+	if (timecmp(snap_abstime(sh.arrivaltime, away), expirytime) < 0)
+		return 0;
+
+	key = (const char *)p + sizeof(sh);
+	p  += sizeof(sh) + sh.keylen;
+	cp = historydb_restore(digi->historydb, key, sh.keylen,
+			       (const char *)p + sh.heardcount * sizeof(int32_t),
+			       sh.packetlen);
+	if (cp == NULL)
+		return 0;
+
+	cp->arrivaltime  = snap_abstime(sh.arrivaltime, away);
+	cp->positiontime = snap_abstime(sh.positiontime, away);
+	snap_get_bucket(&sh.bucket, away, digi->src_tbf_limit,
+			&cp->tokenbucket, &cp->tbf_filltime);
+	cp->lat          = sh.lat;
+	cp->coslat       = sh.coslat;
+	cp->lon          = sh.lon;
+	cp->packettype   = sh.packettype;
+	cp->flags        = sh.flags;
+	for (i = 0; i < sh.heardcount && i < top_interfaces_group; ++i) {
+		int32_t t;
+		memcpy(&t, p + i * sizeof(t), sizeof(t));
+		cp->last_heard[i] = snap_abstime(t, away);
+	}
+	return 1;
+}
+#endif
+
+static int snapshot_read_dupe(struct digipeater *digi, const uint8_t *p, const int len, const long away)
+{
+	struct snap_dupe sd;
+	dupe_record_t *dp;
+
+	if (len < sizeof(sd)) return 0;
+	memcpy(&sd, p, sizeof(sd));
+	if (len != sizeof(sd) + sd.alen + sd.plen)
+		return 0;
+
+	dp = dupecheck_restore(digi->dupechecker,
+			       (const char *)p + sizeof(sd), sd.alen,
+			       (const char *)p + sizeof(sd) + sd.alen, sd.plen,
+			       snap_abstime(sd.t, away));
+	if (dp == NULL)
+		return 0;
+
+	dp->seen                = sd.seen;
+	dp->delayed_seen        = sd.delayed_seen;
+	dp->seen_on_transmitter = sd.seen_on_transmitter;
+	return 1;
+}
+
+static void snapshot_load(void)
+{
+	struct snap_head head;
+	struct snap_rec  rec;
+	struct digipeater *digi = NULL;
+	struct stat st;
+	const uint8_t *map;
+	long away, off;
+	int fd, cells = 0, dupes = 0;
+
+	fd = open(snapshotfile, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			aprxlog("snapshot: can not open %s: %s", snapshotfile, strerror(errno));
+		return;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(head)) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		aprxlog("snapshot: mmap() of %s failed: %s", snapshotfile, strerror(errno));
+		return;
+	}
+
+	memcpy(&head, map, sizeof(head));
+	if (memcmp(head.magic, SNAPSHOT_MAGIC, sizeof(head.magic)) != 0 ||
+	    head.version   != SNAPSHOT_VERSION ||
+	    head.byteorder != SNAPSHOT_BYTEORDER) {
+		aprxlog("snapshot: %s is not of this version, ignored", snapshotfile);
+		munmap((void *)map, st.st_size);
+		return;
+	}
+	away = time(NULL) - head.walltime;
+	if (away < 0) away = 0; // Wall clock was set back
+
+	for (off = sizeof(head); off + sizeof(rec) <= st.st_size; ) {
+		const uint8_t *p;
+
+		memcpy(&rec, map + off, sizeof(rec));
+		off += sizeof(rec);
+		if (rec.type == SNAP_END || rec.len > st.st_size - off)
+			break;
+		p    = map + off;
+		off += rec.len;
+
+		switch (rec.type) {
+		case SNAP_DIGI:
+			digi = snapshot_read_digi(p, rec.len, away);
+			break;
+#ifndef DISABLE_IGATE
+		case SNAP_HCELL:
+			if (digi != NULL && digi->historydb != NULL)
+				cells += snapshot_read_hcell(digi, p, rec.len, away);
+			break;
+#endif
+		case SNAP_DUPE:
+			if (digi != NULL && digi->dupechecker != NULL)
+				dupes += snapshot_read_dupe(digi, p, rec.len, away);
+			break;
+		default:
+			break;
+		}
+	}
+	munmap((void *)map, st.st_size);
+
+	aprxlog("snapshot: restored %d history cells, %d dupe records, %ld seconds old",
+		cells, dupes, away);
+}
+
+
+static void snapshot_expired(struct aprxtimer *t, void *arg)
+{
+	aprxtimer_arm_millis(t, SNAPSHOT_INTERVAL * 1000);
+	snapshot_save();
+}
+
+// Time jumped, start the interval over
+static void snapshot_resettime(struct aprxtimer *t, void *arg)
+{
+	aprxtimer_arm_millis(t, SNAPSHOT_INTERVAL * 1000);
+}
+
+void snapshot_start(void)
+{
+	if (snapshotfile == NULL) return;
+
+	snapshot_load();
+
+	aprxtimer_init(&snapshot_timer, "snapshot",
+		       snapshot_expired, snapshot_resettime, NULL);
+	aprxtimer_arm_millis(&snapshot_timer, SNAPSHOT_INTERVAL * 1000);
+}
+
+void snapshot_stop(void)
+{
+	if (snapshotfile == NULL) return;
+
+	snapshot_save();
+}
@@ -23,8 +23,8 @@ static int telemetry_1min_steps = 20;
 static int telemetry_10min_steps = 2;
 #endif
 
-static struct timeval telemetry_time;
-static struct timeval telemetry_labeltime;
+static struct aprxtimer telemetry_timer;
+static struct aprxtimer telemetry_labeltimer;
 static int telemetry_seq;
 
 
@@ -44,14 +44,33 @@ static void rf_telemetry(
 		const const char *buf,
 		const int buflen);
 
-static void telemetry_resettime(void *arg) {
-	struct timeval *tv = (struct timeval*)arg;
-	tv_timeradd_seconds( tv, &tick, telemetry_interval );
+static void telemetry_resettime(struct aprxtimer *t, void *arg) {
+	struct timeval tv;
+	tv_timeradd_seconds( &tv, &tick, telemetry_interval );
+	aprxtimer_arm(t, &tv);
 }
 
-static void telemetry_resetlabeltime(void *arg) {
-	struct timeval *tv = (struct timeval*)arg;
-	tv_timeradd_seconds( tv, &tick, 120 );  // first label 2 minutes from now
+static void telemetry_resetlabeltime(struct aprxtimer *t, void *arg) {
+	struct timeval tv;
+	tv_timeradd_seconds( &tv, &tick, 120 );  // first label 2 minutes from now
+	aprxtimer_arm(t, &tv);
+}
+
+static void telemetry_datatx(void);
+static void telemetry_labeltx(void);
+
+static void telemetry_expired(struct aprxtimer *t, void *arg) {
+	struct timeval tv;
+	tv_timeradd_seconds(&tv, &t->expires, telemetry_interval);
+	aprxtimer_arm(t, &tv);
+	telemetry_datatx();
+}
+
+static void telemetry_labelexpired(struct aprxtimer *t, void *arg) {
+	struct timeval tv;
+	tv_timeradd_seconds(&tv, &t->expires, telemetry_labelinterval);
+	aprxtimer_arm(t, &tv);
+	telemetry_labeltx();
 }
 
 
@@ -65,55 +84,16 @@ void telemetry_start() {
 	telemetry_seq = (time(NULL)) & 255;
 
 	// "tick" is supposedly current time..
-	telemetry_resettime( &telemetry_time );
-	telemetry_resetlabeltime( &telemetry_labeltime );
+	aprxtimer_init(&telemetry_timer, "telemetry",
+		       telemetry_expired, telemetry_resettime, NULL);
+	aprxtimer_init(&telemetry_labeltimer, "telemetry-label",
+		       telemetry_labelexpired, telemetry_resetlabeltime, NULL);
+	telemetry_resettime( &telemetry_timer, NULL );
+	telemetry_resetlabeltime( &telemetry_labeltimer, NULL );
 
 	if (debug) printf("telemetry_start()\n");
 }
 
-int telemetry_prepoll(struct aprxpolls *app) {
-	// Check that time has not jumped too far ahead/back (1.5 telemetry intervals)
-	if (time_reset) {
-		telemetry_resettime(&telemetry_time);
-		telemetry_resetlabeltime(&telemetry_labeltime);
-	}
-
-	// Normal operational step
-
-	if (tv_timercmp(&app->next_timeout, &telemetry_time) > 0) {
-		app->next_timeout = telemetry_time;
-	}
-	if (tv_timercmp(&app->next_timeout, &telemetry_labeltime) > 0) {
-		app->next_timeout = telemetry_labeltime;
-	}
-
-	if (debug>1) printf("telemetry_prepoll()\n");
-
-	return 0;
-}
-
-static void telemetry_datatx(void);
-static void telemetry_labeltx(void);
-
-int telemetry_postpoll(struct aprxpolls *app) {
-	if (debug>1) {
-		printf("telemetry_postpoll()  telemetrytime=%ds  labeltime=%ds\n",
-				tv_timerdelta_millis(&tick, &telemetry_time)/1000,
-				tv_timerdelta_millis(&tick, &telemetry_labeltime)/1000);
-	}
-	if (tv_timercmp(&telemetry_time, &tick) <= 0) {
-		tv_timeradd_seconds(&telemetry_time, &telemetry_time, telemetry_interval);
-		telemetry_datatx();
-	}
-
-	if (tv_timercmp(&telemetry_labeltime, &tick) <= 0) {
-		tv_timeradd_seconds(&telemetry_labeltime, &telemetry_labeltime, telemetry_labelinterval);
-		telemetry_labeltx();
-	}
-
-	return 0;
-}
-
 static void telemetry_datatx(void) {
 	int  i, j, k, t;
 	char buf[200], *s;
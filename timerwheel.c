@@ -0,0 +1,236 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+
+/*
+ *  Timer service for subsystem timeouts.
+ *
+ *  Armed timers live in a hashed timing wheel of TIMERWHEEL_SLOTS
+ *  slots, each TIMERWHEEL_MILLIS wide.  A timer sits at the slot
+ *  of its expiry time modulo wheel size, so arming and disarming
+ *  are O(1).  Timers further away than one revolution just stay
+ *  in their slot until the cursor comes around the right time.
+ *
+ *  aprxtimer_prepoll() tells the main loop when the earliest timer
+ *  expires, and aprxtimer_postpoll() runs the callbacks of expired
+ *  timers.  Observed time jumps (time_reset) are handled here too:
+ *  every armed timer gets its reset function called, or is made
+ *  to expire right away.
+ */
+
+#define TIMERWHEEL_SLOTS   256	/* power of two */
+#define TIMERWHEEL_MILLIS   16
+
+static struct aprxtimer *timerwheel[TIMERWHEEL_SLOTS];
+static long long timerwheel_cursor;	// slots up to this are processed
+static int timerwheel_count;
+
+static long long aprxtimer_slot(const struct timeval *tv)
+{
+	return ((long long)tv->tv_sec * 1000 + tv->tv_usec / 1000) / TIMERWHEEL_MILLIS;
+}
+
+/* Put timer at the head of a list */
+static void aprxtimer_push(struct aprxtimer **tp, struct aprxtimer *t)
+{
+	t->next  = *tp;
+	t->prevp = tp;
+	if (*tp)
+		(*tp)->prevp = &t->next;
+	*tp = t;
+}
+
+static void aprxtimer_link(struct aprxtimer *t)
+{
+	long long slot = aprxtimer_slot(&t->expires);
+
+	if (slot <= timerwheel_cursor)
+		slot = timerwheel_cursor + 1; // overdue, at next round
+
+	aprxtimer_push(&timerwheel[slot & (TIMERWHEEL_SLOTS-1)], t);
+	++timerwheel_count;
+}
+
+/* Unlink from whatever list, without touching the count */
+static void aprxtimer_unlink(struct aprxtimer *t)
+{
+	*t->prevp = t->next;
+	if (t->next)
+		t->next->prevp = t->prevp;
+	t->next  = NULL;
+	t->prevp = NULL;
+}
+
+void aprxtimer_disarm(struct aprxtimer *t)
+{
+	if (t->prevp == NULL)
+		return; // Not armed
+	aprxtimer_unlink(t);
+	--timerwheel_count;
+}
+
+void aprxtimer_init(struct aprxtimer *t, const char *name,
+		    void (*callback)(struct aprxtimer *, void *),
+		    void (*resetfunc)(struct aprxtimer *, void *),
+		    void *arg)
+{
+	memset(t, 0, sizeof(*t));
+	t->name      = name;
+	t->callback  = callback;
+	t->resetfunc = resetfunc;
+	t->arg       = arg;
+}
+
+void aprxtimer_arm(struct aprxtimer *t, const struct timeval *expires)
+{
+	aprxtimer_disarm(t);
+	t->expires = *expires;
+	if (timerwheel_cursor == 0)
+		timerwheel_cursor = aprxtimer_slot(&tick) - 1;
+	aprxtimer_link(t);
+}
+
+void aprxtimer_arm_millis(struct aprxtimer *t, const int millis)
+{
+	struct timeval tv;
+	tv_timeradd_millis(&tv, &tick, millis);
+	aprxtimer_arm(t, &tv);
+}
+
+/* Time did jump, re-seat all armed timers */
+static void aprxtimer_reset(void)
+{
+	struct aprxtimer *list = NULL, **lp = &list, *t;
+	int i;
+
+	for (i = 0; i < TIMERWHEEL_SLOTS; ++i) {
+		while ((t = timerwheel[i]) != NULL) {
+			aprxtimer_unlink(t);
+			aprxtimer_push(lp, t);
+			lp = &t->next;
+		}
+	}
+	timerwheel_cursor = aprxtimer_slot(&tick) - 1;
+
+	// Like at aprxtimer_postpoll(), a reset function may touch
+	// the timers still waiting on this list.
+	while ((t = list) != NULL) {
+		aprxtimer_disarm(t);
+		if (debug)
+			printf("Resetting timer '%s'\n", t->name);
+		t->expires = tick;
+		if (t->resetfunc)
+			t->resetfunc(t, t->arg); // may re-arm as it likes
+		if (t->prevp == NULL)
+			aprxtimer_link(t);
+	}
+}
+
+/* Earliest expiry of any timer, or NULL */
+static const struct timeval *aprxtimer_earliest(void)
+{
+	const struct timeval *best = NULL;
+	struct aprxtimer *t;
+	long long slot;
+	int i;
+
+	if (timerwheel_count == 0)
+		return NULL;
+
+	// Walk one revolution from the cursor, first slot with
+	// a timer due on this revolution has the earliest one.
+	for (slot = timerwheel_cursor + 1;
+	     slot <= timerwheel_cursor + TIMERWHEEL_SLOTS; ++slot) {
+		for (t = timerwheel[slot & (TIMERWHEEL_SLOTS-1)]; t; t = t->next) {
+			if (aprxtimer_slot(&t->expires) > slot)
+				continue; // on some later revolution
+			if (best == NULL || tv_timercmp(&t->expires, (struct timeval *)best) < 0)
+				best = &t->expires;
+		}
+		if (best)
+			return best;
+	}
+
+	// All are further away, look at them all
+	for (i = 0; i < TIMERWHEEL_SLOTS; ++i) {
+		for (t = timerwheel[i]; t; t = t->next) {
+			if (best == NULL || tv_timercmp(&t->expires, (struct timeval *)best) < 0)
+				best = &t->expires;
+		}
+	}
+	return best;
+}
+
+/*
+ * aprxtimer_prepoll()  -- call after all other pre-polls, as they
+ *                         may look at time_reset flag
+ */
+int aprxtimer_prepoll(struct aprxpolls *app)
+{
+	static int can_clear_timereset;
+	const struct timeval *tv;
+
+	if (time_reset)
+		aprxtimer_reset();
+
+	tv = aprxtimer_earliest();
+	if (tv != NULL && tv_timercmp(&app->next_timeout, (struct timeval *)tv) > 0)
+		app->next_timeout = *tv;
+
+	// All pre-polls are done, time_reset has been seen by
+	// everybody.  It is kept on over the very first round.
+	if (can_clear_timereset)
+		time_reset = 0;
+	else
+		can_clear_timereset = 1;
+
+	return 0;
+}
+
+int aprxtimer_postpoll(struct aprxpolls *app)
+{
+	struct aprxtimer *expired = NULL, **ep = &expired, *t, *tnext;
+	long long slot, now = aprxtimer_slot(&tick);
+
+	if (timerwheel_count == 0) {
+		timerwheel_cursor = now - 1;
+		return 0;
+	}
+
+	slot = timerwheel_cursor + 1;
+	if (now - slot >= TIMERWHEEL_SLOTS)
+		slot = now - TIMERWHEEL_SLOTS + 1; // all slots once
+
+	for ( ; slot <= now; ++slot) {
+		for (t = timerwheel[slot & (TIMERWHEEL_SLOTS-1)]; t; t = tnext) {
+			tnext = t->next;
+			if (tv_timercmp(&t->expires, &tick) > 0)
+				continue; // not yet
+			// Still armed, just on the expired list now
+			aprxtimer_unlink(t);
+			aprxtimer_push(ep, t); // at the tail
+			ep = &t->next;
+		}
+	}
+	// Current slot may still have timers due later on it
+	timerwheel_cursor = now - 1;
+
+	// Run callbacks only now.  Each timer is disarmed right
+	// before its callback, and callbacks may re-arm or disarm
+	// any timer, including those still waiting on this list.
+	while ((t = expired) != NULL) {
+		aprxtimer_disarm(t);
+		if (debug>2)
+			printf("Timer '%s' expired\n", t->name);
+		t->callback(t, t->arg);
+	}
+	return 0;
+}
@@ -26,7 +26,10 @@ static int ttycount;		/* How many are defined ? */
 #define TTY_OPEN_RETRY_DELAY_SECS 30
 
 static int poll_millis;         /* milliseconds (0 = none.)             */
-static struct timeval poll_millis_tv;
+static struct aprxtimer kisspoll_timer;
+
+static void ttyreader_retry_later(struct serialport *S);
+static void ttyreader_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg);
 
 
 void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr)
@@ -75,16 +78,7 @@ void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr)
  */
 int ttyreader_getc(struct serialport *S)
 {
-	if (S->rdcursor >= S->rdlen) {	/* Out of data ? */
-		if (S->rdcursor)
-			S->rdcursor = S->rdlen = 0;
-		/* printf("-\n"); */
-		return -1;
-	}
-
-	/* printf(" %02X", 0xFF & S->rdbuf[S->rdcursor++]); */
-
-	return (0xFF & S->rdbuf[S->rdcursor++]);
+	return rdbuf_getc(&S->rd);
 }
 
 
@@ -102,7 +96,7 @@ static int ttyreader_pulltnc2(struct serialport *S)
 	if (p != NULL)
 	  addrlen = (int)(p - S->rdline);
 
-	erlang_add(S->ttycallsign[0], ERLANG_RX, S->rdlinelen, 1);	/* Account one packet */
+	erlang_add_handle(S->ttyerlang[0], ERLANG_RX, S->rdlinelen, 1);	/* Account one packet */
 
 	/* Send the frame to internal AX.25 network */
 	/* netax25_sendax25_tnc2(S->rdline, S->rdlinelen); */
@@ -243,6 +237,7 @@ void ttyreader_linewrite(struct serialport *S)
 
 	if ((S->wrlen == 0) || (S->wrlen > 0 && S->wrcursor >= S->wrlen)) {
 		S->wrlen = S->wrcursor = 0;	/* already all written */
+		ttyreader_pollout(S);
 		return;
 	}
 
@@ -265,6 +260,29 @@ void ttyreader_linewrite(struct serialport *S)
 			S->wrlen = len;
 		}
 	}
+	ttyreader_pollout(S);
+}
+
+/*
+ *  ttyreader_pollout()  --  ask for POLLOUT while there is output pending
+ */
+void ttyreader_pollout(struct serialport *S)
+{
+	short events = POLLIN | POLLPRI;
+
+	if (S->wrlen > S->wrcursor)
+		events |= POLLOUT;
+	aprxpolls_events(&S->pollfd, events);
+}
+
+/*
+ *  ttyreader_close()  --  close the port, it is to be re-opened later
+ */
+static void ttyreader_close(struct serialport *S)
+{
+	aprxpolls_remove(&S->pollfd);
+	close(S->fd);
+	S->fd = -1;
 }
 
 
@@ -277,32 +295,11 @@ static void ttyreader_lineread(struct serialport *S)
 {
 	int i;
 
-	int rdspace = sizeof(S->rdbuf) - S->rdlen;
-
-	if (S->rdcursor > 0) {
-		/* Read-out cursor is not at block beginning,
-		   is there unread data too ?  */
-		if (S->rdlen > S->rdcursor) {
-			/* Uh..  lets move buffer down a bit,
-			   to make room for more to the end.. */
-			memcpy(S->rdbuf, S->rdbuf + S->rdcursor,
-			       S->rdlen - S->rdcursor);
-			S->rdlen = S->rdlen - S->rdcursor;
-		} else
-			S->rdlen = 0;	/* all processed, mark its size zero */
-		/* Cursor to zero, rdspace recalculated */
-		S->rdcursor = 0;
-
-		/* recalculate */
-		rdspace = sizeof(S->rdbuf) - S->rdlen;
-	}
-
-	if (rdspace > 0) {	/* We have room to read into.. */
-		i = read(S->fd, S->rdbuf + S->rdlen, rdspace);
+	if (rdbuf_makespace(&S->rd) > 0) {	/* We have room to read into.. */
+		i = rdbuf_read(&S->rd, S->fd);
 		if (i == 0) {	/* EOF ?  USB unplugged ? */
-			close(S->fd);
-			S->fd = -1;
-                        tv_timeradd_seconds(&S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
+			ttyreader_close(S);
+                        ttyreader_retry_later(S);
                         aprxlog("TTY %s EOF - CLOSED, WAITING %d SECS\n", S->ttyname, TTY_OPEN_RETRY_DELAY_SECS);
 			return;
 		}
@@ -312,11 +309,10 @@ static void ttyreader_lineread(struct serialport *S)
 		/* Some data has been accumulated ! */
 		if (debug > 2) {
 		  printf("%ld\tTTY %s: read() frame: ", tick.tv_sec, S->ttyname);
-		  hexdumpfp(stdout, S->rdbuf+S->rdlen, i, 1);
+		  hexdumpfp(stdout, S->rd.data + S->rd.len - i, i, 1);
 		  printf("\n");
 		}
                 
-		S->rdlen += i;
 		S->last_read_something = tick.tv_sec;
 	}
 
@@ -350,20 +346,11 @@ static void ttyreader_lineread(struct serialport *S)
 		ttyreader_pulltext(S);
 
 	} else {
-		close(S->fd);	/* Urgh ?? Bad linetype value ?? */
-		S->fd = -1;
-                tv_timeradd_seconds(&S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
+		ttyreader_close(S);	/* Urgh ?? Bad linetype value ?? */
+                ttyreader_retry_later(S);
                 aprxlog("TTY %s Unsupported linetype - CLOSED, WAITING %d SECS\n", S->ttyname, TTY_OPEN_RETRY_DELAY_SECS);
 	}
-
-	/* Consumed something, and our read cursor is not in the beginning ? */
-	if (S->rdcursor > 0 && S->rdcursor < S->rdlen) {
-		/* Compact the input buffer! */
-		memcpy(S->rdbuf, S->rdbuf + S->rdcursor,
-		       S->rdlen - S->rdcursor);
-	}
-	S->rdlen -= S->rdcursor;
-	S->rdcursor = 0;
+	/* What was left unconsumed waits for the next read */
 }
 
 
@@ -375,9 +362,6 @@ static void ttyreader_linesetup(struct serialport *S)
 {
 	int i;
 
-	S->wait_until.tv_sec = 0;	// Zero it just to be safe
-	S->wait_until.tv_usec = 0;	// Zero it just to be safe
-
 	S->wrlen = S->wrcursor = 0;	// init them at first
 
         // If NOT tcp! type socket, it is presumably openable with
@@ -396,7 +380,7 @@ static void ttyreader_linesetup(struct serialport *S)
                         }
                 }
 		if (S->fd < 0) {	/* Urgh.. an error.. */
-			tv_timeradd_seconds(&S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
+			ttyreader_retry_later(S);
 			if (debug)
 				printf("FAILED, WAITING %d SECS\n",
 				       TTY_OPEN_RETRY_DELAY_SECS);
@@ -418,9 +402,8 @@ static void ttyreader_linesetup(struct serialport *S)
 			if (debug)
 			  printf("%ld\tERROR: TCSETATTR failed; errno=%d\n",
 				 tick.tv_sec, errno);
-			close(S->fd);
-			S->fd = -1;
-			tv_timeradd_seconds(&S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
+			ttyreader_close(S);
+			ttyreader_retry_later(S);
                         aprxlog("TTY %s tcsetattr() failed. CLOSING TTY.\n", S->ttyname);
 			return;
 		}
@@ -499,8 +482,7 @@ static void ttyreader_linesetup(struct serialport *S)
 					   anything else and we fail entirely...      */
 					if (debug)
 						printf("ttyreader socket connect call failed: %d : %s\n", errno, strerror(errno));
-					close(S->fd);
-					S->fd = -1;
+					ttyreader_close(S);
                                         aprxlog("TTY %s Socket open failed.\n", S->ttyname);
 				}
 			}
@@ -508,194 +490,139 @@ static void ttyreader_linesetup(struct serialport *S)
 			freeaddrinfo(ai);
                 }
 		free(par);
+		if (S->fd < 0) {
+			ttyreader_retry_later(S);
+			return;
+		}
 	}
 
 	S->last_read_something = tick.tv_sec;	/* mark the timeout for future.. */
 
-	S->rdlen = S->rdcursor = S->rdlinelen = 0;
+	rdbuf_reset(&S->rd);
+	S->rdlinelen = 0;
 	S->kissstate = KISSSTATE_SYNCHUNT;
 
 	memset( S->smack_probe, 0, sizeof(S->smack_probe) );
 	S->smack_subids = 0;
-}
 
-/*
- *  ttyreader_init()
- */
+	aprxpolls_add(&S->pollfd, S->fd, POLLIN | POLLPRI,
+		      ttyreader_pollevents, S);
+	ttyreader_pollout(S);	// init strings may be pending
 
-void ttyreader_init(void)
-{
-	/* nothing.. */
+	if (S->read_timeout > 0)	/* read watchdog */
+		aprxtimer_arm_millis(&S->timer, S->read_timeout * 1000);
 }
 
-
+/* Closed port, try to open it again after a while */
+static void ttyreader_retry_later(struct serialport *S)
+{
+	aprxtimer_arm_millis(&S->timer, TTY_OPEN_RETRY_DELAY_SECS * 1000);
+}
 
 /*
- *  ttyreader_prepoll()  --  prepare system for next round of polling
+ *  ttyreader_timer_expired()  --  open a closed port, or check
+ *				   the read timeout of an open one
  */
-
-int ttyreader_prepoll(struct aprxpolls *app)
+static void ttyreader_timer_expired(struct aprxtimer *t, void *arg)
 {
-	int idx = 0;		/* returns number of *fds filled.. */
-	int i;
-	struct serialport *S;
-	struct pollfd *pfd;
+	struct serialport *S = arg;
+	time_t deadline;
 
-        if (poll_millis_tv.tv_sec == 0) {
-        	poll_millis_tv = tick;
-        }
-
-        // if (debug) printf("ttyreader_prepoll() %d\n", poll_millis);
-	for (i = 0; i < ttycount; ++i) {
-		S = ttys[i];
-		if (!S->ttyname)
-			continue;	/* No name, no look... */
+	if (!S->ttyname)
+		return;		/* No name, no look... */
 
+	if (S->fd < 0) {
+		/* FD is not open, and deadline is past.
+		   Lets try to open! */
+		ttyreader_linesetup(S);
+		return;
+	}
+	if (S->read_timeout <= 0)
+		return;
 
-#if 0 // occasional debug mode without real hardware at hand
-                if (poll_millis > 0) {
-                  int deltams = tv_timerdelta_millis(&tick, &poll_millis_tv);
-                  struct timeval tv;
-                  if (debug) printf("%d.%06d .. defining %d ms KISS POLL\n", tick.tv_sec, tick.tv_usec, poll_millis);
-                }
-#endif
+	// FD is open, check read/idle timeout ...
+	deadline = S->last_read_something + S->read_timeout;
+	if (timecmp(tick.tv_sec, deadline) > 0) {
+		if (debug)
+		  printf("%ld\tRead timeout on %s; %d seconds w/o input. fd=%d\n",
+			 tick.tv_sec, S->ttyname, S->read_timeout, S->fd);
+		ttyreader_close(S);	/* Close and mark for re-open */
+		ttyreader_retry_later(S);
+		aprxlog("TTY %s read timeout. Closing TTY for later re-open.\n", S->ttyname);
+		return;
+	}
+	// Did read something meanwhile, look again at the new deadline
+	aprxtimer_arm_millis(t, (deadline - tick.tv_sec + 1) * 1000);
+}
 
-		if (S->fd < 0) {
-                	if (time_reset && (S->wait_until.tv_sec != 0)) {
-                        	// System time jumped, reset it to NOW.
-                        	S->wait_until = tick;
-                        }
+/* System time has jumped */
+static void ttyreader_timer_reset(struct aprxtimer *t, void *arg)
+{
+	struct serialport *S = arg;
 
-			/* Not an open TTY, but perhaps waiting ? */
-			if ((S->wait_until.tv_sec != 0) && tv_timercmp( &S->wait_until, &tick) > 0) {
-				/* .. waiting for future! */
-                        	if (tv_timercmp( &app->next_timeout, &S->wait_until ) > 0) {
-                                	app->next_timeout = S->wait_until;
-                                }
-				/* .. but only until our timeout,
-				   if it is sooner than global one. */
-				continue;	/* Waiting on this one.. */
-			}
+	if (S->fd < 0) {
+		// Waiting for re-open, do it NOW.
+		aprxtimer_arm_millis(t, 0);
+		return;
+	}
+	// Reset the read time to NOW.
+	S->last_read_something = tick.tv_sec;
+	aprxtimer_arm_millis(t, S->read_timeout * 1000);
+}
 
-			/* Waiting or not, FD is not open, and deadline is past.
-			   Lets try to open! */
+/* Active KISS polling, all open KISS lines at once */
+static void ttyreader_kisspoll_expired(struct aprxtimer *t, void *arg)
+{
+	struct serialport *S;
+	int i;
 
-			ttyreader_linesetup(S);
+	for (i = 0; i < ttycount; ++i) {
+		S = ttys[i];
 
-		}
-		/* .. No open FD */
-		/* Still no open FD ? */
 		if (S->fd < 0)
-			continue;
-
-		// FD is open, check read/idle timeout ...
-                if (time_reset) {
-                  // System time has jumped, Reset the read time to NOW.
-                  S->last_read_something = tick.tv_sec;
-                }
+			continue;	/* Not polled */
 
-		// FD is open, check read/idle timeout ...
-		if ((S->read_timeout > 0) &&
-		    timecmp(tick.tv_sec, (S->last_read_something + S->read_timeout)) > 0) {
-			if (debug)
-			  printf("%ld\tRead timeout on %s; %d seconds w/o input. fd=%d\n",
-				 tick.tv_sec, S->ttyname, S->read_timeout, S->fd);
-			close(S->fd);	/* Close and mark for re-open */
-			S->fd = -1;
-                        tv_timeradd_seconds( &S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
-                        aprxlog("TTY %s read timeout. Closing TTY for later re-open.\n", S->ttyname);
+		if (!(S->linetype == LINETYPE_KISS ||
+		      S->linetype == LINETYPE_KISSFLEXNET ||
+		      S->linetype == LINETYPE_KISSBPQCRC ||
+		      S->linetype == LINETYPE_KISSSMACK)) {
+			// Not a KISS line..
 			continue;
 		}
-
-
-                if (poll_millis > 0) {
-                        int margin  = poll_millis*2;
-                        // Limit large delta time to within 0..2*poll_millis.
-			int deltams = tv_timerdelta_millis(&tick, &poll_millis_tv);
-                        if (deltams > margin)  deltams = poll_millis;
-                        if (deltams < -margin) deltams = poll_millis;
-                        tv_timeradd_millis(&poll_millis_tv, &tick, deltams);
-
-                        if (debug) printf("%ld.%06d .. defining %d ms KISS POLL\n", (long)tick.tv_sec, (int)tick.tv_usec, poll_millis);
-                }
-
-		/* FD is open, lets mark it for poll read.. */
-		pfd = aprxpolls_new(app);
-		pfd->fd = S->fd;
-		pfd->events = POLLIN | POLLPRI;
-		pfd->revents = 0;
-		if (S->wrlen > 0 && S->wrlen > S->wrcursor)
-			pfd->events |= POLLOUT;
-
-		++idx;
+		// Poll interval gone, time for next active POLL request!
+		kiss_poll(S);
 	}
-	return idx;
+	if (debug>1) printf("%ld.%06d .. next %d ms KISS POLL\n", (long)tick.tv_sec, (int)tick.tv_usec, poll_millis);
+	aprxtimer_arm_millis(t, poll_millis);
 }
 
-
 /*
- *  ttyreader_postpoll()  -- Done polling, what happened ?
+ *  ttyreader_init()
  */
 
-int ttyreader_postpoll(struct aprxpolls *app)
+void ttyreader_init(void)
 {
-	int idx, i;
-
-	struct serialport *S;
-	struct pollfd *P;
-
-        // if (debug) printf("ttyreader_postpoll()\n");
-
-	for (idx = 0, P = app->polls; idx < app->pollcount; ++idx, ++P) {
-
-        	// Are we operating in active KISS polling mode?
-        	if (poll_millis > 0) {
-			for (i = 0; i < ttycount; ++i) {
-                               	S = ttys[i];
+	aprxtimer_init(&kisspoll_timer, "kiss-poll",
+		       ttyreader_kisspoll_expired, NULL, NULL);
+}
 
-#if 0  // occasional debug mode without real hardware at hand
-                                if (tv_timercmp(&poll_millis_tv, &tick) <= 0) {
-	                                // Poll interval gone, time for next active POLL request!
-                                        kiss_poll(S);
-                                        tv_timeradd_millis(&poll_millis_tv, &poll_millis_tv, poll_millis);
-                                }
-#endif
 
-                                if (S->fd != P->fd)
-                                	continue;	/* Not this one ? */
-                                if (S->fd < 0)
-                                	continue;	/* Not this one ? */
-
-                                if (!(S->linetype == LINETYPE_KISS ||
-                                      S->linetype == LINETYPE_KISSFLEXNET ||
-                                      S->linetype == LINETYPE_KISSBPQCRC ||
-                                      S->linetype == LINETYPE_KISSSMACK)) {
-                                        // Not a KISS line..
-                                        continue;
-                                }
-                                if (tv_timercmp(&poll_millis_tv, &tick) <= 0) {
-	                                // Poll interval gone, time for next active POLL request!
-                                        kiss_poll(S);
-                                        tv_timeradd_millis(&poll_millis_tv, &poll_millis_tv, poll_millis);
-                                }
-                        }
-                }
 
-		for (i = 0; i < ttycount; ++i) {
-			S = ttys[i];
-			if (S->fd != P->fd)
-				continue;	/* Not this one ? */
-			/* It is this one! */
+/*
+ *  ttyreader_pollevents()  -- our descriptor had events
+ */
+static void ttyreader_pollevents(struct aprxpolls *app, struct pollfd *P, void *arg)
+{
+	struct serialport *S = arg;
 
-			if (P->revents & POLLOUT)
-				ttyreader_linewrite(S);
+	if (S->fd != P->fd)
+		return;	/* Closed meanwhile */
 
-                        if (P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP))
-                		ttyreader_lineread(S);
-		}
-	}
+	if (P->revents & POLLOUT)
+		ttyreader_linewrite(S);
 
-	return 0;
+	if (P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP))
+		ttyreader_lineread(S);
 }
 
 /*
@@ -730,7 +657,7 @@ struct serialport *ttyreader_new(void)
 	int baud = B1200;
 
 	tty->fd = -1;
-        tv_timeradd_seconds( &tty->wait_until, &tick, -1); /* begin opening immediately */
+	rdbuf_init(&tty->rd, tty->rdstore, sizeof(tty->rdstore));
 	tty->last_read_something = tick.tv_sec;	/* well, not really.. */
 	tty->linetype  = LINETYPE_KISS;	/* default */
 	tty->kissstate = KISSSTATE_SYNCHUNT;
@@ -1007,11 +934,25 @@ int ttyreader_parse_ttyparams(struct configfile *cf, struct serialport *tty, cha
 
 void ttyreader_register(struct serialport *tty)
 {
+	int i;
+
+	// Erlang accounting handles of the callsigns
+	for (i = 0; i < 16; ++i)
+		tty->ttyerlang[i] = erlang_handle(tty->ttycallsign[i]);
+
 	/* Grow the array as is needed.. - this is array of pointers,
 	   not array of blocks so that memory allocation does not
 	   grow into way too big chunks. */
 	ttys = realloc(ttys, sizeof(void *) * (ttycount + 1));
 	ttys[ttycount++] = tty;
+
+	// Begin opening immediately
+	aprxtimer_init(&tty->timer, "tty", ttyreader_timer_expired,
+		       ttyreader_timer_reset, tty);
+	aprxtimer_arm_millis(&tty->timer, 0);
+
+	if (poll_millis > 0 && !aprxtimer_armed(&kisspoll_timer))
+		aprxtimer_arm_millis(&kisspoll_timer, poll_millis);
 }
 
 const char *ttyreader_serialcfg(struct configfile *cf, char *param1, char *str)
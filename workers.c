@@ -0,0 +1,364 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+#include "aprx.h"
+
+/*
+ *  Parse worker pool.
+ *
+ *  With  "parse-workers N"  in the configuration, the received radio
+ *  frames are not parsed in the main loop.  ax25_to_tnc2() validates
+ *  the AX.25 header and makes the TNC2 text, as always, and then the
+ *  frame is handed to one of  N  worker threads, which allocate the
+ *  pbuf and run parse_aprs() on it.
+ *
+ *  The frames are given to the workers in turns, and the results are
+ *  taken back strictly in the same order, so everything after the
+ *  parse -- Rx-IGate, HistoryDB, filters, dupecheck, the digipeater
+ *  with its viscous delay and token buckets, and the transmit -- sees
+ *  the packets in the order they were received, all in the main loop.
+ *
+ *  Each worker has a ring of job slots with three running counters:
+ *  head  is written by the main loop when a job is given,  done  by
+ *  the worker when it has parsed the job, and  tail  by the main loop
+ *  when it has completed the job.  The worker is woken up with its
+ *  eventfd (or a pipe) only when it was seen idle, and the workers
+ *  wake up the main loop with a shared one after a batch of jobs.
+ */
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD) && defined(__ATOMIC_SEQ_CST)
+#define PARSE_WORKERS 1
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#include <signal.h>
+#endif
+
+int parse_workers;		/* configured number of workers, 0 = none */
+
+#ifdef PARSE_WORKERS
+
+#define WORKER_RING_SIZE 32	/* power of two */
+#define WORKER_DATALEN   4096	/* AX.25 frame and its TNC2 text */
+
+struct worker_job {
+	const struct aprx_interface *aif;
+	const char    *portname;
+	int            tncid;
+	int            is_aprs;
+	int            ui_pid;
+	int            axaddrlen;
+	int            axlen;
+	int            tnc2addrlen;
+	int            tnc2len;
+	struct pbuf_t *pb;		/* parse result, or NULL */
+	int64_t        parse_ns;	/* time spent at the parse */
+	uint8_t        data[WORKER_DATALEN]; /* frame, then TNC2 text */
+};
+
+struct worker {
+	unsigned int head;	/* main loop: jobs given */
+	char pad1[60];		/* keep counters on separate cache lines */
+	unsigned int done;	/* worker: jobs parsed */
+	char pad2[60];
+	unsigned int tail;	/* main loop: jobs completed */
+	int  wakefd[2];		/* [0] is polled by worker, [1] is written to */
+	pthread_t thread;
+	struct worker_job jobs[WORKER_RING_SIZE];
+};
+
+static struct worker *workers;
+static int workers_count;	/* running workers */
+static int workers_die;
+static int workers_donefd[2] = { -1, -1 };
+static struct aprxpollfd workers_donepoll; // workers_donefd[0] at the main loop
+static unsigned int workers_given;	/* jobs given, all workers */
+static unsigned int workers_completed;	/* jobs completed, all workers */
+
+static int workers_wakefd_new(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	fds[0] = eventfd(0, 0);
+	fds[1] = fds[0];
+	if (fds[0] < 0)
+#endif
+	if (pipe(fds) != 0)
+		return -1;
+	fd_nonblockingmode(fds[0]);
+	fd_nonblockingmode(fds[1]);
+	return 0;
+}
+
+static void workers_wakefd_close(int fds[2])
+{
+	if (fds[0] < 0) return;
+	close(fds[0]);
+	if (fds[1] != fds[0])
+		close(fds[1]);
+	fds[0] = fds[1] = -1;
+}
+
+static void workers_wake(int fd)
+{
+	static const uint64_t one = 1;
+	int rc = write(fd, &one, sizeof(one));
+	(void)rc;
+}
+
+static void workers_wakeclear(int fd)
+{
+	char buf[64];
+	while (read(fd, buf, sizeof(buf)) == sizeof(buf))
+		;	/* pipe may have more, eventfd gives 8 bytes */
+}
+
+static void worker_parse(struct worker_job *job)
+{
+	int64_t t0 = erlang_latency_now();
+
+	job->pb = interface_parse_ax25(job->aif, job->is_aprs, job->ui_pid,
+				       job->data, job->axaddrlen, job->axlen,
+				       (const char *)job->data + job->axlen,
+				       job->tnc2addrlen, job->tnc2len);
+	job->parse_ns = erlang_latency_now() - t0;
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *W = arg;
+	unsigned int done = W->done;
+	sigset_t sigs_to_block;
+
+	// Signals are for the main loop
+	sigfillset(&sigs_to_block);
+	pthread_sigmask(SIG_BLOCK, &sigs_to_block, NULL);
+
+	for (;;) {
+		unsigned int head = __atomic_load_n(&W->head, __ATOMIC_SEQ_CST);
+		if (done == head) {
+			struct pollfd pfd;
+			if (__atomic_load_n(&workers_die, __ATOMIC_SEQ_CST))
+				break;
+			pfd.fd      = W->wakefd[0];
+			pfd.events  = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, -1);
+			workers_wakeclear(W->wakefd[0]);
+			continue;
+		}
+		for ( ; done != head; ++done) {
+			worker_parse(&W->jobs[done & (WORKER_RING_SIZE-1)]);
+			__atomic_store_n(&W->done, done + 1, __ATOMIC_SEQ_CST);
+		}
+		workers_wake(workers_donefd[1]);
+	}
+	return NULL;
+}
+
+/* The rest of ax25_to_tnc2() for a parsed job, in the main loop */
+static void workers_complete(struct worker_job *job)
+{
+	if (job->pb != NULL)
+		job->pb->t = tick.tv_sec;	// Arrival time, by main clock
+
+#ifndef DISABLE_IGATE
+	if (job->is_aprs) {
+	  igate_to_aprsis(job->portname, job->tncid,
+			  (const char *)job->data + job->axlen,
+			  job->tnc2addrlen, job->tnc2len, 0, 1);
+	}
+#endif
+	if (job->pb != NULL) {
+		erlang_latency_record(LATENCY_PARSE, job->parse_ns);
+		interface_receive_pbuf(job->aif, job->pb);
+		job->pb = NULL;
+	}
+}
+
+/*
+ * Complete the parsed jobs in the order they were given.
+ * When  wait  is set, wait for the workers until  count  jobs
+ * are completed, or there is nothing left.
+ */
+static int workers_collect(int count, const int wait)
+{
+	int n = 0;
+
+	while (n < count && workers_completed != workers_given) {
+		struct worker *W = &workers[workers_completed % workers_count];
+
+		if (__atomic_load_n(&W->done, __ATOMIC_SEQ_CST) == W->tail) {
+			struct pollfd pfd;
+			if (!wait)
+				break;
+			pfd.fd      = workers_donefd[0];
+			pfd.events  = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, 100);
+			workers_wakeclear(workers_donefd[0]);
+			continue;
+		}
+		workers_complete(&W->jobs[W->tail & (WORKER_RING_SIZE-1)]);
+		++W->tail;
+		++workers_completed;
+		++n;
+	}
+	return n;
+}
+
+/*
+ * workers_submit()  -- give a frame to the parse workers.
+ * Returns 0 when the caller must process the frame itself.
+ */
+int workers_submit(const struct aprx_interface *aif, const char *portname,
+		   const int tncid, const int is_aprs, const int ui_pid,
+		   const uint8_t *frame, const int frameaddrlen, const int framelen,
+		   const char *tnc2buf, const int tnc2addrlen, const int tnc2len)
+{
+	struct worker *W;
+	struct worker_job *job;
+	unsigned int head;
+
+	if (workers_count == 0) return 0;
+
+	if (framelen + tnc2len > WORKER_DATALEN) {
+		// Does not fit in, let everything before it finish first
+		workers_flush();
+		return 0;
+	}
+
+	W = &workers[workers_given % workers_count];
+	while (W->head - W->tail >= WORKER_RING_SIZE) {
+		// Ring is full, complete older jobs
+		workers_collect(1, 1);
+	}
+
+	head = W->head;
+	job = &W->jobs[head & (WORKER_RING_SIZE-1)];
+	job->aif         = aif;
+	job->portname    = portname;
+	job->tncid       = tncid;
+	job->is_aprs     = is_aprs;
+	job->ui_pid      = ui_pid;
+	job->axaddrlen   = frameaddrlen;
+	job->axlen       = framelen;
+	job->tnc2addrlen = tnc2addrlen;
+	job->tnc2len     = tnc2len;
+	job->pb          = NULL;
+	memcpy(job->data, frame, framelen);
+	memcpy(job->data + framelen, tnc2buf, tnc2len);
+
+	__atomic_store_n(&W->head, head + 1, __ATOMIC_SEQ_CST);
+	++workers_given;
+
+	// Worker may sleep only when it has seen all jobs done
+	if (__atomic_load_n(&W->done, __ATOMIC_SEQ_CST) == head)
+		workers_wake(W->wakefd[1]);
+
+	return 1;
+}
+
+/* Complete all jobs given so far */
+void workers_flush(void)
+{
+	if (workers_count == 0) return;
+	workers_collect(workers_given - workers_completed, 1);
+}
+
+static void workers_pollevents(struct aprxpolls *app, struct pollfd *pfd, void *arg)
+{
+	if (pfd->revents & POLLIN) {
+		workers_wakeclear(pfd->fd);
+		workers_collect(workers_given - workers_completed, 0);
+	}
+}
+
+void workers_start(void)
+{
+	int i;
+
+	if (parse_workers <= 0) return;
+	if (workers_wakefd_new(workers_donefd) < 0) {
+		aprxlog("parse-workers: can not make wakeup descriptor: %s", strerror(errno));
+		return;
+	}
+	workers = calloc(parse_workers, sizeof(*workers));
+	if (workers == NULL) {
+		workers_wakefd_close(workers_donefd);
+		return;
+	}
+
+	pbuf_locking = 1;
+
+	for (i = 0; i < parse_workers; ++i) {
+		struct worker *W = &workers[i];
+		if (workers_wakefd_new(W->wakefd) < 0)
+			break;
+		if (pthread_create(&W->thread, NULL, worker_run, W) != 0) {
+			workers_wakefd_close(W->wakefd);
+			break;
+		}
+	}
+	workers_count = i;
+	if (debug) printf("parse-workers: %d running\n", workers_count);
+	if (workers_count < parse_workers)
+		aprxlog("parse-workers: only %d of %d workers started",
+			workers_count, parse_workers);
+	if (workers_count == 0) {
+		pbuf_locking = 0;
+		free(workers);
+		workers = NULL;
+		workers_wakefd_close(workers_donefd);
+		return;
+	}
+	aprxpolls_add(&workers_donepoll, workers_donefd[0], POLLIN | POLLPRI,
+		      workers_pollevents, NULL);
+}
+
+void workers_stop(void)
+{
+	int i;
+
+	if (workers_count == 0) return;
+
+	workers_flush();
+
+	__atomic_store_n(&workers_die, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < workers_count; ++i) {
+		workers_wake(workers[i].wakefd[1]);
+		pthread_join(workers[i].thread, NULL);
+		workers_wakefd_close(workers[i].wakefd);
+	}
+	workers_count = 0;
+	pbuf_locking  = 0;
+	free(workers);
+	workers = NULL;
+	aprxpolls_remove(&workers_donepoll);
+	workers_wakefd_close(workers_donefd);
+}
+
+#else  // No pthread(3p), everything is done in the main loop
+
+int  workers_submit(const struct aprx_interface *aif, const char *portname,
+		    const int tncid, const int is_aprs, const int ui_pid,
+		    const uint8_t *frame, const int frameaddrlen, const int framelen,
+		    const char *tnc2buf, const int tnc2addrlen, const int tnc2len)
+{
+	return 0;
+}
+void workers_flush(void) { }
+void workers_start(void)
+{
+	if (parse_workers > 0)
+		aprxlog("parse-workers: no threads in this build, parsing in the main loop");
+}
+void workers_stop(void) { }
+
+#endif